@@ -0,0 +1,811 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+
+#include "cbor.h"
+#include "cbor_aio.h"
+#include "cbor_json.h"
+#include "cbor_path.h"
+#include "cbor_phf.h"
+#include "cbor_pool.h"
+#include "cbor_ring.h"
+#include "cbor_schema.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITEMS   4096
+#define RECORDS 256
+#define LOGS    (1 << 20)      /* records per ring run */
+#define BLOCK   (256 * 1024)   /* file block for the aio runs */
+#define FIELDS  40             /* keys per message for the dispatch runs */
+
+struct bench {
+	const char *name;
+	size_t    (*run)(void);     /* returns bytes processed */
+	size_t      items;          /* items per run */
+};
+
+static uint64_t          uints[ITEMS];
+static double            doubles[ITEMS];
+static uint8_t           encoded_uints[ITEMS * 9];
+static uint8_t           encoded_doubles[ITEMS * 9];
+static size_t            encoded_uints_len;
+static size_t            encoded_doubles_len;
+static uint8_t           scratch[ITEMS * 9];
+static char              json[RECORDS * 256];
+static uint8_t           encoded_json[RECORDS * 256];
+static uint8_t           transcoded[RECORDS * 256];
+static size_t            json_len;
+static size_t            encoded_json_len;
+static struct cbor_path  paths[3];
+static struct cbor_schema schema;
+static struct cbor_pool_cache pool;
+static char              field_names[FIELDS][24];
+static const char       *fields[FIELDS];
+static struct cbor_phf   phf;
+static cbor_phf_handler  field_handlers[FIELDS];
+static uint8_t           messages[RECORDS * FIELDS * 32];
+static size_t            messages_len;
+static volatile uint64_t sink;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint64_t
+xorshift(void)
+{
+	static uint64_t state = 0x9e3779b97f4a7c15ull;
+
+	state ^= state << 13;
+	state ^= state >>  7;
+	state ^= state << 17;
+
+	return state;
+}
+
+static size_t
+bench_encode_uint(void)
+{
+	struct cbor_buf buf;
+
+	cbor_buf_init_empty(&buf, scratch, sizeof(scratch));
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_uint64(&buf, uints[i]);
+	}
+	sink += buf.len;
+
+	return buf.len;
+}
+
+/* Hashing while encoding against a second pass over the message. */
+static size_t
+bench_encode_hashed(void)
+{
+	struct cbor_buf  buf;
+	struct cbor_hash hash;
+
+	cbor_buf_init_empty(&buf, scratch, sizeof(scratch));
+	cbor_hash_init(&hash, 0);
+	cbor_buf_set_hash(&buf, &hash);
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_uint64(&buf, uints[i]);
+	}
+	sink += cbor_buf_digest(&buf);
+
+	return buf.len;
+}
+
+static size_t
+bench_encode_then_hash(void)
+{
+	struct cbor_buf  buf;
+	struct cbor_hash hash;
+
+	cbor_buf_init_empty(&buf, scratch, sizeof(scratch));
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_uint64(&buf, uints[i]);
+	}
+	cbor_hash_init(&hash, 0);
+	cbor_hash_update(&hash, buf.data, buf.len);
+	sink += cbor_hash_digest(&hash);
+
+	return buf.len;
+}
+
+static size_t
+bench_decode_uint(void)
+{
+	struct cbor_buf buf;
+	uint64_t        value = 0;
+	uint64_t        sum = 0;
+
+	if ( !cbor_buf_init(&buf, encoded_uints, encoded_uints_len, sizeof(encoded_uints)) ) {
+		return 0;
+	}
+	while ( cbor_read_positive_integer(&buf, &value) ) {
+		sum += value;
+	}
+	sink += sum;
+
+	return buf.len;
+}
+
+static size_t
+bench_encode_double(void)
+{
+	struct cbor_buf buf;
+
+	cbor_buf_init_empty(&buf, scratch, sizeof(scratch));
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_double(&buf, doubles[i]);
+	}
+	sink += buf.len;
+
+	return buf.len;
+}
+
+static size_t
+bench_decode_double(void)
+{
+	struct cbor_buf buf;
+	double          value;
+	double          sum = 0.0;
+
+	if ( !cbor_buf_init(&buf, encoded_doubles, encoded_doubles_len, sizeof(encoded_doubles)) ) {
+		return 0;
+	}
+	while ( cbor_read_double(&buf, &value) ) {
+		sum += value;
+	}
+	sink += (uint64_t)sum;
+
+	return buf.len;
+}
+
+static size_t
+bench_skip(void)
+{
+	struct cbor_buf buf;
+	size_t          items = 0;
+
+	if ( !cbor_buf_init(&buf, encoded_uints, encoded_uints_len, sizeof(encoded_uints)) ) {
+		return 0;
+	}
+	while ( cbor_skip_item(&buf) ) {
+		items++;
+	}
+	sink += items;
+
+	return buf.len;
+}
+
+static size_t
+bench_cbor2json(void)
+{
+	struct cbor_buf in;
+	struct cbor_buf out;
+
+	if ( !cbor_buf_init(&in, encoded_json, encoded_json_len, sizeof(encoded_json)) ) {
+		return 0;
+	}
+	cbor_buf_init_empty(&out, transcoded, sizeof(transcoded));
+	if ( !cbor_to_json(&in, &out) ) {
+		return 0;
+	}
+	sink += out.len;
+
+	return in.len;
+}
+
+static size_t
+bench_json2cbor(void)
+{
+	struct cbor_buf in;
+	struct cbor_buf out;
+
+	if ( !cbor_buf_init(&in, json, json_len, sizeof(json)) ) {
+		return 0;
+	}
+	cbor_buf_init_empty(&out, transcoded, sizeof(transcoded));
+	if ( !cbor_from_json(&in, &out) ) {
+		return 0;
+	}
+	sink += out.len;
+
+	return in.len;
+}
+
+static bool
+bench_path_fn(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len)
+{
+	size_t *matches = arg;
+
+	(void)path;
+	(void)buf;
+	(void)offset;
+	*matches += len;
+
+	return true;
+}
+
+/* Three fields out of every record in one pass. */
+static size_t
+bench_path(void)
+{
+	struct cbor_buf buf;
+	size_t          matches = 0;
+
+	if ( !cbor_buf_init(&buf, encoded_json, encoded_json_len, sizeof(encoded_json)) ) {
+		return 0;
+	}
+	if ( !cbor_path_eval(&buf, paths, 3, bench_path_fn, &matches) ) {
+		return 0;
+	}
+	sink += matches;
+
+	return buf.len;
+}
+
+static size_t
+bench_skip_records(void)
+{
+	struct cbor_buf buf;
+
+	if ( !cbor_buf_init(&buf, encoded_json, encoded_json_len, sizeof(encoded_json)) ) {
+		return 0;
+	}
+	if ( !cbor_skip_item(&buf) ) {
+		return 0;
+	}
+
+	return buf.len;
+}
+
+static size_t
+bench_schema(void)
+{
+	struct cbor_buf buf;
+
+	if ( !cbor_buf_init(&buf, encoded_json, encoded_json_len, sizeof(encoded_json)) ) {
+		return 0;
+	}
+	if ( !cbor_schema_validate(&schema, &buf) ) {
+		return 0;
+	}
+
+	return buf.len;
+}
+
+/* A scratch buffer per request, from malloc() or from the pool. */
+static size_t
+encode_request(struct cbor_buf *buf, size_t i)
+{
+	cbor_add_map(buf, 3);
+	cbor_add_utf8_cstr(buf, "id");
+	cbor_add_uint64(buf, uints[i]);
+	cbor_add_utf8_cstr(buf, "score");
+	cbor_add_double(buf, doubles[i]);
+	cbor_add_utf8_cstr(buf, "user");
+	cbor_add_utf8_cstr(buf, "someone@example.org");
+
+	return buf->len;
+}
+
+static size_t
+bench_scratch_malloc(void)
+{
+	struct cbor_buf buf;
+	size_t          bytes = 0;
+
+	for ( size_t i = 0; i < RECORDS; i++ ) {
+		size_t size = 256 << (i % 4);
+		void  *data = malloc(size);
+
+		if ( data == NULL ) {
+			return 0;
+		}
+		cbor_buf_init_empty(&buf, data, size);
+		bytes += encode_request(&buf, i);
+		free(data);
+	}
+
+	return bytes;
+}
+
+static size_t
+bench_scratch_pool(void)
+{
+	struct cbor_buf buf;
+	size_t          bytes = 0;
+
+	for ( size_t i = 0; i < RECORDS; i++ ) {
+		if ( !cbor_pool_get(&pool, &buf, 256 << (i % 4)) ) {
+			return 0;
+		}
+		bytes += encode_request(&buf, i);
+		cbor_pool_put(&pool, &buf);
+	}
+
+	return bytes;
+}
+
+/*
+ * Messages with FIELDS keys each, every key matched against the known set
+ * one by one or looked up in the perfect hash.
+ */
+static bool
+bench_field(void *arg, size_t field, struct cbor_buf *buf)
+{
+	uint64_t *sum = arg;
+	uint64_t  value;
+
+	if ( !cbor_read_positive_integer(buf, &value) ) {
+		return false;
+	}
+	*sum += value ^ field;
+
+	return true;
+}
+
+static size_t
+bench_keys_linear(void)
+{
+	struct cbor_buf buf;
+	uint64_t        sum = 0;
+
+	if ( !cbor_buf_init(&buf, messages, messages_len, sizeof(messages)) ) {
+		return 0;
+	}
+	for ( size_t r = 0; r < RECORDS; r++ ) {
+		uint64_t size = 0;
+
+		if ( !cbor_read_map(&buf, &size) ) {
+			return 0;
+		}
+		for ( uint64_t i = 0; i < size; i++ ) {
+			char  *key = "";
+			size_t len = 0;
+			size_t field;
+
+			if ( !cbor_read_utf8_str(&buf, &key, &len) ) {
+				return 0;
+			}
+			for ( field = 0; field < FIELDS; field++ ) {
+				if ( strlen(fields[field]) == len && memcmp(fields[field], key, len) == 0 ) {
+					break;
+				}
+			}
+			if ( field < FIELDS ? !bench_field(&sum, field, &buf) : !cbor_skip_item(&buf) ) {
+				return 0;
+			}
+		}
+	}
+	sink += sum;
+
+	return buf.len;
+}
+
+static size_t
+bench_keys_phf(void)
+{
+	struct cbor_buf buf;
+	uint64_t        sum = 0;
+
+	if ( !cbor_buf_init(&buf, messages, messages_len, sizeof(messages)) ) {
+		return 0;
+	}
+	for ( size_t r = 0; r < RECORDS; r++ ) {
+		if ( !cbor_phf_read_map(&phf, &buf, field_handlers, &sum) ) {
+			return 0;
+		}
+	}
+	sink += sum;
+
+	return buf.len;
+}
+
+static struct bench benches[] = {
+	{ "encode_uint",      bench_encode_uint,      ITEMS },
+	{ "encode_hashed",    bench_encode_hashed,    ITEMS },
+	{ "encode_then_hash", bench_encode_then_hash, ITEMS },
+	{ "decode_uint",      bench_decode_uint,      ITEMS },
+	{ "encode_double",    bench_encode_double,    ITEMS },
+	{ "decode_double",    bench_decode_double,    ITEMS },
+	{ "skip_uint",        bench_skip,             ITEMS },
+	{ "cbor2json",        bench_cbor2json,        RECORDS },
+	{ "json2cbor",        bench_json2cbor,        RECORDS },
+	{ "path",             bench_path,             RECORDS },
+	{ "skip_records",     bench_skip_records,     RECORDS },
+	{ "schema",           bench_schema,           RECORDS },
+	{ "scratch_malloc",   bench_scratch_malloc,   RECORDS },
+	{ "scratch_pool",     bench_scratch_pool,     RECORDS },
+	{ "keys_linear",      bench_keys_linear,      RECORDS },
+	{ "keys_phf",         bench_keys_phf,         RECORDS },
+};
+
+/*
+ * Producers encode small log records straight into the ring while the main
+ * thread drains them, for 1..N producers on single and multi producer rings.
+ */
+struct ring_producer {
+	pthread_t         thread;
+	struct cbor_ring *ring;
+	uint64_t          id;
+	size_t            records;
+};
+
+static struct cbor_ring ring;
+static uint8_t          ring_data[1 << 20] __attribute__((aligned(CBOR_RING_CHUNK)));
+
+static void *
+ring_produce(void *arg)
+{
+	struct ring_producer *producer = arg;
+	struct cbor_buf       buf;
+
+	for ( size_t i = 0; i < producer->records; i++ ) {
+		while ( !cbor_ring_reserve(producer->ring, &buf, 48) ) {
+			sched_yield();
+		}
+		cbor_add_array(&buf, 4);
+		cbor_add_uint64(&buf, producer->id);
+		cbor_add_uint64(&buf, i);
+		cbor_add_utf8_cstr(&buf, "request served");
+		cbor_add_double(&buf, (double)i * 0.5);
+		cbor_ring_commit(producer->ring, &buf);
+	}
+
+	return NULL;
+}
+
+static bool
+ring_consume(void *arg, struct cbor_buf *record)
+{
+	size_t *bytes = arg;
+
+	*bytes += record->len;
+
+	return true;
+}
+
+static void
+ring_run(bool multi, size_t producers)
+{
+	struct ring_producer threads[16];
+	size_t               records = 0;
+	size_t               bytes   = 0;
+	double               start;
+	double               elapsed;
+
+	cbor_ring_init(&ring, ring_data, sizeof(ring_data), multi);
+	start = now();
+	for ( size_t i = 0; i < producers; i++ ) {
+		threads[i].ring    = &ring;
+		threads[i].id      = i;
+		threads[i].records = LOGS / producers;
+		pthread_create(&threads[i].thread, NULL, ring_produce, &threads[i]);
+	}
+	while ( records < LOGS / producers * producers ) {
+		size_t drained = cbor_ring_drain(&ring, ring_consume, &bytes, 256);
+
+		if ( drained == 0 ) {
+			sched_yield();
+		}
+		records += drained;
+	}
+	elapsed = now() - start;
+	for ( size_t i = 0; i < producers; i++ ) {
+		pthread_join(threads[i].thread, NULL);
+	}
+
+	char name[32];
+
+	snprintf(name, sizeof(name), "ring_%s_%zu", multi ? "mpsc" : "spsc", producers);
+	printf("%-16s %8.2f ns/item %10.1f MB/s\n", name,
+	       elapsed * 1e9 / (double)records, (double)bytes / elapsed / 1e6);
+}
+
+static void
+ring_bench(void)
+{
+	long   cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max  = cpus > 2 ? (size_t)cpus - 1 : 1;
+
+	if ( max > 16 ) {
+		max = 16;
+	}
+	ring_run(false, 1);
+	for ( size_t producers = 1; producers <= max; producers *= 2 ) {
+		ring_run(true, producers);
+	}
+}
+
+/*
+ * The log records again, written to a temporary file and read back, once
+ * with write() and read() between batches and once through cbor_aio.h.
+ */
+static uint8_t aio_data[2 * BLOCK];
+
+static bool
+aio_record(struct cbor_buf *buf, size_t i)
+{
+	size_t mark = buf->len;
+
+	if ( cbor_add_array(buf, 4) && cbor_add_uint64(buf, i & 7) && cbor_add_uint64(buf, i) &&
+	     cbor_add_utf8_cstr(buf, "request served") && cbor_add_double(buf, (double)i * 0.5) ) {
+		return true;
+	}
+	buf->len = mark;
+	cbor_buf_clear_error(buf);
+
+	return false;
+}
+
+static size_t
+aio_write_sync(int fd)
+{
+	struct cbor_buf buf;
+	size_t          bytes = 0;
+
+	cbor_buf_init_empty(&buf, aio_data, BLOCK);
+	for ( size_t i = 0; i < LOGS; i++ ) {
+		if ( !aio_record(&buf, i) ) {
+			bytes += (size_t)write(fd, buf.data, buf.len);
+			cbor_buf_init_empty(&buf, aio_data, BLOCK);
+			aio_record(&buf, i);
+		}
+	}
+
+	return bytes + (size_t)write(fd, buf.data, buf.len);
+}
+
+static size_t
+aio_write(struct cbor_aio *aio, int fd)
+{
+	struct cbor_aio_writer writer;
+
+	cbor_aio_writer_init(&writer, aio, fd, 0, BLOCK);
+	for ( size_t i = 0; i < LOGS; i++ ) {
+		if ( !aio_record(cbor_aio_writer_buf(&writer), i) ) {
+			cbor_aio_writer_next(&writer);
+			aio_record(cbor_aio_writer_buf(&writer), i);
+		}
+	}
+	cbor_aio_writer_finish(&writer);
+	cbor_aio_writer_destroy(&writer);
+
+	return (size_t)writer.off;
+}
+
+static size_t
+aio_read_sync(int fd)
+{
+	struct cbor_buf buf;
+	size_t          bytes = 0;
+	size_t          rest  = 0;
+	ssize_t         n;
+
+	while ( (n = read(fd, aio_data + rest, BLOCK)) > 0 ) {
+		cbor_buf_init(&buf, aio_data, rest + (size_t)n, sizeof(aio_data));
+		while ( cbor_skip_item(&buf) ) {
+		}
+		rest = buf.len - buf.idx;
+		memmove(aio_data, aio_data + buf.idx, rest);
+		bytes += (size_t)n;
+	}
+
+	return bytes;
+}
+
+static size_t
+aio_read(struct cbor_aio *aio, int fd)
+{
+	struct cbor_aio_reader reader;
+	struct cbor_buf        item;
+	size_t                 bytes = 0;
+
+	cbor_aio_reader_init(&reader, aio, fd, 0, BLOCK, 4);
+	while ( cbor_aio_reader_item(&reader, &item) ) {
+		bytes += item.len;
+	}
+	cbor_aio_reader_destroy(&reader);
+
+	return bytes;
+}
+
+static void
+aio_report(const char *name, double start, size_t bytes)
+{
+	double elapsed = now() - start;
+
+	printf("%-16s %8.2f ns/item %10.1f MB/s\n", name,
+	       elapsed * 1e9 / LOGS, (double)bytes / elapsed / 1e6);
+}
+
+static void
+aio_bench(void)
+{
+	char            path[] = "/tmp/cbor-bench-XXXXXX";
+	struct cbor_aio aio;
+	int             fd;
+	double          start;
+	size_t          bytes;
+
+	if ( (fd = mkstemp(path)) == -1 || !cbor_aio_init(&aio, 8) ) {
+		perror("aio");
+		return;
+	}
+	unlink(path);
+	printf("aio engine: %s\n", aio.uring ? "io_uring" : "threads");
+
+	start = now();
+	bytes = aio_write_sync(fd);
+	aio_report("aio_write_sync", start, bytes);
+	lseek(fd, 0, SEEK_SET);
+	start = now();
+	bytes = aio_read_sync(fd);
+	aio_report("aio_read_sync", start, bytes);
+
+	if ( ftruncate(fd, 0) != 0 ) {
+		perror("aio");
+		return;
+	}
+	start = now();
+	bytes = aio_write(&aio, fd);
+	aio_report("aio_write", start, bytes);
+	start = now();
+	bytes = aio_read(&aio, fd);
+	aio_report("aio_read", start, bytes);
+
+	cbor_aio_destroy(&aio);
+	close(fd);
+}
+
+static void
+setup(void)
+{
+	static const uint64_t max[] = { 23, UINT8_MAX, UINT16_MAX, UINT32_MAX, UINT64_MAX };
+	struct cbor_buf       buf;
+
+	/* Spread the values evenly over the 1, 2, 3, 5 and 9 byte heads. */
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		uints[i]   = xorshift() % max[i % 5];
+		doubles[i] = (double)xorshift() / (double)UINT64_MAX * 1e6;
+	}
+
+	cbor_buf_init_empty(&buf, encoded_uints, sizeof(encoded_uints));
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_uint64(&buf, uints[i]);
+	}
+	encoded_uints_len = buf.len;
+
+	cbor_buf_init_empty(&buf, encoded_doubles, sizeof(encoded_doubles));
+	for ( size_t i = 0; i < ITEMS; i++ ) {
+		cbor_add_double(&buf, doubles[i]);
+	}
+	encoded_doubles_len = buf.len;
+
+	/* Log-like records mixing integers, floats, strings and escapes. */
+	json_len = 0;
+	json[json_len++] = '[';
+	for ( size_t i = 0; i < RECORDS; i++ ) {
+		json_len += (size_t)snprintf(json + json_len, sizeof(json) - json_len,
+		    "%s{\"id\":%zu,\"user\":\"user-%llu\",\"score\":%.17g,\"ok\":%s,"
+		    "\"tags\":[\"alpha\",\"beta\"],\"msg\":\"request \\\"%zu\\\" took %llu us\\n\"}",
+		    i > 0 ? "," : "", i, (unsigned long long)(xorshift() % 100000),
+		    doubles[i], i % 3 ? "true" : "false", i,
+		    (unsigned long long)(xorshift() % 5000));
+	}
+	json[json_len++] = ']';
+
+	struct cbor_buf in;
+
+	if ( cbor_buf_init(&in, json, json_len, sizeof(json)) ) {
+		cbor_buf_init_empty(&buf, encoded_json, sizeof(encoded_json));
+		cbor_from_json(&in, &buf);
+		encoded_json_len = buf.len;
+	}
+
+	cbor_path_compile_cstr(&paths[0], "[*].id");
+	cbor_path_compile_cstr(&paths[1], "[*].tags[0]");
+	cbor_path_compile_cstr(&paths[2], "[*].ok");
+
+	cbor_pool_init(&pool);
+
+	for ( size_t i = 0; i < FIELDS; i++ ) {
+		snprintf(field_names[i], sizeof(field_names[i]), "%s_%zu", i % 2 ? "request" : "attr", i);
+		fields[i]         = field_names[i];
+		field_handlers[i] = bench_field;
+	}
+	cbor_phf_init(&phf, fields, FIELDS);
+
+	/* Keys in a different order per message, as they come off the wire. */
+	cbor_buf_init_empty(&buf, messages, sizeof(messages));
+	for ( size_t r = 0; r < RECORDS; r++ ) {
+		cbor_add_map(&buf, FIELDS);
+		for ( size_t i = 0; i < FIELDS; i++ ) {
+			size_t field = (i * 7 + r) % FIELDS;
+
+			cbor_add_utf8_cstr(&buf, field_names[field]);
+			cbor_add_uint64(&buf, uints[(r * FIELDS + i) % ITEMS]);
+		}
+	}
+	messages_len = buf.len;
+
+	cbor_schema_compile_cstr(&schema,
+	    "records = [* record]\n"
+	    "record = { id: uint, user: tstr, score: float, ok: bool, tags: [* tstr], msg: tstr }\n");
+}
+
+static void
+run(struct bench *bench)
+{
+	size_t rounds = 0;
+	size_t bytes  = 0;
+	double start  = now();
+	double elapsed;
+
+	do {
+		for ( int i = 0; i < 64; i++ ) {
+			bytes += bench->run();
+		}
+		rounds += 64;
+		elapsed = now() - start;
+	} while ( elapsed < 0.5 );
+
+	printf("%-16s %8.2f ns/item %10.1f MB/s\n", bench->name,
+	       elapsed * 1e9 / (double)(rounds * bench->items),
+	       (double)bytes / elapsed / 1e6);
+}
+
+static bool
+selected(int argc, char **argv, const char *name)
+{
+	bool selected = argc < 2;
+
+	for ( int i = 1; i < argc; i++ ) {
+		selected |= strcmp(argv[i], name) == 0;
+	}
+
+	return selected;
+}
+
+int
+main(int argc, char **argv)
+{
+#if defined(CBOR_LITTLE_ENDIAN)
+	const char *mode = "word, little-endian";
+#elif defined(CBOR_BIG_ENDIAN)
+	const char *mode = "word, big-endian";
+#else
+	const char *mode = "bytewise";
+#endif
+
+	setup();
+	printf("loads and stores: %s\n", mode);
+
+	for ( size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++ ) {
+		if ( selected(argc, argv, benches[i].name) ) {
+			run(&benches[i]);
+		}
+	}
+	if ( selected(argc, argv, "ring") ) {
+		ring_bench();
+	}
+	if ( selected(argc, argv, "aio") ) {
+		aio_bench();
+	}
+
+	return 0;
+}
@@ -37,13 +37,627 @@
 typedef __int128_t  int128_t;
 typedef __uint128_t uint128_t;
 
+/*
+ * Unaligned big-endian loads and stores. A fixed size memcpy() compiles to a
+ * single unaligned access and __builtin_bswap*() to a single instruction, so
+ * on little-endian hosts a 64 bit head costs one load and one byte swap.
+ * Unknown compilers and hosts, or -DCBOR_BYTEWISE, use the byte-wise form.
+ */
+#if !defined(CBOR_BYTEWISE) && defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define CBOR_BIG_ENDIAN 1
+#elif !defined(CBOR_BYTEWISE) && defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(__GNUC__)
+#define CBOR_LITTLE_ENDIAN 1
+#endif
+
+static inline uint16_t
+cbor_load_be16(const uint8_t *data)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+	uint16_t value;
+
+	memcpy(&value, data, sizeof(value));
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap16(value);
+#endif
+	return value;
+#else
+	return (uint16_t)(((uint16_t)data[0]) << 8 |
+	                  ((uint16_t)data[1]));
+#endif
+}
+
+static inline uint32_t
+cbor_load_be32(const uint8_t *data)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+	uint32_t value;
+
+	memcpy(&value, data, sizeof(value));
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap32(value);
+#endif
+	return value;
+#else
+	return ((uint32_t)data[0]) << 24 |
+	       ((uint32_t)data[1]) << 16 |
+	       ((uint32_t)data[2]) <<  8 |
+	       ((uint32_t)data[3]);
+#endif
+}
+
+static inline uint64_t
+cbor_load_be64(const uint8_t *data)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+	uint64_t value;
+
+	memcpy(&value, data, sizeof(value));
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap64(value);
+#endif
+	return value;
+#else
+	return ((uint64_t)data[0]) << 56 |
+	       ((uint64_t)data[1]) << 48 |
+	       ((uint64_t)data[2]) << 40 |
+	       ((uint64_t)data[3]) << 32 |
+	       ((uint64_t)data[4]) << 24 |
+	       ((uint64_t)data[5]) << 16 |
+	       ((uint64_t)data[6]) <<  8 |
+	       ((uint64_t)data[7]);
+#endif
+}
+
+static inline void
+cbor_store_be16(uint8_t *data, uint16_t value)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap16(value);
+#endif
+	memcpy(data, &value, sizeof(value));
+#else
+	data[0] = (uint8_t)(value >> 8);
+	data[1] = (uint8_t)(value     );
+#endif
+}
+
+static inline void
+cbor_store_be32(uint8_t *data, uint32_t value)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap32(value);
+#endif
+	memcpy(data, &value, sizeof(value));
+#else
+	data[0] = (uint8_t)(value >> 24);
+	data[1] = (uint8_t)(value >> 16);
+	data[2] = (uint8_t)(value >>  8);
+	data[3] = (uint8_t)(value      );
+#endif
+}
+
+static inline void
+cbor_store_be64(uint8_t *data, uint64_t value)
+{
+#if defined(CBOR_BIG_ENDIAN) || defined(CBOR_LITTLE_ENDIAN)
+#ifdef CBOR_LITTLE_ENDIAN
+	value = __builtin_bswap64(value);
+#endif
+	memcpy(data, &value, sizeof(value));
+#else
+	data[0] = (uint8_t)(value >> 56);
+	data[1] = (uint8_t)(value >> 48);
+	data[2] = (uint8_t)(value >> 40);
+	data[3] = (uint8_t)(value >> 32);
+	data[4] = (uint8_t)(value >> 24);
+	data[5] = (uint8_t)(value >> 16);
+	data[6] = (uint8_t)(value >>  8);
+	data[7] = (uint8_t)(value      );
+#endif
+}
+
+enum cbor_error {
+	CBOR_OK = 0,
+	CBOR_ERR_TRUNCATED,     /* item extends past the end of the buffer */
+	CBOR_ERR_TYPE,          /* unexpected major type or simple value */
+	CBOR_ERR_INFO,          /* reserved additional info (0x1c - 0x1e) */
+	CBOR_ERR_OVERFLOW,      /* value does not fit the requested type */
+	CBOR_ERR_CAPACITY,      /* not enough space left to append */
+	CBOR_ERR_LIMIT,         /* item exceeds a struct cbor_limits bound */
+	CBOR_ERR_DEPTH,         /* nesting deeper than the depth limit */
+	CBOR_ERR_SYNTAX,        /* malformed input text (JSON, paths, schemas) */
+	CBOR_ERR_SCHEMA,        /* item does not match the schema */
+	CBOR_ERR_COUNT
+};
+
+enum cbor_major {
+	CBOR_MAJOR_UINT   = 0,
+	CBOR_MAJOR_NEGINT = 1,
+	CBOR_MAJOR_BYTES  = 2,
+	CBOR_MAJOR_TEXT   = 3,
+	CBOR_MAJOR_ARRAY  = 4,
+	CBOR_MAJOR_MAP    = 5,
+	CBOR_MAJOR_TAG    = 6,
+	CBOR_MAJOR_SIMPLE = 7
+};
+
+#define CBOR_MAJOR_BIT(major) (1u << (major))
+#define CBOR_MAJOR_ANY        0xffu
+#define CBOR_MAJOR_NONE       (-1)
+
+static inline const char *
+cbor_error_string(enum cbor_error err)
+{
+	switch ( err ) {
+		case CBOR_OK:            return "no error";
+		case CBOR_ERR_TRUNCATED: return "truncated item";
+		case CBOR_ERR_TYPE:      return "unexpected type";
+		case CBOR_ERR_INFO:      return "invalid additional info";
+		case CBOR_ERR_OVERFLOW:  return "value out of range";
+		case CBOR_ERR_CAPACITY:  return "buffer full";
+		case CBOR_ERR_LIMIT:     return "decoding limit exceeded";
+		case CBOR_ERR_DEPTH:     return "nesting too deep";
+		case CBOR_ERR_SYNTAX:    return "syntax error";
+		case CBOR_ERR_SCHEMA:    return "schema mismatch";
+		default:                 return "unknown error";
+	}
+}
+
+/*
+ * Optional instrumentation. Build with -DCBOR_STATS to count items, bytes and
+ * head widths per major type into a struct cbor_stats attached to a buffer
+ * with cbor_buf_set_stats(). Without CBOR_STATS the hooks compile to nothing.
+ *
+ * Independently of CBOR_STATS every hook expands CBOR_PROBE(name, ...), which
+ * can be defined before including this header to fire USDT probes, e.g.
+ * #define CBOR_PROBE(name, ...) STAP_PROBEV(cbor, name, __VA_ARGS__)
+ */
+#ifndef CBOR_PROBE
+#define CBOR_PROBE(name, ...) ((void)0)
+#endif
+
+#ifdef CBOR_STATS
+struct cbor_stats_counters {
+	uint64_t items[8];      /* by major type */
+	uint64_t bytes[8];      /* by major type, head and payload */
+	uint64_t heads[5];      /* 1, 2, 3, 5 and 9 byte heads */
+};
+
+struct cbor_stats {
+	struct cbor_stats_counters encode;
+	struct cbor_stats_counters decode;
+	uint64_t                   capacity_failures;
+	uint64_t                   decode_failures[CBOR_ERR_COUNT];
+	enum cbor_error            last_failure;
+	size_t                     last_failure_offset;
+};
+#endif
+
+/*
+ * Bounds for decoding untrusted input. They are enforced by every reader,
+ * the typed scalar readers as well as cbor_read_head() and everything built
+ * on top of it (string, array and map readers and cbor_skip_item()), while
+ * walking, so no separate validation pass is needed.
+ */
+#ifndef CBOR_MAX_DEPTH
+#define CBOR_MAX_DEPTH 64
+#endif
+
+struct cbor_limits {
+	size_t   max_depth;     /* nesting, capped at CBOR_MAX_DEPTH */
+	uint64_t max_string;    /* declared byte or text string length */
+	uint64_t max_container; /* declared array elements or map pairs */
+	uint64_t max_items;     /* data items decoded from the buffer */
+	size_t   max_bytes;     /* bytes consumed from the buffer */
+};
+
+static inline void
+cbor_limits_default(struct cbor_limits *limits)
+{
+	limits->max_depth     = 32;
+	limits->max_string    = 16 * 1024 * 1024;
+	limits->max_container = 1024 * 1024;
+	limits->max_items     = 16 * 1024 * 1024;
+	limits->max_bytes     = SIZE_MAX;
+}
+
+/*
+ * Optional content hash over everything appended to a buffer, attached with
+ * cbor_buf_set_hash(). The append paths hand newly written bytes to the
+ * hash in runs of CBOR_HASH_BATCH while they are still in cache, so the
+ * digest is ready when encoding ends without another pass over the
+ * message; cbor_buf_digest() hashes the last run. The built-in hash is
+ * xxHash64; setting update plugs in another, whose state the callback keeps
+ * behind arg.
+ *
+ * Only appended bytes are hashed: edits of bytes already hashed, as done by
+ * cbor_buf_splice() and the cbor_patch_*() functions, are not seen.
+ */
+#ifndef CBOR_HASH_BATCH
+#define CBOR_HASH_BATCH 256
+#endif
+
+struct cbor_hash {
+	void   (*update)(struct cbor_hash *hash, const void *data, size_t len);
+	void    *arg;
+	size_t   pending;       /* first byte of the buffer not hashed yet */
+
+	uint64_t acc[4];
+	uint64_t total;
+	uint64_t seed;
+	uint8_t  mem[32];
+	size_t   mem_len;
+};
+
+#define CBOR_XXH_PRIME1 0x9e3779b185ebca87ull
+#define CBOR_XXH_PRIME2 0xc2b2ae3d27d4eb4full
+#define CBOR_XXH_PRIME3 0x165667b19e3779f9ull
+#define CBOR_XXH_PRIME4 0x85ebca77c2b2ae63ull
+#define CBOR_XXH_PRIME5 0x27d4eb2f165667c5ull
+
+static inline void
+cbor_hash_init(struct cbor_hash *hash, uint64_t seed)
+{
+	hash->update  = NULL;
+	hash->arg     = NULL;
+	hash->pending = 0;
+	hash->acc[0]  = seed + CBOR_XXH_PRIME1 + CBOR_XXH_PRIME2;
+	hash->acc[1]  = seed + CBOR_XXH_PRIME2;
+	hash->acc[2]  = seed;
+	hash->acc[3]  = seed - CBOR_XXH_PRIME1;
+	hash->total   = 0;
+	hash->seed    = seed;
+	hash->mem_len = 0;
+}
+
+static inline void
+cbor_hash_init_fn(struct cbor_hash *hash, void (*update)(struct cbor_hash *, const void *, size_t), void *arg)
+{
+	cbor_hash_init(hash, 0);
+	hash->update = update;
+	hash->arg    = arg;
+}
+
+static inline uint64_t
+cbor_hash_rotl(uint64_t x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+cbor_hash_le64(const uint8_t *data)
+{
+#if defined(CBOR_LITTLE_ENDIAN)
+	uint64_t x;
+
+	memcpy(&x, data, sizeof(x));
+	return x;
+#elif defined(CBOR_BIG_ENDIAN)
+	return __builtin_bswap64(cbor_load_be64(data));
+#else
+	return (uint64_t)data[0]       | (uint64_t)data[1] <<  8 | (uint64_t)data[2] << 16 |
+	       (uint64_t)data[3] << 24 | (uint64_t)data[4] << 32 | (uint64_t)data[5] << 40 |
+	       (uint64_t)data[6] << 48 | (uint64_t)data[7] << 56;
+#endif
+}
+
+static inline uint64_t
+cbor_hash_round(uint64_t acc, uint64_t input)
+{
+	acc += input * CBOR_XXH_PRIME2;
+
+	return cbor_hash_rotl(acc, 31) * CBOR_XXH_PRIME1;
+}
+
+static inline uint64_t
+cbor_hash_merge(uint64_t h, uint64_t acc)
+{
+	h ^= cbor_hash_round(0, acc);
+
+	return h * CBOR_XXH_PRIME1 + CBOR_XXH_PRIME4;
+}
+
+static inline void
+cbor_hash_stripe(uint64_t *acc, const uint8_t *data)
+{
+	acc[0] = cbor_hash_round(acc[0], cbor_hash_le64(data));
+	acc[1] = cbor_hash_round(acc[1], cbor_hash_le64(data + 8));
+	acc[2] = cbor_hash_round(acc[2], cbor_hash_le64(data + 16));
+	acc[3] = cbor_hash_round(acc[3], cbor_hash_le64(data + 24));
+}
+
+static inline void
+cbor_hash_update(struct cbor_hash *hash, const void *data, size_t len)
+{
+	const uint8_t *p    = data;
+	size_t         fill = sizeof(hash->mem) - hash->mem_len;
+
+	if ( hash->update != NULL ) {
+		hash->update(hash, data, len);
+		return;
+	}
+
+	hash->total += len;
+	/* Buffer input that does not fill the stripe, the copy stays inside mem. */
+	if ( len < sizeof(hash->mem) && len < fill ) {
+		memcpy(hash->mem + hash->mem_len, p, len);
+		hash->mem_len += len;
+		return;
+	}
+
+	if ( hash->mem_len > 0 ) {
+		memcpy(hash->mem + hash->mem_len, p, fill);
+		cbor_hash_stripe(hash->acc, hash->mem);
+		p   += fill;
+		len -= fill;
+		hash->mem_len = 0;
+	}
+
+	/* Stripes straight from the caller's bytes, no copy. */
+	for ( ; len >= sizeof(hash->mem); p += sizeof(hash->mem), len -= sizeof(hash->mem) ) {
+		cbor_hash_stripe(hash->acc, p);
+	}
+
+	memcpy(hash->mem, p, len);
+	hash->mem_len = len;
+}
+
+/* The xxHash64 of everything fed so far. The state is not changed. */
+static inline uint64_t
+cbor_hash_digest(const struct cbor_hash *hash)
+{
+	const uint8_t *p   = hash->mem;
+	size_t         len = hash->mem_len;
+	uint64_t       h;
+
+	if ( hash->total >= sizeof(hash->mem) ) {
+		h = cbor_hash_rotl(hash->acc[0], 1) + cbor_hash_rotl(hash->acc[1], 7) +
+		    cbor_hash_rotl(hash->acc[2], 12) + cbor_hash_rotl(hash->acc[3], 18);
+		for ( int i = 0; i < 4; i++ ) {
+			h = cbor_hash_merge(h, hash->acc[i]);
+		}
+	} else {
+		h = hash->seed + CBOR_XXH_PRIME5;
+	}
+	h += hash->total;
+
+	for ( ; len >= 8; p += 8, len -= 8 ) {
+		h ^= cbor_hash_round(0, cbor_hash_le64(p));
+		h  = cbor_hash_rotl(h, 27) * CBOR_XXH_PRIME1 + CBOR_XXH_PRIME4;
+	}
+	if ( len >= 4 ) {
+		uint32_t k = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+
+		h ^= k * CBOR_XXH_PRIME1;
+		h  = cbor_hash_rotl(h, 23) * CBOR_XXH_PRIME2 + CBOR_XXH_PRIME3;
+		p   += 4;
+		len -= 4;
+	}
+	for ( ; len > 0; p++, len-- ) {
+		h ^= *p * CBOR_XXH_PRIME5;
+		h  = cbor_hash_rotl(h, 11) * CBOR_XXH_PRIME1;
+	}
+
+	h ^= h >> 33;
+	h *= CBOR_XXH_PRIME2;
+	h ^= h >> 29;
+	h *= CBOR_XXH_PRIME3;
+	h ^= h >> 32;
+
+	return h;
+}
+
+struct cbor_head {
+	uint8_t  initial;       /* initial byte */
+	uint8_t  major;         /* enum cbor_major */
+	uint8_t  size;          /* head width in bytes */
+	bool     indefinite;    /* indefinite length or break */
+	uint64_t arg;           /* count, length, tag, value or float bits */
+};
+
 struct cbor_buf {
 	uint8_t *data;
 	size_t   len;
 	size_t   cap;
 	size_t   idx;
+
+	/* Last failure, only written on the error path. */
+	enum cbor_error err;
+	size_t          err_idx;
+	unsigned        err_expected;   /* mask of CBOR_MAJOR_BIT() */
+	int             err_actual;     /* initial byte or CBOR_MAJOR_NONE */
+
+	const struct cbor_limits *limits;
+	uint64_t                  items;
+	struct cbor_hash         *hash;
+#ifdef CBOR_STATS
+	struct cbor_stats *stats;
+#endif
 };
 
+#ifdef CBOR_STATS
+static inline void
+cbor_stats_reset(struct cbor_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+static inline void
+cbor_stats_snapshot(struct cbor_stats *snapshot, const struct cbor_stats *stats)
+{
+	*snapshot = *stats;
+}
+
+static inline void
+cbor_stats_merge(struct cbor_stats *total, const struct cbor_stats *stats)
+{
+	for ( int i = 0; i < 8; i++ ) {
+		total->encode.items[i] += stats->encode.items[i];
+		total->encode.bytes[i] += stats->encode.bytes[i];
+		total->decode.items[i] += stats->decode.items[i];
+		total->decode.bytes[i] += stats->decode.bytes[i];
+	}
+	for ( int i = 0; i < 5; i++ ) {
+		total->encode.heads[i] += stats->encode.heads[i];
+		total->decode.heads[i] += stats->decode.heads[i];
+	}
+	for ( int i = 0; i < CBOR_ERR_COUNT; i++ ) {
+		total->decode_failures[i] += stats->decode_failures[i];
+	}
+	total->capacity_failures += stats->capacity_failures;
+}
+
+static inline void
+cbor_stats_count(struct cbor_stats_counters *counters, uint8_t initial, size_t head, size_t size)
+{
+	int major = initial >> 5;
+	int width;
+
+	switch ( head ) {
+		case 1:  width = 0; break;
+		case 2:  width = 1; break;
+		case 3:  width = 2; break;
+		case 5:  width = 3; break;
+		default: width = 4; break;
+	}
+
+	counters->items[major] += 1;
+	counters->bytes[major] += head + size;
+	counters->heads[width] += 1;
+}
+
+static inline void
+cbor_stats_encoded(struct cbor_buf *buf, uint8_t initial, size_t head, size_t size)
+{
+	CBOR_PROBE(encoded, buf, initial, head, size);
+
+	if ( buf->stats != NULL ) {
+		cbor_stats_count(&buf->stats->encode, initial, head, size);
+	}
+}
+
+static inline void
+cbor_stats_decoded(struct cbor_buf *buf, uint8_t initial, size_t head, size_t size)
+{
+	CBOR_PROBE(decoded, buf, initial, head, size);
+
+	if ( buf->stats != NULL ) {
+		cbor_stats_count(&buf->stats->decode, initial, head, size);
+	}
+}
+
+static inline void
+cbor_stats_payload(struct cbor_buf *buf, int major, size_t size)
+{
+	CBOR_PROBE(payload, buf, major, size);
+
+	if ( buf->stats != NULL ) {
+		buf->stats->decode.bytes[major] += size;
+	}
+}
+
+static inline void
+cbor_stats_capacity(struct cbor_buf *buf)
+{
+	CBOR_PROBE(capacity, buf, buf->len, buf->cap);
+
+	if ( buf->stats != NULL ) {
+		buf->stats->capacity_failures += 1;
+	}
+}
+
+static inline void
+cbor_stats_failure(struct cbor_buf *buf, enum cbor_error err)
+{
+	CBOR_PROBE(failure, buf, err, buf->idx);
+
+	if ( buf->stats != NULL ) {
+		buf->stats->decode_failures[err] += 1;
+		buf->stats->last_failure        = err;
+		buf->stats->last_failure_offset = buf->idx;
+	}
+}
+
+#define CBOR_STATS_ENCODED(buf, initial, head, size) cbor_stats_encoded(buf, initial, head, size)
+#define CBOR_STATS_DECODED(buf, initial, head, size) cbor_stats_decoded(buf, initial, head, size)
+#define CBOR_STATS_PAYLOAD(buf, major, size)         cbor_stats_payload(buf, major, size)
+#define CBOR_STATS_CAPACITY(buf)                     cbor_stats_capacity(buf)
+#define CBOR_STATS_FAILURE(buf, err)                 cbor_stats_failure(buf, err)
+#else
+#define CBOR_STATS_ENCODED(buf, initial, head, size) CBOR_PROBE(encoded, buf, initial, head, size)
+#define CBOR_STATS_DECODED(buf, initial, head, size) CBOR_PROBE(decoded, buf, initial, head, size)
+#define CBOR_STATS_PAYLOAD(buf, major, size)         CBOR_PROBE(payload, buf, major, size)
+#define CBOR_STATS_CAPACITY(buf)                     CBOR_PROBE(capacity, buf, (buf)->len, (buf)->cap)
+#define CBOR_STATS_FAILURE(buf, err)                 CBOR_PROBE(failure, buf, err, (buf)->idx)
+#endif
+
+static inline bool
+cbor_buf_fail(struct cbor_buf *buf, enum cbor_error err, unsigned expected)
+{
+	size_t idx = buf->idx;
+
+	buf->err          = err;
+	buf->err_idx      = idx;
+	buf->err_expected = expected;
+	buf->err_actual   = idx < buf->len ? buf->data[idx] : CBOR_MAJOR_NONE;
+
+	CBOR_STATS_FAILURE(buf, err);
+
+	return false;
+}
+
+static inline bool
+cbor_buf_full(struct cbor_buf *buf)
+{
+	buf->err          = CBOR_ERR_CAPACITY;
+	buf->err_idx      = buf->len;
+	buf->err_expected = 0;
+	buf->err_actual   = CBOR_MAJOR_NONE;
+
+	CBOR_STATS_CAPACITY(buf);
+
+	return false;
+}
+
+static inline enum cbor_error
+cbor_buf_error(struct cbor_buf *buf)
+{
+	return buf->err;
+}
+
+static inline size_t
+cbor_buf_error_offset(struct cbor_buf *buf)
+{
+	return buf->err_idx;
+}
+
+static inline unsigned
+cbor_buf_error_expected(struct cbor_buf *buf)
+{
+	return buf->err_expected;
+}
+
+static inline int
+cbor_buf_error_actual(struct cbor_buf *buf)
+{
+	int initial = buf->err_actual;
+
+	return initial == CBOR_MAJOR_NONE ? CBOR_MAJOR_NONE : initial >> 5;
+}
+
+static inline void
+cbor_buf_clear_error(struct cbor_buf *buf)
+{
+	buf->err          = CBOR_OK;
+	buf->err_idx      = 0;
+	buf->err_expected = 0;
+	buf->err_actual   = CBOR_MAJOR_NONE;
+}
+
 static inline bool
 cbor_buf_init(struct cbor_buf *buf, void *data, size_t len, size_t size)
 {
@@ -51,10 +665,18 @@ cbor_buf_init(struct cbor_buf *buf, void *data, size_t len, size_t size)
 		return false;
 	}
 
-	buf->data = data;
-	buf->len  = len;
-	buf->cap  = size;
-	buf->idx  = 0;
+	buf->data   = data;
+	buf->len    = len;
+	buf->cap    = size;
+	buf->idx    = 0;
+	buf->limits = NULL;
+	buf->items  = 0;
+	buf->hash   = NULL;
+
+	cbor_buf_clear_error(buf);
+#ifdef CBOR_STATS
+	buf->stats = NULL;
+#endif
 
 	return true;
 }
@@ -62,10 +684,87 @@ cbor_buf_init(struct cbor_buf *buf, void *data, size_t len, size_t size)
 static inline void
 cbor_buf_init_empty(struct cbor_buf *buf, void *data, size_t size)
 {
-	buf->data = data;
-	buf->len  = 0;
-	buf->cap  = size;
-	buf->idx  = 0;
+	buf->data   = data;
+	buf->len    = 0;
+	buf->cap    = size;
+	buf->idx    = 0;
+	buf->limits = NULL;
+	buf->items  = 0;
+	buf->hash   = NULL;
+
+	cbor_buf_clear_error(buf);
+#ifdef CBOR_STATS
+	buf->stats = NULL;
+#endif
+}
+
+#ifdef CBOR_STATS
+static inline void
+cbor_buf_set_stats(struct cbor_buf *buf, struct cbor_stats *stats)
+{
+	buf->stats = stats;
+}
+#endif
+
+static inline void
+cbor_buf_set_limits(struct cbor_buf *buf, const struct cbor_limits *limits)
+{
+	buf->limits = limits;
+	buf->items  = 0;
+}
+
+/* Hash what is appended from now on. */
+static inline void
+cbor_buf_set_hash(struct cbor_buf *buf, struct cbor_hash *hash)
+{
+	buf->hash = hash;
+	if ( hash != NULL ) {
+		hash->pending = buf->len;
+	}
+}
+
+static inline void
+cbor_buf_hash_flush(struct cbor_buf *buf)
+{
+	struct cbor_hash *hash = buf->hash;
+
+	if ( hash != NULL && buf->len > hash->pending ) {
+		cbor_hash_update(hash, buf->data + hash->pending, buf->len - hash->pending);
+		hash->pending = buf->len;
+	}
+}
+
+/* Called by the append paths, hashes a full run of new bytes. */
+static inline void
+cbor_buf_hash(struct cbor_buf *buf)
+{
+	struct cbor_hash *hash = buf->hash;
+
+	if ( hash != NULL && buf->len - hash->pending >= CBOR_HASH_BATCH ) {
+		cbor_buf_hash_flush(buf);
+	}
+}
+
+/*
+ * Hash bytes that follow the buffer contents in the message but are not
+ * copied into it, e.g. a payload sent separately with writev().
+ */
+static inline void
+cbor_buf_hash_segment(struct cbor_buf *buf, const void *data, size_t len)
+{
+	if ( buf->hash != NULL ) {
+		cbor_buf_hash_flush(buf);
+		cbor_hash_update(buf->hash, data, len);
+	}
+}
+
+/* The digest of everything appended since the hash was attached. */
+static inline uint64_t
+cbor_buf_digest(struct cbor_buf *buf)
+{
+	cbor_buf_hash_flush(buf);
+
+	return buf->hash != NULL ? cbor_hash_digest(buf->hash) : 0;
 }
 
 static inline size_t
@@ -137,6 +836,30 @@ cbor_buf_index(struct cbor_buf *buf)
 	return buf->idx;
 }
 
+/*
+ * Replace the size bytes at off with room for len bytes, moving the rest of
+ * the buffer with one memmove. The caller fills in the new bytes. A cursor
+ * past the replaced bytes moves with them.
+ */
+static inline bool
+cbor_buf_splice(struct cbor_buf *buf, size_t off, size_t size, size_t len)
+{
+	if ( off > buf->len || size > buf->len - off ) {
+		return false;
+	}
+	if ( len > size && len - size > buf->cap - buf->len ) {
+		return cbor_buf_full(buf);
+	}
+
+	memmove(buf->data + off + len, buf->data + off + size, buf->len - off - size);
+	buf->len = buf->len - size + len;
+	if ( buf->idx >= off + size ) {
+		buf->idx = buf->idx - size + len;
+	}
+
+	return true;
+}
+
 static inline bool
 cbor_buf_append_byte(struct cbor_buf *buf, uint8_t n)
 {
@@ -145,12 +868,15 @@ cbor_buf_append_byte(struct cbor_buf *buf, uint8_t n)
 	size_t   cap  = buf->cap;
 
 	if ( cap - len < sizeof(n) ) {
-		return false;
+		return cbor_buf_full(buf);
 	}
 
 	data[len] = n;
 	buf->len  = len + sizeof(n);
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, n, 1, 0);
+
 	return true;
 }
 
@@ -161,14 +887,17 @@ cbor_buf_append_byte_plus(struct cbor_buf *buf, uint8_t n, void *plus, size_t si
 	size_t   len  = buf->len;
 	size_t   cap  = buf->cap;
 
-	if ( cap - len < sizeof(n) + size ) {
-        	return false;
+	if ( size > cap - len || cap - len - size < sizeof(n) ) {
+		return cbor_buf_full(buf);
 	}
 
 	data[len] = n;
 	memcpy(data + len + 1, plus, size);
 	buf->len = len + sizeof(n) + size;
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, n, 1, size);
+
 	return true;
 }
 
@@ -180,13 +909,16 @@ cbor_buf_append_2byte(struct cbor_buf *buf, uint8_t m, uint8_t n)
 	size_t   cap  = buf->cap;
 
 	if ( cap - len < sizeof(m) + sizeof(n) ) { 
-        	return false;
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
 	data[len + 1] = n;
 	buf->len      = len + sizeof(m) + sizeof(n);
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 2, 0);
+
 	return true;
 
 }
@@ -198,8 +930,8 @@ cbor_buf_append_2byte_plus(struct cbor_buf *buf, uint8_t m, uint8_t n, void *plu
 	size_t   len  = buf->len;
 	size_t   cap  = buf->cap;
 
-	if ( cap - len < sizeof(m) + sizeof(n) + size ) {
-        	return false;
+	if ( size > cap - len || cap - len - size < sizeof(m) + sizeof(n) ) {
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
@@ -207,6 +939,9 @@ cbor_buf_append_2byte_plus(struct cbor_buf *buf, uint8_t m, uint8_t n, void *plu
 	memcpy(data + len + 2, plus, size);
 	buf->len      = len + sizeof(m) + sizeof(n) + size;
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 2, size);
+
 	return true;
 }
 
@@ -218,14 +953,16 @@ cbor_buf_append_3byte(struct cbor_buf *buf, uint8_t m, uint16_t n)
 	size_t   cap  = buf->cap;
 
 	if ( cap - len < sizeof(m) + sizeof(n) ) { 
-        	return false;
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 8);
-	data[len + 2] = (uint8_t)(n     );
+	cbor_store_be16(data + len + 1, n);
 	buf->len      = len + sizeof(m) + sizeof(n);
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 3, 0);
+
 	return true;
 }
 
@@ -236,16 +973,18 @@ cbor_buf_append_3byte_plus(struct cbor_buf *buf, uint8_t m, uint16_t n, void *pl
 	size_t   len  = buf->len;
 	size_t   cap  = buf->cap;
 
-	if ( cap - len < sizeof(m) + sizeof(n) + size ) {
-        	return false;
+	if ( size > cap - len || cap - len - size < sizeof(m) + sizeof(n) ) {
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 8);
-	data[len + 2] = (uint8_t)(n     );
+	cbor_store_be16(data + len + 1, n);
 	memcpy(data + len + 3, plus, size);
 	buf->len      = len + sizeof(m) + sizeof(n) + size;
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 3, size);
+
 	return true;
 }
 
@@ -257,16 +996,16 @@ cbor_buf_append_5byte(struct cbor_buf *buf, uint8_t m, uint32_t n)
 	size_t   cap  = buf->cap;
 
 	if ( cap - len < sizeof(m) + sizeof(n) ) { 
-        	return false;
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 24);
-	data[len + 2] = (uint8_t)(n >> 16);
-	data[len + 3] = (uint8_t)(n >>  8);
-	data[len + 4] = (uint8_t)(n      );
+	cbor_store_be32(data + len + 1, n);
 	buf->len  = len + sizeof(m) + sizeof(n);
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 5, 0);
+
 	return true;
 }
 
@@ -277,18 +1016,18 @@ cbor_buf_append_5byte_plus(struct cbor_buf *buf, uint8_t m, uint32_t n, void *pl
 	size_t   len  = buf->len;
 	size_t   cap  = buf->cap;
 
-	if ( cap - len < sizeof(m) + sizeof(n) + size ) {
-		return false;
+	if ( size > cap - len || cap - len - size < sizeof(m) + sizeof(n) ) {
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 24);
-	data[len + 2] = (uint8_t)(n >> 16);
-	data[len + 3] = (uint8_t)(n >>  8);
-	data[len + 4] = (uint8_t)(n      );
+	cbor_store_be32(data + len + 1, n);
 	memcpy(data + len + 5, plus, size);
 	buf->len      = len + sizeof(m) + sizeof(n) + size;
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 5, size);
+
 	return true;
 }
 
@@ -300,20 +1039,16 @@ cbor_buf_append_9byte(struct cbor_buf *buf, uint8_t m, uint64_t n)
 	size_t   cap  = buf->cap;
 
 	if ( cap - len < sizeof(m) + sizeof(n) ) {
-        	return false;
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 56);
-	data[len + 2] = (uint8_t)(n >> 48);
-	data[len + 3] = (uint8_t)(n >> 40);
-	data[len + 4] = (uint8_t)(n >> 32);
-	data[len + 5] = (uint8_t)(n >> 24);
-	data[len + 6] = (uint8_t)(n >> 16);
-	data[len + 7] = (uint8_t)(n >>  8);
-	data[len + 8] = (uint8_t)(n      );
+	cbor_store_be64(data + len + 1, n);
 	buf->len      = len + sizeof(m) + sizeof(n);
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 9, 0);
+
 	return true;
 }
 
@@ -324,22 +1059,18 @@ cbor_buf_append_9byte_plus(struct cbor_buf *buf, uint8_t m, uint64_t n, void *pl
 	size_t   len  = buf->len;
 	size_t   cap  = buf->cap;
 
-	if ( cap - len < sizeof(m) + sizeof(n) + size ) {
-		return false;
+	if ( size > cap - len || cap - len - size < sizeof(m) + sizeof(n) ) {
+		return cbor_buf_full(buf);
 	}
 
 	data[len    ] = m;
-	data[len + 1] = (uint8_t)(n >> 56);
-	data[len + 2] = (uint8_t)(n >> 48);
-	data[len + 3] = (uint8_t)(n >> 40);
-	data[len + 4] = (uint8_t)(n >> 32);
-	data[len + 5] = (uint8_t)(n >> 24);
-	data[len + 6] = (uint8_t)(n >> 16);
-	data[len + 7] = (uint8_t)(n >>  8);
-	data[len + 8] = (uint8_t)(n      );
+	cbor_store_be64(data + len + 1, n);
 	memcpy(data + len + 9, plus, size);
 	buf->len      = len + sizeof(m) + sizeof(n) + size;
 
+	cbor_buf_hash(buf);
+	CBOR_STATS_ENCODED(buf, m, 9, size);
+
 	return true;
 }
 
@@ -422,7 +1153,7 @@ cbor_add_int64(struct cbor_buf *buf, int64_t i)
 		return cbor_add_uint64(buf, (uint64_t)i);
 	}
 
-        uint64_t n = ((uint64_t)(-i))-1;
+        uint64_t n = (uint64_t)(-(i + 1));
 
 	if ( n <= 23 ) {
         	return cbor_buf_append_byte(buf, (uint8_t)(0x20 | n));
@@ -530,6 +1261,47 @@ cbor_add_utf8_cstr(struct cbor_buf *buf, char *str)
 	return cbor_add_utf8_str(buf, str, len);
 }
 
+/*
+ * Append only the head of a string whose payload goes out separately, e.g.
+ * with writev(). The payload is hashed in place, not copied.
+ */
+static inline bool
+cbor_add_string_ref(struct cbor_buf *buf, int major, const void *data, size_t len)
+{
+	uint8_t initial = (uint8_t)(major << 5);
+	bool    ok;
+
+	if ( len <= 23 ) {
+		ok = cbor_buf_append_byte(buf, initial | (uint8_t)len);
+	} else if ( len <= UINT8_MAX ) {
+		ok = cbor_buf_append_2byte(buf, initial | 0x18, (uint8_t)len);
+	} else if ( len <= UINT16_MAX ) {
+		ok = cbor_buf_append_3byte(buf, initial | 0x19, (uint16_t)len);
+	} else if ( len <= UINT32_MAX ) {
+		ok = cbor_buf_append_5byte(buf, initial | 0x1a, (uint32_t)len);
+	} else {
+		ok = cbor_buf_append_9byte(buf, initial | 0x1b, len);
+	}
+
+	if ( ok ) {
+		cbor_buf_hash_segment(buf, data, len);
+	}
+
+	return ok;
+}
+
+static inline bool
+cbor_add_byte_str_ref(struct cbor_buf *buf, const void *data, size_t len)
+{
+	return cbor_add_string_ref(buf, CBOR_MAJOR_BYTES, data, len);
+}
+
+static inline bool
+cbor_add_utf8_str_ref(struct cbor_buf *buf, const char *data, size_t len)
+{
+	return cbor_add_string_ref(buf, CBOR_MAJOR_TEXT, data, len);
+}
+
 static inline bool
 cbor_add_array(struct cbor_buf *buf, uint64_t size)
 {
@@ -537,15 +1309,15 @@ cbor_add_array(struct cbor_buf *buf, uint64_t size)
 		return cbor_buf_append_byte(buf, (uint8_t)(0x80 | size));
 	}
 
-	if ( size < UINT8_MAX ) {
+	if ( size <= UINT8_MAX ) {
 		return cbor_buf_append_2byte(buf, 0x98, (uint8_t)size);
 	}
 
-	if ( size < UINT16_MAX ) {
+	if ( size <= UINT16_MAX ) {
 		return cbor_buf_append_3byte(buf, 0x99, (uint16_t)size);
 	}
 
-	if ( size < UINT32_MAX ) {
+	if ( size <= UINT32_MAX ) {
 		return cbor_buf_append_5byte(buf, 0x9a, (uint32_t)size);
 	}
 
@@ -567,60 +1339,222 @@ cbor_add_map(struct cbor_buf *buf, uint64_t size)
 		return cbor_buf_append_byte(buf, (uint8_t)(0xa0 | size));
 	}
 
-	if ( size < UINT8_MAX ) {
+	if ( size <= UINT8_MAX ) {
 		return cbor_buf_append_2byte(buf, 0xb8, (uint8_t)size);
 	}
 
-	if ( size < UINT16_MAX ) {
+	if ( size <= UINT16_MAX ) {
 		return cbor_buf_append_3byte(buf, 0xb9, (uint16_t)size);
 	}
 
-	if ( size < UINT32_MAX ) {
+	if ( size <= UINT32_MAX ) {
 		return cbor_buf_append_5byte(buf, 0xba, (uint32_t)size);
 	}
 
-	return cbor_buf_append_9byte(buf, 0xbb, size);
+	return cbor_buf_append_9byte(buf, 0xbb, size);
+}
+
+static inline bool
+cbor_add_map_start(struct cbor_buf *buf)
+{
+	return cbor_buf_append_byte(buf, 0xbf);
+}
+
+#define cbor_add_map_end cbor_add_break
+
+static inline bool
+cbor_add_tag(struct cbor_buf *buf, uint64_t tag)
+{
+	if ( tag <= 23 ) {
+		return cbor_buf_append_byte(buf, (uint8_t)(0xc0 | tag));
+	}
+
+	if ( tag <= UINT8_MAX ) {
+		return cbor_buf_append_2byte(buf, 0xd8, (uint8_t)tag);
+	}
+
+	if ( tag <= UINT16_MAX ) {
+		return cbor_buf_append_3byte(buf, 0xd9, (uint16_t)tag);
+	}
+
+	if ( tag <= UINT32_MAX ) {
+		return cbor_buf_append_5byte(buf, 0xda, (uint32_t)tag);
+	}
+
+	return cbor_buf_append_9byte(buf, 0xdb, tag);
+}
+
+static inline size_t
+cbor_head_size(uint64_t arg)
+{
+	if ( arg <= 23 ) {
+		return 1;
+	}
+	if ( arg <= UINT8_MAX ) {
+		return 2;
+	}
+	if ( arg <= UINT16_MAX ) {
+		return 3;
+	}
+	if ( arg <= UINT32_MAX ) {
+		return 5;
+	}
+
+	return 9;
+}
+
+/*
+ * Write a head of size bytes, which must be at least cbor_head_size(arg).
+ * Wider heads than needed are valid CBOR, just not preferred.
+ */
+static inline size_t
+cbor_encode_head_size(uint8_t *data, int major, uint64_t arg, size_t size)
+{
+	uint8_t initial = (uint8_t)(major << 5);
+
+	switch ( size ) {
+		case 1:
+			data[0] = initial | (uint8_t)arg;
+			return 1;
+
+		case 2:
+			data[0] = initial | 0x18;
+			data[1] = (uint8_t)arg;
+			return 2;
+
+		case 3:
+			data[0] = initial | 0x19;
+			cbor_store_be16(data + 1, (uint16_t)arg);
+			return 3;
+
+		case 5:
+			data[0] = initial | 0x1a;
+			cbor_store_be32(data + 1, (uint32_t)arg);
+			return 5;
+
+		default:
+			data[0] = initial | 0x1b;
+			cbor_store_be64(data + 1, arg);
+			return 9;
+	}
+}
+
+/*
+ * Write the shortest head for major type and argument to data, which must
+ * have room for cbor_head_size(arg) bytes. Used to back-patch lengths of
+ * items whose size is only known after their content has been written.
+ */
+static inline size_t
+cbor_encode_head(uint8_t *data, int major, uint64_t arg)
+{
+	return cbor_encode_head_size(data, major, arg, cbor_head_size(arg));
+}
+
+/*
+ * Embedded CBOR data item, tag 24 around a byte string. The inner item is
+ * encoded straight into buf between cbor_add_embedded_start() and
+ * cbor_add_embedded_end(), which back-patches the byte string length.
+ * Room for the length is reserved from a size hint; if the item turns out
+ * to need a different head width, the end moves it once to keep the head
+ * shortest. Scopes nest. An attached hash is held back while a scope is
+ * open, as its head changes, and sees the bytes after the outermost end.
+ * An end that fails for lack of room reattaches the hash and leaves the
+ * scope open, to be cancelled.
+ */
+#define CBOR_TAG_EMBEDDED 24
+
+struct cbor_embedded {
+	size_t            head;     /* offset of the byte string head */
+	size_t            width;    /* bytes reserved for it */
+	struct cbor_hash *hash;
+};
+
+static inline bool
+cbor_add_embedded_start(struct cbor_buf *buf, struct cbor_embedded *scope, size_t hint)
+{
+	size_t width = cbor_head_size(hint);
+
+	if ( buf->cap - buf->len < 2 + width ) {
+		return cbor_buf_full(buf);
+	}
+
+	cbor_buf_hash_flush(buf);
+	scope->hash  = buf->hash;
+	scope->head  = buf->len + 2;
+	scope->width = width;
+	buf->hash    = NULL;
+
+	buf->data[buf->len]     = 0xd8;
+	buf->data[buf->len + 1] = CBOR_TAG_EMBEDDED;
+	buf->len += 2 + width;
+
+	return true;
+}
+
+static inline bool
+cbor_add_embedded_end(struct cbor_buf *buf, struct cbor_embedded *scope)
+{
+	size_t len   = buf->len - scope->head - scope->width;
+	size_t width = cbor_head_size(len);
+
+	if ( width != scope->width && !cbor_buf_splice(buf, scope->head, scope->width, width) ) {
+		buf->hash = scope->hash;
+		return false;
+	}
+	cbor_encode_head_size(buf->data + scope->head, CBOR_MAJOR_BYTES, len, width);
+	buf->hash = scope->hash;
+	cbor_buf_hash(buf);
+
+	CBOR_STATS_ENCODED(buf, 0xd8, 2, 0);
+
+	return true;
+}
+
+/* Drop the scope and everything encoded in it. */
+static inline void
+cbor_add_embedded_cancel(struct cbor_buf *buf, struct cbor_embedded *scope)
+{
+	buf->len  = scope->head - 2;
+	buf->hash = scope->hash;
 }
 
+/* Wrap an item that is encoded already, e.g. one forwarded unopened. */
 static inline bool
-cbor_add_map_start(struct cbor_buf *buf)
+cbor_add_embedded(struct cbor_buf *buf, const void *data, size_t len)
 {
-	return cbor_buf_append_byte(buf, 0xbf);
-}
+	size_t need = 2 + cbor_head_size(len) + len;
 
-#define cbor_add_map_end cbor_add_break
+	if ( buf->cap - buf->len < need ) {
+		return cbor_buf_full(buf);
+	}
+
+	return cbor_add_tag(buf, CBOR_TAG_EMBEDDED) && cbor_add_byte_str(buf, (void *)data, len);
+}
 
 static inline bool
 cbor_is_positive_integer(struct cbor_buf *buf)
 {
-	uint8_t *data = buf->data;
-	size_t   idx  = buf->idx;
-	uint8_t  byte = data[idx];
+	size_t idx = buf->idx;
 
-	return byte < 0x20;
+	return idx < buf->len && buf->data[idx] < 0x20;
 }
 
 static inline bool
 cbor_is_negative_integer(struct cbor_buf *buf)
 {
-	uint8_t *data = buf->data;
-	size_t   idx  = buf->idx;
-	uint8_t  byte = data[idx];
+	size_t idx = buf->idx;
 
-	return byte >= 0x20 && byte < 0x40;
+	return idx < buf->len && buf->data[idx] >> 5 == CBOR_MAJOR_NEGINT;
 }
 
 static inline bool
 cbor_is_integer(struct cbor_buf *buf)
 {
-	uint8_t *data = buf->data;
-	size_t   idx  = buf->idx;
-	uint8_t  byte = data[idx];
+	size_t idx = buf->idx;
 
-	return byte < 0x40;
+	return idx < buf->len && buf->data[idx] < 0x40;
 }
 
-// TODO: Find a better portable way to express unaligned loads.
 static inline uint64_t
 cbor_peek_u8(uint8_t *data)
 {
@@ -630,21 +1564,13 @@ cbor_peek_u8(uint8_t *data)
 static inline uint64_t
 cbor_peek_u16(uint8_t *data)
 {
-	uint16_t value = ((uint16_t)data[0]) << 8 |
-	                 ((uint16_t)data[1]); 
-
-	return (uint64_t)value;
+	return (uint64_t)cbor_load_be16(data);
 }
 
 static inline uint64_t
 cbor_peek_u32(uint8_t *data)
 {
-	uint32_t value = ((uint32_t)data[0]) << 24 |
-	                 ((uint32_t)data[1]) << 16 |
-			 ((uint32_t)data[2]) <<  8 |
-			 ((uint32_t)data[3]);
-
-	return (uint64_t)value;
+	return (uint64_t)cbor_load_be32(data);
 }
 
 static inline float
@@ -653,10 +1579,7 @@ cbor_peek_float(uint8_t *data)
 	union {
 		uint32_t n;
 		float    x;
-	} tmp = { .n = ((uint32_t)data[0]) << 24 |
-		       ((uint32_t)data[1]) << 16 |
-	               ((uint32_t)data[2]) <<  8 |
-		       ((uint32_t)data[3]) };
+	} tmp = { .n = cbor_load_be32(data) };
 
 	return tmp.x;
 }
@@ -667,14 +1590,7 @@ cbor_peek_double(uint8_t *data)
 	union {
 		uint64_t n;
 		double   x;
-	} tmp = { .n = ((uint64_t)data[0]) << 56 |
-		       ((uint64_t)data[1]) << 48 |
-	               ((uint64_t)data[2]) << 40 |
-		       ((uint64_t)data[3]) << 32 |
-		       ((uint64_t)data[4]) << 24 |
-		       ((uint64_t)data[5]) << 16 |
-		       ((uint64_t)data[6]) <<  8 |
-		       ((uint64_t)data[7]) };
+	} tmp = { .n = cbor_load_be64(data) };
 
 	return tmp.x;
 }
@@ -682,16 +1598,31 @@ cbor_peek_double(uint8_t *data)
 static inline uint64_t
 cbor_peek_u64(uint8_t *data)
 {
-	uint64_t value = ((uint64_t)data[0]) << 56 |
-	                 ((uint64_t)data[1]) << 48 |
-			 ((uint64_t)data[2]) << 40 |
-			 ((uint64_t)data[3]) << 32 |
-			 ((uint64_t)data[4]) << 24 |
-			 ((uint64_t)data[5]) << 16 |
-			 ((uint64_t)data[6]) <<  8 |
-			 ((uint64_t)data[7]);
+	return cbor_load_be64(data);
+}
+
+/*
+ * Charge a head of size bytes at the cursor against the limits: its bytes,
+ * and one data item unless it is a break. Every reader calls this before
+ * it moves the cursor.
+ */
+static inline bool
+cbor_buf_charge(struct cbor_buf *buf, uint8_t initial, size_t size, unsigned expected)
+{
+	const struct cbor_limits *limits = buf->limits;
 
-	return value;
+	if ( limits == NULL ) {
+		return true;
+	}
+	if ( buf->idx + size > limits->max_bytes ) {
+		return cbor_buf_fail(buf, CBOR_ERR_LIMIT, expected);
+	}
+	if ( initial != 0xff && buf->items >= limits->max_items ) {
+		return cbor_buf_fail(buf, CBOR_ERR_LIMIT, expected);
+	}
+	buf->items += initial != 0xff;
+
+	return true;
 }
 
 static inline bool
@@ -702,14 +1633,18 @@ cbor_read_positive_integer(struct cbor_buf *buf, uint64_t *value)
 	uint8_t *data = buf->data + idx;
 
 	if ( idx >= len ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
 	}
 
 	uint8_t byte = data[0];
 	
 	if ( byte < 0x18 ) {
-        	buf->idx = idx + sizeof(byte);
+		if ( !cbor_buf_charge(buf, byte, sizeof(byte), CBOR_MAJOR_BIT(CBOR_MAJOR_UINT)) ) {
+			return false;
+		}
+		buf->idx = idx + sizeof(byte);
 		*value   = (uint64_t)byte;
+		CBOR_STATS_DECODED(buf, byte, 1, 0);
 		return true;
 	}
         
@@ -717,38 +1652,57 @@ cbor_read_positive_integer(struct cbor_buf *buf, uint64_t *value)
 	switch ( byte ) {
         	case 0x18:
 			if ( len - idx < sizeof(byte) + sizeof(uint8_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint8_t), CBOR_MAJOR_BIT(CBOR_MAJOR_UINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint8_t);
 			*value   = cbor_peek_u8(data);
+			CBOR_STATS_DECODED(buf, byte, 2, 0);
 			return true;
 
 		case 0x19:
 			if ( len - idx < sizeof(byte) + sizeof(uint16_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint16_t), CBOR_MAJOR_BIT(CBOR_MAJOR_UINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint16_t);
 			*value   = cbor_peek_u16(data);
+			CBOR_STATS_DECODED(buf, byte, 3, 0);
 			return true;
 
 		case 0x1a:
 			if ( len - idx < sizeof(byte) + sizeof(uint32_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint32_t), CBOR_MAJOR_BIT(CBOR_MAJOR_UINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint32_t);
 			*value   = cbor_peek_u32(data);
+			CBOR_STATS_DECODED(buf, byte, 5, 0);
 			return true;
 
 		case 0x1b:
 			if ( len - idx < sizeof(byte) + sizeof(uint64_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint64_t), CBOR_MAJOR_BIT(CBOR_MAJOR_UINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint64_t);
 			*value   = cbor_peek_u64(data);
+			CBOR_STATS_DECODED(buf, byte, 9, 0);
 			return true;
 
 		default:
-			return false;
+			if ( byte < 0x20 ) {
+				return cbor_buf_fail(buf, CBOR_ERR_INFO, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
+			}
+			return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT));
 	}
 
 	return false;
@@ -762,14 +1716,18 @@ cbor_read_negative_integer_biased(struct cbor_buf *buf, uint64_t *value)
 	uint8_t *data = buf->data + idx;
 
 	if ( idx >= len ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
 	}
 
-	uint8_t  byte = data[idx];
+	uint8_t  byte = data[0];
 
 	if ( byte >= 0x20 && byte < 0x38 ) {
-        	buf->idx = idx + sizeof(byte);
+		if ( !cbor_buf_charge(buf, byte, sizeof(byte), CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT)) ) {
+			return false;
+		}
+		buf->idx = idx + sizeof(byte);
 		*value   = (uint64_t)byte - 0x20;
+		CBOR_STATS_DECODED(buf, byte, 1, 0);
 		return true;
 	}
 
@@ -777,38 +1735,57 @@ cbor_read_negative_integer_biased(struct cbor_buf *buf, uint64_t *value)
 	switch ( byte ) {
         	case 0x38:
 			if ( len - idx < sizeof(byte) + sizeof(uint8_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint8_t), CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint8_t);
 			*value   = cbor_peek_u8(data);
+			CBOR_STATS_DECODED(buf, byte, 2, 0);
 			return true;
 
 		case 0x39:
 			if ( len - idx < sizeof(byte) + sizeof(uint16_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint16_t), CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint16_t);
 			*value   = cbor_peek_u16(data);
+			CBOR_STATS_DECODED(buf, byte, 3, 0);
 			return true;
 
 		case 0x3a:
 			if ( len - idx < sizeof(byte) + sizeof(uint32_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint32_t), CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint32_t);
 			*value   = cbor_peek_u32(data);
+			CBOR_STATS_DECODED(buf, byte, 5, 0);
 			return true;
 
 		case 0x3b:
 			if ( len - idx < sizeof(byte) + sizeof(uint64_t) ) {
+				return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			if ( !cbor_buf_charge(buf, byte, sizeof(byte) + sizeof(uint64_t), CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT)) ) {
 				return false;
 			}
 			buf->idx = idx + sizeof(byte) + sizeof(uint64_t);
 			*value   = cbor_peek_u64(data);
+			CBOR_STATS_DECODED(buf, byte, 9, 0);
 			return true;
 
 		default:
-			return false;
+			if ( byte >= 0x20 && byte < 0x40 ) {
+				return cbor_buf_fail(buf, CBOR_ERR_INFO, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
 	}
 
 	return false;
@@ -838,7 +1815,7 @@ cbor_read_integer(struct cbor_buf *buf, int128_t *value)
 	uint8_t *data = buf->data + idx;
 
 	if ( idx >= len ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT) | CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
 	}
 
 	uint8_t byte = data[0];
@@ -855,7 +1832,7 @@ cbor_read_integer(struct cbor_buf *buf, int128_t *value)
         	return cbor_read_negative_integer_unbiased(buf, value);
 	}
 
-	return false;
+	return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_UINT) | CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
 }
 
 static inline bool
@@ -866,15 +1843,19 @@ cbor_expect_byte(struct cbor_buf *buf, uint8_t byte)
 	uint8_t *data = buf->data + idx;
 
         if ( idx >= len ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(byte >> 5));
 	}
 	
 	if ( *data == byte ) {
+		if ( !cbor_buf_charge(buf, byte, 1, CBOR_MAJOR_BIT(byte >> 5)) ) {
+			return false;
+		}
 		buf->idx = idx + 1;
+		CBOR_STATS_DECODED(buf, byte, 1, 0);
 		return true;
 	}
 
-	return false;
+	return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(byte >> 5));
 }
 
 static inline bool
@@ -903,18 +1884,22 @@ cbor_read_boolean(struct cbor_buf *buf, bool *value)
 	uint8_t *data = buf->data + idx;
 
 	if ( idx >= len ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 	
 	uint8_t byte = *data;
 
 	if ( byte == 0xf4 || byte == 0xf5 ) {
-        	buf->idx = idx + 1;
+		if ( !cbor_buf_charge(buf, byte, 1, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE)) ) {
+			return false;
+		}
+		buf->idx = idx + 1;
 		*value = byte == 0xf5;
+		CBOR_STATS_DECODED(buf, byte, 1, 0);
 		return true;
 	}
 	
-	return false;
+	return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 }
 
 static inline bool
@@ -925,16 +1910,21 @@ cbor_read_float(struct cbor_buf *buf, float *x)
 	uint8_t *data = buf->data + idx;
 
 	if ( len < sizeof(uint8_t) + sizeof(float) || idx > len - sizeof(uint8_t) - sizeof(float) ) {
-        	return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 	
 	if ( *data++ != 0xfa ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 
+	if ( !cbor_buf_charge(buf, 0xfa, sizeof(uint8_t) + sizeof(float), CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE)) ) {
+		return false;
+	}
 	buf->idx = idx + sizeof(uint8_t) + sizeof(float);
 	*x       = cbor_peek_float(data);
 
+	CBOR_STATS_DECODED(buf, 0xfa, 5, 0);
+
 	return true;
 }
 
@@ -946,29 +1936,34 @@ cbor_read_double(struct cbor_buf *buf, double *x)
 	uint8_t *data = buf->data + idx;
 
 	if ( len < sizeof(uint8_t) + sizeof(double) || idx > len - sizeof(uint8_t) - sizeof(double) ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 	
 	if ( *data++ != 0xfb ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 
+	if ( !cbor_buf_charge(buf, 0xfb, sizeof(uint8_t) + sizeof(double), CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE)) ) {
+		return false;
+	}
 	buf->idx = idx + sizeof(uint8_t) + sizeof(double);
 	*x       = cbor_peek_double(data);
 
+	CBOR_STATS_DECODED(buf, 0xfb, 9, 0);
+
 	return true;
 }
 
 static inline double
 cbor_decode_half(uint8_t *data)
 {
-	int    half      = (data[0] << 8) + data[1];
+	int    half      = cbor_load_be16(data);
 	int    exponent  = (half >> 10) & 0x1f;
 	int    mantissa  = half & 0x3ff;
 	double sign      = half & 0x8000 ? -1.0 : 1.0;
 	double absolute;
 	
-	if ( exp == 0 ) {
+	if ( exponent == 0 ) {
 		absolute = ldexp(mantissa, -24);
 	} else if ( exponent != 31 ) {
 		absolute = ldexp(mantissa + 1024, exponent - 25);
@@ -986,18 +1981,439 @@ cbor_read_half(struct cbor_buf *buf, double *x)
 	uint8_t *data = buf->data + idx;
 
 	if ( len < sizeof(uint8_t) * 3 || idx > len - sizeof(uint8_t) * 3 ) {
-		return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 
 	if ( *data++ != 0xf9 ) {
-        	return false;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
 	}
 
+	if ( !cbor_buf_charge(buf, 0xf9, sizeof(uint8_t) * 3, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE)) ) {
+		return false;
+	}
 	buf->idx = idx + sizeof(uint8_t) * 3;
 	*x       = cbor_decode_half(data);
 
+	CBOR_STATS_DECODED(buf, 0xf9, 3, 0);
+
+	return true;
+}
+
+
+static inline bool
+cbor_read_head(struct cbor_buf *buf, struct cbor_head *head)
+{
+	size_t   len  = buf->len;
+	size_t   idx  = buf->idx;
+	uint8_t *data = buf->data + idx;
+	size_t   size;
+
+	if ( idx >= len ) {
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_ANY);
+	}
+
+	uint8_t byte  = data[0];
+	uint8_t major = byte >> 5;
+	uint8_t info  = byte & 0x1f;
+
+	if ( info < 24 ) {
+		size = 1;
+	} else if ( info < 28 ) {
+		size = (size_t)1 + ((size_t)1 << (info - 24));
+	} else if ( info == 31 && major != CBOR_MAJOR_UINT && major != CBOR_MAJOR_NEGINT && major != CBOR_MAJOR_TAG ) {
+		size = 1;
+	} else {
+		return cbor_buf_fail(buf, CBOR_ERR_INFO, CBOR_MAJOR_ANY);
+	}
+
+	if ( len - idx < size ) {
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_ANY);
+	}
+
+	/* Simple values below 32 only have the one byte form. */
+	if ( byte == 0xf8 && data[1] < 0x20 ) {
+		return cbor_buf_fail(buf, CBOR_ERR_INFO, CBOR_MAJOR_ANY);
+	}
+
+	if ( !cbor_buf_charge(buf, byte, size, CBOR_MAJOR_ANY) ) {
+		return false;
+	}
+
+	head->initial    = byte;
+	head->major      = major;
+	head->size       = (uint8_t)size;
+	head->indefinite = info == 31;
+
+	data += sizeof(byte);
+	switch ( size ) {
+		case 1:  head->arg = info == 31 ? 0 : info; break;
+		case 2:  head->arg = cbor_peek_u8(data);    break;
+		case 3:  head->arg = cbor_peek_u16(data);   break;
+		case 5:  head->arg = cbor_peek_u32(data);   break;
+		default: head->arg = cbor_peek_u64(data);   break;
+	}
+	buf->idx = idx + size;
+
+	CBOR_STATS_DECODED(buf, byte, size, 0);
+
+	return true;
+}
+
+static inline bool
+cbor_check_major(struct cbor_buf *buf, int major)
+{
+	size_t idx = buf->idx;
+
+	if ( idx >= buf->len ) {
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(major));
+	}
+	if ( buf->data[idx] >> 5 != major ) {
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(major));
+	}
+
+	return true;
+}
+
+/* Callers consume the payload once the check passes, so it is counted here. */
+static inline bool
+cbor_check_string(struct cbor_buf *buf, uint64_t size, size_t start)
+{
+	const struct cbor_limits *limits = buf->limits;
+	int                       major  = buf->data[start] >> 5;
+
+	if ( limits != NULL && (size > limits->max_string || buf->idx + size > limits->max_bytes) ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_LIMIT, CBOR_MAJOR_BIT(major));
+	}
+	if ( size > buf->len - buf->idx ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(major));
+	}
+
+	CBOR_STATS_PAYLOAD(buf, major, (size_t)size);
+
+	return true;
+}
+
+static inline bool
+cbor_check_container(struct cbor_buf *buf, uint64_t size, size_t start)
+{
+	const struct cbor_limits *limits = buf->limits;
+	int                       major  = buf->data[start] >> 5;
+	uint64_t                  avail  = buf->len - buf->idx;
+
+	if ( limits != NULL && size > limits->max_container ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_LIMIT, CBOR_MAJOR_BIT(major));
+	}
+
+	/* Every element takes at least one byte, every map pair two. */
+	if ( major == CBOR_MAJOR_MAP ? size > avail / 2 : size > avail ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(major));
+	}
+
+	return true;
+}
+
+static inline bool
+cbor_read_string(struct cbor_buf *buf, int major, uint8_t **data, size_t *len)
+{
+	size_t           start = buf->idx;
+	struct cbor_head head;
+
+	if ( !cbor_check_major(buf, major) || !cbor_read_head(buf, &head) ) {
+		return false;
+	}
+	if ( head.indefinite ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(major));
+	}
+	if ( !cbor_check_string(buf, head.arg, start) ) {
+		return false;
+	}
+
+	*data     = buf->data + buf->idx;
+	*len      = (size_t)head.arg;
+	buf->idx += (size_t)head.arg;
+
+	return true;
+}
+
+static inline bool
+cbor_read_byte_str(struct cbor_buf *buf, uint8_t **data, size_t *len)
+{
+	return cbor_read_string(buf, CBOR_MAJOR_BYTES, data, len);
+}
+
+static inline bool
+cbor_read_utf8_str(struct cbor_buf *buf, char **data, size_t *len)
+{
+	return cbor_read_string(buf, CBOR_MAJOR_TEXT, (uint8_t **)data, len);
+}
+
+static inline bool
+cbor_read_container(struct cbor_buf *buf, int major, uint64_t *size)
+{
+	size_t           start = buf->idx;
+	struct cbor_head head;
+
+	if ( !cbor_check_major(buf, major) || !cbor_read_head(buf, &head) ) {
+		return false;
+	}
+	if ( head.indefinite ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(major));
+	}
+	if ( !cbor_check_container(buf, head.arg, start) ) {
+		return false;
+	}
+
+	*size = head.arg;
+
+	return true;
+}
+
+static inline bool
+cbor_read_array(struct cbor_buf *buf, uint64_t *size)
+{
+	return cbor_read_container(buf, CBOR_MAJOR_ARRAY, size);
+}
+
+static inline bool
+cbor_read_array_start(struct cbor_buf *buf)
+{
+	return cbor_expect_byte(buf, 0x9f);
+}
+
+static inline bool
+cbor_read_map(struct cbor_buf *buf, uint64_t *size)
+{
+	return cbor_read_container(buf, CBOR_MAJOR_MAP, size);
+}
+
+static inline bool
+cbor_read_map_start(struct cbor_buf *buf)
+{
+	return cbor_expect_byte(buf, 0xbf);
+}
+
+static inline bool
+cbor_read_tag(struct cbor_buf *buf, uint64_t *tag)
+{
+	struct cbor_head head;
+
+	if ( !cbor_check_major(buf, CBOR_MAJOR_TAG) || !cbor_read_head(buf, &head) ) {
+		return false;
+	}
+
+	*tag = head.arg;
+
+	return true;
+}
+
+/*
+ * Read an embedded CBOR data item and point inner at its bytes, without
+ * copying or parsing them; the outer cursor moves past. inner shares the
+ * limits of buf and continues its item count, so reading the embedded item
+ * cannot exceed max_items. Only definite length byte strings can be viewed
+ * in place, chunked ones fail with CBOR_ERR_TYPE. On failure neither the
+ * cursor nor the item count of buf moves.
+ */
+static inline bool
+cbor_read_embedded(struct cbor_buf *buf, struct cbor_buf *inner)
+{
+	size_t   start = buf->idx;
+	uint64_t items = buf->items;
+	uint64_t tag   = 0;
+	uint8_t *data  = NULL;
+	size_t   len   = 0;
+
+	if ( !cbor_read_tag(buf, &tag) ) {
+		return false;
+	}
+	if ( tag != CBOR_TAG_EMBEDDED ) {
+		buf->idx   = start;
+		buf->items = items;
+		return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_TAG));
+	}
+	if ( !cbor_read_byte_str(buf, &data, &len) ) {
+		buf->idx   = start;
+		buf->items = items;
+		return false;
+	}
+
+	cbor_buf_init(inner, data, len, len);
+	inner->limits = buf->limits;
+	inner->items  = buf->items;
+#ifdef CBOR_STATS
+	inner->stats  = buf->stats;
+#endif
+
 	return true;
 }
 
+static inline bool
+cbor_expect_break(struct cbor_buf *buf)
+{
+	return cbor_expect_byte(buf, 0xff);
+}
+
+static inline bool
+cbor_is_break(struct cbor_buf *buf)
+{
+	size_t idx = buf->idx;
+
+	return idx < buf->len && buf->data[idx] == 0xff;
+}
+
+/* The nesting depth allowed by the limits of buf. */
+static inline size_t
+cbor_buf_max_depth(const struct cbor_buf *buf)
+{
+	const struct cbor_limits *limits = buf->limits;
+
+	return limits != NULL && limits->max_depth < CBOR_MAX_DEPTH ? limits->max_depth : CBOR_MAX_DEPTH;
+}
+
+/*
+ * Skip one complete data item without recursion. Nesting is tracked on a
+ * fixed stack of CBOR_MAX_DEPTH levels, so hostile input cannot exhaust the
+ * C stack. On failure the cursor and item count are left as they were at
+ * the start of the item, so a truncated item can be retried once more input
+ * has arrived, and the error offset points at the offending head.
+ *
+ * cbor_skip_nested() skips an item that sits inside open arrays or maps a
+ * caller has entered itself; they count against max_depth.
+ */
+struct cbor_skip_level {
+	uint64_t remaining;     /* definite: items left, indefinite: items seen */
+	uint8_t  major;
+	bool     indefinite;
+};
+
+static inline bool
+cbor_skip_nested(struct cbor_buf *buf, size_t open)
+{
+	struct cbor_skip_level stack[CBOR_MAX_DEPTH];
+	size_t                 max_depth = cbor_buf_max_depth(buf);
+	size_t                 depth     = 0;
+	size_t                 start     = buf->idx;
+	uint64_t               items     = buf->items;
+	bool                   tagged    = false;
+	struct cbor_head       head;
+
+	max_depth = open < max_depth ? max_depth - open : 0;
+
+	for ( ;; ) {
+		size_t item = buf->idx;
+
+		if ( !cbor_read_head(buf, &head) ) {
+			goto fail;
+		}
+
+		struct cbor_skip_level *top = depth > 0 ? &stack[depth - 1] : NULL;
+
+		if ( top != NULL && top->indefinite &&
+		     (top->major == CBOR_MAJOR_BYTES || top->major == CBOR_MAJOR_TEXT) &&
+		     head.initial != 0xff && (head.major != top->major || head.indefinite) ) {
+			buf->idx = item;
+			cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(top->major));
+			goto fail;
+		}
+
+		/* A tag needs an item, a break cannot complete it. */
+		if ( tagged && head.initial == 0xff ) {
+			buf->idx = item;
+			cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_ANY);
+			goto fail;
+		}
+		tagged = head.major == CBOR_MAJOR_TAG;
+
+		switch ( head.major ) {
+			case CBOR_MAJOR_BYTES:
+			case CBOR_MAJOR_TEXT:
+				if ( !head.indefinite ) {
+					if ( !cbor_check_string(buf, head.arg, item) ) {
+						goto fail;
+					}
+					buf->idx += (size_t)head.arg;
+					break;
+				}
+				/* FALLTHROUGH */
+
+			case CBOR_MAJOR_ARRAY:
+			case CBOR_MAJOR_MAP:
+				if ( !head.indefinite ) {
+					if ( !cbor_check_container(buf, head.arg, item) ) {
+						goto fail;
+					}
+					if ( head.arg == 0 ) {
+						break;
+					}
+				}
+				if ( depth >= max_depth ) {
+					buf->idx = item;
+					cbor_buf_fail(buf, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+					goto fail;
+				}
+				top             = &stack[depth++];
+				top->major      = head.major;
+				top->indefinite = head.indefinite;
+				top->remaining  = head.major == CBOR_MAJOR_MAP ? head.arg * 2 : head.arg;
+				continue;
+
+			case CBOR_MAJOR_TAG:
+				/* The tagged item follows and completes the tag. */
+				continue;
+
+			case CBOR_MAJOR_SIMPLE:
+				if ( head.initial != 0xff ) {
+					break;
+				}
+				if ( top == NULL || !top->indefinite ||
+				     (top->major == CBOR_MAJOR_MAP && top->remaining % 2 != 0) ) {
+					buf->idx = item;
+					cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_ANY);
+					goto fail;
+				}
+				depth--;
+				break;
+
+			default:
+				break;
+		}
+
+		/* An item is complete, account for it in the enclosing levels. */
+		while ( depth > 0 ) {
+			top = &stack[depth - 1];
+			if ( top->indefinite ) {
+				top->remaining++;
+				break;
+			}
+			if ( --top->remaining > 0 ) {
+				break;
+			}
+			depth--;
+		}
+
+		if ( depth == 0 ) {
+			return true;
+		}
+	}
+
+fail:
+	buf->idx   = start;
+	buf->items = items;
+
+	return false;
+}
+
+static inline bool
+cbor_skip_item(struct cbor_buf *buf)
+{
+	return cbor_skip_nested(buf, 0);
+}
+
 
 #endif /* LIBCBOR_CBOR_H */
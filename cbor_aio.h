@@ -0,0 +1,910 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_AIO_H
+#define LIBCBOR_CBOR_AIO_H
+
+#include "cbor.h"
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ * Asynchronous block I/O for CBOR sequence files, so encoding and decoding
+ * overlap with the disk instead of alternating with it.
+ *
+ * A struct cbor_aio runs reads and writes of whole blocks at file offsets.
+ * On Linux it uses io_uring through the raw system calls if the includer
+ * defines _DEFAULT_SOURCE or _GNU_SOURCE, which syscall() needs. Where
+ * io_uring is missing or forbidden, and on other systems, a few threads
+ * run pread() and pwrite() instead. Requests complete in full unless they
+ * fail or a read reaches the end of the file. One engine can serve several
+ * readers and writers.
+ *
+ * The writer encodes into one block while the other is written. The reader
+ * keeps several blocks in flight and hands them to the decoder in file
+ * order; items that span blocks are copied together into a carry area.
+ */
+
+#if defined(__linux__) && (defined(_DEFAULT_SOURCE) || defined(_GNU_SOURCE)) && !defined(CBOR_AIO_NO_URING)
+#define CBOR_AIO_URING 1
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <linux/io_uring.h>
+#endif
+
+#ifndef CBOR_AIO_THREADS
+#define CBOR_AIO_THREADS 4
+#endif
+
+#ifndef CBOR_AIO_MAX_ITEM
+#define CBOR_AIO_MAX_ITEM (64u << 20)
+#endif
+
+#define CBOR_AIO_ALIGN      4096
+#define CBOR_AIO_MAX_BLOCKS 16
+
+struct cbor_aio_req {
+	int                  fd;
+	bool                 write;
+	bool                 done;
+	uint8_t             *data;
+	size_t               len;
+	uint64_t             off;
+	size_t               moved;     /* bytes transferred so far */
+	int                  err;       /* errno of a failed request */
+	struct cbor_aio_req *next;
+};
+
+struct cbor_aio {
+	unsigned             depth;     /* requests in flight at most */
+	unsigned             inflight;
+	bool                 uring;
+
+#ifdef CBOR_AIO_URING
+	int                  ring_fd;
+	void                *sq_ring;
+	void                *cq_ring;
+	size_t               sq_size;
+	size_t               cq_size;
+	unsigned            *sq_head;
+	unsigned            *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t               sqes_size;
+	unsigned            *cq_head;
+	unsigned            *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_cqe *cqes;
+#endif
+
+	/* Thread pool. */
+	pthread_mutex_t      lock;
+	pthread_cond_t       work;
+	pthread_cond_t       finished;
+	struct cbor_aio_req *queue;
+	struct cbor_aio_req *queue_tail;
+	struct cbor_aio_req *completed;
+	pthread_t            threads[CBOR_AIO_THREADS];
+	unsigned             nthreads;
+	bool                 stop;
+};
+
+/* Transfer what is left of req synchronously, as the pool threads do. */
+static inline void
+cbor_aio_transfer(struct cbor_aio_req *req)
+{
+	while ( req->moved < req->len ) {
+		uint8_t *data = req->data + req->moved;
+		size_t   len  = req->len - req->moved;
+		off_t    off  = (off_t)(req->off + req->moved);
+		ssize_t  n    = req->write ? pwrite(req->fd, data, len, off) : pread(req->fd, data, len, off);
+
+		if ( n < 0 ) {
+			if ( errno == EINTR ) {
+				continue;
+			}
+			req->err = errno;
+			return;
+		}
+		if ( n == 0 ) {
+			if ( req->write ) {
+				req->err = EIO;
+			}
+			return;
+		}
+		req->moved += (size_t)n;
+	}
+}
+
+static inline void *
+cbor_aio_worker(void *arg)
+{
+	struct cbor_aio     *aio = arg;
+	struct cbor_aio_req *req;
+
+	pthread_mutex_lock(&aio->lock);
+	for ( ;; ) {
+		while ( aio->queue == NULL && !aio->stop ) {
+			pthread_cond_wait(&aio->work, &aio->lock);
+		}
+		if ( aio->queue == NULL ) {
+			break;
+		}
+		req        = aio->queue;
+		aio->queue = req->next;
+		pthread_mutex_unlock(&aio->lock);
+
+		cbor_aio_transfer(req);
+
+		pthread_mutex_lock(&aio->lock);
+		req->next      = aio->completed;
+		aio->completed = req;
+		pthread_cond_signal(&aio->finished);
+	}
+	pthread_mutex_unlock(&aio->lock);
+
+	return NULL;
+}
+
+static inline void cbor_aio_destroy(struct cbor_aio *aio);
+
+/* Use a pool of nthreads threads, whether io_uring is there or not. */
+static inline bool
+cbor_aio_init_threads(struct cbor_aio *aio, unsigned depth, unsigned nthreads)
+{
+	if ( depth == 0 || nthreads == 0 || nthreads > CBOR_AIO_THREADS ) {
+		return false;
+	}
+
+	memset(aio, 0, sizeof(*aio));
+	aio->depth = depth;
+	pthread_mutex_init(&aio->lock, NULL);
+	pthread_cond_init(&aio->work, NULL);
+	pthread_cond_init(&aio->finished, NULL);
+	for ( ; aio->nthreads < nthreads; aio->nthreads++ ) {
+		if ( pthread_create(&aio->threads[aio->nthreads], NULL, cbor_aio_worker, aio) != 0 ) {
+			cbor_aio_destroy(aio);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+#ifdef CBOR_AIO_URING
+static inline bool
+cbor_aio_init_uring(struct cbor_aio *aio, unsigned depth)
+{
+	struct io_uring_params params;
+	uint8_t               *sq;
+	uint8_t               *cq;
+	int                    fd;
+
+	memset(aio, 0, sizeof(*aio));
+	memset(&params, 0, sizeof(params));
+	if ( (fd = (int)syscall(__NR_io_uring_setup, depth, &params)) < 0 ) {
+		return false;
+	}
+
+	/* IORING_OP_READ and IORING_OP_WRITE came with this, in Linux 5.6. */
+	if ( !(params.features & IORING_FEAT_RW_CUR_POS) ) {
+		close(fd);
+		return false;
+	}
+
+	aio->ring_fd   = fd;
+	aio->sq_size   = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	aio->cq_size   = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	aio->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		aio->sq_size = aio->cq_size = aio->sq_size > aio->cq_size ? aio->sq_size : aio->cq_size;
+	}
+
+	aio->sq_ring = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	aio->cq_ring = aio->sq_ring;
+	if ( aio->sq_ring != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP) ) {
+		aio->cq_ring = mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	}
+	aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if ( aio->sq_ring == MAP_FAILED || aio->cq_ring == MAP_FAILED || aio->sqes == MAP_FAILED ) {
+		if ( aio->sqes != MAP_FAILED ) {
+			munmap(aio->sqes, aio->sqes_size);
+		}
+		if ( aio->cq_ring != MAP_FAILED && aio->cq_ring != aio->sq_ring ) {
+			munmap(aio->cq_ring, aio->cq_size);
+		}
+		if ( aio->sq_ring != MAP_FAILED ) {
+			munmap(aio->sq_ring, aio->sq_size);
+		}
+		close(fd);
+		return false;
+	}
+
+	sq = aio->sq_ring;
+	cq = aio->cq_ring;
+	aio->sq_head  = (unsigned *)(sq + params.sq_off.head);
+	aio->sq_tail  = (unsigned *)(sq + params.sq_off.tail);
+	aio->sq_mask  = (unsigned *)(sq + params.sq_off.ring_mask);
+	aio->sq_array = (unsigned *)(sq + params.sq_off.array);
+	aio->cq_head  = (unsigned *)(cq + params.cq_off.head);
+	aio->cq_tail  = (unsigned *)(cq + params.cq_off.tail);
+	aio->cq_mask  = (unsigned *)(cq + params.cq_off.ring_mask);
+	aio->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	aio->depth    = depth < params.sq_entries ? depth : params.sq_entries;
+	aio->uring    = true;
+
+	return true;
+}
+
+/* Queue what is left of req and tell the kernel. */
+static inline bool
+cbor_aio_uring_submit(struct cbor_aio *aio, struct cbor_aio_req *req)
+{
+	unsigned             tail = *aio->sq_tail;
+	unsigned             slot = tail & *aio->sq_mask;
+	struct io_uring_sqe *sqe  = &aio->sqes[slot];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode    = req->write ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd        = req->fd;
+	sqe->addr      = (uint64_t)(uintptr_t)(req->data + req->moved);
+	sqe->len       = (uint32_t)(req->len - req->moved);
+	sqe->off       = req->off + req->moved;
+	sqe->user_data = (uint64_t)(uintptr_t)req;
+	aio->sq_array[slot] = slot;
+	__atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	/*
+	 * Once the kernel has taken the entry the request is in flight, even
+	 * if the call fails. Otherwise take the entry back, so no later call
+	 * submits it after the caller has reused the block.
+	 */
+	for ( ;; ) {
+		bool ok = syscall(__NR_io_uring_enter, aio->ring_fd, 1, 0, 0, NULL, 0) >= 0;
+
+		if ( __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE) != tail ) {
+			return true;
+		}
+		if ( !ok && errno != EINTR && errno != EAGAIN && errno != EBUSY ) {
+			req->err = errno;
+			__atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+			return false;
+		}
+	}
+}
+
+/* Reap one completion, resubmitting short transfers. */
+static inline struct cbor_aio_req *
+cbor_aio_uring_reap(struct cbor_aio *aio)
+{
+	for ( ;; ) {
+		unsigned             head = *aio->cq_head;
+		struct io_uring_cqe *cqe;
+		struct cbor_aio_req *req;
+		int                  res;
+
+		/* The kernel owns the blocks in flight, so wait whatever it says. */
+		if ( head == __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE) ) {
+			if ( syscall(__NR_io_uring_enter, aio->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+			     errno != EINTR ) {
+				sched_yield();
+			}
+			continue;
+		}
+
+		cqe = &aio->cqes[head & *aio->cq_mask];
+		req = (struct cbor_aio_req *)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+
+		if ( res == -EINTR || res == -EAGAIN ) {
+			res = 0;
+		} else if ( res < 0 ) {
+			req->err = -res;
+			return req;
+		} else if ( res == 0 ) {
+			if ( req->write ) {
+				req->err = EIO;
+			}
+			return req;
+		}
+		req->moved += (size_t)res;
+		if ( req->moved == req->len ) {
+			return req;
+		}
+		if ( !cbor_aio_uring_submit(aio, req) ) {
+			return req;
+		}
+	}
+}
+#endif
+
+/* Use io_uring where the kernel offers it, threads otherwise. */
+static inline bool
+cbor_aio_init(struct cbor_aio *aio, unsigned depth)
+{
+	if ( depth == 0 ) {
+		return false;
+	}
+#ifdef CBOR_AIO_URING
+	if ( cbor_aio_init_uring(aio, depth) ) {
+		return true;
+	}
+#endif
+
+	return cbor_aio_init_threads(aio, depth, depth < CBOR_AIO_THREADS ? depth : CBOR_AIO_THREADS);
+}
+
+/*
+ * Start a request. Fails if depth requests are in flight already, or with
+ * req->err set if io_uring refuses it.
+ */
+static inline bool
+cbor_aio_submit(struct cbor_aio *aio, struct cbor_aio_req *req)
+{
+	if ( aio->inflight >= aio->depth ) {
+		return false;
+	}
+
+	req->done  = false;
+	req->moved = 0;
+	req->err   = 0;
+	req->next  = NULL;
+
+#ifdef CBOR_AIO_URING
+	if ( aio->uring ) {
+		if ( !cbor_aio_uring_submit(aio, req) ) {
+			req->done = true;
+			return false;
+		}
+		aio->inflight++;
+		return true;
+	}
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	if ( aio->queue == NULL ) {
+		aio->queue = req;
+	} else {
+		aio->queue_tail->next = req;
+	}
+	aio->queue_tail = req;
+	aio->inflight++;
+	pthread_cond_signal(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+
+	return true;
+}
+
+/* Wait for any request to complete. Returns NULL if none is in flight. */
+static inline struct cbor_aio_req *
+cbor_aio_wait(struct cbor_aio *aio)
+{
+	struct cbor_aio_req *req;
+
+	if ( aio->inflight == 0 ) {
+		return NULL;
+	}
+
+#ifdef CBOR_AIO_URING
+	if ( aio->uring ) {
+		if ( (req = cbor_aio_uring_reap(aio)) == NULL ) {
+			return NULL;
+		}
+		aio->inflight--;
+		req->done = true;
+		return req;
+	}
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	while ( aio->completed == NULL ) {
+		pthread_cond_wait(&aio->finished, &aio->lock);
+	}
+	req            = aio->completed;
+	aio->completed = req->next;
+	aio->inflight--;
+	pthread_mutex_unlock(&aio->lock);
+	req->done = true;
+
+	return req;
+}
+
+/* Wait until req completes, reaping whatever completes before it. */
+static inline bool
+cbor_aio_wait_for(struct cbor_aio *aio, struct cbor_aio_req *req)
+{
+	while ( !req->done ) {
+		if ( cbor_aio_wait(aio) == NULL ) {
+			return false;
+		}
+	}
+
+	return req->err == 0;
+}
+
+/* Submit req, first waiting for a slot if the engine is busy. */
+static inline bool
+cbor_aio_start(struct cbor_aio *aio, struct cbor_aio_req *req)
+{
+	while ( aio->inflight >= aio->depth ) {
+		if ( cbor_aio_wait(aio) == NULL ) {
+			return false;
+		}
+	}
+
+	return cbor_aio_submit(aio, req);
+}
+
+/* Requests still in flight must be waited for first. */
+static inline void
+cbor_aio_destroy(struct cbor_aio *aio)
+{
+#ifdef CBOR_AIO_URING
+	if ( aio->uring ) {
+		munmap(aio->sqes, aio->sqes_size);
+		if ( aio->cq_ring != aio->sq_ring ) {
+			munmap(aio->cq_ring, aio->cq_size);
+		}
+		munmap(aio->sq_ring, aio->sq_size);
+		close(aio->ring_fd);
+		return;
+	}
+#endif
+
+	pthread_mutex_lock(&aio->lock);
+	aio->stop = true;
+	pthread_cond_broadcast(&aio->work);
+	pthread_mutex_unlock(&aio->lock);
+	for ( unsigned i = 0; i < aio->nthreads; i++ ) {
+		pthread_join(aio->threads[i], NULL);
+	}
+	pthread_cond_destroy(&aio->finished);
+	pthread_cond_destroy(&aio->work);
+	pthread_mutex_destroy(&aio->lock);
+}
+
+static inline uint8_t *
+cbor_aio_alloc(size_t size)
+{
+	void *data;
+
+	return posix_memalign(&data, CBOR_AIO_ALIGN, size) == 0 ? data : NULL;
+}
+
+/*
+ * Double-buffered writer. Items are encoded into the struct cbor_buf from
+ * cbor_aio_writer_buf(); when an append fails for capacity, the caller
+ * moves on with cbor_aio_writer_next() and retries the append. Items may
+ * span blocks, the file is one sequence of bytes, but a single append has
+ * to fit a block: larger strings go out as a head and the payload passed
+ * to cbor_aio_writer_write(). A hash attached to the buffer carries over
+ * from block to block.
+ */
+struct cbor_aio_writer {
+	struct cbor_aio     *aio;
+	struct cbor_aio_req  reqs[2];
+	struct cbor_buf      buf;
+	size_t               block_size;
+	uint64_t             off;       /* where the current block goes */
+	unsigned             cur;
+	int                  err;
+};
+
+static inline bool
+cbor_aio_writer_init(struct cbor_aio_writer *writer, struct cbor_aio *aio, int fd, uint64_t off, size_t block_size)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->aio        = aio;
+	writer->block_size = block_size;
+	writer->off        = off;
+	for ( unsigned i = 0; i < 2; i++ ) {
+		writer->reqs[i].fd    = fd;
+		writer->reqs[i].write = true;
+		writer->reqs[i].done  = true;
+		if ( (writer->reqs[i].data = cbor_aio_alloc(block_size)) == NULL ) {
+			free(writer->reqs[0].data);
+			return false;
+		}
+	}
+	cbor_buf_init_empty(&writer->buf, writer->reqs[0].data, block_size);
+
+	return true;
+}
+
+static inline struct cbor_buf *
+cbor_aio_writer_buf(struct cbor_aio_writer *writer)
+{
+	return &writer->buf;
+}
+
+/*
+ * Submit the current block and continue in the other one, once its last
+ * write has completed. Fails with errno in writer->err.
+ */
+static inline bool
+cbor_aio_writer_next(struct cbor_aio_writer *writer)
+{
+	struct cbor_buf     *buf  = &writer->buf;
+	struct cbor_hash    *hash = buf->hash;
+	struct cbor_aio_req *req  = &writer->reqs[writer->cur];
+
+	if ( writer->err != 0 ) {
+		return false;
+	}
+
+	cbor_buf_hash_flush(buf);
+	if ( buf->len > 0 ) {
+		req->len = buf->len;
+		req->off = writer->off;
+		if ( !cbor_aio_start(writer->aio, req) ) {
+			writer->err = req->err != 0 ? req->err : EIO;
+			return false;
+		}
+		writer->off += buf->len;
+		writer->cur ^= 1;
+		req = &writer->reqs[writer->cur];
+	}
+
+	if ( !cbor_aio_wait_for(writer->aio, req) ) {
+		writer->err = req->err != 0 ? req->err : EIO;
+		return false;
+	}
+	cbor_buf_init_empty(buf, req->data, writer->block_size);
+	cbor_buf_set_hash(buf, hash);
+
+	return true;
+}
+
+/* Make sure the current block has room for size bytes. */
+static inline bool
+cbor_aio_writer_reserve(struct cbor_aio_writer *writer, size_t size)
+{
+	if ( size > writer->block_size ) {
+		return false;
+	}
+
+	return cbor_buf_space(&writer->buf) >= size || cbor_aio_writer_next(writer);
+}
+
+/* Append bytes that are encoded already, across blocks if needed. */
+static inline bool
+cbor_aio_writer_write(struct cbor_aio_writer *writer, const void *data, size_t len)
+{
+	const uint8_t   *from = data;
+	struct cbor_buf *buf  = &writer->buf;
+
+	while ( len > 0 ) {
+		size_t n = cbor_buf_space(buf);
+
+		if ( n == 0 ) {
+			if ( !cbor_aio_writer_next(writer) ) {
+				return false;
+			}
+			continue;
+		}
+		n = n < len ? n : len;
+		memcpy(buf->data + buf->len, from, n);
+		buf->len += n;
+		cbor_buf_hash(buf);
+		from += n;
+		len  -= n;
+	}
+
+	return true;
+}
+
+/* Write out the last block and wait for all writes. Returns the status. */
+static inline bool
+cbor_aio_writer_finish(struct cbor_aio_writer *writer)
+{
+	bool ok = cbor_aio_writer_next(writer);
+
+	for ( unsigned i = 0; i < 2; i++ ) {
+		if ( !cbor_aio_wait_for(writer->aio, &writer->reqs[i]) && writer->err == 0 ) {
+			writer->err = writer->reqs[i].err != 0 ? writer->reqs[i].err : EIO;
+		}
+	}
+
+	return ok && writer->err == 0;
+}
+
+/* Writes in flight must be finished first. */
+static inline void
+cbor_aio_writer_destroy(struct cbor_aio_writer *writer)
+{
+	free(writer->reqs[0].data);
+	free(writer->reqs[1].data);
+}
+
+/*
+ * Block reader. cbor_aio_reader_next() returns a view of data to decode:
+ * the rest of a block, or an item that spans blocks put together in the
+ * carry area. The caller decodes items from the view until it ends or an
+ * item is cut off, with CBOR_ERR_TRUNCATED, and then asks for the next
+ * view with the index back at the start of that item; the bytes left over
+ * lead the next view. cbor_aio_reader_item() does this one item at a time.
+ */
+struct cbor_aio_reader {
+	struct cbor_aio     *aio;
+	struct cbor_aio_req  reqs[CBOR_AIO_MAX_BLOCKS];
+	unsigned             nblocks;
+	unsigned             head;      /* block read next, in file order */
+	bool                 holding;   /* the view or carry uses reqs[head] */
+	size_t               used;      /* bytes of reqs[head] handed out */
+	size_t               block_size;
+	uint64_t             off;       /* where the next block is read from */
+	bool                 eof;
+
+	uint8_t             *carry;
+	size_t               carry_len;
+	size_t               carry_cap;
+
+	struct cbor_buf      view;
+	int                  err;       /* errno, or 0 for a CBOR error in view */
+};
+
+static inline void cbor_aio_reader_destroy(struct cbor_aio_reader *reader);
+
+/* Read block i from the next offset, unless the end has been seen. */
+static inline bool
+cbor_aio_reader_fill(struct cbor_aio_reader *reader, unsigned i)
+{
+	struct cbor_aio_req *req = &reader->reqs[i];
+
+	req->len = reader->block_size;
+	req->off = reader->off;
+	if ( reader->eof ) {
+		req->moved = 0;
+		req->done  = true;
+		return true;
+	}
+	if ( !cbor_aio_start(reader->aio, req) ) {
+		reader->err = req->err != 0 ? req->err : EIO;
+		return false;
+	}
+	reader->off += reader->block_size;
+
+	return true;
+}
+
+static inline bool
+cbor_aio_reader_init(struct cbor_aio_reader *reader, struct cbor_aio *aio, int fd, uint64_t off,
+                     size_t block_size, unsigned nblocks)
+{
+	if ( nblocks == 0 || nblocks > CBOR_AIO_MAX_BLOCKS || block_size == 0 ) {
+		return false;
+	}
+
+	memset(reader, 0, sizeof(*reader));
+	reader->aio        = aio;
+	reader->nblocks    = nblocks;
+	reader->block_size = block_size;
+	reader->off        = off;
+	for ( unsigned i = 0; i < nblocks; i++ ) {
+		reader->reqs[i].fd   = fd;
+		reader->reqs[i].done = true;
+		if ( (reader->reqs[i].data = cbor_aio_alloc(block_size)) == NULL ) {
+			while ( i-- > 0 ) {
+				free(reader->reqs[i].data);
+			}
+			return false;
+		}
+	}
+	for ( unsigned i = 0; i < nblocks; i++ ) {
+		if ( !cbor_aio_reader_fill(reader, i) ) {
+			cbor_aio_reader_destroy(reader);
+			return false;
+		}
+	}
+	cbor_buf_init(&reader->view, NULL, 0, 0);
+
+	return true;
+}
+
+/* Hand back the block at head for the read after the last one. */
+static inline bool
+cbor_aio_reader_release(struct cbor_aio_reader *reader)
+{
+	unsigned head = reader->head;
+
+	reader->holding = false;
+	reader->used    = 0;
+	reader->head    = (head + 1) % reader->nblocks;
+
+	return cbor_aio_reader_fill(reader, head);
+}
+
+/* Wait for the block at head. Returns false at the end of the file. */
+static inline bool
+cbor_aio_reader_take(struct cbor_aio_reader *reader)
+{
+	struct cbor_aio_req *req = &reader->reqs[reader->head];
+
+	if ( !cbor_aio_wait_for(reader->aio, req) ) {
+		reader->err = req->err != 0 ? req->err : EIO;
+		return false;
+	}
+	if ( req->moved < req->len ) {
+		reader->eof = true;
+	}
+	if ( req->moved == 0 ) {
+		return false;
+	}
+	reader->holding = true;
+	reader->used    = 0;
+
+	return true;
+}
+
+static inline bool
+cbor_aio_reader_carry(struct cbor_aio_reader *reader, const uint8_t *data, size_t len)
+{
+	if ( reader->carry_len + len > reader->carry_cap ) {
+		size_t   cap = reader->carry_cap > 0 ? reader->carry_cap : 4096;
+		uint8_t *carry;
+
+		while ( cap < reader->carry_len + len ) {
+			cap *= 2;
+		}
+		if ( cap > CBOR_AIO_MAX_ITEM ) {
+			cbor_buf_fail(&reader->view, CBOR_ERR_LIMIT, CBOR_MAJOR_ANY);
+			return false;
+		}
+		if ( (carry = realloc(reader->carry, cap)) == NULL ) {
+			reader->err = ENOMEM;
+			return false;
+		}
+		reader->carry     = carry;
+		reader->carry_cap = cap;
+	}
+	memmove(reader->carry + reader->carry_len, data, len);
+	reader->carry_len += len;
+
+	return true;
+}
+
+/*
+ * Move on to the next view. Returns false at the end of the file, with
+ * reader->err set on an I/O error, or an error in the view for an item cut
+ * off by the end of the file.
+ */
+static inline bool
+cbor_aio_reader_next(struct cbor_aio_reader *reader)
+{
+	struct cbor_buf *view = &reader->view;
+	size_t           rest = view->len - view->idx;
+	uint8_t         *block;
+	size_t           len;
+
+	if ( reader->err != 0 ) {
+		return false;
+	}
+
+	/* Whatever the decoder left over leads the next view. */
+	if ( view->data != NULL && view->data == reader->carry ) {
+		memmove(reader->carry, reader->carry + view->idx, rest);
+		reader->carry_len = rest;
+	} else if ( view->data != NULL ) {
+		reader->carry_len = 0;
+		if ( !cbor_aio_reader_carry(reader, view->data + view->idx, rest) ||
+		     !cbor_aio_reader_release(reader) ) {
+			return false;
+		}
+	}
+	cbor_buf_init(view, NULL, 0, 0);
+
+	for ( ;; ) {
+		if ( !reader->holding || reader->used == reader->reqs[reader->head].moved ) {
+			if ( reader->holding && !cbor_aio_reader_release(reader) ) {
+				return false;
+			}
+			if ( !cbor_aio_reader_take(reader) ) {
+				if ( reader->err == 0 && reader->carry_len > 0 ) {
+					cbor_buf_init(view, reader->carry, reader->carry_len, reader->carry_len);
+					cbor_skip_item(view);
+				}
+				return false;
+			}
+		}
+
+		block = reader->reqs[reader->head].data + reader->used;
+		len   = reader->reqs[reader->head].moved - reader->used;
+
+		if ( reader->carry_len == 0 ) {
+			cbor_buf_init(view, block, len, len);
+			reader->used += len;
+			return true;
+		}
+
+		/*
+		 * Complete the item in the carry area, taking as many bytes again
+		 * as it holds so every retry of the skip covers twice as much.
+		 */
+		size_t take = reader->carry_len < len ? reader->carry_len : len;
+
+		if ( !cbor_aio_reader_carry(reader, block, take) ) {
+			return false;
+		}
+		reader->used += take;
+
+		cbor_buf_init(view, reader->carry, reader->carry_len, reader->carry_len);
+		if ( cbor_skip_item(view) || cbor_buf_error(view) != CBOR_ERR_TRUNCATED ) {
+			/* Bytes past the item go back to the block. */
+			size_t end = cbor_buf_error(view) == CBOR_OK ? cbor_buf_index(view) : reader->carry_len;
+
+			reader->used     -= reader->carry_len - end;
+			reader->carry_len = end;
+			cbor_buf_init(view, reader->carry, end, end);
+			return true;
+		}
+	}
+}
+
+/* The next complete item, pointing into the reader until the next call. */
+static inline bool
+cbor_aio_reader_item(struct cbor_aio_reader *reader, struct cbor_buf *item)
+{
+	struct cbor_buf *view = &reader->view;
+
+	for ( ;; ) {
+		size_t start = view->idx;
+
+		if ( start < view->len ) {
+			if ( cbor_skip_item(view) ) {
+				cbor_buf_init(item, view->data + start, view->idx - start, view->idx - start);
+				return true;
+			}
+			if ( cbor_buf_error(view) != CBOR_ERR_TRUNCATED ) {
+				return false;
+			}
+			cbor_buf_clear_error(view);
+		}
+		if ( !cbor_aio_reader_next(reader) ) {
+			return false;
+		}
+	}
+}
+
+/* Waits for the reads still in flight. */
+static inline void
+cbor_aio_reader_destroy(struct cbor_aio_reader *reader)
+{
+	for ( unsigned i = 0; i < reader->nblocks; i++ ) {
+		cbor_aio_wait_for(reader->aio, &reader->reqs[i]);
+		free(reader->reqs[i].data);
+	}
+	free(reader->carry);
+}
+
+#endif /* LIBCBOR_CBOR_AIO_H */
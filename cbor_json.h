@@ -0,0 +1,1506 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_JSON_H
+#define LIBCBOR_CBOR_JSON_H
+
+#include "cbor.h"
+
+#include <locale.h>
+
+/*
+ * Streaming CBOR <-> JSON transcoding between two struct cbor_buf. Both
+ * directions make a single pass over the input and write the output as they
+ * go; no tree is built.
+ *
+ * CBOR -> JSON follows RFC 8949 section 6.1: byte strings become base64url
+ * strings, tags are dropped, undefined and non-finite floats become null and
+ * scalar map keys are quoted. Floats are printed with Grisu2, which yields
+ * the shortest digits that round-trip in all but rare cases and never more
+ * than 17 digits.
+ *
+ * JSON -> CBOR writes definite length arrays and maps, back-patching the head
+ * once the element count is known. Integers that fit become major type 0 or
+ * 1, everything else a float, narrowed to single precision when exact.
+ * Numbers are converted the same way under any locale. While a container is
+ * open the output takes 8 bytes more than the final encoding, and up to 8
+ * more for every closed one with over CBOR_JSON_MOVE bytes of content, so
+ * out needs some room to spare beyond the result.
+ *
+ * Input errors are recorded in the input buffer, CBOR_ERR_CAPACITY in the
+ * output buffer. On failure both cursors are restored.
+ */
+
+static inline uint8_t *
+cbor_json_reserve(struct cbor_buf *out, size_t size)
+{
+	if ( out->cap - out->len < size ) {
+		cbor_buf_full(out);
+		return NULL;
+	}
+
+	return out->data + out->len;
+}
+
+static inline bool
+cbor_json_put(struct cbor_buf *out, const void *data, size_t size)
+{
+	uint8_t *dst = cbor_json_reserve(out, size);
+
+	if ( dst == NULL ) {
+		return false;
+	}
+	memcpy(dst, data, size);
+	out->len += size;
+
+	return true;
+}
+
+static inline bool
+cbor_json_put_byte(struct cbor_buf *out, uint8_t byte)
+{
+	uint8_t *dst = cbor_json_reserve(out, 1);
+
+	if ( dst == NULL ) {
+		return false;
+	}
+	*dst      = byte;
+	out->len += 1;
+
+	return true;
+}
+
+/* Two digits per division. Writes at most 20 characters. */
+static inline size_t
+cbor_json_format_u64(char *dst, uint64_t value)
+{
+	static const char digits[] =
+		"00010203040506070809101112131415161718192021222324"
+		"25262728293031323334353637383940414243444546474849"
+		"50515253545556575859606162636465666768697071727374"
+		"75767778798081828384858687888990919293949596979899";
+	char  tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	while ( value >= 100 ) {
+		size_t r = (size_t)(value % 100) * 2;
+
+		value /= 100;
+		p     -= 2;
+		memcpy(p, digits + r, 2);
+	}
+	if ( value >= 10 ) {
+		p -= 2;
+		memcpy(p, digits + value * 2, 2);
+	} else {
+		*--p = (char)('0' + value);
+	}
+
+	size_t len = (size_t)(tmp + sizeof(tmp) - p);
+
+	memcpy(dst, p, len);
+
+	return len;
+}
+
+/*
+ * Grisu2 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately
+ * with Integers", 2010) on a 64 bit significand with 128 bit products.
+ */
+struct cbor_json_fp {
+	uint64_t f;
+	int      e;
+};
+
+static inline struct cbor_json_fp
+cbor_json_fp_mul(struct cbor_json_fp x, struct cbor_json_fp y)
+{
+	uint128_t           p = (uint128_t)x.f * y.f + ((uint128_t)1 << 63);
+	struct cbor_json_fp r = { (uint64_t)(p >> 64), x.e + y.e + 64 };
+
+	return r;
+}
+
+static inline struct cbor_json_fp
+cbor_json_fp_normalize(struct cbor_json_fp x)
+{
+#ifdef __GNUC__
+	int shift = __builtin_clzll(x.f);
+
+	x.f <<= shift;
+	x.e  -= shift;
+#else
+	while ( (x.f >> 63) == 0 ) {
+		x.f <<= 1;
+		x.e  -= 1;
+	}
+#endif
+
+	return x;
+}
+
+/* Cached 10^k, k = -300 .. 324 in steps of 8, as normalized f * 2^e. */
+static inline struct cbor_json_fp
+cbor_json_cached_power(int e, int *k)
+{
+	static const struct {
+		uint64_t f;
+		int16_t  e;
+		int16_t  k;
+	} powers[] = {
+		{ 0xAB70FE17C79AC6CAull, -1060, -300 },
+		{ 0xFF77B1FCBEBCDC4Full, -1034, -292 },
+		{ 0xBE5691EF416BD60Cull, -1007, -284 },
+		{ 0x8DD01FAD907FFC3Cull,  -980, -276 },
+		{ 0xD3515C2831559A83ull,  -954, -268 },
+		{ 0x9D71AC8FADA6C9B5ull,  -927, -260 },
+		{ 0xEA9C227723EE8BCBull,  -901, -252 },
+		{ 0xAECC49914078536Dull,  -874, -244 },
+		{ 0x823C12795DB6CE57ull,  -847, -236 },
+		{ 0xC21094364DFB5637ull,  -821, -228 },
+		{ 0x9096EA6F3848984Full,  -794, -220 },
+		{ 0xD77485CB25823AC7ull,  -768, -212 },
+		{ 0xA086CFCD97BF97F4ull,  -741, -204 },
+		{ 0xEF340A98172AACE5ull,  -715, -196 },
+		{ 0xB23867FB2A35B28Eull,  -688, -188 },
+		{ 0x84C8D4DFD2C63F3Bull,  -661, -180 },
+		{ 0xC5DD44271AD3CDBAull,  -635, -172 },
+		{ 0x936B9FCEBB25C996ull,  -608, -164 },
+		{ 0xDBAC6C247D62A584ull,  -582, -156 },
+		{ 0xA3AB66580D5FDAF6ull,  -555, -148 },
+		{ 0xF3E2F893DEC3F126ull,  -529, -140 },
+		{ 0xB5B5ADA8AAFF80B8ull,  -502, -132 },
+		{ 0x87625F056C7C4A8Bull,  -475, -124 },
+		{ 0xC9BCFF6034C13053ull,  -449, -116 },
+		{ 0x964E858C91BA2655ull,  -422, -108 },
+		{ 0xDFF9772470297EBDull,  -396, -100 },
+		{ 0xA6DFBD9FB8E5B88Full,  -369,  -92 },
+		{ 0xF8A95FCF88747D94ull,  -343,  -84 },
+		{ 0xB94470938FA89BCFull,  -316,  -76 },
+		{ 0x8A08F0F8BF0F156Bull,  -289,  -68 },
+		{ 0xCDB02555653131B6ull,  -263,  -60 },
+		{ 0x993FE2C6D07B7FACull,  -236,  -52 },
+		{ 0xE45C10C42A2B3B06ull,  -210,  -44 },
+		{ 0xAA242499697392D3ull,  -183,  -36 },
+		{ 0xFD87B5F28300CA0Eull,  -157,  -28 },
+		{ 0xBCE5086492111AEBull,  -130,  -20 },
+		{ 0x8CBCCC096F5088CCull,  -103,  -12 },
+		{ 0xD1B71758E219652Cull,   -77,   -4 },
+		{ 0x9C40000000000000ull,   -50,    4 },
+		{ 0xE8D4A51000000000ull,   -24,   12 },
+		{ 0xAD78EBC5AC620000ull,     3,   20 },
+		{ 0x813F3978F8940984ull,    30,   28 },
+		{ 0xC097CE7BC90715B3ull,    56,   36 },
+		{ 0x8F7E32CE7BEA5C70ull,    83,   44 },
+		{ 0xD5D238A4ABE98068ull,   109,   52 },
+		{ 0x9F4F2726179A2245ull,   136,   60 },
+		{ 0xED63A231D4C4FB27ull,   162,   68 },
+		{ 0xB0DE65388CC8ADA8ull,   189,   76 },
+		{ 0x83C7088E1AAB65DBull,   216,   84 },
+		{ 0xC45D1DF942711D9Aull,   242,   92 },
+		{ 0x924D692CA61BE758ull,   269,  100 },
+		{ 0xDA01EE641A708DEAull,   295,  108 },
+		{ 0xA26DA3999AEF774Aull,   322,  116 },
+		{ 0xF209787BB47D6B85ull,   348,  124 },
+		{ 0xB454E4A179DD1877ull,   375,  132 },
+		{ 0x865B86925B9BC5C2ull,   402,  140 },
+		{ 0xC83553C5C8965D3Dull,   428,  148 },
+		{ 0x952AB45CFA97A0B3ull,   455,  156 },
+		{ 0xDE469FBD99A05FE3ull,   481,  164 },
+		{ 0xA59BC234DB398C25ull,   508,  172 },
+		{ 0xF6C69A72A3989F5Cull,   534,  180 },
+		{ 0xB7DCBF5354E9BECEull,   561,  188 },
+		{ 0x88FCF317F22241E2ull,   588,  196 },
+		{ 0xCC20CE9BD35C78A5ull,   614,  204 },
+		{ 0x98165AF37B2153DFull,   641,  212 },
+		{ 0xE2A0B5DC971F303Aull,   667,  220 },
+		{ 0xA8D9D1535CE3B396ull,   694,  228 },
+		{ 0xFB9B7CD9A4A7443Cull,   720,  236 },
+		{ 0xBB764C4CA7A44410ull,   747,  244 },
+		{ 0x8BAB8EEFB6409C1Aull,   774,  252 },
+		{ 0xD01FEF10A657842Cull,   800,  260 },
+		{ 0x9B10A4E5E9913129ull,   827,  268 },
+		{ 0xE7109BFBA19C0C9Dull,   853,  276 },
+		{ 0xAC2820D9623BF429ull,   880,  284 },
+		{ 0x80444B5E7AA7CF85ull,   907,  292 },
+		{ 0xBF21E44003ACDD2Dull,   933,  300 },
+		{ 0x8E679C2F5E44FF8Full,   960,  308 },
+		{ 0xD433179D9C8CB841ull,   986,  316 },
+		{ 0x9E19DB92B4E31BA9ull,  1013,  324 },
+	};
+	int f = -60 - e - 1;
+	int n = (f * 78913) / (1 << 18) + (f > 0);
+	int i = (300 + n + 7) / 8;
+
+	struct cbor_json_fp c = { powers[i].f, powers[i].e };
+
+	*k = powers[i].k;
+
+	return c;
+}
+
+static inline void
+cbor_json_grisu_round(char *digits, int len, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k)
+{
+	while ( rest < dist && delta - rest >= ten_k &&
+	        (rest + ten_k < dist || dist - rest > rest + ten_k - dist) ) {
+		digits[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+static inline int
+cbor_json_grisu_digits(char *digits, int *exponent, struct cbor_json_fp minus,
+                       struct cbor_json_fp w, struct cbor_json_fp plus)
+{
+	uint64_t delta = plus.f - minus.f;
+	uint64_t dist  = plus.f - w.f;
+	int      shift = -plus.e;
+	uint64_t one   = (uint64_t)1 << shift;
+	uint32_t p1    = (uint32_t)(plus.f >> shift);
+	uint64_t p2    = plus.f & (one - 1);
+	uint32_t pow10 = 1;
+	int      n     = 1;
+	int      len   = 0;
+
+	while ( n < 10 && p1 / pow10 >= 10 ) {
+		pow10 *= 10;
+		n++;
+	}
+
+	while ( n > 0 ) {
+		digits[len++] = (char)('0' + p1 / pow10);
+		p1           %= pow10;
+		n--;
+
+		uint64_t rest = ((uint64_t)p1 << shift) + p2;
+
+		if ( rest <= delta ) {
+			*exponent += n;
+			cbor_json_grisu_round(digits, len, dist, delta, rest, (uint64_t)pow10 << shift);
+			return len;
+		}
+		pow10 /= 10;
+	}
+
+	for ( ;; ) {
+		p2    *= 10;
+		delta *= 10;
+		dist  *= 10;
+		digits[len++] = (char)('0' + (p2 >> shift));
+		p2           &= one - 1;
+		*exponent    -= 1;
+
+		if ( p2 <= delta ) {
+			break;
+		}
+	}
+	cbor_json_grisu_round(digits, len, dist, delta, p2, one);
+
+	return len;
+}
+
+/*
+ * Digits and decimal exponent of a positive, finite binary float given by
+ * its bits without the sign and its significand and exponent widths, so
+ * half, single and double precision each get their own shortest output.
+ */
+static inline int
+cbor_json_grisu(char *digits, int *exponent, uint64_t bits, int mant_bits, int exp_bits)
+{
+	int      bias     = (1 << (exp_bits - 1)) - 1 + mant_bits;
+	uint64_t fraction = bits & (((uint64_t)1 << mant_bits) - 1);
+	int      biased   = (int)(bits >> mant_bits);
+	int      k;
+
+	struct cbor_json_fp v;
+	struct cbor_json_fp plus;
+	struct cbor_json_fp minus;
+
+	if ( biased == 0 ) {
+		v.f = fraction;
+		v.e = 1 - bias;
+	} else {
+		v.f = fraction + ((uint64_t)1 << mant_bits);
+		v.e = biased - bias;
+	}
+
+	/* Boundaries halfway to the neighbouring floats. */
+	plus.f = 2 * v.f + 1;
+	plus.e = v.e - 1;
+	if ( fraction == 0 && biased > 1 ) {
+		minus.f = 4 * v.f - 1;
+		minus.e = v.e - 2;
+	} else {
+		minus.f = 2 * v.f - 1;
+		minus.e = v.e - 1;
+	}
+	plus     = cbor_json_fp_normalize(plus);
+	minus.f <<= minus.e - plus.e;
+	minus.e  = plus.e;
+	v        = cbor_json_fp_normalize(v);
+
+	struct cbor_json_fp c = cbor_json_cached_power(plus.e, &k);
+
+	v      = cbor_json_fp_mul(v, c);
+	minus  = cbor_json_fp_mul(minus, c);
+	plus   = cbor_json_fp_mul(plus, c);
+
+	minus.f += 1;
+	plus.f  -= 1;
+
+	*exponent = -k;
+
+	return cbor_json_grisu_digits(digits, exponent, minus, v, plus);
+}
+
+/*
+ * Print a binary float as a JSON number: plain notation for decimal
+ * exponents -4 .. 15, scientific otherwise. Integral values keep a ".0" so
+ * they come back as floats. Non-finite values have no JSON form and are
+ * written as null.
+ */
+static inline bool
+cbor_json_put_float(struct cbor_buf *out, uint64_t bits, int mant_bits, int exp_bits)
+{
+	uint64_t exp_mask = ((uint64_t)1 << exp_bits) - 1;
+	bool     negative = (bits >> (mant_bits + exp_bits)) & 1;
+	char     text[32];
+	char    *digits   = text + negative;
+	int      exponent;
+	int      len;
+	size_t   size;
+
+	bits &= ((uint64_t)1 << (mant_bits + exp_bits)) - 1;
+
+	if ( (bits >> mant_bits) == exp_mask ) {
+		return cbor_json_put(out, "null", 4);
+	}
+
+	text[0] = '-';
+	if ( bits == 0 ) {
+		memcpy(digits, "0.0", 3);
+		return cbor_json_put(out, text, (size_t)negative + 3);
+	}
+
+	len = cbor_json_grisu(digits, &exponent, bits, mant_bits, exp_bits);
+
+	int point = len + exponent;
+
+	if ( len <= point && point <= 15 ) {
+		/* digits000.0 */
+		memset(digits + len, '0', (size_t)(point - len));
+		digits[point]     = '.';
+		digits[point + 1] = '0';
+		size = (size_t)point + 2;
+	} else if ( 0 < point && point <= 15 ) {
+		/* dig.its */
+		memmove(digits + point + 1, digits + point, (size_t)(len - point));
+		digits[point] = '.';
+		size = (size_t)len + 1;
+	} else if ( -4 < point && point <= 0 ) {
+		/* 0.000digits */
+		memmove(digits + 2 - point, digits, (size_t)len);
+		digits[0] = '0';
+		digits[1] = '.';
+		memset(digits + 2, '0', (size_t)-point);
+		size = (size_t)(2 - point + len);
+	} else {
+		/* d.igitse-123 */
+		int e = point - 1;
+
+		if ( len > 1 ) {
+			memmove(digits + 2, digits + 1, (size_t)(len - 1));
+			digits[1] = '.';
+			len++;
+		}
+		digits[len++] = 'e';
+		if ( e < 0 ) {
+			digits[len++] = '-';
+			e = -e;
+		}
+		len += (int)cbor_json_format_u64(digits + len, (uint64_t)e);
+		size = (size_t)len;
+	}
+
+	return cbor_json_put(out, text, (size_t)negative + size);
+}
+
+static inline bool
+cbor_json_put_u64(struct cbor_buf *out, uint64_t value)
+{
+	uint8_t *dst = cbor_json_reserve(out, 20);
+
+	if ( dst == NULL ) {
+		return false;
+	}
+	out->len += cbor_json_format_u64((char *)dst, value);
+
+	return true;
+}
+
+/* CBOR negative integers reach -2^64, one past what a uint64_t holds. */
+static inline bool
+cbor_json_put_negative(struct cbor_buf *out, uint64_t biased)
+{
+	if ( biased == UINT64_MAX ) {
+		return cbor_json_put(out, "-18446744073709551616", 21);
+	}
+
+	return cbor_json_put_byte(out, '-') && cbor_json_put_u64(out, biased + 1);
+}
+
+/*
+ * Test eight bytes at once for '"', '\\' and control characters, the bytes
+ * that need escaping in a JSON string. Exact for "any byte matches".
+ */
+static inline bool
+cbor_json_word_special(uint64_t x)
+{
+	const uint64_t ones  = 0x0101010101010101ull;
+	const uint64_t highs = 0x8080808080808080ull;
+	uint64_t       quote = x ^ (ones * '"');
+	uint64_t       slash = x ^ (ones * '\\');
+
+	uint64_t control = (x - ones * 0x20) & ~x;
+	uint64_t quotes  = (quote - ones) & ~quote;
+	uint64_t slashes = (slash - ones) & ~slash;
+
+	return ((control | quotes | slashes) & highs) != 0;
+}
+
+static inline bool
+cbor_json_byte_special(uint8_t byte)
+{
+	return byte < 0x20 || byte == '"' || byte == '\\';
+}
+
+/* Length of the prefix of data that needs no escaping. */
+static inline size_t
+cbor_json_plain_span(const uint8_t *data, size_t len)
+{
+	size_t i = 0;
+
+	while ( len - i >= sizeof(uint64_t) ) {
+		uint64_t word;
+
+		memcpy(&word, data + i, sizeof(word));
+		if ( cbor_json_word_special(word) ) {
+			break;
+		}
+		i += sizeof(word);
+	}
+	while ( i < len && !cbor_json_byte_special(data[i]) ) {
+		i++;
+	}
+
+	return i;
+}
+
+static inline bool
+cbor_json_put_escaped(struct cbor_buf *out, const uint8_t *data, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t            i     = 0;
+
+	while ( i < len ) {
+		size_t span = cbor_json_plain_span(data + i, len - i);
+
+		if ( !cbor_json_put(out, data + i, span) ) {
+			return false;
+		}
+		i += span;
+		if ( i == len ) {
+			break;
+		}
+
+		uint8_t byte = data[i++];
+		char    esc[6] = { '\\', 0, '0', '0', 0, 0 };
+		size_t  size   = 2;
+
+		switch ( byte ) {
+			case '"':  esc[1] = '"';  break;
+			case '\\': esc[1] = '\\'; break;
+			case '\b': esc[1] = 'b';  break;
+			case '\f': esc[1] = 'f';  break;
+			case '\n': esc[1] = 'n';  break;
+			case '\r': esc[1] = 'r';  break;
+			case '\t': esc[1] = 't';  break;
+			default:
+				esc[1] = 'u';
+				esc[4] = hex[byte >> 4];
+				esc[5] = hex[byte & 0xf];
+				size   = 6;
+				break;
+		}
+		if ( !cbor_json_put(out, esc, size) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Unpadded base64url, carried across the chunks of indefinite strings. */
+struct cbor_json_base64 {
+	uint8_t carry[2];
+	size_t  count;
+};
+
+static inline void
+cbor_json_base64_group(char *dst, const uint8_t *src, size_t size)
+{
+	static const char alphabet[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	uint32_t group = (uint32_t)src[0] << 16;
+
+	if ( size > 1 ) {
+		group |= (uint32_t)src[1] << 8;
+	}
+	if ( size > 2 ) {
+		group |= (uint32_t)src[2];
+	}
+
+	dst[0] = alphabet[(group >> 18) & 0x3f];
+	dst[1] = alphabet[(group >> 12) & 0x3f];
+	dst[2] = alphabet[(group >>  6) & 0x3f];
+	dst[3] = alphabet[(group      ) & 0x3f];
+}
+
+static inline bool
+cbor_json_base64_update(struct cbor_buf *out, struct cbor_json_base64 *state, const uint8_t *data, size_t len)
+{
+	uint8_t group[3];
+	char   *dst;
+
+	while ( state->count > 0 && len > 0 ) {
+		if ( state->count == 2 ) {
+			group[0] = state->carry[0];
+			group[1] = state->carry[1];
+			group[2] = *data++;
+			len--;
+			if ( (dst = (char *)cbor_json_reserve(out, 4)) == NULL ) {
+				return false;
+			}
+			cbor_json_base64_group(dst, group, 3);
+			out->len    += 4;
+			state->count = 0;
+		} else {
+			state->carry[1] = *data++;
+			len--;
+			state->count = 2;
+		}
+	}
+
+	size_t groups = len / 3;
+
+	if ( (dst = (char *)cbor_json_reserve(out, groups * 4)) == NULL ) {
+		return false;
+	}
+	for ( size_t i = 0; i < groups; i++ ) {
+		cbor_json_base64_group(dst + i * 4, data + i * 3, 3);
+	}
+	out->len += groups * 4;
+	data     += groups * 3;
+	len      -= groups * 3;
+
+	/* Bytes are only carried over once the carry is empty. */
+	if ( len > 0 ) {
+		state->carry[0] = data[0];
+		if ( len > 1 ) {
+			state->carry[1] = data[1];
+		}
+		state->count = len;
+	}
+
+	return true;
+}
+
+static inline bool
+cbor_json_base64_final(struct cbor_buf *out, struct cbor_json_base64 *state)
+{
+	uint8_t group[3] = { state->carry[0], state->carry[1], 0 };
+	char    text[4];
+
+	if ( state->count == 0 ) {
+		return true;
+	}
+	cbor_json_base64_group(text, group, state->count);
+
+	return cbor_json_put(out, text, state->count + 1);
+}
+
+struct cbor_json_level {
+	uint64_t remaining;     /* definite: items left */
+	uint64_t count;         /* items written so far */
+	uint8_t  major;
+	bool     indefinite;
+};
+
+static inline bool
+cbor_json_close(struct cbor_buf *out, struct cbor_json_level *level, struct cbor_json_base64 *base64)
+{
+	switch ( level->major ) {
+		case CBOR_MAJOR_ARRAY:
+			return cbor_json_put_byte(out, ']');
+		case CBOR_MAJOR_MAP:
+			return cbor_json_put_byte(out, '}');
+		case CBOR_MAJOR_BYTES:
+			return cbor_json_base64_final(out, base64) && cbor_json_put_byte(out, '"');
+		default:
+			return cbor_json_put_byte(out, '"');
+	}
+}
+
+static inline bool
+cbor_json_put_simple(struct cbor_buf *out, struct cbor_head *head)
+{
+	switch ( head->size ) {
+		case 3:
+			return cbor_json_put_float(out, head->arg, 10, 5);
+		case 5:
+			return cbor_json_put_float(out, head->arg, 23, 8);
+		case 9:
+			return cbor_json_put_float(out, head->arg, 52, 11);
+		default:
+			break;
+	}
+
+	switch ( head->initial ) {
+		case 0xf4:
+			return cbor_json_put(out, "false", 5);
+		case 0xf5:
+			return cbor_json_put(out, "true", 4);
+		default:
+			return cbor_json_put(out, "null", 4);
+	}
+}
+
+/*
+ * Transcode the data item at the input cursor to JSON appended to out.
+ */
+static inline bool
+cbor_to_json(struct cbor_buf *in, struct cbor_buf *out)
+{
+	struct cbor_json_level    stack[CBOR_MAX_DEPTH];
+	struct cbor_json_base64   base64    = { { 0, 0 }, 0 };
+	const struct cbor_limits *limits    = in->limits;
+	size_t                    max_depth = CBOR_MAX_DEPTH;
+	size_t                    depth     = 0;
+	size_t                    start     = in->idx;
+	size_t                    mark      = out->len;
+	struct cbor_hash         *hash      = out->hash;
+	bool                      tagged    = false;
+	struct cbor_head          head;
+
+	if ( limits != NULL && limits->max_depth < max_depth ) {
+		max_depth = limits->max_depth;
+	}
+
+	/* Output is written and patched in place, it is hashed once complete. */
+	cbor_buf_hash_flush(out);
+	out->hash = NULL;
+
+	for ( ;; ) {
+		struct cbor_json_level *top  = depth > 0 ? &stack[depth - 1] : NULL;
+		size_t                  item = in->idx;
+		bool                    key;
+
+		if ( !cbor_read_head(in, &head) ) {
+			goto fail;
+		}
+
+		if ( head.initial == 0xff ) {
+			if ( tagged || top == NULL || !top->indefinite ||
+			     (top->major == CBOR_MAJOR_MAP && top->count % 2 != 0) ) {
+				in->idx = item;
+				cbor_buf_fail(in, CBOR_ERR_TYPE, CBOR_MAJOR_ANY);
+				goto fail;
+			}
+			if ( !cbor_json_close(out, top, &base64) ) {
+				goto fail;
+			}
+			depth--;
+			goto complete;
+		}
+
+		/* Chunks of an indefinite length string. */
+		if ( top != NULL && top->indefinite &&
+		     (top->major == CBOR_MAJOR_BYTES || top->major == CBOR_MAJOR_TEXT) ) {
+			if ( head.major != top->major || head.indefinite ) {
+				in->idx = item;
+				cbor_buf_fail(in, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(top->major));
+				goto fail;
+			}
+			if ( !cbor_check_string(in, head.arg, item) ) {
+				goto fail;
+			}
+
+			uint8_t *chunk = in->data + in->idx;
+
+			in->idx += (size_t)head.arg;
+			if ( top->major == CBOR_MAJOR_TEXT ?
+			     !cbor_json_put_escaped(out, chunk, (size_t)head.arg) :
+			     !cbor_json_base64_update(out, &base64, chunk, (size_t)head.arg) ) {
+				goto fail;
+			}
+			continue;
+		}
+
+		key = top != NULL && top->major == CBOR_MAJOR_MAP && top->count % 2 == 0;
+
+		if ( !tagged && top != NULL && top->count > 0 ) {
+			if ( !cbor_json_put_byte(out, key ? ',' : (top->major == CBOR_MAJOR_MAP ? ':' : ',')) ) {
+				goto fail;
+			}
+		}
+		tagged = false;
+
+		if ( key && (head.major == CBOR_MAJOR_ARRAY || head.major == CBOR_MAJOR_MAP) ) {
+			in->idx = item;
+			cbor_buf_fail(in, CBOR_ERR_TYPE,
+			              CBOR_MAJOR_ANY & ~(CBOR_MAJOR_BIT(CBOR_MAJOR_ARRAY) | CBOR_MAJOR_BIT(CBOR_MAJOR_MAP)));
+			goto fail;
+		}
+
+		switch ( head.major ) {
+			case CBOR_MAJOR_UINT:
+			case CBOR_MAJOR_NEGINT:
+			case CBOR_MAJOR_SIMPLE:
+				if ( key && !cbor_json_put_byte(out, '"') ) {
+					goto fail;
+				}
+				if ( head.major == CBOR_MAJOR_UINT ? !cbor_json_put_u64(out, head.arg) :
+				     head.major == CBOR_MAJOR_NEGINT ? !cbor_json_put_negative(out, head.arg) :
+				     !cbor_json_put_simple(out, &head) ) {
+					goto fail;
+				}
+				if ( key && !cbor_json_put_byte(out, '"') ) {
+					goto fail;
+				}
+				break;
+
+			case CBOR_MAJOR_BYTES:
+			case CBOR_MAJOR_TEXT:
+				if ( !cbor_json_put_byte(out, '"') ) {
+					goto fail;
+				}
+				if ( !head.indefinite ) {
+					if ( !cbor_check_string(in, head.arg, item) ) {
+						goto fail;
+					}
+
+					uint8_t *data = in->data + in->idx;
+
+					in->idx += (size_t)head.arg;
+					if ( head.major == CBOR_MAJOR_TEXT ) {
+						if ( !cbor_json_put_escaped(out, data, (size_t)head.arg) ) {
+							goto fail;
+						}
+					} else {
+						base64.count = 0;
+						if ( !cbor_json_base64_update(out, &base64, data, (size_t)head.arg) ||
+						     !cbor_json_base64_final(out, &base64) ) {
+							goto fail;
+						}
+					}
+					if ( !cbor_json_put_byte(out, '"') ) {
+						goto fail;
+					}
+					break;
+				}
+				base64.count = 0;
+				/* FALLTHROUGH */
+
+			case CBOR_MAJOR_ARRAY:
+			case CBOR_MAJOR_MAP:
+				if ( head.major == CBOR_MAJOR_ARRAY || head.major == CBOR_MAJOR_MAP ) {
+					if ( !head.indefinite && !cbor_check_container(in, head.arg, item) ) {
+						goto fail;
+					}
+					if ( !cbor_json_put_byte(out, head.major == CBOR_MAJOR_ARRAY ? '[' : '{') ) {
+						goto fail;
+					}
+					if ( !head.indefinite && head.arg == 0 ) {
+						if ( !cbor_json_put_byte(out, head.major == CBOR_MAJOR_ARRAY ? ']' : '}') ) {
+							goto fail;
+						}
+						break;
+					}
+				}
+				if ( depth >= max_depth ) {
+					in->idx = item;
+					cbor_buf_fail(in, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+					goto fail;
+				}
+				top             = &stack[depth++];
+				top->major      = head.major;
+				top->indefinite = head.indefinite;
+				top->count      = 0;
+				top->remaining  = head.major == CBOR_MAJOR_MAP ? head.arg * 2 : head.arg;
+				continue;
+
+			case CBOR_MAJOR_TAG:
+				tagged = true;
+				continue;
+		}
+
+complete:
+		while ( depth > 0 ) {
+			top = &stack[depth - 1];
+			top->count++;
+			if ( top->indefinite || --top->remaining > 0 ) {
+				break;
+			}
+			if ( !cbor_json_close(out, top, &base64) ) {
+				goto fail;
+			}
+			depth--;
+		}
+
+		if ( depth == 0 ) {
+			out->hash = hash;
+			cbor_buf_hash(out);
+			return true;
+		}
+	}
+
+fail:
+	in->idx   = start;
+	out->len  = mark;
+	out->hash = hash;
+
+	return false;
+}
+
+static inline bool
+cbor_json_space(uint8_t byte)
+{
+	return byte == ' ' || byte == '\t' || byte == '\n' || byte == '\r';
+}
+
+static inline void
+cbor_json_skip_space(struct cbor_buf *in)
+{
+	size_t idx = in->idx;
+
+	while ( idx < in->len && cbor_json_space(in->data[idx]) ) {
+		idx++;
+	}
+	in->idx = idx;
+}
+
+static inline int
+cbor_json_hex(uint8_t c)
+{
+	if ( c >= '0' && c <= '9' ) {
+		return c - '0';
+	}
+	c |= 0x20;
+	if ( c >= 'a' && c <= 'f' ) {
+		return c - 'a' + 10;
+	}
+
+	return -1;
+}
+
+static inline bool
+cbor_json_read_u16(struct cbor_buf *in, uint32_t *value)
+{
+	size_t idx = in->idx;
+
+	if ( in->len - idx < 4 ) {
+		return cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+	}
+
+	*value = 0;
+	for ( int i = 0; i < 4; i++ ) {
+		int digit = cbor_json_hex(in->data[idx + (size_t)i]);
+
+		if ( digit < 0 ) {
+			in->idx = idx + (size_t)i;
+			return cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+		}
+		*value = *value << 4 | (uint32_t)digit;
+	}
+	in->idx = idx + 4;
+
+	return true;
+}
+
+/* One escape sequence after the backslash, as UTF-8 into dst[0..3]. */
+static inline size_t
+cbor_json_read_escape(struct cbor_buf *in, uint8_t *dst)
+{
+	uint32_t code = 0;
+	size_t   idx  = in->idx;
+
+	if ( idx >= in->len ) {
+		cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+		return 0;
+	}
+
+	in->idx = idx + 1;
+	switch ( in->data[idx] ) {
+		case '"':  *dst = '"';  return 1;
+		case '\\': *dst = '\\'; return 1;
+		case '/':  *dst = '/';  return 1;
+		case 'b':  *dst = '\b'; return 1;
+		case 'f':  *dst = '\f'; return 1;
+		case 'n':  *dst = '\n'; return 1;
+		case 'r':  *dst = '\r'; return 1;
+		case 't':  *dst = '\t'; return 1;
+		case 'u':  break;
+		default:
+			in->idx = idx;
+			cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+			return 0;
+	}
+
+	if ( !cbor_json_read_u16(in, &code) ) {
+		return 0;
+	}
+
+	if ( code >= 0xd800 && code < 0xdc00 ) {
+		uint32_t low = 0;
+
+		idx = in->idx;
+		if ( in->len - idx < 2 || in->data[idx] != '\\' || in->data[idx + 1] != 'u' ) {
+			cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+			return 0;
+		}
+		in->idx = idx + 2;
+		if ( !cbor_json_read_u16(in, &low) ) {
+			return 0;
+		}
+		if ( low < 0xdc00 || low >= 0xe000 ) {
+			in->idx = idx;
+			cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+			return 0;
+		}
+		code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+	} else if ( code >= 0xdc00 && code < 0xe000 ) {
+		in->idx = idx;
+		cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+		return 0;
+	}
+
+	if ( code < 0x80 ) {
+		dst[0] = (uint8_t)code;
+		return 1;
+	}
+	if ( code < 0x800 ) {
+		dst[0] = (uint8_t)(0xc0 | (code >> 6));
+		dst[1] = (uint8_t)(0x80 | (code & 0x3f));
+		return 2;
+	}
+	if ( code < 0x10000 ) {
+		dst[0] = (uint8_t)(0xe0 | (code >> 12));
+		dst[1] = (uint8_t)(0x80 | ((code >> 6) & 0x3f));
+		dst[2] = (uint8_t)(0x80 | (code & 0x3f));
+		return 3;
+	}
+	dst[0] = (uint8_t)(0xf0 | (code >> 18));
+	dst[1] = (uint8_t)(0x80 | ((code >> 12) & 0x3f));
+	dst[2] = (uint8_t)(0x80 | ((code >> 6) & 0x3f));
+	dst[3] = (uint8_t)(0x80 | (code & 0x3f));
+
+	return 4;
+}
+
+/*
+ * A JSON string after its opening quote. Strings without escapes are copied
+ * once by cbor_add_utf8_str(). Escaped strings are decoded behind room for
+ * the largest head and moved down once their length is known.
+ */
+static inline bool
+cbor_json_read_string(struct cbor_buf *in, struct cbor_buf *out)
+{
+	uint8_t *data = in->data;
+	size_t   len  = in->len;
+	size_t   idx  = in->idx;
+	size_t   span = cbor_json_plain_span(data + idx, len - idx);
+
+	if ( idx + span < len && data[idx + span] == '"' ) {
+		in->idx = idx + span + 1;
+		return cbor_add_utf8_str(out, (char *)data + idx, span);
+	}
+
+	size_t base = out->len + 9;
+	size_t size = 0;
+
+	for ( ;; ) {
+		if ( out->cap < base || out->cap - base - size < span + 4 ) {
+			return cbor_buf_full(out);
+		}
+		memcpy(out->data + base + size, data + idx, span);
+		size += span;
+		idx  += span;
+
+		if ( idx >= len ) {
+			in->idx = idx;
+			return cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+		}
+		if ( data[idx] == '"' ) {
+			break;
+		}
+		if ( data[idx] != '\\' ) {
+			in->idx = idx;
+			return cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+		}
+
+		in->idx = idx + 1;
+
+		size_t n = cbor_json_read_escape(in, out->data + base + size);
+
+		if ( n == 0 ) {
+			return false;
+		}
+		size += n;
+		idx   = in->idx;
+		span  = cbor_json_plain_span(data + idx, len - idx);
+	}
+
+	size_t head = cbor_encode_head(out->data + out->len, CBOR_MAJOR_TEXT, size);
+
+	memmove(out->data + out->len + head, out->data + base, size);
+	out->len += head + size;
+	in->idx   = idx + 1;
+
+	return true;
+}
+
+/*
+ * strtod() of a well-formed JSON number, independent of the locale. The
+ * significant digits are handed over as 0.digits, with the decimal point of
+ * the locale, and an exponent. Digits past CBOR_JSON_DIGITS only matter for
+ * rounding, they are folded into a sticky digit, so numbers of any length
+ * convert correctly.
+ */
+#define CBOR_JSON_DIGITS 800
+
+static inline bool
+cbor_json_strtod(const uint8_t *data, size_t len, double *value)
+{
+	const char *point     = localeconv()->decimal_point;
+	size_t      point_len = strlen(point);
+	char        text[CBOR_JSON_DIGITS + 64];
+	size_t      n         = 0;
+	size_t      digits    = 0;
+	size_t      i         = 0;
+	int64_t     exponent  = 0;
+	int64_t     e         = 0;
+	bool        fraction  = false;
+	bool        sticky    = false;
+	char       *end;
+
+	if ( point_len > 32 ) {
+		return false;
+	}
+	if ( data[0] == '-' ) {
+		text[n++] = '-';
+		i++;
+	}
+	text[n++] = '0';
+	memcpy(text + n, point, point_len);
+	n += point_len;
+
+	for ( ; i < len && data[i] != 'e' && data[i] != 'E'; i++ ) {
+		if ( data[i] == '.' ) {
+			fraction = true;
+		} else if ( digits == 0 && data[i] == '0' ) {
+			exponent -= fraction;
+		} else {
+			exponent += !fraction;
+			if ( digits < CBOR_JSON_DIGITS ) {
+				text[n++] = (char)data[i];
+				digits++;
+			} else {
+				sticky |= data[i] != '0';
+			}
+		}
+	}
+	if ( digits == 0 ) {
+		*value = data[0] == '-' ? -0.0 : 0.0;
+		return true;
+	}
+	if ( sticky ) {
+		text[n++] = '1';
+	}
+
+	if ( i < len ) {
+		bool negative = data[++i] == '-';
+
+		i += data[i] == '-' || data[i] == '+';
+		for ( ; i < len; i++ ) {
+			if ( e < 1000000 ) {
+				e = e * 10 + (data[i] - '0');
+			}
+		}
+		exponent += negative ? -e : e;
+	}
+
+	/* Far beyond the range of a double either way. */
+	if ( exponent > 100000 ) {
+		exponent = 100000;
+	} else if ( exponent < -100000 ) {
+		exponent = -100000;
+	}
+	text[n++] = 'e';
+	if ( exponent < 0 ) {
+		text[n++] = '-';
+		exponent  = -exponent;
+	}
+	n += cbor_json_format_u64(text + n, (uint64_t)exponent);
+	text[n] = '\0';
+
+	*value = strtod(text, &end);
+
+	return *end == '\0';
+}
+
+static inline bool
+cbor_json_read_number(struct cbor_buf *in, struct cbor_buf *out)
+{
+	uint8_t *data     = in->data;
+	size_t   len      = in->len;
+	size_t   start    = in->idx;
+	size_t   idx      = start;
+	bool     negative = false;
+	bool     integral = true;
+	bool     overflow = false;
+	uint64_t value    = 0;
+
+	if ( data[idx] == '-' ) {
+		negative = true;
+		idx++;
+	}
+	if ( idx >= len || data[idx] < '0' || data[idx] > '9' ) {
+		in->idx = idx;
+		return cbor_buf_fail(in, idx >= len ? CBOR_ERR_TRUNCATED : CBOR_ERR_SYNTAX, 0);
+	}
+	if ( data[idx] == '0' ) {
+		idx++;
+	} else {
+		while ( idx < len && data[idx] >= '0' && data[idx] <= '9' ) {
+			unsigned digit = data[idx++] - '0';
+
+			overflow |= value > (UINT64_MAX - digit) / 10;
+			value     = value * 10 + digit;
+		}
+	}
+	if ( idx < len && data[idx] == '.' ) {
+		integral = false;
+		if ( ++idx >= len || data[idx] < '0' || data[idx] > '9' ) {
+			in->idx = idx;
+			return cbor_buf_fail(in, idx >= len ? CBOR_ERR_TRUNCATED : CBOR_ERR_SYNTAX, 0);
+		}
+		while ( idx < len && data[idx] >= '0' && data[idx] <= '9' ) {
+			idx++;
+		}
+	}
+	if ( idx < len && (data[idx] == 'e' || data[idx] == 'E') ) {
+		integral = false;
+		if ( ++idx < len && (data[idx] == '+' || data[idx] == '-') ) {
+			idx++;
+		}
+		if ( idx >= len || data[idx] < '0' || data[idx] > '9' ) {
+			in->idx = idx;
+			return cbor_buf_fail(in, idx >= len ? CBOR_ERR_TRUNCATED : CBOR_ERR_SYNTAX, 0);
+		}
+		while ( idx < len && data[idx] >= '0' && data[idx] <= '9' ) {
+			idx++;
+		}
+	}
+
+	if ( integral && !overflow ) {
+		in->idx = idx;
+		if ( !negative || value == 0 ) {
+			return cbor_add_uint64(out, value);
+		}
+		return cbor_add_int128(out, -(int128_t)value);
+	}
+
+	double x;
+
+	if ( !cbor_json_strtod(data + start, idx - start, &x) ) {
+		return cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+	}
+
+	float y = (float)x;
+
+	in->idx = idx;
+	if ( (double)y == x ) {
+		return cbor_add_float(out, y);
+	}
+
+	return cbor_add_double(out, x);
+}
+
+static inline bool
+cbor_json_read_literal(struct cbor_buf *in, const char *literal, size_t size)
+{
+	size_t idx = in->idx;
+
+	if ( in->len - idx < size ) {
+		return cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+	}
+	if ( memcmp(in->data + idx, literal, size) != 0 ) {
+		return cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+	}
+	in->idx = idx + size;
+
+	return true;
+}
+
+struct cbor_json_frame {
+	size_t   head;          /* offset of the room for the head in out */
+	uint64_t count;         /* items, keys and values counted separately */
+	uint8_t  major;
+};
+
+/*
+ * Containers are opened with room for the widest head. Closing one with at
+ * most CBOR_JSON_MOVE bytes of content moves the content down behind the
+ * final head at once. Larger ones keep the spare room as padding in front
+ * of the head, which cbor_json_compact() drops in a single pass at the end,
+ * so no byte is moved more than a bounded number of times however deep the
+ * nesting. pad is lowered to the first padding in out.
+ */
+#define CBOR_JSON_MOVE 64
+#define CBOR_JSON_PAD  0x1c     /* reserved additional information */
+
+static inline void
+cbor_json_patch(struct cbor_buf *out, struct cbor_json_frame *frame, size_t *pad)
+{
+	uint64_t count = frame->major == CBOR_MAJOR_MAP ? frame->count / 2 : frame->count;
+	size_t   size  = cbor_head_size(count);
+	size_t   head  = frame->head;
+	size_t   body  = out->len - head - 9;
+
+	if ( body <= CBOR_JSON_MOVE ) {
+		cbor_encode_head(out->data + head, frame->major, count);
+		memmove(out->data + head + size, out->data + head + 9, body);
+		out->len -= 9 - size;
+		return;
+	}
+	memset(out->data + head, CBOR_JSON_PAD, 9 - size);
+	cbor_encode_head(out->data + head + 9 - size, frame->major, count);
+	if ( head < *pad ) {
+		*pad = head;
+	}
+}
+
+/* Drop the padding, from has to be the start of an item or padding. */
+static inline void
+cbor_json_compact(struct cbor_buf *out, size_t from)
+{
+	uint8_t *data = out->data;
+	size_t   src  = from;
+	size_t   dst  = from;
+
+	while ( src < out->len ) {
+		uint8_t initial = data[src];
+		int     major   = initial >> 5;
+		size_t  info    = initial & 0x1f;
+		size_t  size    = info < 24 ? 1 : 1 + ((size_t)1 << (info - 24));
+
+		if ( initial == CBOR_JSON_PAD ) {
+			src++;
+			continue;
+		}
+		if ( major == CBOR_MAJOR_BYTES || major == CBOR_MAJOR_TEXT ) {
+			switch ( info ) {
+				case 24: size += data[src + 1];                                 break;
+				case 25: size += cbor_load_be16(data + src + 1);                break;
+				case 26: size += cbor_load_be32(data + src + 1);                break;
+				case 27: size += (size_t)cbor_load_be64(data + src + 1);        break;
+				default: size += info;                                          break;
+			}
+		}
+		if ( dst != src ) {
+			memmove(data + dst, data + src, size);
+		}
+		src += size;
+		dst += size;
+	}
+	out->len = dst;
+}
+
+/*
+ * Transcode the JSON value at the input cursor, after optional white space,
+ * to CBOR appended to out. The cursor is left right behind the value.
+ */
+static inline bool
+cbor_from_json(struct cbor_buf *in, struct cbor_buf *out)
+{
+	struct cbor_json_frame    stack[CBOR_MAX_DEPTH];
+	const struct cbor_limits *limits    = in->limits;
+	size_t                    max_depth = CBOR_MAX_DEPTH;
+	size_t                    depth     = 0;
+	size_t                    start     = in->idx;
+	size_t                    mark      = out->len;
+	size_t                    pad       = SIZE_MAX;
+	struct cbor_hash         *hash      = out->hash;
+
+	if ( limits != NULL && limits->max_depth < max_depth ) {
+		max_depth = limits->max_depth;
+	}
+
+	/* Definite lengths are back-patched, the output is hashed once complete. */
+	cbor_buf_hash_flush(out);
+	out->hash = NULL;
+
+	for ( ;; ) {
+		struct cbor_json_frame *top = depth > 0 ? &stack[depth - 1] : NULL;
+		bool                    key = top != NULL && top->major == CBOR_MAJOR_MAP && top->count % 2 == 0;
+
+		cbor_json_skip_space(in);
+		if ( in->idx >= in->len ) {
+			cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+			goto fail;
+		}
+
+		uint8_t c = in->data[in->idx];
+
+		if ( key && c != '"' ) {
+			cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+			goto fail;
+		}
+
+		switch ( c ) {
+			case '[':
+			case '{':
+				if ( depth >= max_depth ) {
+					cbor_buf_fail(in, CBOR_ERR_DEPTH, 0);
+					goto fail;
+				}
+				in->idx++;
+				cbor_json_skip_space(in);
+				if ( in->idx < in->len && in->data[in->idx] == (c == '[' ? ']' : '}') ) {
+					in->idx++;
+					if ( !cbor_buf_append_byte(out, c == '[' ? 0x80 : 0xa0) ) {
+						goto fail;
+					}
+					break;
+				}
+				if ( cbor_json_reserve(out, 9) == NULL ) {
+					goto fail;
+				}
+				top        = &stack[depth++];
+				top->head  = out->len;
+				top->count = 0;
+				top->major = c == '[' ? CBOR_MAJOR_ARRAY : CBOR_MAJOR_MAP;
+				out->len  += 9;
+				continue;
+
+			case '"':
+				in->idx++;
+				if ( !cbor_json_read_string(in, out) ) {
+					goto fail;
+				}
+				break;
+
+			case 't':
+				if ( !cbor_json_read_literal(in, "true", 4) || !cbor_add_true(out) ) {
+					goto fail;
+				}
+				break;
+
+			case 'f':
+				if ( !cbor_json_read_literal(in, "false", 5) || !cbor_add_false(out) ) {
+					goto fail;
+				}
+				break;
+
+			case 'n':
+				if ( !cbor_json_read_literal(in, "null", 4) || !cbor_add_null(out) ) {
+					goto fail;
+				}
+				break;
+
+			default:
+				if ( c != '-' && (c < '0' || c > '9') ) {
+					cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+					goto fail;
+				}
+				if ( !cbor_json_read_number(in, out) ) {
+					goto fail;
+				}
+				break;
+		}
+
+		/* A value is complete, continue or close the enclosing levels. */
+		while ( depth > 0 ) {
+			top = &stack[depth - 1];
+			top->count++;
+
+			cbor_json_skip_space(in);
+			if ( in->idx >= in->len ) {
+				cbor_buf_fail(in, CBOR_ERR_TRUNCATED, 0);
+				goto fail;
+			}
+
+			c = in->data[in->idx];
+			if ( top->major == CBOR_MAJOR_MAP && top->count % 2 != 0 ) {
+				if ( c != ':' ) {
+					cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+					goto fail;
+				}
+				in->idx++;
+				break;
+			}
+			if ( c == ',' ) {
+				in->idx++;
+				break;
+			}
+			if ( c != (top->major == CBOR_MAJOR_ARRAY ? ']' : '}') ) {
+				cbor_buf_fail(in, CBOR_ERR_SYNTAX, 0);
+				goto fail;
+			}
+			in->idx++;
+			cbor_json_patch(out, top, &pad);
+			depth--;
+		}
+
+		if ( depth == 0 ) {
+			if ( pad != SIZE_MAX ) {
+				cbor_json_compact(out, pad);
+			}
+			out->hash = hash;
+			cbor_buf_hash(out);
+			return true;
+		}
+	}
+
+fail:
+	in->idx   = start;
+	out->len  = mark;
+	out->hash = hash;
+
+	return false;
+}
+
+#endif /* LIBCBOR_CBOR_JSON_H */
@@ -0,0 +1,364 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_PATCH_H
+#define LIBCBOR_CBOR_PATCH_H
+
+#include "cbor.h"
+
+/*
+ * In-place edits of encoded items. The item at offset off is replaced by a
+ * new value: when the new encoding has the same width it is overwritten,
+ * integers and floats keep a wider existing head when the value fits it,
+ * and otherwise the rest of the buffer is moved once with
+ * cbor_buf_splice().
+ *
+ * Array and map counts do not change when an item is replaced, but the
+ * lengths of byte strings wrapping the item do, e.g. embedded CBOR in tag
+ * 24. The caller passes the offsets of those heads, outermost first, in
+ * outer; each is rewritten for the new length. A head that changes width
+ * costs one more move, and the offsets in outer behind it are updated.
+ * Offsets of anything after the edited item move by the change in size.
+ *
+ * Nothing is changed when an edit fails, e.g. for lack of capacity.
+ */
+
+static inline bool
+cbor_patch_fail(struct cbor_buf *buf, size_t off, enum cbor_error err, unsigned expected)
+{
+	size_t idx = buf->idx;
+
+	buf->idx = off;
+	cbor_buf_fail(buf, err, expected);
+	buf->idx = idx;
+
+	return false;
+}
+
+/*
+ * The probes below decode the item being edited without counting against
+ * the limits, which cover reading rather than editing. A probe leaves the
+ * cursor, item count and last error as they were; a failed one reports
+ * its error at off.
+ */
+struct cbor_patch_state {
+	size_t                    idx;
+	uint64_t                  items;
+	const struct cbor_limits *limits;
+	enum cbor_error           err;
+	size_t                    err_idx;
+	unsigned                  err_expected;
+	int                       err_actual;
+};
+
+static inline void
+cbor_patch_save(struct cbor_buf *buf, struct cbor_patch_state *state, size_t off)
+{
+	state->idx          = buf->idx;
+	state->items        = buf->items;
+	state->limits       = buf->limits;
+	state->err          = buf->err;
+	state->err_idx      = buf->err_idx;
+	state->err_expected = buf->err_expected;
+	state->err_actual   = buf->err_actual;
+
+	buf->idx    = off;
+	buf->limits = NULL;
+}
+
+static inline bool
+cbor_patch_restore(struct cbor_buf *buf, const struct cbor_patch_state *state, size_t off, bool ok)
+{
+	enum cbor_error err      = buf->err;
+	unsigned        expected = buf->err_expected;
+
+	buf->idx          = state->idx;
+	buf->items        = state->items;
+	buf->limits       = state->limits;
+	buf->err          = state->err;
+	buf->err_idx      = state->err_idx;
+	buf->err_expected = state->err_expected;
+	buf->err_actual   = state->err_actual;
+
+	if ( !ok ) {
+		return cbor_patch_fail(buf, off, err, expected);
+	}
+
+	return true;
+}
+
+/* Read the head at off without moving the cursor. */
+static inline bool
+cbor_patch_head(struct cbor_buf *buf, size_t off, struct cbor_head *head)
+{
+	struct cbor_patch_state state;
+	bool                    ok;
+
+	cbor_patch_save(buf, &state, off);
+	ok = cbor_read_head(buf, head);
+
+	return cbor_patch_restore(buf, &state, off, ok);
+}
+
+/* Size of the item at off. */
+static inline bool
+cbor_patch_extent(struct cbor_buf *buf, size_t off, size_t *size)
+{
+	struct cbor_patch_state state;
+	bool                    ok;
+
+	cbor_patch_save(buf, &state, off);
+	ok    = cbor_skip_item(buf);
+	*size = ok ? buf->idx - off : 0;
+
+	return cbor_patch_restore(buf, &state, off, ok);
+}
+
+/*
+ * Replace the item at off with a head followed by payload. The sizes of the
+ * outer heads are worked out first, so a failure leaves the buffer as is.
+ */
+static inline bool
+cbor_patch_replace(struct cbor_buf *buf, size_t off, const uint8_t *head, size_t head_len,
+                   const void *payload, size_t payload_len, size_t *outer, size_t nouter)
+{
+	struct cbor_head h = { 0 };
+	size_t           size;
+	size_t           len   = head_len + payload_len;
+	ptrdiff_t        delta = (ptrdiff_t)len;
+
+	if ( !cbor_patch_extent(buf, off, &size) ) {
+		return false;
+	}
+	delta -= (ptrdiff_t)size;
+
+	for ( size_t i = nouter; i-- > 0; ) {
+		size_t at = outer[i];
+
+		if ( !cbor_patch_head(buf, at, &h) ) {
+			return false;
+		}
+		if ( h.major != CBOR_MAJOR_BYTES || h.indefinite ) {
+			return cbor_patch_fail(buf, at, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(CBOR_MAJOR_BYTES));
+		}
+
+		/* The string must hold the item and the next inner string. */
+		size_t inner = i + 1 < nouter ? outer[i + 1] : off;
+
+		if ( at + h.size > inner || off + size > at + h.size + h.arg ) {
+			return cbor_patch_fail(buf, at, CBOR_ERR_TRUNCATED, CBOR_MAJOR_BIT(CBOR_MAJOR_BYTES));
+		}
+		delta += (ptrdiff_t)cbor_head_size((uint64_t)((ptrdiff_t)h.arg + delta)) - (ptrdiff_t)h.size;
+	}
+
+	if ( delta > 0 && (size_t)delta > buf->cap - buf->len ) {
+		return cbor_buf_full(buf);
+	}
+
+	if ( len != size ) {
+		cbor_buf_splice(buf, off, size, len);
+	}
+	memcpy(buf->data + off, head, head_len);
+	if ( payload_len > 0 ) {
+		memcpy(buf->data + off + head_len, payload, payload_len);
+	}
+
+	/* Innermost first: the heads before a rewritten one stay where they are. */
+	delta = (ptrdiff_t)len - (ptrdiff_t)size;
+	for ( size_t i = nouter; i-- > 0 && delta != 0; ) {
+		uint8_t encoded[9];
+		size_t  at = outer[i];
+
+		cbor_patch_head(buf, at, &h);
+
+		size_t width = cbor_encode_head(encoded, CBOR_MAJOR_BYTES, (uint64_t)((ptrdiff_t)h.arg + delta));
+
+		if ( width != h.size ) {
+			cbor_buf_splice(buf, at, h.size, width);
+			delta += (ptrdiff_t)width - (ptrdiff_t)h.size;
+			for ( size_t j = i + 1; j < nouter; j++ ) {
+				outer[j] = outer[j] - h.size + width;
+			}
+		}
+		memcpy(buf->data + at, encoded, width);
+	}
+
+	return true;
+}
+
+/* Replace the item at off with an already encoded item. */
+static inline bool
+cbor_patch_item(struct cbor_buf *buf, size_t off, const void *item, size_t len,
+                size_t *outer, size_t nouter)
+{
+	return cbor_patch_replace(buf, off, item, len, NULL, 0, outer, nouter);
+}
+
+static inline bool
+cbor_patch_integer(struct cbor_buf *buf, size_t off, int major, uint64_t arg,
+                   size_t *outer, size_t nouter)
+{
+	struct cbor_head head;
+	uint8_t          encoded[9];
+
+	if ( !cbor_patch_head(buf, off, &head) ) {
+		return false;
+	}
+	if ( (head.major == CBOR_MAJOR_UINT || head.major == CBOR_MAJOR_NEGINT) && cbor_head_size(arg) <= head.size ) {
+		cbor_encode_head_size(buf->data + off, major, arg, head.size);
+		return true;
+	}
+
+	return cbor_patch_replace(buf, off, encoded, cbor_encode_head(encoded, major, arg), NULL, 0, outer, nouter);
+}
+
+static inline bool
+cbor_patch_uint64(struct cbor_buf *buf, size_t off, uint64_t value, size_t *outer, size_t nouter)
+{
+	return cbor_patch_integer(buf, off, CBOR_MAJOR_UINT, value, outer, nouter);
+}
+
+static inline bool
+cbor_patch_int64(struct cbor_buf *buf, size_t off, int64_t value, size_t *outer, size_t nouter)
+{
+	if ( value < 0 ) {
+		return cbor_patch_integer(buf, off, CBOR_MAJOR_NEGINT, (uint64_t)(-1 - value), outer, nouter);
+	}
+
+	return cbor_patch_integer(buf, off, CBOR_MAJOR_UINT, (uint64_t)value, outer, nouter);
+}
+
+static inline bool
+cbor_patch_bool(struct cbor_buf *buf, size_t off, bool value, size_t *outer, size_t nouter)
+{
+	uint8_t encoded = value ? 0xf5 : 0xf4;
+
+	return cbor_patch_replace(buf, off, &encoded, 1, NULL, 0, outer, nouter);
+}
+
+static inline bool
+cbor_patch_null(struct cbor_buf *buf, size_t off, size_t *outer, size_t nouter)
+{
+	uint8_t encoded = 0xf6;
+
+	return cbor_patch_replace(buf, off, &encoded, 1, NULL, 0, outer, nouter);
+}
+
+/*
+ * The float with the same value as x, if there is one. A NaN narrows only
+ * when the 29 mantissa bits a float drops are zero, so its sign and payload
+ * survive.
+ */
+static inline bool
+cbor_patch_narrow(double x, uint32_t *narrow)
+{
+	float    f = (float)x;
+	uint64_t bits;
+
+	memcpy(&bits, &x, sizeof(bits));
+	if ( isnan(x) ) {
+		if ( (bits & 0x1fffffff) != 0 ) {
+			return false;
+		}
+		*narrow = (uint32_t)(bits >> 32 & 0x80000000) | 0x7f800000 | (uint32_t)(bits >> 29 & 0x7fffff);
+		return true;
+	}
+	if ( (double)f != x ) {
+		return false;
+	}
+	memcpy(narrow, &f, sizeof(*narrow));
+
+	return true;
+}
+
+/*
+ * Store x in an existing double, or in an existing float when that is exact.
+ * Otherwise the item becomes a float if exact, else a double.
+ */
+static inline bool
+cbor_patch_double(struct cbor_buf *buf, size_t off, double x, size_t *outer, size_t nouter)
+{
+	uint8_t  encoded[9];
+	uint32_t narrow = 0;
+	bool     exact  = cbor_patch_narrow(x, &narrow);
+	uint64_t bits;
+	size_t   len;
+
+	memcpy(&bits, &x, sizeof(bits));
+	if ( off < buf->len && buf->data[off] == 0xfb && buf->len - off >= 9 ) {
+		cbor_store_be64(buf->data + off + 1, bits);
+		return true;
+	}
+	if ( off < buf->len && buf->data[off] == 0xfa && buf->len - off >= 5 && exact ) {
+		cbor_store_be32(buf->data + off + 1, narrow);
+		return true;
+	}
+
+	if ( exact ) {
+		encoded[0] = 0xfa;
+		cbor_store_be32(encoded + 1, narrow);
+		len = 5;
+	} else {
+		encoded[0] = 0xfb;
+		cbor_store_be64(encoded + 1, bits);
+		len = 9;
+	}
+
+	return cbor_patch_replace(buf, off, encoded, len, NULL, 0, outer, nouter);
+}
+
+static inline bool
+cbor_patch_string(struct cbor_buf *buf, size_t off, int major, const void *data, size_t len,
+                  size_t *outer, size_t nouter)
+{
+	struct cbor_head head;
+	uint8_t          encoded[9];
+
+	if ( !cbor_patch_head(buf, off, &head) ) {
+		return false;
+	}
+	if ( head.major == major && !head.indefinite && head.arg == len && off + head.size + len <= buf->len ) {
+		memcpy(buf->data + off + head.size, data, len);
+		return true;
+	}
+
+	return cbor_patch_replace(buf, off, encoded, cbor_encode_head(encoded, major, len), data, len, outer, nouter);
+}
+
+static inline bool
+cbor_patch_byte_str(struct cbor_buf *buf, size_t off, const void *data, size_t len,
+                    size_t *outer, size_t nouter)
+{
+	return cbor_patch_string(buf, off, CBOR_MAJOR_BYTES, data, len, outer, nouter);
+}
+
+static inline bool
+cbor_patch_utf8_str(struct cbor_buf *buf, size_t off, const char *data, size_t len,
+                    size_t *outer, size_t nouter)
+{
+	return cbor_patch_string(buf, off, CBOR_MAJOR_TEXT, data, len, outer, nouter);
+}
+
+#endif /* LIBCBOR_CBOR_PATCH_H */
@@ -0,0 +1,522 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_PATH_H
+#define LIBCBOR_CBOR_PATH_H
+
+#include "cbor.h"
+
+/*
+ * Compiled path queries. A path such as .events[*].user.id is parsed once
+ * into a struct cbor_path; cbor_path_eval() then runs a batch of paths over
+ * one data item in a single forward pass. Subtrees no path can match are
+ * skipped with cbor_skip_item(), matches are reported as offset and length
+ * of the encoded item, pointing into the buffer.
+ *
+ * Syntax, applied left to right starting at the item:
+ *   .name  ."name"  ["name"]   value under a text string map key
+ *   [N]                        array element N, or value under integer key N
+ *   [*]  .*                    every array element or map value
+ *
+ * Map keys are compared as encoded bytes against keys encoded at compile
+ * time, so they must use the shortest head, as preferred serialization in
+ * RFC 8949 requires. Tags are looked through.
+ */
+
+#ifndef CBOR_PATH_MAX_STEPS
+#define CBOR_PATH_MAX_STEPS 16
+#endif
+
+#ifndef CBOR_PATH_MAX_KEYS
+#define CBOR_PATH_MAX_KEYS 256
+#endif
+
+#define CBOR_PATH_MAX_BATCH 64
+
+struct cbor_path_step {
+	bool     any;           /* [*] or .* */
+	bool     has_index;     /* index is valid for arrays */
+	uint16_t key;           /* encoded map key in keys[] */
+	uint16_t key_len;
+	uint64_t index;
+};
+
+struct cbor_path {
+	struct cbor_path_step steps[CBOR_PATH_MAX_STEPS];
+	size_t                nsteps;
+	uint8_t               keys[CBOR_PATH_MAX_KEYS];
+	size_t                keys_len;
+};
+
+/* Called per match. Return false to stop the evaluation early. */
+typedef bool (*cbor_path_fn)(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len);
+
+static inline struct cbor_path_step *
+cbor_path_add_step(struct cbor_path *path, struct cbor_buf *expr)
+{
+	struct cbor_path_step *step;
+
+	if ( path->nsteps >= CBOR_PATH_MAX_STEPS ) {
+		cbor_buf_fail(expr, CBOR_ERR_LIMIT, 0);
+		return NULL;
+	}
+	step = &path->steps[path->nsteps++];
+	memset(step, 0, sizeof(*step));
+
+	return step;
+}
+
+static inline bool
+cbor_path_add_key(struct cbor_path *path, struct cbor_buf *expr, struct cbor_path_step *step,
+                  int major, const uint8_t *data, size_t len)
+{
+	uint64_t arg  = major == CBOR_MAJOR_TEXT ? len : step->index;
+	size_t   size = cbor_head_size(arg) + (major == CBOR_MAJOR_TEXT ? len : 0);
+	uint8_t *dst  = path->keys + path->keys_len;
+
+	if ( size > CBOR_PATH_MAX_KEYS - path->keys_len ) {
+		return cbor_buf_fail(expr, CBOR_ERR_LIMIT, 0);
+	}
+
+	size_t head = cbor_encode_head(dst, major, arg);
+
+	if ( major == CBOR_MAJOR_TEXT ) {
+		memcpy(dst + head, data, len);
+	}
+	step->key        = (uint16_t)path->keys_len;
+	step->key_len    = (uint16_t)size;
+	path->keys_len  += size;
+
+	return true;
+}
+
+static inline bool
+cbor_path_quoted(struct cbor_path *path, struct cbor_buf *expr)
+{
+	uint8_t  name[CBOR_PATH_MAX_KEYS];
+	size_t   len  = 0;
+	uint8_t *data = expr->data;
+
+	/* Opening quote already consumed. */
+	for ( ;; ) {
+		if ( expr->idx >= expr->len ) {
+			return cbor_buf_fail(expr, CBOR_ERR_TRUNCATED, 0);
+		}
+
+		uint8_t c = data[expr->idx++];
+
+		if ( c == '"' ) {
+			break;
+		}
+		if ( c == '\\' ) {
+			if ( expr->idx >= expr->len ) {
+				return cbor_buf_fail(expr, CBOR_ERR_TRUNCATED, 0);
+			}
+			c = data[expr->idx++];
+		}
+		if ( len >= sizeof(name) ) {
+			return cbor_buf_fail(expr, CBOR_ERR_LIMIT, 0);
+		}
+		name[len++] = c;
+	}
+
+	struct cbor_path_step *step = cbor_path_add_step(path, expr);
+
+	return step != NULL && cbor_path_add_key(path, expr, step, CBOR_MAJOR_TEXT, name, len);
+}
+
+static inline bool
+cbor_path_index(struct cbor_path *path, struct cbor_buf *expr)
+{
+	uint8_t *data     = expr->data;
+	bool     negative = false;
+	uint64_t value    = 0;
+	size_t   digits   = 0;
+
+	if ( expr->idx < expr->len && data[expr->idx] == '-' ) {
+		negative = true;
+		expr->idx++;
+	}
+	while ( expr->idx < expr->len && data[expr->idx] >= '0' && data[expr->idx] <= '9' ) {
+		unsigned digit = data[expr->idx++] - '0';
+
+		if ( value > (UINT64_MAX - digit) / 10 ) {
+			return cbor_buf_fail(expr, CBOR_ERR_OVERFLOW, 0);
+		}
+		value = value * 10 + digit;
+		digits++;
+	}
+	if ( digits == 0 || (negative && value == 0) ) {
+		return cbor_buf_fail(expr, CBOR_ERR_SYNTAX, 0);
+	}
+
+	struct cbor_path_step *step = cbor_path_add_step(path, expr);
+
+	if ( step == NULL ) {
+		return false;
+	}
+	step->has_index = !negative;
+	step->index     = negative ? value - 1 : value;
+
+	return cbor_path_add_key(path, expr, step, negative ? CBOR_MAJOR_NEGINT : CBOR_MAJOR_UINT, NULL, 0);
+}
+
+static inline bool
+cbor_path_expect(struct cbor_buf *expr, uint8_t c)
+{
+	if ( expr->idx >= expr->len ) {
+		return cbor_buf_fail(expr, CBOR_ERR_TRUNCATED, 0);
+	}
+	if ( expr->data[expr->idx] != c ) {
+		return cbor_buf_fail(expr, CBOR_ERR_SYNTAX, 0);
+	}
+	expr->idx++;
+
+	return true;
+}
+
+/*
+ * Compile the path text in expr. Syntax errors are recorded in expr.
+ */
+static inline bool
+cbor_path_compile(struct cbor_path *path, struct cbor_buf *expr)
+{
+	uint8_t *data = expr->data;
+	size_t   len  = expr->len;
+
+	path->nsteps   = 0;
+	path->keys_len = 0;
+
+	if ( expr->idx < len && data[expr->idx] == '$' ) {
+		expr->idx++;
+	}
+	if ( len - expr->idx == 1 && data[expr->idx] == '.' ) {
+		expr->idx++;
+		return true;
+	}
+
+	while ( expr->idx < len ) {
+		uint8_t c = data[expr->idx++];
+
+		if ( c == '.' ) {
+			if ( expr->idx >= len ) {
+				return cbor_buf_fail(expr, CBOR_ERR_TRUNCATED, 0);
+			}
+			c = data[expr->idx];
+			if ( c == '*' ) {
+				struct cbor_path_step *step = cbor_path_add_step(path, expr);
+
+				if ( step == NULL ) {
+					return false;
+				}
+				step->any = true;
+				expr->idx++;
+			} else if ( c == '"' ) {
+				expr->idx++;
+				if ( !cbor_path_quoted(path, expr) ) {
+					return false;
+				}
+			} else if ( c != '[' ) {
+				size_t start = expr->idx;
+
+				while ( expr->idx < len && data[expr->idx] != '.' && data[expr->idx] != '[' &&
+				        data[expr->idx] != ']' ) {
+					expr->idx++;
+				}
+				if ( expr->idx == start ) {
+					return cbor_buf_fail(expr, CBOR_ERR_SYNTAX, 0);
+				}
+
+				struct cbor_path_step *step = cbor_path_add_step(path, expr);
+
+				if ( step == NULL ||
+				     !cbor_path_add_key(path, expr, step, CBOR_MAJOR_TEXT, data + start, expr->idx - start) ) {
+					return false;
+				}
+			}
+		} else if ( c == '[' ) {
+			if ( expr->idx >= len ) {
+				return cbor_buf_fail(expr, CBOR_ERR_TRUNCATED, 0);
+			}
+			c = data[expr->idx];
+			if ( c == '*' ) {
+				struct cbor_path_step *step = cbor_path_add_step(path, expr);
+
+				if ( step == NULL ) {
+					return false;
+				}
+				step->any = true;
+				expr->idx++;
+			} else if ( c == '"' ) {
+				expr->idx++;
+				if ( !cbor_path_quoted(path, expr) ) {
+					return false;
+				}
+			} else if ( !cbor_path_index(path, expr) ) {
+				return false;
+			}
+			if ( !cbor_path_expect(expr, ']') ) {
+				return false;
+			}
+		} else {
+			expr->idx--;
+			return cbor_buf_fail(expr, CBOR_ERR_SYNTAX, 0);
+		}
+	}
+
+	return true;
+}
+
+static inline bool
+cbor_path_compile_cstr(struct cbor_path *path, const char *expr)
+{
+	struct cbor_buf buf;
+	size_t          len = strlen(expr);
+
+	cbor_buf_init(&buf, (void *)expr, len, len);
+
+	return cbor_path_compile(path, &buf);
+}
+
+struct cbor_path_ctx {
+	struct cbor_buf        *buf;
+	const struct cbor_path *paths;
+	cbor_path_fn            fn;
+	void                   *arg;
+	bool                    stop;
+};
+
+static inline bool cbor_path_walk(struct cbor_path_ctx *ctx, size_t depth, uint64_t active);
+
+static inline bool
+cbor_path_child(struct cbor_path_ctx *ctx, size_t depth, uint64_t active)
+{
+	if ( active == 0 ) {
+		return cbor_skip_nested(ctx->buf, depth + 1);
+	}
+
+	return cbor_path_walk(ctx, depth + 1, active);
+}
+
+/* Paths in active whose step at depth selects element index of an array. */
+static inline uint64_t
+cbor_path_select_index(struct cbor_path_ctx *ctx, size_t depth, uint64_t active, uint64_t index)
+{
+	uint64_t selected = 0;
+
+	for ( uint64_t set = active; set != 0; set &= set - 1 ) {
+		size_t                       p    = (size_t)__builtin_ctzll(set);
+		const struct cbor_path_step *step = &ctx->paths[p].steps[depth];
+
+		if ( step->any || (step->has_index && step->index == index) ) {
+			selected |= (uint64_t)1 << p;
+		}
+	}
+
+	return selected;
+}
+
+/* Paths in active whose step at depth selects the map key at the cursor. */
+static inline uint64_t
+cbor_path_select_key(struct cbor_path_ctx *ctx, size_t depth, uint64_t active)
+{
+	struct cbor_buf *buf      = ctx->buf;
+	const uint8_t   *key      = buf->data + buf->idx;
+	size_t           avail    = buf->len - buf->idx;
+	uint64_t         selected = 0;
+
+	for ( uint64_t set = active; set != 0; set &= set - 1 ) {
+		size_t                       p    = (size_t)__builtin_ctzll(set);
+		const struct cbor_path       *path = &ctx->paths[p];
+		const struct cbor_path_step *step = &path->steps[depth];
+
+		if ( step->any ||
+		     (step->key_len <= avail && memcmp(key, path->keys + step->key, step->key_len) == 0) ) {
+			selected |= (uint64_t)1 << p;
+		}
+	}
+
+	return selected;
+}
+
+/*
+ * Walk the item at the cursor for the paths in active, all of which have
+ * matched depth steps so far, so depth arrays and maps are open around it.
+ * Recursion is bounded by CBOR_PATH_MAX_STEPS: once no path is left the
+ * rest of the subtree is skipped iteratively, below the open levels.
+ */
+static inline bool
+cbor_path_walk(struct cbor_path_ctx *ctx, size_t depth, uint64_t active)
+{
+	struct cbor_buf *buf   = ctx->buf;
+	size_t           start = buf->idx;
+	uint64_t         items = buf->items;
+	size_t           item  = start;
+	uint64_t         done  = 0;
+	uint64_t         deeper;
+	struct cbor_head head;
+
+	for ( uint64_t set = active; set != 0; set &= set - 1 ) {
+		size_t p = (size_t)__builtin_ctzll(set);
+
+		if ( ctx->paths[p].nsteps == depth ) {
+			done |= (uint64_t)1 << p;
+		}
+	}
+	deeper = active & ~done;
+
+	do {
+		item = buf->idx;
+		if ( !cbor_read_head(buf, &head) ) {
+			return false;
+		}
+	} while ( head.major == CBOR_MAJOR_TAG );
+
+	/* The skip reads the heads again, they must not count twice. */
+	if ( deeper == 0 || (head.major != CBOR_MAJOR_ARRAY && head.major != CBOR_MAJOR_MAP) ) {
+		buf->idx   = start;
+		buf->items = items;
+		if ( !cbor_skip_nested(buf, depth) ) {
+			return false;
+		}
+	} else if ( (head.indefinite || head.arg > 0) && depth >= cbor_buf_max_depth(buf) ) {
+		buf->idx = item;
+		return cbor_buf_fail(buf, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+	} else if ( head.major == CBOR_MAJOR_ARRAY ) {
+		if ( !head.indefinite && !cbor_check_container(buf, head.arg, start) ) {
+			return false;
+		}
+		for ( uint64_t i = 0; head.indefinite ? !cbor_is_break(buf) : i < head.arg; i++ ) {
+			if ( !cbor_path_child(ctx, depth, cbor_path_select_index(ctx, depth, deeper, i)) ) {
+				return false;
+			}
+			if ( ctx->stop ) {
+				return true;
+			}
+		}
+		if ( head.indefinite && !cbor_expect_break(buf) ) {
+			return false;
+		}
+	} else {
+		if ( !head.indefinite && !cbor_check_container(buf, head.arg, start) ) {
+			return false;
+		}
+		for ( uint64_t i = 0; head.indefinite ? !cbor_is_break(buf) : i < head.arg; i++ ) {
+			uint64_t selected = cbor_path_select_key(ctx, depth, deeper);
+
+			if ( !cbor_skip_nested(buf, depth + 1) || !cbor_path_child(ctx, depth, selected) ) {
+				return false;
+			}
+			if ( ctx->stop ) {
+				return true;
+			}
+		}
+		if ( head.indefinite && !cbor_expect_break(buf) ) {
+			return false;
+		}
+	}
+
+	/* The extent of the item is known only now, report matches ending here. */
+	for ( uint64_t set = done; set != 0 && !ctx->stop; set &= set - 1 ) {
+		size_t p = (size_t)__builtin_ctzll(set);
+
+		ctx->stop = !ctx->fn(ctx->arg, p, buf, start, buf->idx - start);
+	}
+
+	return true;
+}
+
+/*
+ * Evaluate up to CBOR_PATH_MAX_BATCH paths over the item at the cursor in
+ * one pass, calling fn for every match. Matches inside an item are reported
+ * before a match of the item itself. On success the cursor is moved past
+ * the item; on error or when fn stops the walk it is restored.
+ */
+static inline bool
+cbor_path_eval(struct cbor_buf *buf, const struct cbor_path *paths, size_t npaths, cbor_path_fn fn, void *arg)
+{
+	struct cbor_path_ctx ctx   = { buf, paths, fn, arg, false };
+	size_t               start = buf->idx;
+	uint64_t             items = buf->items;
+	uint64_t             active;
+
+	if ( npaths > CBOR_PATH_MAX_BATCH ) {
+		return cbor_buf_fail(buf, CBOR_ERR_LIMIT, 0);
+	}
+	active = npaths == CBOR_PATH_MAX_BATCH ? UINT64_MAX : ((uint64_t)1 << npaths) - 1;
+
+	if ( !cbor_path_walk(&ctx, 0, active) || ctx.stop ) {
+		bool ok = ctx.stop;
+
+		buf->idx   = start;
+		buf->items = items;
+		return ok;
+	}
+
+	return true;
+}
+
+struct cbor_path_first {
+	size_t offset;
+	size_t len;
+	bool   found;
+};
+
+static inline bool
+cbor_path_first_fn(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len)
+{
+	struct cbor_path_first *first = arg;
+
+	(void)path;
+	(void)buf;
+	first->offset = offset;
+	first->len    = len;
+	first->found  = true;
+
+	return false;
+}
+
+/*
+ * Find the first match of a single path and return a view of it in match,
+ * which reads only the matched item. The cursor is not moved.
+ */
+static inline bool
+cbor_path_find(struct cbor_buf *buf, const struct cbor_path *path, struct cbor_buf *match)
+{
+	struct cbor_path_first first = { 0, 0, false };
+	size_t                 start = buf->idx;
+
+	if ( !cbor_path_eval(buf, path, 1, cbor_path_first_fn, &first) ) {
+		return false;
+	}
+	buf->idx = start;
+	if ( !first.found ) {
+		return false;
+	}
+
+	return cbor_buf_init(match, buf->data + first.offset, first.len, first.len);
+}
+
+#endif /* LIBCBOR_CBOR_PATH_H */
@@ -0,0 +1,325 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_PHF_H
+#define LIBCBOR_CBOR_PHF_H
+
+#include "cbor.h"
+
+/*
+ * Minimal perfect hash over a fixed set of map keys, built once at init
+ * with hash and displace: keys are hashed into buckets of about two, and
+ * each bucket, largest first, gets the smallest displacement that puts all
+ * of its keys into free slots. There are as many slots as keys, so a
+ * lookup is one pass over the key bytes, two multiplications and a single
+ * memcmp against the only key that can match.
+ *
+ * The key strings are referenced, not copied, and must outlive the table.
+ */
+
+#ifndef CBOR_PHF_MAX_KEYS
+#define CBOR_PHF_MAX_KEYS 256
+#endif
+
+#define CBOR_PHF_MAX_BUCKETS (CBOR_PHF_MAX_KEYS / 2 + 1)
+#define CBOR_PHF_SEEDS       32         /* seeds tried before init gives up */
+
+struct cbor_phf_slot {
+	const char *key;
+	uint32_t    len;
+	uint32_t    field;
+};
+
+struct cbor_phf {
+	uint64_t             seed;
+	uint32_t             nkeys;
+	uint32_t             nbuckets;
+	uint16_t             disp[CBOR_PHF_MAX_BUCKETS];
+	struct cbor_phf_slot slots[CBOR_PHF_MAX_KEYS];
+};
+
+static inline uint64_t
+cbor_phf_mix(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 29;
+
+	return x;
+}
+
+static inline uint64_t
+cbor_phf_hash(const uint8_t *data, size_t len, uint64_t seed)
+{
+	uint64_t h = seed ^ ((uint64_t)len * 0x9e3779b97f4a7c15ULL);
+	uint64_t w;
+
+	for ( ; len > 8; data += 8, len -= 8 ) {
+		memcpy(&w, data, 8);
+		h = cbor_phf_mix(h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+	}
+	w = 0;
+	memcpy(&w, data, len);
+
+	return cbor_phf_mix((h ^ w) * 0xc4ceb9fe1a85ec53ULL);
+}
+
+/* Upper half of the hash picks the bucket, the displaced lower half the slot. */
+static inline uint32_t
+cbor_phf_bucket(uint64_t h, uint32_t nbuckets)
+{
+	return (uint32_t)(((h >> 32) * nbuckets) >> 32);
+}
+
+static inline uint32_t
+cbor_phf_slot(uint64_t h, uint32_t disp, uint32_t nkeys)
+{
+	uint32_t x = (uint32_t)cbor_phf_mix(h + disp * 0x9e3779b97f4a7c15ULL);
+
+	return (uint32_t)(((uint64_t)x * nkeys) >> 32);
+}
+
+/* Place the keys of one bucket, members[0..n), with the first displacement that fits. */
+static inline bool
+cbor_phf_place(struct cbor_phf *phf, const uint64_t *hash, const uint32_t *members, size_t n, uint32_t bucket)
+{
+	uint32_t slot[CBOR_PHF_MAX_KEYS];
+
+	for ( uint32_t d = 0; d <= UINT16_MAX; d++ ) {
+		size_t i;
+
+		for ( i = 0; i < n; i++ ) {
+			size_t j;
+
+			slot[i] = cbor_phf_slot(hash[members[i]], d, phf->nkeys);
+			if ( phf->slots[slot[i]].key != NULL ) {
+				break;
+			}
+			for ( j = 0; j < i && slot[j] != slot[i]; j++ ) {
+			}
+			if ( j < i ) {
+				break;
+			}
+		}
+		if ( i == n ) {
+			for ( i = 0; i < n; i++ ) {
+				phf->slots[slot[i]].field = members[i];
+			}
+			phf->disp[bucket] = (uint16_t)d;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static inline bool
+cbor_phf_build(struct cbor_phf *phf, const char *const *keys, const uint64_t *hash)
+{
+	uint32_t nkeys    = phf->nkeys;
+	uint32_t nbuckets = phf->nbuckets;
+	uint32_t start[CBOR_PHF_MAX_BUCKETS + 1];
+	uint32_t fill[CBOR_PHF_MAX_BUCKETS];
+	uint32_t order[CBOR_PHF_MAX_BUCKETS];
+	uint32_t members[CBOR_PHF_MAX_KEYS];
+	uint32_t norder = 0;
+
+	/* Group the keys by bucket. */
+	memset(start, 0, sizeof(start));
+	for ( uint32_t i = 0; i < nkeys; i++ ) {
+		start[cbor_phf_bucket(hash[i], nbuckets) + 1]++;
+	}
+	for ( uint32_t b = 0; b < nbuckets; b++ ) {
+		start[b + 1] += start[b];
+		fill[b]       = start[b];
+	}
+	for ( uint32_t i = 0; i < nkeys; i++ ) {
+		members[fill[cbor_phf_bucket(hash[i], nbuckets)]++] = i;
+	}
+
+	/* Largest buckets first, while most slots are free. */
+	for ( uint32_t size = nkeys; size > 0; size-- ) {
+		for ( uint32_t b = 0; b < nbuckets; b++ ) {
+			if ( start[b + 1] - start[b] == size ) {
+				order[norder++] = b;
+			}
+		}
+	}
+
+	memset(phf->disp, 0, sizeof(phf->disp));
+	for ( uint32_t i = 0; i < nkeys; i++ ) {
+		phf->slots[i].key = NULL;
+	}
+	for ( uint32_t i = 0; i < norder; i++ ) {
+		uint32_t b = order[i];
+
+		if ( !cbor_phf_place(phf, hash, members + start[b], start[b + 1] - start[b], b) ) {
+			return false;
+		}
+		for ( uint32_t j = start[b]; j < start[b + 1]; j++ ) {
+			uint32_t s = cbor_phf_slot(hash[members[j]], phf->disp[b], nkeys);
+
+			phf->slots[s].key = keys[members[j]];
+			phf->slots[s].len = (uint32_t)strlen(keys[members[j]]);
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Build the table for keys[0..nkeys); the field index of a key is its
+ * position in keys. Fails for an empty or oversized set and for duplicate
+ * keys.
+ */
+static inline bool
+cbor_phf_init(struct cbor_phf *phf, const char *const *keys, size_t nkeys)
+{
+	uint64_t hash[CBOR_PHF_MAX_KEYS];
+
+	if ( nkeys == 0 || nkeys > CBOR_PHF_MAX_KEYS ) {
+		return false;
+	}
+	for ( size_t i = 0; i < nkeys; i++ ) {
+		for ( size_t j = 0; j < i; j++ ) {
+			if ( strcmp(keys[i], keys[j]) == 0 ) {
+				return false;
+			}
+		}
+	}
+
+	phf->nkeys    = (uint32_t)nkeys;
+	phf->nbuckets = (uint32_t)(nkeys + 1) / 2;
+
+	for ( uint64_t n = 1; n <= CBOR_PHF_SEEDS; n++ ) {
+		phf->seed = cbor_phf_mix(n * 0x9e3779b97f4a7c15ULL);
+		for ( size_t i = 0; i < nkeys; i++ ) {
+			hash[i] = cbor_phf_hash((const uint8_t *)keys[i], strlen(keys[i]), phf->seed);
+		}
+		if ( cbor_phf_build(phf, keys, hash) ) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* Field index of key, false if it is not in the set. */
+static inline bool
+cbor_phf_lookup(const struct cbor_phf *phf, const void *key, size_t len, size_t *field)
+{
+	uint64_t                    h    = cbor_phf_hash(key, len, phf->seed);
+	uint32_t                    b    = cbor_phf_bucket(h, phf->nbuckets);
+	const struct cbor_phf_slot *slot = &phf->slots[cbor_phf_slot(h, phf->disp[b], phf->nkeys)];
+
+	if ( slot->len != len || memcmp(slot->key, key, len) != 0 ) {
+		return false;
+	}
+	*field = slot->field;
+
+	return true;
+}
+
+/*
+ * Called with the cursor on the value of a known key. A handler reads
+ * exactly that value, or returns false with the error recorded in buf.
+ */
+typedef bool (*cbor_phf_handler)(void *arg, size_t field, struct cbor_buf *buf);
+
+static inline bool
+cbor_phf_read_pair(const struct cbor_phf *phf, struct cbor_buf *buf, const cbor_phf_handler *handlers, void *arg)
+{
+	size_t idx   = buf->idx;
+	size_t field = 0;
+	bool   known = false;
+
+	/* Only definite text keys can be in the set, anything else is skipped. */
+	if ( idx < buf->len && buf->data[idx] >> 5 == CBOR_MAJOR_TEXT && buf->data[idx] != 0x7f ) {
+		uint8_t *key = NULL;
+		size_t   len = 0;
+
+		if ( !cbor_read_string(buf, CBOR_MAJOR_TEXT, &key, &len) ) {
+			return false;
+		}
+		known = cbor_phf_lookup(phf, key, len, &field);
+	} else if ( !cbor_skip_item(buf) ) {
+		return false;
+	}
+
+	if ( known && handlers[field] != NULL ) {
+		return handlers[field](arg, field, buf);
+	}
+
+	return cbor_skip_item(buf);
+}
+
+/*
+ * Walk a map, definite or indefinite length, and pass the value of every
+ * key in the set to handlers[field]. Values of unknown keys and of fields
+ * without a handler are skipped. On failure the cursor is left on the map;
+ * handlers that already ran are not undone.
+ */
+static inline bool
+cbor_phf_read_map(const struct cbor_phf *phf, struct cbor_buf *buf, const cbor_phf_handler *handlers, void *arg)
+{
+	size_t           start = buf->idx;
+	uint64_t         items = buf->items;
+	struct cbor_head head;
+
+	if ( !cbor_check_major(buf, CBOR_MAJOR_MAP) || !cbor_read_head(buf, &head) ) {
+		goto fail;
+	}
+
+	if ( head.indefinite ) {
+		while ( !cbor_is_break(buf) ) {
+			if ( !cbor_phf_read_pair(phf, buf, handlers, arg) ) {
+				goto fail;
+			}
+		}
+		if ( !cbor_expect_break(buf) ) {
+			goto fail;
+		}
+		return true;
+	}
+
+	if ( !cbor_check_container(buf, head.arg, start) ) {
+		goto fail;
+	}
+	for ( uint64_t i = 0; i < head.arg; i++ ) {
+		if ( !cbor_phf_read_pair(phf, buf, handlers, arg) ) {
+			goto fail;
+		}
+	}
+
+	return true;
+
+fail:
+	buf->idx   = start;
+	buf->items = items;
+
+	return false;
+}
+
+#endif /* LIBCBOR_CBOR_PHF_H */
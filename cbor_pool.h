@@ -0,0 +1,333 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_POOL_H
+#define LIBCBOR_CBOR_POOL_H
+
+#include "cbor.h"
+
+/*
+ * Pool of encode buffers in power of two size classes. Each thread owns a
+ * struct cbor_pool_cache and gets and puts buffers through it without
+ * locks; in the steady state no allocator calls are made. A buffer put by
+ * another thread is pushed onto a lock-free stash of its owning cache,
+ * which the owner takes over in one exchange when it runs dry.
+ *
+ * Blocks are cache line aligned and start with a one line header, the
+ * buffer data follows it. Requests above the largest class are served
+ * straight from malloc() and freed on put.
+ *
+ * cbor_pool_trim() returns cached blocks beyond the high water mark of
+ * blocks in use since the previous trim, so a burst does not pin memory
+ * forever. A cache must outlive the blocks it handed out, including those
+ * still held by other threads.
+ */
+
+#define CBOR_POOL_LINE      64
+#define CBOR_POOL_MIN_SHIFT 8       /* 256 bytes */
+
+#ifndef CBOR_POOL_CLASSES
+#define CBOR_POOL_CLASSES   13      /* up to 1 MiB */
+#endif
+
+#define CBOR_POOL_HUGE      CBOR_POOL_CLASSES
+
+struct cbor_pool_cache;
+
+struct cbor_pool_block {
+	struct cbor_pool_block *next;
+	struct cbor_pool_cache *owner;
+	void                   *base;   /* as returned by malloc() */
+	size_t                  size_class;
+	uint8_t                 pad[CBOR_POOL_LINE - 3 * sizeof(void *) - sizeof(size_t)];
+};
+
+struct cbor_pool_stats {
+	uint64_t gets;
+	uint64_t hits;          /* served from the cache */
+	uint64_t allocs;        /* served by malloc() */
+	uint64_t puts;
+	uint64_t remote_puts;   /* put into another thread's stash */
+	uint64_t remote_takes;  /* taken back from our stash */
+	uint64_t trimmed;       /* blocks freed by cbor_pool_trim() */
+	size_t   cached_bytes;
+};
+
+struct cbor_pool_class {
+	struct cbor_pool_block *free;
+	size_t                  cached;
+	size_t                  in_use;
+	size_t                  peak;   /* in_use high water since the last trim */
+};
+
+struct cbor_pool_cache {
+	struct cbor_pool_class  classes[CBOR_POOL_CLASSES];
+	struct cbor_pool_stats  stats;
+
+	/* Written by other threads, kept off the lines above. */
+	uint8_t                 pad[CBOR_POOL_LINE];
+	struct cbor_pool_block *remote;
+};
+
+static inline void
+cbor_pool_init(struct cbor_pool_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+}
+
+static inline size_t
+cbor_pool_class_size(size_t size_class)
+{
+	return (size_t)1 << (CBOR_POOL_MIN_SHIFT + size_class);
+}
+
+static inline size_t
+cbor_pool_class_of(size_t size)
+{
+	if ( size <= cbor_pool_class_size(0) ) {
+		return 0;
+	}
+
+	size_t size_class = (size_t)(64 - __builtin_clzll((unsigned long long)size - 1)) - CBOR_POOL_MIN_SHIFT;
+
+	return size_class < CBOR_POOL_CLASSES ? size_class : CBOR_POOL_HUGE;
+}
+
+static inline struct cbor_pool_block *
+cbor_pool_block_of(struct cbor_buf *buf)
+{
+	return (struct cbor_pool_block *)(buf->data - sizeof(struct cbor_pool_block));
+}
+
+static inline struct cbor_pool_block *
+cbor_pool_alloc(struct cbor_pool_cache *cache, size_t size_class, size_t size)
+{
+	void                   *base = malloc(sizeof(struct cbor_pool_block) + size + CBOR_POOL_LINE - 1);
+	struct cbor_pool_block *block;
+
+	if ( base == NULL ) {
+		return NULL;
+	}
+	block = (struct cbor_pool_block *)(((uintptr_t)base + CBOR_POOL_LINE - 1) & ~(uintptr_t)(CBOR_POOL_LINE - 1));
+	block->next       = NULL;
+	block->owner      = cache;
+	block->base       = base;
+	block->size_class = size_class;
+	cache->stats.allocs++;
+
+	return block;
+}
+
+/* Move the blocks other threads put back onto our free lists. */
+static inline bool
+cbor_pool_take_remote(struct cbor_pool_cache *cache)
+{
+	struct cbor_pool_block *block;
+
+	if ( __atomic_load_n(&cache->remote, __ATOMIC_RELAXED) == NULL ) {
+		return false;
+	}
+
+	block = __atomic_exchange_n(&cache->remote, NULL, __ATOMIC_ACQUIRE);
+	while ( block != NULL ) {
+		struct cbor_pool_block *next = block->next;
+		struct cbor_pool_class *pc   = &cache->classes[block->size_class];
+
+		block->next = pc->free;
+		pc->free    = block;
+		pc->cached++;
+		pc->in_use--;
+		cache->stats.remote_takes++;
+		cache->stats.cached_bytes += cbor_pool_class_size(block->size_class);
+		block = next;
+	}
+
+	return true;
+}
+
+/*
+ * Point buf at a buffer of at least size bytes. The capacity is that of
+ * the size class. buf->data must not be changed until the buffer is put.
+ */
+static inline bool
+cbor_pool_get(struct cbor_pool_cache *cache, struct cbor_buf *buf, size_t size)
+{
+	size_t                  size_class = cbor_pool_class_of(size);
+	struct cbor_pool_block *block;
+
+	cache->stats.gets++;
+
+	if ( size_class == CBOR_POOL_HUGE ) {
+		block = cbor_pool_alloc(cache, size_class, size);
+		if ( block == NULL ) {
+			return false;
+		}
+		cbor_buf_init_empty(buf, block + 1, size);
+		return true;
+	}
+
+	struct cbor_pool_class *pc = &cache->classes[size_class];
+
+	if ( pc->free == NULL ) {
+		cbor_pool_take_remote(cache);
+	}
+
+	block = pc->free;
+	if ( block != NULL ) {
+		pc->free = block->next;
+		pc->cached--;
+		cache->stats.hits++;
+		cache->stats.cached_bytes -= cbor_pool_class_size(size_class);
+	} else {
+		block = cbor_pool_alloc(cache, size_class, cbor_pool_class_size(size_class));
+		if ( block == NULL ) {
+			return false;
+		}
+	}
+
+	if ( ++pc->in_use > pc->peak ) {
+		pc->peak = pc->in_use;
+	}
+	cbor_buf_init_empty(buf, block + 1, cbor_pool_class_size(size_class));
+
+	return true;
+}
+
+/* Give the buffer in buf back, cache is the calling thread's cache. */
+static inline void
+cbor_pool_put(struct cbor_pool_cache *cache, struct cbor_buf *buf)
+{
+	struct cbor_pool_block *block = cbor_pool_block_of(buf);
+	struct cbor_pool_cache *owner = block->owner;
+
+	cache->stats.puts++;
+	buf->data = NULL;
+	buf->len  = 0;
+	buf->cap  = 0;
+	buf->idx  = 0;
+
+	if ( block->size_class == CBOR_POOL_HUGE ) {
+		free(block->base);
+		return;
+	}
+
+	if ( owner != cache ) {
+		block->next = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+		while ( !__atomic_compare_exchange_n(&owner->remote, &block->next, block, true,
+		                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED) ) {
+			/* block->next was reloaded by the failed exchange. */
+		}
+		cache->stats.remote_puts++;
+		return;
+	}
+
+	struct cbor_pool_class *pc = &cache->classes[block->size_class];
+
+	block->next = pc->free;
+	pc->free    = block;
+	pc->cached++;
+	pc->in_use--;
+	cache->stats.cached_bytes += cbor_pool_class_size(block->size_class);
+}
+
+/*
+ * Move the contents of buf into a buffer twice as large, for an encoder
+ * that ran out of space. The cursor and error state are kept.
+ */
+static inline bool
+cbor_pool_grow(struct cbor_pool_cache *cache, struct cbor_buf *buf)
+{
+	struct cbor_buf grown;
+
+	if ( !cbor_pool_get(cache, &grown, buf->cap * 2) ) {
+		return false;
+	}
+	memcpy(grown.data, buf->data, buf->len);
+
+	uint8_t *data = grown.data;
+	size_t   cap  = grown.cap;
+
+	grown      = *buf;
+	grown.data = data;
+	grown.cap  = cap;
+	cbor_pool_put(cache, buf);
+	*buf = grown;
+
+	return true;
+}
+
+/*
+ * Free cached blocks beyond what the high water mark of blocks in use
+ * since the previous trim says is needed, then start a new period. Call it
+ * periodically, e.g. once a second or every few thousand requests.
+ */
+static inline size_t
+cbor_pool_trim(struct cbor_pool_cache *cache)
+{
+	size_t trimmed = 0;
+
+	cbor_pool_take_remote(cache);
+
+	for ( size_t size_class = 0; size_class < CBOR_POOL_CLASSES; size_class++ ) {
+		struct cbor_pool_class *pc   = &cache->classes[size_class];
+		size_t                  keep = pc->peak - pc->in_use;
+
+		while ( pc->cached > keep ) {
+			struct cbor_pool_block *block = pc->free;
+
+			pc->free = block->next;
+			pc->cached--;
+			cache->stats.cached_bytes -= cbor_pool_class_size(size_class);
+			free(block->base);
+			trimmed++;
+		}
+		pc->peak = pc->in_use;
+	}
+	cache->stats.trimmed += trimmed;
+
+	return trimmed;
+}
+
+/* Free every cached block. Blocks still in use must not be put afterwards. */
+static inline void
+cbor_pool_destroy(struct cbor_pool_cache *cache)
+{
+	cbor_pool_take_remote(cache);
+
+	for ( size_t size_class = 0; size_class < CBOR_POOL_CLASSES; size_class++ ) {
+		struct cbor_pool_class *pc = &cache->classes[size_class];
+
+		while ( pc->free != NULL ) {
+			struct cbor_pool_block *block = pc->free;
+
+			pc->free = block->next;
+			free(block->base);
+		}
+		pc->cached = 0;
+	}
+	cache->stats.cached_bytes = 0;
+}
+
+#endif /* LIBCBOR_CBOR_POOL_H */
@@ -0,0 +1,225 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_RING_H
+#define LIBCBOR_CBOR_RING_H
+
+#include "cbor.h"
+
+/*
+ * Ring of encode buffers for handing records from producer threads to one
+ * consumer without locks or copies. A producer reserves a contiguous slot,
+ * encodes into it through a struct cbor_buf and commits it with a release
+ * store of the slot header. The consumer drains committed records in order
+ * and releases their space in one store per batch.
+ *
+ * The ring is split into 64 byte chunks and every record starts on a chunk
+ * with an 8 byte header: length, chunk count and a committed bit. Before
+ * space is handed back the consumer clears the header word of every chunk
+ * it consumed, so a chunk reused by the next record never looks committed.
+ * A record that would straddle the end is preceded by an empty padding
+ * record running to the end of the ring.
+ *
+ * Single producer rings take the slot with plain stores, multi producer
+ * rings with a compare and swap on the tail. The memory orders are those
+ * of C11 atomics, spelled with the __atomic builtins to stay within C99.
+ */
+
+#define CBOR_RING_CHUNK     64
+#define CBOR_RING_HEADER    sizeof(uint64_t)
+#define CBOR_RING_COMMITTED ((uint64_t)1 << 63)
+
+struct cbor_ring {
+	uint8_t *data;
+	uint64_t size;
+	bool     multi;
+
+	/* Producer side. */
+	uint64_t tail __attribute__((aligned(CBOR_RING_CHUNK)));
+	uint64_t head_cache;
+
+	/* Consumer side. */
+	uint64_t head __attribute__((aligned(CBOR_RING_CHUNK)));
+};
+
+/* Called per record. Return false to end the batch after this record. */
+typedef bool (*cbor_ring_fn)(void *arg, struct cbor_buf *record);
+
+/*
+ * Use data as a ring. size must be a power of two of at least two chunks
+ * and data aligned to a chunk.
+ */
+static inline bool
+cbor_ring_init(struct cbor_ring *ring, void *data, size_t size, bool multi)
+{
+	if ( size < 2 * CBOR_RING_CHUNK || (size & (size - 1)) != 0 || (uintptr_t)data % CBOR_RING_CHUNK != 0 ) {
+		return false;
+	}
+
+	memset(data, 0, size);
+	ring->data       = data;
+	ring->size       = size;
+	ring->multi      = multi;
+	ring->tail       = 0;
+	ring->head_cache = 0;
+	ring->head       = 0;
+
+	return true;
+}
+
+static inline uint64_t
+cbor_ring_chunks(size_t size)
+{
+	return (CBOR_RING_HEADER + size + CBOR_RING_CHUNK - 1) / CBOR_RING_CHUNK;
+}
+
+/* Whether [tail, next) is free, refreshing the cached consumer position. */
+static inline bool
+cbor_ring_room(struct cbor_ring *ring, uint64_t next)
+{
+	uint64_t head = ring->multi ? __atomic_load_n(&ring->head_cache, __ATOMIC_ACQUIRE) : ring->head_cache;
+
+	if ( next - head <= ring->size ) {
+		return true;
+	}
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if ( ring->multi ) {
+		__atomic_store_n(&ring->head_cache, head, __ATOMIC_RELEASE);
+	} else {
+		ring->head_cache = head;
+	}
+
+	return next - head <= ring->size;
+}
+
+/*
+ * Reserve a slot for a record of up to size bytes and point buf at it.
+ * Returns false if the ring is full; nothing is reserved then.
+ */
+static inline bool
+cbor_ring_reserve(struct cbor_ring *ring, struct cbor_buf *buf, size_t size)
+{
+	uint64_t bytes = cbor_ring_chunks(size) * CBOR_RING_CHUNK;
+	uint64_t mask  = ring->size - 1;
+	uint64_t tail  = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	uint64_t pad;
+	uint64_t next;
+
+	if ( bytes > ring->size / 2 ) {
+		return false;
+	}
+
+	do {
+		uint64_t off = tail & mask;
+
+		pad  = off + bytes > ring->size ? ring->size - off : 0;
+		next = tail + pad + bytes;
+		if ( !cbor_ring_room(ring, next) ) {
+			return false;
+		}
+		if ( !ring->multi ) {
+			__atomic_store_n(&ring->tail, next, __ATOMIC_RELAXED);
+			break;
+		}
+	} while ( !__atomic_compare_exchange_n(&ring->tail, &tail, next, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) );
+
+	if ( pad > 0 ) {
+		uint64_t *header = (uint64_t *)(ring->data + (tail & mask));
+
+		__atomic_store_n(header, CBOR_RING_COMMITTED | (pad / CBOR_RING_CHUNK) << 32, __ATOMIC_RELEASE);
+		tail += pad;
+	}
+
+	cbor_buf_init_empty(buf, ring->data + (tail & mask) + CBOR_RING_HEADER, size);
+
+	return true;
+}
+
+/*
+ * Publish the record encoded into buf. Committing a record with nothing in
+ * it releases an abandoned reservation; the consumer skips it.
+ */
+static inline void
+cbor_ring_commit(struct cbor_ring *ring, struct cbor_buf *buf)
+{
+	uint64_t *header = (uint64_t *)(buf->data - CBOR_RING_HEADER);
+
+	(void)ring;
+	__atomic_store_n(header, CBOR_RING_COMMITTED | cbor_ring_chunks(buf->cap) << 32 | (uint32_t)buf->len,
+	                 __ATOMIC_RELEASE);
+}
+
+/*
+ * Pass up to max committed records to fn, in reservation order. Records
+ * point into the ring and stay valid until fn returns. Returns the number
+ * of records consumed, including skipped ones.
+ */
+static inline size_t
+cbor_ring_drain(struct cbor_ring *ring, cbor_ring_fn fn, void *arg, size_t max)
+{
+	uint8_t *data  = ring->data;
+	uint64_t mask  = ring->size - 1;
+	uint64_t head  = ring->head;
+	uint64_t start = head;
+	size_t   count = 0;
+	bool     more  = true;
+
+	/* Headers are cleared at the end, so a batch must not wrap onto itself. */
+	while ( more && count < max && head - start < ring->size ) {
+		uint8_t *record = data + (head & mask);
+		uint64_t header = __atomic_load_n((uint64_t *)record, __ATOMIC_ACQUIRE);
+
+		if ( !(header & CBOR_RING_COMMITTED) ) {
+			break;
+		}
+
+		uint64_t chunks = (header >> 32) & 0x7fffffff;
+		size_t   len    = (uint32_t)header;
+
+		if ( len > 0 ) {
+			struct cbor_buf buf;
+
+			cbor_buf_init(&buf, record + CBOR_RING_HEADER, len, len);
+			more = fn(arg, &buf);
+		}
+		head += chunks * CBOR_RING_CHUNK;
+		count++;
+	}
+
+	if ( head == start ) {
+		return 0;
+	}
+
+	/* Clear the headers of the consumed chunks before handing them back. */
+	for ( uint64_t pos = start; pos != head; pos += CBOR_RING_CHUNK ) {
+		__atomic_store_n((uint64_t *)(data + (pos & mask)), 0, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+	return count;
+}
+
+#endif /* LIBCBOR_CBOR_RING_H */
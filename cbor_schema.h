@@ -0,0 +1,1187 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef LIBCBOR_CBOR_SCHEMA_H
+#define LIBCBOR_CBOR_SCHEMA_H
+
+#include "cbor.h"
+
+/*
+ * Validation against a subset of CDDL (RFC 8610). A schema is compiled once
+ * into a flat node table; cbor_schema_validate() then walks an item and the
+ * table together, reading heads with cbor_read_head() and skipping parts
+ * the schema does not look into with cbor_skip_item(). Nothing is
+ * allocated, and the compiled schema holds no pointers, so it can be built
+ * at startup or ahead of time and copied around as plain data.
+ *
+ * Supported:
+ *   rules          name = type, the first rule is the root
+ *   types          any uint nint int bstr bytes tstr text bool true false
+ *                  nil null undefined float float16 float32 float64
+ *   literals       integers, "text"
+ *   ranges         lo..hi, lo...hi (integers)
+ *   choices        a / b
+ *   arrays         [ entries ], entries may carry labels (name: type)
+ *   maps           { key: type, "key": type, 1: type, tstr => type }
+ *   occurrences    ? * + n*m
+ *   tags           #6.n(type)
+ *
+ * Array entries match greedily without backtracking. Literal map keys and
+ * text literals are compared as encoded bytes, so the input must use the
+ * shortest heads. Map keys are looked up among the literal keys first; a
+ * key matched by a key type instead commits to its entry. Nesting counts
+ * against max_depth as in cbor_skip_item(); tags open no level, but a
+ * chain of more than CBOR_MAX_DEPTH tags is rejected.
+ * Comments run from ; to the end of the line.
+ */
+
+#ifndef CBOR_SCHEMA_MAX_NODES
+#define CBOR_SCHEMA_MAX_NODES 256
+#endif
+
+#ifndef CBOR_SCHEMA_MAX_POOL
+#define CBOR_SCHEMA_MAX_POOL 1024
+#endif
+
+#ifndef CBOR_SCHEMA_MAX_RULES
+#define CBOR_SCHEMA_MAX_RULES 32
+#endif
+
+#define CBOR_SCHEMA_MAX_KEYS      64    /* literal keys per map */
+#define CBOR_SCHEMA_MAX_WILDCARDS 4     /* key type entries per map */
+#define CBOR_SCHEMA_UNBOUNDED     UINT64_MAX
+
+enum cbor_schema_kind {
+	CBOR_SCHEMA_ANY,
+	CBOR_SCHEMA_MAJOR,      /* any item of major type lo */
+	CBOR_SCHEMA_INT,        /* integer in lo..hi */
+	CBOR_SCHEMA_SIMPLE,     /* simple value in lo..hi */
+	CBOR_SCHEMA_FLOAT,      /* float, lo is a mask of 1 << (info - 25) */
+	CBOR_SCHEMA_LITERAL,    /* encoded item in the pool */
+	CBOR_SCHEMA_ARRAY,
+	CBOR_SCHEMA_MAP,
+	CBOR_SCHEMA_ENTRY,
+	CBOR_SCHEMA_CHOICE,
+	CBOR_SCHEMA_TAG,
+	CBOR_SCHEMA_REF
+};
+
+/* Node 0 is unused so that 0 can mean "none" in the links. */
+struct cbor_schema_node {
+	uint8_t  kind;
+	uint16_t next;          /* next alternative or entry */
+	uint16_t child;         /* alternatives, entries, value or target */
+	uint16_t key;           /* map entry key type */
+	uint16_t bytes;         /* literal or name in the pool */
+	uint16_t bytes_len;
+	uint64_t min;           /* entry occurrences, tag number, 1 for an int literal */
+	uint64_t max;
+	int128_t lo;
+	int128_t hi;
+};
+
+struct cbor_schema_rule {
+	uint16_t name;
+	uint16_t name_len;
+	uint16_t node;
+};
+
+struct cbor_schema {
+	struct cbor_schema_node nodes[CBOR_SCHEMA_MAX_NODES];
+	size_t                  nnodes;
+	struct cbor_schema_rule rules[CBOR_SCHEMA_MAX_RULES];
+	size_t                  nrules;
+	uint8_t                 pool[CBOR_SCHEMA_MAX_POOL];
+	size_t                  pool_len;
+	uint16_t                root;
+};
+
+static inline void
+cbor_schema_space(struct cbor_buf *text)
+{
+	uint8_t *data = text->data;
+	size_t   len  = text->len;
+	size_t   idx  = text->idx;
+
+	while ( idx < len ) {
+		uint8_t c = data[idx];
+
+		if ( c == ';' ) {
+			while ( idx < len && data[idx] != '\n' ) {
+				idx++;
+			}
+		} else if ( c == ' ' || c == '\t' || c == '\n' || c == '\r' ) {
+			idx++;
+		} else {
+			break;
+		}
+	}
+	text->idx = idx;
+}
+
+static inline bool
+cbor_schema_accept(struct cbor_buf *text, const char *token)
+{
+	size_t len = strlen(token);
+
+	cbor_schema_space(text);
+	if ( text->len - text->idx < len || memcmp(text->data + text->idx, token, len) != 0 ) {
+		return false;
+	}
+	text->idx += len;
+
+	return true;
+}
+
+static inline bool
+cbor_schema_expect(struct cbor_buf *text, const char *token)
+{
+	if ( cbor_schema_accept(text, token) ) {
+		return true;
+	}
+
+	return cbor_buf_fail(text, text->idx < text->len ? CBOR_ERR_SYNTAX : CBOR_ERR_TRUNCATED, 0);
+}
+
+static inline bool
+cbor_schema_name_char(uint8_t c, bool first)
+{
+	if ( (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$' || c == '@' ) {
+		return true;
+	}
+
+	return !first && ((c >= '0' && c <= '9') || c == '-');
+}
+
+static inline size_t
+cbor_schema_name(struct cbor_buf *text)
+{
+	size_t idx;
+
+	cbor_schema_space(text);
+	idx = text->idx;
+	while ( idx < text->len && cbor_schema_name_char(text->data[idx], idx == text->idx) ) {
+		idx++;
+	}
+
+	return idx - text->idx;
+}
+
+static inline uint16_t
+cbor_schema_node(struct cbor_schema *schema, struct cbor_buf *text, enum cbor_schema_kind kind)
+{
+	struct cbor_schema_node *node;
+
+	if ( schema->nnodes >= CBOR_SCHEMA_MAX_NODES ) {
+		cbor_buf_fail(text, CBOR_ERR_LIMIT, 0);
+		return 0;
+	}
+	node = &schema->nodes[schema->nnodes];
+	memset(node, 0, sizeof(*node));
+	node->kind = (uint8_t)kind;
+
+	return (uint16_t)schema->nnodes++;
+}
+
+static inline uint8_t *
+cbor_schema_reserve(struct cbor_schema *schema, struct cbor_buf *text, size_t size)
+{
+	if ( size > CBOR_SCHEMA_MAX_POOL - schema->pool_len ) {
+		cbor_buf_fail(text, CBOR_ERR_LIMIT, 0);
+		return NULL;
+	}
+
+	return schema->pool + schema->pool_len;
+}
+
+/* Encode an integer literal as a map key. */
+static inline bool
+cbor_schema_encode_int(struct cbor_schema *schema, struct cbor_buf *text, struct cbor_schema_node *node)
+{
+	int      major = node->lo < 0 ? CBOR_MAJOR_NEGINT : CBOR_MAJOR_UINT;
+	uint64_t arg   = node->lo < 0 ? (uint64_t)(-1 - node->lo) : (uint64_t)node->lo;
+	uint8_t *dst   = cbor_schema_reserve(schema, text, 9);
+
+	if ( dst == NULL ) {
+		return false;
+	}
+	node->kind      = CBOR_SCHEMA_LITERAL;
+	node->bytes     = (uint16_t)schema->pool_len;
+	node->bytes_len = (uint16_t)cbor_encode_head(dst, major, arg);
+	schema->pool_len += node->bytes_len;
+
+	return true;
+}
+
+/* Encode a text literal, the opening quote is consumed. */
+static inline uint16_t
+cbor_schema_text(struct cbor_schema *schema, struct cbor_buf *text, const uint8_t *name, size_t name_len)
+{
+	uint16_t n   = cbor_schema_node(schema, text, CBOR_SCHEMA_LITERAL);
+	uint8_t *dst = cbor_schema_reserve(schema, text, 9 + name_len);
+	size_t   len = 0;
+
+	if ( n == 0 || dst == NULL ) {
+		return 0;
+	}
+
+	if ( name != NULL ) {
+		memcpy(dst + 9, name, name_len);
+		len = name_len;
+	} else {
+		for ( ;; ) {
+			if ( text->idx >= text->len ) {
+				cbor_buf_fail(text, CBOR_ERR_TRUNCATED, 0);
+				return 0;
+			}
+
+			uint8_t c = text->data[text->idx++];
+
+			if ( c == '"' ) {
+				break;
+			}
+			if ( c == '\\' ) {
+				if ( text->idx >= text->len ) {
+					cbor_buf_fail(text, CBOR_ERR_TRUNCATED, 0);
+					return 0;
+				}
+				c = text->data[text->idx++];
+			}
+			if ( 9 + len >= CBOR_SCHEMA_MAX_POOL - schema->pool_len ) {
+				cbor_buf_fail(text, CBOR_ERR_LIMIT, 0);
+				return 0;
+			}
+			dst[9 + len++] = c;
+		}
+	}
+
+	size_t head = cbor_encode_head(dst, CBOR_MAJOR_TEXT, len);
+
+	memmove(dst + head, dst + 9, len);
+
+	struct cbor_schema_node *node = &schema->nodes[n];
+
+	node->bytes      = (uint16_t)schema->pool_len;
+	node->bytes_len  = (uint16_t)(head + len);
+	schema->pool_len += head + len;
+
+	return n;
+}
+
+static inline bool
+cbor_schema_integer(struct cbor_buf *text, int128_t *value)
+{
+	uint8_t *data     = text->data;
+	bool     negative = false;
+	int128_t n        = 0;
+	size_t   digits   = 0;
+
+	cbor_schema_space(text);
+	if ( text->idx < text->len && data[text->idx] == '-' ) {
+		negative = true;
+		text->idx++;
+	}
+	while ( text->idx < text->len && data[text->idx] >= '0' && data[text->idx] <= '9' ) {
+		n = n * 10 + (data[text->idx++] - '0');
+		if ( n > (int128_t)UINT64_MAX + 1 ) {
+			return cbor_buf_fail(text, CBOR_ERR_OVERFLOW, 0);
+		}
+		digits++;
+	}
+	if ( digits == 0 ) {
+		return cbor_buf_fail(text, text->idx < text->len ? CBOR_ERR_SYNTAX : CBOR_ERR_TRUNCATED, 0);
+	}
+	if ( !negative && n > (int128_t)UINT64_MAX ) {
+		return cbor_buf_fail(text, CBOR_ERR_OVERFLOW, 0);
+	}
+	*value = negative ? -n : n;
+
+	return true;
+}
+
+static inline bool
+cbor_schema_is(struct cbor_buf *text, size_t len, const char *name)
+{
+	return strlen(name) == len && memcmp(text->data + text->idx, name, len) == 0;
+}
+
+/* Builtin type names, false if name is a rule reference. */
+static inline bool
+cbor_schema_builtin(struct cbor_buf *text, size_t len, struct cbor_schema_node *node)
+{
+	if ( cbor_schema_is(text, len, "any") ) {
+		node->kind = CBOR_SCHEMA_ANY;
+	} else if ( cbor_schema_is(text, len, "uint") ) {
+		node->kind = CBOR_SCHEMA_INT;
+		node->lo   = 0;
+		node->hi   = UINT64_MAX;
+	} else if ( cbor_schema_is(text, len, "nint") ) {
+		node->kind = CBOR_SCHEMA_INT;
+		node->lo   = -(int128_t)UINT64_MAX - 1;
+		node->hi   = -1;
+	} else if ( cbor_schema_is(text, len, "int") ) {
+		node->kind = CBOR_SCHEMA_INT;
+		node->lo   = -(int128_t)UINT64_MAX - 1;
+		node->hi   = UINT64_MAX;
+	} else if ( cbor_schema_is(text, len, "bstr") || cbor_schema_is(text, len, "bytes") ) {
+		node->kind = CBOR_SCHEMA_MAJOR;
+		node->lo   = CBOR_MAJOR_BYTES;
+	} else if ( cbor_schema_is(text, len, "tstr") || cbor_schema_is(text, len, "text") ) {
+		node->kind = CBOR_SCHEMA_MAJOR;
+		node->lo   = CBOR_MAJOR_TEXT;
+	} else if ( cbor_schema_is(text, len, "bool") ) {
+		node->kind = CBOR_SCHEMA_SIMPLE;
+		node->lo   = 20;
+		node->hi   = 21;
+	} else if ( cbor_schema_is(text, len, "false") ) {
+		node->kind = CBOR_SCHEMA_SIMPLE;
+		node->lo   = node->hi = 20;
+	} else if ( cbor_schema_is(text, len, "true") ) {
+		node->kind = CBOR_SCHEMA_SIMPLE;
+		node->lo   = node->hi = 21;
+	} else if ( cbor_schema_is(text, len, "nil") || cbor_schema_is(text, len, "null") ) {
+		node->kind = CBOR_SCHEMA_SIMPLE;
+		node->lo   = node->hi = 22;
+	} else if ( cbor_schema_is(text, len, "undefined") ) {
+		node->kind = CBOR_SCHEMA_SIMPLE;
+		node->lo   = node->hi = 23;
+	} else if ( cbor_schema_is(text, len, "float") ) {
+		node->kind = CBOR_SCHEMA_FLOAT;
+		node->lo   = 7;
+	} else if ( cbor_schema_is(text, len, "float16") ) {
+		node->kind = CBOR_SCHEMA_FLOAT;
+		node->lo   = 1;
+	} else if ( cbor_schema_is(text, len, "float32") ) {
+		node->kind = CBOR_SCHEMA_FLOAT;
+		node->lo   = 2;
+	} else if ( cbor_schema_is(text, len, "float64") ) {
+		node->kind = CBOR_SCHEMA_FLOAT;
+		node->lo   = 4;
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+static inline uint16_t cbor_schema_type(struct cbor_schema *schema, struct cbor_buf *text, size_t depth);
+
+/* Entries of an array or map up to the closing bracket. */
+static inline uint16_t
+cbor_schema_group(struct cbor_schema *schema, struct cbor_buf *text, enum cbor_schema_kind kind,
+                  const char *close, size_t depth)
+{
+	uint16_t group = cbor_schema_node(schema, text, kind);
+	uint16_t last  = 0;
+	size_t   keys  = 0;
+	size_t   wild  = 0;
+
+	if ( group == 0 ) {
+		return 0;
+	}
+
+	while ( !cbor_schema_accept(text, close) ) {
+		uint16_t entry = cbor_schema_node(schema, text, CBOR_SCHEMA_ENTRY);
+		uint64_t min   = 1;
+		uint64_t max   = 1;
+		uint16_t key   = 0;
+		uint16_t value;
+
+		if ( entry == 0 ) {
+			return 0;
+		}
+
+		cbor_schema_space(text);
+		if ( cbor_schema_accept(text, "?") ) {
+			min = 0;
+		} else if ( cbor_schema_accept(text, "+") ) {
+			max = CBOR_SCHEMA_UNBOUNDED;
+		} else {
+			size_t   save = text->idx;
+			int128_t n;
+
+			min = 0;
+			max = CBOR_SCHEMA_UNBOUNDED;
+			if ( text->idx < text->len && text->data[text->idx] >= '0' && text->data[text->idx] <= '9' ) {
+				if ( !cbor_schema_integer(text, &n) ) {
+					return 0;
+				}
+				min = (uint64_t)n;
+			}
+			if ( text->idx < text->len && text->data[text->idx] == '*' ) {
+				text->idx++;
+				if ( text->idx < text->len && text->data[text->idx] >= '0' && text->data[text->idx] <= '9' ) {
+					if ( !cbor_schema_integer(text, &n) ) {
+						return 0;
+					}
+					max = (uint64_t)n;
+				}
+				if ( min > max ) {
+					cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+					return 0;
+				}
+			} else {
+				/* Not an occurrence, e.g. an integer literal. */
+				text->idx = save;
+				min       = 1;
+				max       = 1;
+			}
+		}
+
+		size_t name = cbor_schema_name(text);
+
+		if ( name > 0 ) {
+			size_t save = text->idx;
+
+			text->idx += name;
+			if ( cbor_schema_accept(text, ":") ) {
+				key = cbor_schema_text(schema, text, text->data + save, name);
+				if ( key == 0 ) {
+					return 0;
+				}
+			} else {
+				text->idx = save;
+			}
+		}
+
+		value = cbor_schema_type(schema, text, depth + 1);
+		if ( value == 0 ) {
+			return 0;
+		}
+		if ( key == 0 ) {
+			struct cbor_schema_node *node    = &schema->nodes[value];
+			bool                     literal = node->kind == CBOR_SCHEMA_LITERAL ||
+			                                   (node->kind == CBOR_SCHEMA_INT && node->min == 1);
+
+			if ( cbor_schema_accept(text, "=>") || (literal && cbor_schema_accept(text, ":")) ) {
+				key   = value;
+				value = cbor_schema_type(schema, text, depth + 1);
+				if ( value == 0 ) {
+					return 0;
+				}
+			}
+		}
+
+		if ( kind == CBOR_SCHEMA_MAP ) {
+			if ( key == 0 ) {
+				cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+				return 0;
+			}
+
+			struct cbor_schema_node *node = &schema->nodes[key];
+
+			if ( node->kind == CBOR_SCHEMA_INT && node->min == 1 && !cbor_schema_encode_int(schema, text, node) ) {
+				return 0;
+			}
+			if ( node->kind == CBOR_SCHEMA_LITERAL ) {
+				keys++;
+			} else {
+				wild++;
+			}
+			if ( keys > CBOR_SCHEMA_MAX_KEYS || wild > CBOR_SCHEMA_MAX_WILDCARDS ) {
+				cbor_buf_fail(text, CBOR_ERR_LIMIT, 0);
+				return 0;
+			}
+		} else {
+			/* Labels in arrays are documentation only. */
+			key = 0;
+		}
+
+		schema->nodes[entry].key   = key;
+		schema->nodes[entry].child = value;
+		schema->nodes[entry].min   = min;
+		schema->nodes[entry].max   = max;
+		if ( last == 0 ) {
+			schema->nodes[group].child = entry;
+		} else {
+			schema->nodes[last].next = entry;
+		}
+		last = entry;
+
+		/* Commas between entries are optional in CDDL. */
+		cbor_schema_accept(text, ",");
+	}
+
+	return group;
+}
+
+static inline uint16_t
+cbor_schema_type1(struct cbor_schema *schema, struct cbor_buf *text, size_t depth)
+{
+	uint16_t n;
+
+	if ( depth >= CBOR_MAX_DEPTH ) {
+		cbor_buf_fail(text, CBOR_ERR_DEPTH, 0);
+		return 0;
+	}
+
+	cbor_schema_space(text);
+	if ( text->idx >= text->len ) {
+		cbor_buf_fail(text, CBOR_ERR_TRUNCATED, 0);
+		return 0;
+	}
+
+	uint8_t c    = text->data[text->idx];
+	size_t  name = cbor_schema_name(text);
+
+	if ( c == '[' ) {
+		text->idx++;
+		return cbor_schema_group(schema, text, CBOR_SCHEMA_ARRAY, "]", depth);
+	} else if ( c == '{' ) {
+		text->idx++;
+		return cbor_schema_group(schema, text, CBOR_SCHEMA_MAP, "}", depth);
+	} else if ( c == '(' ) {
+		text->idx++;
+		n = cbor_schema_type(schema, text, depth + 1);
+		return n != 0 && cbor_schema_expect(text, ")") ? n : 0;
+	} else if ( c == '"' ) {
+		text->idx++;
+		return cbor_schema_text(schema, text, NULL, 0);
+	} else if ( c == '#' ) {
+		int128_t tag;
+
+		if ( !cbor_schema_expect(text, "#6.") || !cbor_schema_integer(text, &tag) || tag < 0 ||
+		     !cbor_schema_expect(text, "(") ) {
+			return 0;
+		}
+		n = cbor_schema_node(schema, text, CBOR_SCHEMA_TAG);
+		if ( n == 0 ) {
+			return 0;
+		}
+		schema->nodes[n].min = (uint64_t)tag;
+
+		uint16_t child = cbor_schema_type(schema, text, depth + 1);
+
+		if ( child == 0 || !cbor_schema_expect(text, ")") ) {
+			return 0;
+		}
+		schema->nodes[n].child = child;
+
+		return n;
+	} else if ( c == '-' || (c >= '0' && c <= '9') ) {
+		int128_t lo;
+		int128_t hi;
+		bool     range = true;
+
+		if ( !cbor_schema_integer(text, &lo) ) {
+			return 0;
+		}
+		hi = lo;
+		if ( cbor_schema_accept(text, "...") ) {
+			if ( !cbor_schema_integer(text, &hi) ) {
+				return 0;
+			}
+			hi--;
+		} else if ( cbor_schema_accept(text, "..") ) {
+			if ( !cbor_schema_integer(text, &hi) ) {
+				return 0;
+			}
+		} else {
+			range = false;
+		}
+		n = cbor_schema_node(schema, text, CBOR_SCHEMA_INT);
+		if ( n == 0 ) {
+			return 0;
+		}
+		schema->nodes[n].lo  = lo;
+		schema->nodes[n].hi  = hi;
+		schema->nodes[n].min = range ? 0 : 1;
+
+		return n;
+	} else if ( name > 0 ) {
+		n = cbor_schema_node(schema, text, CBOR_SCHEMA_REF);
+		if ( n == 0 ) {
+			return 0;
+		}
+
+		struct cbor_schema_node *node = &schema->nodes[n];
+
+		if ( !cbor_schema_builtin(text, name, node) ) {
+			uint8_t *dst = cbor_schema_reserve(schema, text, name);
+
+			if ( dst == NULL ) {
+				return 0;
+			}
+			memcpy(dst, text->data + text->idx, name);
+			node->bytes       = (uint16_t)schema->pool_len;
+			node->bytes_len   = (uint16_t)name;
+			node->min         = text->idx;
+			schema->pool_len += name;
+		}
+		text->idx += name;
+
+		return n;
+	}
+
+	cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+
+	return 0;
+}
+
+static inline uint16_t
+cbor_schema_type(struct cbor_schema *schema, struct cbor_buf *text, size_t depth)
+{
+	uint16_t first = cbor_schema_type1(schema, text, depth);
+	uint16_t last  = first;
+	uint16_t choice;
+
+	if ( first == 0 || !cbor_schema_accept(text, "/") ) {
+		return first;
+	}
+
+	choice = cbor_schema_node(schema, text, CBOR_SCHEMA_CHOICE);
+	if ( choice == 0 ) {
+		return 0;
+	}
+	schema->nodes[choice].child = first;
+
+	do {
+		uint16_t alt = cbor_schema_type1(schema, text, depth);
+
+		if ( alt == 0 ) {
+			return 0;
+		}
+		schema->nodes[last].next = alt;
+		last = alt;
+	} while ( cbor_schema_accept(text, "/") );
+
+	return choice;
+}
+
+/*
+ * A reference that reaches itself through references and choices alone,
+ * as in a = a / int, would recurse without consuming input.
+ */
+static inline bool
+cbor_schema_left_recursive(const struct cbor_schema *schema, uint16_t ref)
+{
+	bool     seen[CBOR_SCHEMA_MAX_NODES] = { false };
+	uint16_t work[CBOR_SCHEMA_MAX_NODES];
+	size_t   top = 0;
+
+	/* Nodes are marked when pushed, so each is pushed at most once. */
+	work[top++] = ref;
+	while ( top > 0 ) {
+		const struct cbor_schema_node *node = &schema->nodes[work[--top]];
+		bool                           alts = node->kind == CBOR_SCHEMA_CHOICE;
+
+		if ( node->kind != CBOR_SCHEMA_REF && !alts ) {
+			continue;
+		}
+		for ( uint16_t n = node->child; n != 0; n = alts ? schema->nodes[n].next : 0 ) {
+			if ( n == ref ) {
+				return true;
+			}
+			if ( !seen[n] ) {
+				seen[n]     = true;
+				work[top++] = n;
+			}
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Compile the schema text in text. Errors are recorded in text, its error
+ * offset points into the schema.
+ */
+static inline bool
+cbor_schema_compile(struct cbor_schema *schema, struct cbor_buf *text)
+{
+	schema->nnodes   = 1;
+	schema->nrules   = 0;
+	schema->pool_len = 0;
+	schema->root     = 0;
+
+	for ( ;; ) {
+		cbor_schema_space(text);
+		if ( text->idx >= text->len ) {
+			break;
+		}
+
+		size_t name = cbor_schema_name(text);
+
+		if ( name == 0 ) {
+			return cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+		}
+		for ( size_t i = 0; i < schema->nrules; i++ ) {
+			struct cbor_schema_rule *rule = &schema->rules[i];
+
+			if ( rule->name_len == name && memcmp(schema->pool + rule->name, text->data + text->idx, name) == 0 ) {
+				return cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+			}
+		}
+		if ( schema->nrules >= CBOR_SCHEMA_MAX_RULES ) {
+			return cbor_buf_fail(text, CBOR_ERR_LIMIT, 0);
+		}
+
+		uint8_t *dst = cbor_schema_reserve(schema, text, name);
+
+		if ( dst == NULL ) {
+			return false;
+		}
+		memcpy(dst, text->data + text->idx, name);
+
+		struct cbor_schema_rule *rule = &schema->rules[schema->nrules++];
+
+		rule->name        = (uint16_t)schema->pool_len;
+		rule->name_len    = (uint16_t)name;
+		schema->pool_len += name;
+		text->idx        += name;
+
+		if ( !cbor_schema_expect(text, "=") ) {
+			return false;
+		}
+		rule->node = cbor_schema_type(schema, text, 0);
+		if ( rule->node == 0 ) {
+			return false;
+		}
+	}
+
+	if ( schema->nrules == 0 ) {
+		return cbor_buf_fail(text, CBOR_ERR_TRUNCATED, 0);
+	}
+	schema->root = schema->rules[0].node;
+
+	/* Resolve references now that every rule is known. */
+	for ( size_t n = 1; n < schema->nnodes; n++ ) {
+		struct cbor_schema_node *node = &schema->nodes[n];
+
+		if ( node->kind != CBOR_SCHEMA_REF ) {
+			continue;
+		}
+		for ( size_t i = 0; i < schema->nrules && node->child == 0; i++ ) {
+			struct cbor_schema_rule *rule = &schema->rules[i];
+
+			if ( rule->name_len == node->bytes_len &&
+			     memcmp(schema->pool + rule->name, schema->pool + node->bytes, rule->name_len) == 0 ) {
+				node->child = rule->node;
+			}
+		}
+		if ( node->child == 0 ) {
+			text->idx = (size_t)node->min;
+			return cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+		}
+	}
+
+	for ( size_t n = 1; n < schema->nnodes; n++ ) {
+		if ( schema->nodes[n].kind == CBOR_SCHEMA_REF && cbor_schema_left_recursive(schema, (uint16_t)n) ) {
+			text->idx = (size_t)schema->nodes[n].min;
+			return cbor_buf_fail(text, CBOR_ERR_SYNTAX, 0);
+		}
+	}
+
+	return true;
+}
+
+static inline bool
+cbor_schema_compile_cstr(struct cbor_schema *schema, const char *text)
+{
+	struct cbor_buf buf;
+	size_t          len = strlen(text);
+
+	cbor_buf_init(&buf, (void *)text, len, len);
+
+	return cbor_schema_compile(schema, &buf);
+}
+
+static inline bool
+cbor_schema_mismatch(struct cbor_buf *buf, size_t item, unsigned expected)
+{
+	buf->idx = item;
+
+	return cbor_buf_fail(buf, CBOR_ERR_SCHEMA, expected);
+}
+
+/* Number of tag heads in a row at the cursor, counting up to at most max. */
+static inline size_t
+cbor_schema_tag_chain(const struct cbor_buf *buf, size_t max)
+{
+	static const uint8_t sizes[32] = {
+		1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 1, 1, 1, 2, 3, 5, 9, 0, 0, 0, 0,
+	};
+	size_t idx   = buf->idx;
+	size_t count = 0;
+
+	while ( count < max && idx < buf->len && buf->data[idx] >> 5 == CBOR_MAJOR_TAG &&
+	        sizes[buf->data[idx] & 0x1f] != 0 ) {
+		idx += sizes[buf->data[idx] & 0x1f];
+		count++;
+	}
+
+	return count;
+}
+
+/* Skip a map key, definite strings and integers without the skip stack. */
+static inline bool
+cbor_schema_skip(struct cbor_buf *buf, size_t depth)
+{
+	size_t           start = buf->idx;
+	uint64_t         items = buf->items;
+	struct cbor_head head;
+
+	if ( !cbor_read_head(buf, &head) ) {
+		return false;
+	}
+	if ( head.major == CBOR_MAJOR_UINT || head.major == CBOR_MAJOR_NEGINT ) {
+		return true;
+	}
+	if ( head.indefinite || (head.major != CBOR_MAJOR_BYTES && head.major != CBOR_MAJOR_TEXT) ) {
+		buf->idx   = start;
+		buf->items = items;
+		return cbor_skip_nested(buf, depth);
+	}
+	if ( !cbor_check_string(buf, head.arg, start) ) {
+		return false;
+	}
+	buf->idx += (size_t)head.arg;
+
+	return true;
+}
+
+static inline bool cbor_schema_item(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n,
+                                    size_t depth);
+
+/* Validate without consuming anything on failure, the error is kept. */
+static inline bool
+cbor_schema_try(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n, size_t depth)
+{
+	size_t   idx   = buf->idx;
+	uint64_t items = buf->items;
+
+	if ( cbor_schema_item(schema, buf, n, depth) ) {
+		return true;
+	}
+	buf->idx   = idx;
+	buf->items = items;
+
+	return false;
+}
+
+static inline bool
+cbor_schema_choice(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n, size_t depth)
+{
+	size_t          idx      = buf->idx;
+	uint64_t        items    = buf->items;
+	bool            failed   = false;
+	enum cbor_error err      = CBOR_ERR_SCHEMA;
+	size_t          err_idx  = idx;
+	unsigned        expected = 0;
+	int             actual   = CBOR_MAJOR_NONE;
+
+	for ( uint16_t alt = schema->nodes[n].child; alt != 0; alt = schema->nodes[alt].next ) {
+		if ( cbor_schema_item(schema, buf, alt, depth) ) {
+			return true;
+		}
+
+		/* Report the alternative that got furthest, the first of a tie. */
+		if ( !failed || buf->err_idx > err_idx ) {
+			failed   = true;
+			err      = buf->err;
+			err_idx  = buf->err_idx;
+			expected = buf->err_expected;
+			actual   = buf->err_actual;
+		}
+		buf->idx   = idx;
+		buf->items = items;
+	}
+
+	buf->err          = err;
+	buf->err_idx      = err_idx;
+	buf->err_expected = expected;
+	buf->err_actual   = actual;
+
+	return false;
+}
+
+static inline bool
+cbor_schema_array(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n,
+                  struct cbor_head *head, size_t start, size_t depth)
+{
+	uint64_t remaining = head->arg;
+
+	if ( !head->indefinite && !cbor_check_container(buf, remaining, start) ) {
+		return false;
+	}
+
+	for ( uint16_t e = schema->nodes[n].child; e != 0; e = schema->nodes[e].next ) {
+		const struct cbor_schema_node *entry = &schema->nodes[e];
+		uint64_t                       count = 0;
+		bool                           ok    = true;
+
+		while ( count < entry->max && (head->indefinite ? !cbor_is_break(buf) : remaining > 0) ) {
+			if ( !(ok = cbor_schema_try(schema, buf, entry->child, depth + 1)) ) {
+				break;
+			}
+			count++;
+			remaining--;
+		}
+		if ( !ok && buf->err != CBOR_ERR_SCHEMA ) {
+			return false;
+		}
+		if ( count < entry->min ) {
+			return ok ? cbor_schema_mismatch(buf, buf->idx, CBOR_MAJOR_ANY) : false;
+		}
+	}
+
+	if ( head->indefinite ? !cbor_is_break(buf) : remaining > 0 ) {
+		return cbor_schema_mismatch(buf, buf->idx, 0);
+	}
+
+	return !head->indefinite || cbor_expect_break(buf);
+}
+
+static inline bool
+cbor_schema_map(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n,
+                struct cbor_head *head, size_t start, size_t depth)
+{
+	uint64_t seen = 0;
+	uint64_t counts[CBOR_SCHEMA_MAX_WILDCARDS] = { 0 };
+
+	if ( !head->indefinite && !cbor_check_container(buf, head->arg, start) ) {
+		return false;
+	}
+
+	for ( uint64_t i = 0; head->indefinite ? !cbor_is_break(buf) : i < head->arg; i++ ) {
+		const uint8_t *key     = buf->data + buf->idx;
+		size_t         avail   = buf->len - buf->idx;
+		size_t         item    = buf->idx;
+		size_t         keys    = 0;
+		size_t         wild    = 0;
+		uint16_t       matched = 0;
+
+		/* Members are unordered, key types only take keys no literal names. */
+		for ( uint16_t e = schema->nodes[n].child; e != 0 && matched == 0; e = schema->nodes[e].next ) {
+			const struct cbor_schema_node *k = &schema->nodes[schema->nodes[e].key];
+			const uint8_t                 *bytes;
+
+			if ( k->kind != CBOR_SCHEMA_LITERAL ) {
+				continue;
+			}
+			bytes = schema->pool + k->bytes;
+			if ( k->bytes_len <= avail && key[0] == bytes[0] && memcmp(key, bytes, k->bytes_len) == 0 ) {
+				if ( seen & ((uint64_t)1 << keys) ) {
+					return cbor_schema_mismatch(buf, item, 0);
+				}
+				seen   |= (uint64_t)1 << keys;
+				matched = e;
+				if ( !cbor_schema_skip(buf, depth + 1) ) {
+					return false;
+				}
+			}
+			keys++;
+		}
+		for ( uint16_t e = schema->nodes[n].child; e != 0 && matched == 0; e = schema->nodes[e].next ) {
+			const struct cbor_schema_node *entry = &schema->nodes[e];
+
+			if ( schema->nodes[entry->key].kind == CBOR_SCHEMA_LITERAL ) {
+				continue;
+			}
+			if ( counts[wild] < entry->max && cbor_schema_try(schema, buf, entry->key, depth + 1) ) {
+				counts[wild]++;
+				matched = e;
+			}
+			wild++;
+		}
+
+		if ( matched == 0 ) {
+			return cbor_schema_mismatch(buf, item, 0);
+		}
+		if ( !cbor_schema_item(schema, buf, schema->nodes[matched].child, depth + 1) ) {
+			return false;
+		}
+	}
+
+	/* Every required key must have been seen. */
+	size_t keys = 0;
+	size_t wild = 0;
+
+	for ( uint16_t e = schema->nodes[n].child; e != 0; e = schema->nodes[e].next ) {
+		const struct cbor_schema_node *entry = &schema->nodes[e];
+
+		if ( schema->nodes[entry->key].kind == CBOR_SCHEMA_LITERAL ) {
+			if ( entry->min > 0 && !(seen & ((uint64_t)1 << keys)) ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_MAP));
+			}
+			keys++;
+		} else {
+			if ( counts[wild] < entry->min ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_MAP));
+			}
+			wild++;
+		}
+	}
+
+	return !head->indefinite || cbor_expect_break(buf);
+}
+
+/*
+ * Validate the item at the cursor against node n, depth counts the arrays
+ * and maps open around it. Compilation rejects left recursion, so
+ * references, choices and tags always reach a node that consumes input.
+ */
+static inline bool
+cbor_schema_item(const struct cbor_schema *schema, struct cbor_buf *buf, uint16_t n, size_t depth)
+{
+	const struct cbor_schema_node *node  = &schema->nodes[n];
+	size_t                         start = buf->idx;
+	uint64_t                       items = buf->items;
+	struct cbor_head               head;
+
+	switch ( node->kind ) {
+		case CBOR_SCHEMA_ANY:
+			return cbor_skip_nested(buf, depth);
+
+		case CBOR_SCHEMA_REF:
+			return cbor_schema_item(schema, buf, node->child, depth);
+
+		case CBOR_SCHEMA_CHOICE:
+			return cbor_schema_choice(schema, buf, n, depth);
+
+		case CBOR_SCHEMA_LITERAL:
+			if ( node->bytes_len > buf->len - start ||
+			     memcmp(buf->data + start, schema->pool + node->bytes, node->bytes_len) != 0 ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(schema->pool[node->bytes] >> 5));
+			}
+			return cbor_skip_nested(buf, depth);
+
+		default:
+			break;
+	}
+
+	if ( !cbor_read_head(buf, &head) ) {
+		return false;
+	}
+
+	/* An array or map with content opens a level, as in cbor_skip_item(). */
+	if ( (head.major == CBOR_MAJOR_ARRAY || head.major == CBOR_MAJOR_MAP) &&
+	     (head.indefinite || head.arg > 0) && depth >= cbor_buf_max_depth(buf) ) {
+		buf->idx = start;
+		return cbor_buf_fail(buf, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+	}
+
+	switch ( node->kind ) {
+		case CBOR_SCHEMA_MAJOR:
+			if ( head.major != node->lo ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT((int)node->lo));
+			}
+			if ( head.indefinite || head.major > CBOR_MAJOR_TEXT ) {
+				buf->idx   = start;
+				buf->items = items;
+				return cbor_skip_nested(buf, depth);
+			}
+			if ( !cbor_check_string(buf, head.arg, start) ) {
+				return false;
+			}
+			buf->idx += (size_t)head.arg;
+			return true;
+
+		case CBOR_SCHEMA_INT: {
+			int128_t value = head.major == CBOR_MAJOR_UINT ? (int128_t)head.arg : -1 - (int128_t)head.arg;
+
+			if ( (head.major != CBOR_MAJOR_UINT && head.major != CBOR_MAJOR_NEGINT) ||
+			     value < node->lo || value > node->hi ) {
+				return cbor_schema_mismatch(buf, start,
+				    CBOR_MAJOR_BIT(CBOR_MAJOR_UINT) | CBOR_MAJOR_BIT(CBOR_MAJOR_NEGINT));
+			}
+			return true;
+		}
+
+		case CBOR_SCHEMA_SIMPLE:
+			if ( head.major != CBOR_MAJOR_SIMPLE || head.size > 2 || head.indefinite ||
+			     (int128_t)head.arg < node->lo || (int128_t)head.arg > node->hi ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
+			}
+			return true;
+
+		case CBOR_SCHEMA_FLOAT: {
+			unsigned info = head.initial & 0x1f;
+
+			if ( head.major != CBOR_MAJOR_SIMPLE || info < 25 || info > 27 || !(node->lo & (1 << (info - 25))) ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE));
+			}
+			return true;
+		}
+
+		case CBOR_SCHEMA_TAG:
+			if ( head.major != CBOR_MAJOR_TAG || head.arg != node->min ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_TAG));
+			}
+
+			/* The recursion below is not bounded by max_depth, so the chain is. */
+			if ( cbor_schema_tag_chain(buf, CBOR_MAX_DEPTH) == CBOR_MAX_DEPTH ) {
+				buf->idx = start;
+				return cbor_buf_fail(buf, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+			}
+			return cbor_schema_item(schema, buf, node->child, depth);
+
+		case CBOR_SCHEMA_ARRAY:
+			if ( head.major != CBOR_MAJOR_ARRAY ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_ARRAY));
+			}
+			return cbor_schema_array(schema, buf, n, &head, start, depth);
+
+		case CBOR_SCHEMA_MAP:
+			if ( head.major != CBOR_MAJOR_MAP ) {
+				return cbor_schema_mismatch(buf, start, CBOR_MAJOR_BIT(CBOR_MAJOR_MAP));
+			}
+			return cbor_schema_map(schema, buf, n, &head, start, depth);
+
+		default:
+			return cbor_schema_mismatch(buf, start, 0);
+	}
+}
+
+/*
+ * Validate the item at the cursor. On success the cursor is moved past it;
+ * on failure it is restored and the error offset points at the first part
+ * of the item that did not match.
+ */
+static inline bool
+cbor_schema_validate(const struct cbor_schema *schema, struct cbor_buf *buf)
+{
+	size_t          start    = buf->idx;
+	enum cbor_error err      = buf->err;
+	size_t          err_idx  = buf->err_idx;
+	unsigned        expected = buf->err_expected;
+	int             actual   = buf->err_actual;
+
+	if ( !cbor_schema_item(schema, buf, schema->root, 0) ) {
+		buf->idx = start;
+		return false;
+	}
+
+	/* Failed alternatives are not errors of the whole item. */
+	buf->err          = err;
+	buf->err_idx      = err_idx;
+	buf->err_expected = expected;
+	buf->err_actual   = actual;
+
+	return true;
+}
+
+#endif /* LIBCBOR_CBOR_SCHEMA_H */
@@ -0,0 +1,634 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#define _POSIX_C_SOURCE 200809L
+#define CBORPROF_WALK_ONLY
+
+#include "cborprof.c"
+#include "cbor_json.h"
+#include "cbor_patch.h"
+#include "cbor_path.h"
+#include "cbor_phf.h"
+#include "cbor_schema.h"
+
+#include <stdio.h>
+
+/*
+ * cborfuzz
+ *
+ * Differential fuzz target: every input is walked as a CBOR sequence by a
+ * small reference decoder written straight from RFC 8949, and the readers
+ * and writers of cbor.h must agree with it: cbor_skip_item() on where each
+ * item ends, cbor_read_head() on every head, the typed readers on the first
+ * head of each item and the writers on re-encoding what they read. The JSON
+ * transcoder, the perfect-hash map walk, path queries, the schema validator,
+ * the patch functions and the cborprof walk must not accept anything the
+ * skipper rejects, and JSON that cbor_to_json() writes must parse back.
+ *
+ * Built with -fsanitize=fuzzer for libFuzzer. With CBOR_FUZZ_STDIN it gets
+ * a main() reading one input from stdin, for AFL or to replay a crash.
+ */
+
+#define FUZZ_MAX_HEADS 4096
+
+#define FUZZ_CHECK(cond)                                                        \
+	do {                                                                    \
+		if ( !(cond) ) {                                                \
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			abort();                                                \
+		}                                                               \
+	} while ( 0 )
+
+struct ref_head {
+	uint8_t  major;
+	uint8_t  info;
+	uint64_t arg;
+	size_t   size;
+};
+
+struct ref_walk {
+	const uint8_t *data;
+	size_t         len;
+	size_t         heads[FUZZ_MAX_HEADS];
+	size_t         nheads;
+};
+
+static bool
+ref_head(const uint8_t *data, size_t len, size_t at, struct ref_head *head)
+{
+	if ( at >= len ) {
+		return false;
+	}
+	head->major = data[at] >> 5;
+	head->info  = data[at] & 0x1f;
+	head->arg   = head->info;
+	head->size  = 1;
+
+	if ( head->info >= 24 && head->info <= 27 ) {
+		size_t n = (size_t)1 << (head->info - 24);
+
+		if ( len - at - 1 < n ) {
+			return false;
+		}
+		head->arg = 0;
+		for ( size_t i = 1; i <= n; i++ ) {
+			head->arg = head->arg << 8 | data[at + i];
+		}
+		head->size += n;
+	} else if ( head->info >= 28 && head->info <= 30 ) {
+		return false;
+	} else if ( head->info == 31 ) {
+		if ( head->major == CBOR_MAJOR_UINT || head->major == CBOR_MAJOR_NEGINT || head->major == CBOR_MAJOR_TAG ) {
+			return false;
+		}
+		head->arg = 0;
+	}
+
+	/* Two byte simple values below 32 are not well-formed. */
+	if ( head->major == CBOR_MAJOR_SIMPLE && head->info == 24 && head->arg < 32 ) {
+		return false;
+	}
+
+	return true;
+}
+
+/*
+ * One well-formed item at *at, nested no deeper than cbor_skip_item()
+ * allows: definite containers with items and indefinite containers and
+ * strings take a level each, tags do not.
+ */
+static bool
+ref_item(struct ref_walk *walk, size_t *at, size_t depth)
+{
+	struct ref_head head;
+
+	for ( ;; ) {
+		if ( !ref_head(walk->data, walk->len, *at, &head) ) {
+			return false;
+		}
+		if ( walk->nheads < FUZZ_MAX_HEADS ) {
+			walk->heads[walk->nheads++] = *at;
+		}
+		*at += head.size;
+		if ( head.major != CBOR_MAJOR_TAG ) {
+			break;
+		}
+	}
+
+	switch ( head.major ) {
+		case CBOR_MAJOR_BYTES:
+		case CBOR_MAJOR_TEXT:
+			if ( head.info != 31 ) {
+				if ( head.arg > walk->len - *at ) {
+					return false;
+				}
+				*at += (size_t)head.arg;
+				return true;
+			}
+			if ( depth >= CBOR_MAX_DEPTH ) {
+				return false;
+			}
+			for ( ;; ) {
+				struct ref_head chunk;
+
+				if ( *at < walk->len && walk->data[*at] == 0xff ) {
+					*at += 1;
+					return true;
+				}
+				if ( !ref_head(walk->data, walk->len, *at, &chunk) || chunk.major != head.major ||
+				     chunk.info == 31 || !ref_item(walk, at, depth + 1) ) {
+					return false;
+				}
+			}
+
+		case CBOR_MAJOR_ARRAY:
+		case CBOR_MAJOR_MAP:
+			if ( head.info != 31 ) {
+				uint64_t items = head.major == CBOR_MAJOR_MAP ? head.arg * 2 : head.arg;
+
+				if ( head.arg == 0 ) {
+					return true;
+				}
+				if ( depth >= CBOR_MAX_DEPTH || head.arg > walk->len - *at ) {
+					return false;
+				}
+				for ( uint64_t i = 0; i < items; i++ ) {
+					if ( !ref_item(walk, at, depth + 1) ) {
+						return false;
+					}
+				}
+				return true;
+			}
+			if ( depth >= CBOR_MAX_DEPTH ) {
+				return false;
+			}
+			for ( uint64_t n = 0;; n++ ) {
+				if ( *at < walk->len && walk->data[*at] == 0xff ) {
+					*at += 1;
+					return head.major != CBOR_MAJOR_MAP || n % 2 == 0;
+				}
+				if ( !ref_item(walk, at, depth + 1) ) {
+					return false;
+				}
+			}
+
+		case CBOR_MAJOR_SIMPLE:
+			return head.info != 31;
+
+		default:
+			return true;
+	}
+}
+
+static double
+ref_half(uint64_t half)
+{
+	int    exponent = (int)(half >> 10) & 0x1f;
+	double mantissa = (double)(half & 0x3ff);
+	double value;
+
+	if ( exponent == 0 ) {
+		value = mantissa / 1024.0 / 16384.0;
+	} else if ( exponent == 31 ) {
+		value = mantissa == 0 ? INFINITY : NAN;
+	} else {
+		value = (1.0 + mantissa / 1024.0) * ldexp(1.0, exponent - 15);
+	}
+
+	return half & 0x8000 ? -value : value;
+}
+
+static bool
+same_bits(const void *x, const void *y, size_t size)
+{
+	return memcmp(x, y, size) == 0;
+}
+
+/* cbor_read_head() agrees with the reference on a head. */
+static void
+fuzz_head(struct cbor_buf *buf, size_t at)
+{
+	struct ref_head  ref;
+	struct cbor_head head;
+	bool             ok  = ref_head(buf->data, buf->len, at, &ref);
+
+	buf->idx = at;
+	FUZZ_CHECK(cbor_read_head(buf, &head) == ok);
+	if ( !ok ) {
+		FUZZ_CHECK(buf->idx == at);
+		return;
+	}
+	FUZZ_CHECK(buf->idx == at + ref.size && head.size == ref.size && head.major == ref.major &&
+	           head.arg == ref.arg && head.indefinite == (ref.info == 31) && head.initial == buf->data[at]);
+}
+
+/* The typed readers at the start of an item, against the reference head. */
+static void
+fuzz_readers(struct cbor_buf *buf, size_t at)
+{
+	const uint8_t   *data  = buf->data + at;
+	size_t           avail = buf->len - at;
+	struct ref_head  ref;
+	bool             valid = ref_head(buf->data, buf->len, at, &ref);
+	bool             minimal;
+	uint64_t         value   = 0;
+	int128_t         integer = 0;
+	bool             boolean = false;
+	double           x       = 0;
+	float            f       = 0;
+	uint8_t         *bytes   = NULL;
+	size_t           len     = 0;
+	struct cbor_buf  inner   = { 0 };
+	uint8_t          out_data[16];
+	struct cbor_buf  out;
+
+	minimal = valid && ref.info != 31 && ref.size == cbor_head_size(ref.arg);
+
+#define FUZZ_READ(call, expected)                                               \
+	do {                                                                    \
+		buf->idx = at;                                                  \
+		bool ok_ = (call);                                              \
+		FUZZ_CHECK(ok_ == (expected));                                  \
+		FUZZ_CHECK(ok_ || buf->idx == at);                              \
+	} while ( 0 )
+
+	FUZZ_READ(cbor_read_positive_integer(buf, &value), valid && ref.major == CBOR_MAJOR_UINT);
+	if ( valid && ref.major == CBOR_MAJOR_UINT ) {
+		FUZZ_CHECK(value == ref.arg && buf->idx == at + ref.size);
+		if ( minimal ) {
+			cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+			FUZZ_CHECK(cbor_add_uint64(&out, ref.arg) && out.len == ref.size && memcmp(out_data, data, ref.size) == 0);
+		}
+	}
+
+	FUZZ_READ(cbor_read_negative_integer_biased(buf, &value), valid && ref.major == CBOR_MAJOR_NEGINT);
+	if ( valid && ref.major == CBOR_MAJOR_NEGINT ) {
+		FUZZ_CHECK(value == ref.arg && buf->idx == at + ref.size);
+		if ( minimal ) {
+			cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+			FUZZ_CHECK(cbor_add_int128(&out, -(int128_t)ref.arg - 1) && out.len == ref.size &&
+			           memcmp(out_data, data, ref.size) == 0);
+			if ( ref.arg <= INT64_MAX ) {
+				cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+				FUZZ_CHECK(cbor_add_int64(&out, -(int64_t)ref.arg - 1) && out.len == ref.size &&
+				           memcmp(out_data, data, ref.size) == 0);
+			}
+		}
+	}
+
+	FUZZ_READ(cbor_read_integer(buf, &integer), valid && ref.major <= CBOR_MAJOR_NEGINT);
+	if ( valid && ref.major <= CBOR_MAJOR_NEGINT ) {
+		FUZZ_CHECK(integer == (ref.major == CBOR_MAJOR_UINT ? (int128_t)ref.arg : -(int128_t)ref.arg - 1));
+	}
+
+	buf->idx = at;
+	FUZZ_CHECK(cbor_is_positive_integer(buf) == (avail > 0 && data[0] >> 5 == CBOR_MAJOR_UINT));
+	FUZZ_CHECK(cbor_is_negative_integer(buf) == (avail > 0 && data[0] >> 5 == CBOR_MAJOR_NEGINT));
+	FUZZ_CHECK(cbor_is_integer(buf) == (avail > 0 && data[0] >> 5 <= CBOR_MAJOR_NEGINT));
+	FUZZ_CHECK(cbor_is_break(buf) == (avail > 0 && data[0] == 0xff));
+
+	FUZZ_READ(cbor_read_boolean(buf, &boolean), avail > 0 && (data[0] == 0xf4 || data[0] == 0xf5));
+	FUZZ_CHECK(buf->idx == at || boolean == (data[0] == 0xf5));
+	FUZZ_READ(cbor_expect_null(buf), avail > 0 && data[0] == 0xf6);
+
+	FUZZ_READ(cbor_read_half(buf, &x), valid && data[0] == 0xf9);
+	if ( valid && data[0] == 0xf9 ) {
+		double y = ref_half(ref.arg);
+
+		FUZZ_CHECK(isnan(x) ? isnan(y) : x == y && signbit(x) == signbit(y));
+	}
+
+	FUZZ_READ(cbor_read_float(buf, &f), valid && data[0] == 0xfa);
+	if ( valid && data[0] == 0xfa ) {
+		uint32_t bits = (uint32_t)ref.arg;
+
+		FUZZ_CHECK(same_bits(&f, &bits, sizeof(f)));
+		cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+		FUZZ_CHECK(cbor_add_float(&out, f) && out.len == 5 && memcmp(out_data, data, 5) == 0);
+	}
+
+	FUZZ_READ(cbor_read_double(buf, &x), valid && data[0] == 0xfb);
+	if ( valid && data[0] == 0xfb ) {
+		FUZZ_CHECK(same_bits(&x, &ref.arg, sizeof(x)));
+		cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+		FUZZ_CHECK(cbor_add_double(&out, x) && out.len == 9 && memcmp(out_data, data, 9) == 0);
+	}
+
+	for ( int major = CBOR_MAJOR_BYTES; major <= CBOR_MAJOR_TEXT; major++ ) {
+		bool fits = valid && ref.major == major && ref.info != 31 && ref.arg <= avail - ref.size;
+
+		FUZZ_READ(cbor_read_string(buf, major, &bytes, &len), fits);
+		if ( fits ) {
+			FUZZ_CHECK(bytes == data + ref.size && len == ref.arg && buf->idx == at + ref.size + len);
+			if ( minimal ) {
+				cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+				FUZZ_CHECK(cbor_add_string_ref(&out, major, bytes, len) && out.len == ref.size &&
+				           memcmp(out_data, data, ref.size) == 0);
+			}
+		}
+	}
+
+	for ( int major = CBOR_MAJOR_ARRAY; major <= CBOR_MAJOR_MAP; major++ ) {
+		/* Each element takes a byte at least, so a longer count cannot fit. */
+		uint64_t room = major == CBOR_MAJOR_MAP ? (avail - ref.size) / 2 : avail - ref.size;
+		bool     fits = valid && ref.major == major && ref.info != 31 && ref.arg <= room;
+
+		FUZZ_READ(cbor_read_container(buf, major, &value), fits);
+		if ( fits ) {
+			FUZZ_CHECK(value == ref.arg && buf->idx == at + ref.size);
+			if ( minimal ) {
+				cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+				FUZZ_CHECK((major == CBOR_MAJOR_ARRAY ? cbor_add_array(&out, ref.arg) : cbor_add_map(&out, ref.arg)) &&
+				           out.len == ref.size && memcmp(out_data, data, ref.size) == 0);
+			}
+		}
+	}
+	FUZZ_READ(cbor_read_array_start(buf), avail > 0 && data[0] == 0x9f);
+	FUZZ_READ(cbor_read_map_start(buf), avail > 0 && data[0] == 0xbf);
+
+	FUZZ_READ(cbor_read_tag(buf, &value), valid && ref.major == CBOR_MAJOR_TAG);
+	if ( valid && ref.major == CBOR_MAJOR_TAG ) {
+		FUZZ_CHECK(value == ref.arg);
+		if ( minimal ) {
+			cbor_buf_init_empty(&out, out_data, sizeof(out_data));
+			FUZZ_CHECK(cbor_add_tag(&out, ref.arg) && out.len == ref.size && memcmp(out_data, data, ref.size) == 0);
+		}
+	}
+
+	/* Tag 24 over a definite byte string that fits. */
+	struct ref_head str;
+	bool            embedded = valid && ref.major == CBOR_MAJOR_TAG && ref.arg == CBOR_TAG_EMBEDDED &&
+	                           ref_head(buf->data, buf->len, at + ref.size, &str) &&
+	                           str.major == CBOR_MAJOR_BYTES && str.info != 31 &&
+	                           str.arg <= avail - ref.size - str.size;
+
+	FUZZ_READ(cbor_read_embedded(buf, &inner), embedded);
+	if ( embedded ) {
+		FUZZ_CHECK(inner.data == data + ref.size + str.size && inner.len == str.arg && inner.idx == 0);
+		FUZZ_CHECK(buf->idx == at + ref.size + str.size + str.arg);
+	}
+
+#undef FUZZ_READ
+}
+
+static const char *const fuzz_paths[] = { "[0]", "[*]", ".a", ".*.b[1]", "[*][*].id", ".*.*.*" };
+
+static const char *const fuzz_schemas[] = {
+	"a = any",
+	"a = [ * a ] / { * a => a } / #6.1(a) / int / tstr / bstr / float / bool / nil / undefined",
+	"a = { ? \"a\": [ * uint ], * tstr => any } / [ 1*3 (tstr / int), * any ]",
+};
+
+/* Matches lie inside the item and are items themselves. */
+static bool
+fuzz_match(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len)
+{
+	const size_t   *bounds = arg;
+	struct cbor_buf match;
+
+	(void)path;
+	FUZZ_CHECK(offset >= bounds[0] && offset + len <= bounds[1]);
+	cbor_buf_init(&match, buf->data + offset, len, len);
+	FUZZ_CHECK(cbor_skip_item(&match) && match.idx == len);
+
+	return true;
+}
+
+/* A patch of the item at at in a copy succeeds exactly when the item is whole. */
+static void
+fuzz_patch(struct cbor_buf *buf, size_t at, bool ok, size_t end, int kind)
+{
+	size_t          cap  = buf->len + 64;
+	uint8_t        *data = malloc(cap);
+	struct cbor_buf copy;
+	bool            patched;
+
+	if ( data == NULL ) {
+		return;
+	}
+	memcpy(data, buf->data, buf->len);
+	cbor_buf_init(&copy, data, buf->len, cap);
+
+	switch ( kind ) {
+		case 0:  patched = cbor_patch_uint64(&copy, at, 1000000, NULL, 0); break;
+		case 1:  patched = cbor_patch_double(&copy, at, 0.1, NULL, 0); break;
+		default: patched = cbor_patch_utf8_str(&copy, at, "xyz", 3, NULL, 0); break;
+	}
+	FUZZ_CHECK(patched == ok);
+	if ( patched ) {
+		size_t tail = buf->len - end;
+
+		copy.idx = at;
+		FUZZ_CHECK(cbor_skip_item(&copy) && copy.idx == copy.len - tail);
+		FUZZ_CHECK(memcmp(copy.data + copy.idx, buf->data + end, tail) == 0);
+	} else {
+		FUZZ_CHECK(copy.len == buf->len && memcmp(data, buf->data, buf->len) == 0);
+	}
+	free(data);
+}
+
+/* Consumers built on the skipper never accept what it rejects. */
+static void
+fuzz_consumers(struct cbor_buf *buf, size_t at, bool ok, size_t end)
+{
+	static const char *const keys[] = { "a", "b", "id", "Fun", "Amt", "name" };
+	static struct cbor_phf   phf;
+	static bool              phf_ready;
+	cbor_phf_handler         handlers[sizeof(keys) / sizeof(keys[0])] = { NULL };
+	size_t                   cap  = 16 * (buf->len - at) + 64;
+	uint8_t                 *json = malloc(cap);
+	struct cbor_buf          out;
+
+	if ( json == NULL ) {
+		return;
+	}
+
+	buf->idx = at;
+	cbor_buf_init_empty(&out, json, cap);
+	if ( cbor_to_json(buf, &out) ) {
+		FUZZ_CHECK(ok && buf->idx == end);
+
+		/*
+		 * Whatever was written is JSON that reads back, but for empty
+		 * containers at the innermost level: the JSON reader counts them
+		 * against the depth limit, the skipper does not.
+		 */
+		uint8_t        *back = malloc(out.len + 16);
+		struct cbor_buf in;
+
+		if ( back != NULL ) {
+			struct cbor_buf cbor;
+
+			cbor_buf_init(&in, json, out.len, cap);
+			cbor_buf_init_empty(&cbor, back, out.len + 16);
+			FUZZ_CHECK(cbor_from_json(&in, &cbor) || cbor.err == CBOR_ERR_CAPACITY || in.err == CBOR_ERR_DEPTH);
+			free(back);
+		}
+	} else {
+		FUZZ_CHECK(buf->idx == at && out.len == 0);
+	}
+	free(json);
+
+	if ( !phf_ready ) {
+		FUZZ_CHECK(cbor_phf_init(&phf, keys, sizeof(keys) / sizeof(keys[0])));
+		phf_ready = true;
+	}
+	buf->idx = at;
+	if ( ok && buf->data[at] >> 5 == CBOR_MAJOR_MAP ) {
+		FUZZ_CHECK(cbor_phf_read_map(&phf, buf, handlers, NULL) && buf->idx == end);
+	}
+
+	static struct cbor_path paths[sizeof(fuzz_paths) / sizeof(fuzz_paths[0])];
+	static bool             paths_ready;
+	size_t                  bounds[2] = { at, ok ? end : buf->len };
+
+	if ( !paths_ready ) {
+		for ( size_t i = 0; i < sizeof(fuzz_paths) / sizeof(fuzz_paths[0]); i++ ) {
+			FUZZ_CHECK(cbor_path_compile_cstr(&paths[i], fuzz_paths[i]));
+		}
+		paths_ready = true;
+	}
+	buf->idx = at;
+	if ( cbor_path_eval(buf, paths, sizeof(paths) / sizeof(paths[0]), fuzz_match, bounds) ) {
+		FUZZ_CHECK(ok && buf->idx == end);
+	} else {
+		FUZZ_CHECK(buf->idx == at);
+	}
+
+	static struct cbor_schema schemas[sizeof(fuzz_schemas) / sizeof(fuzz_schemas[0])];
+	static bool               schemas_ready;
+
+	if ( !schemas_ready ) {
+		for ( size_t i = 0; i < sizeof(fuzz_schemas) / sizeof(fuzz_schemas[0]); i++ ) {
+			FUZZ_CHECK(cbor_schema_compile_cstr(&schemas[i], fuzz_schemas[i]));
+		}
+		schemas_ready = true;
+	}
+	for ( size_t i = 0; i < sizeof(schemas) / sizeof(schemas[0]); i++ ) {
+		bool valid;
+
+		buf->idx = at;
+		valid    = cbor_schema_validate(&schemas[i], buf);
+		FUZZ_CHECK(valid ? ok && buf->idx == end : buf->idx == at);
+		FUZZ_CHECK(i > 0 || valid == ok);
+	}
+
+	for ( int kind = 0; kind < 3; kind++ ) {
+		fuzz_patch(buf, at, ok, end, kind);
+	}
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *input, size_t size);
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *input, size_t size)
+{
+	/* A copy of exactly the input size, so that overreads hit the redzone. */
+	uint8_t         *data = malloc(size > 0 ? size : 1);
+	struct ref_walk *walk = malloc(sizeof(*walk));
+	struct prof      prof;
+	struct cbor_buf  buf;
+	size_t           at   = 0;
+
+	if ( data == NULL || walk == NULL || !prof_init(&prof, data, size) ) {
+		if ( data != NULL && walk != NULL ) {
+			prof_free(&prof);
+		}
+		free(data);
+		free(walk);
+		return 0;
+	}
+	memcpy(data, input, size);
+	cbor_buf_init(&buf, data, size, size);
+	walk->data = data;
+	walk->len  = size;
+
+	while ( at < size ) {
+		size_t end = at;
+		bool   ok;
+
+		walk->nheads = 0;
+		ok           = ref_item(walk, &end, 0);
+
+		fuzz_readers(&buf, at);
+		for ( size_t i = 0; i < walk->nheads; i++ ) {
+			fuzz_head(&buf, walk->heads[i]);
+		}
+
+		buf.idx = at;
+		FUZZ_CHECK(cbor_skip_item(&buf) == ok);
+		FUZZ_CHECK(buf.idx == (ok ? end : at));
+
+		fuzz_consumers(&buf, at, ok, end);
+
+		/* The profiler walks items as the skipper does. */
+		buf.idx = at;
+		FUZZ_CHECK(prof_item(&prof, &buf) == ok);
+		FUZZ_CHECK(buf.idx == end || !ok);
+
+		if ( !ok ) {
+			break;
+		}
+		at = end;
+	}
+
+	prof_free(&prof);
+	free(data);
+	free(walk);
+
+	return 0;
+}
+
+#ifdef CBOR_FUZZ_STDIN
+int
+main(void)
+{
+	size_t   cap  = 1 << 16;
+	size_t   size = 0;
+	uint8_t *data = malloc(cap);
+
+	while ( data != NULL ) {
+		size += fread(data + size, 1, cap - size, stdin);
+		if ( size < cap ) {
+			break;
+		}
+		cap *= 2;
+
+		uint8_t *grown = realloc(data, cap);
+
+		if ( grown == NULL ) {
+			free(data);
+		}
+		data = grown;
+	}
+	if ( data == NULL ) {
+		return 1;
+	}
+	LLVMFuzzerTestOneInput(data, size);
+	free(data);
+
+	return 0;
+}
+#endif
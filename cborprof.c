@@ -0,0 +1,1057 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "cbor.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+ * cborprof [-j] [-n rows] file
+ *
+ * Show where the bytes of a CBOR item or sequence go: head and payload
+ * bytes per major type and per map key path, heads wider than needed,
+ * floats that would fit a narrower width and strings that repeat. Paths
+ * are printed in the cbor_path.h syntax, array elements collapse into
+ * [*] and maps with more than PROF_MAX_FANOUT distinct keys at one path
+ * are taken as dictionaries and collapse into .*. The input is mapped and
+ * read once front to back, -j prints JSON instead of tables.
+ *
+ * The walk is CPU bound: accounting each item costs about three times what
+ * cbor_skip_item() does, some 100 to 130 MB/s on one core for records of
+ * small items, which is short of disk speed on fast storage.
+ *
+ * With CBORPROF_WALK_ONLY defined only the walk is compiled, for cbortest
+ * and cborfuzz to include and check against the other decoders.
+ */
+
+#ifndef PROF_MAX_FANOUT
+#define PROF_MAX_FANOUT 256
+#endif
+
+#ifndef PROF_MAX_PATHS
+#define PROF_MAX_PATHS (1u << 20)
+#endif
+
+#ifndef PROF_MAX_STRINGS
+#define PROF_MAX_STRINGS (1u << 22)
+#endif
+
+enum prof_kind {
+	PROF_ROOT,
+	PROF_NAME,              /* text string map key */
+	PROF_UINT,              /* integer map keys */
+	PROF_NEGINT,
+	PROF_ELEM,              /* array elements */
+	PROF_ANY                /* other keys, or too many distinct ones */
+};
+
+struct prof_path {
+	uint32_t       parent;
+	uint32_t       children;
+	uint32_t       first;   /* hint: child looked up first */
+	uint32_t       next;    /* hint: sibling looked up after this one */
+	uint8_t        kind;
+	const uint8_t *name;
+	uint64_t       arg;     /* name length or integer key */
+	uint64_t       items;
+	uint64_t       head;
+	uint64_t       payload;
+	uint64_t       keys;    /* bytes of the map keys naming this path */
+	uint64_t       named;   /* text keys naming it, interned at the end */
+	uint64_t       waste;
+	uint64_t       total;   /* including everything below */
+};
+
+struct prof_string {
+	uint64_t hash;
+	size_t   off;           /* payload of the first occurrence */
+	uint64_t len;
+	uint64_t count;
+	uint32_t rank;          /* order of first occurrence, set at the end */
+	uint8_t  major;
+};
+
+/* Major types, with floats counted apart from other simple values. */
+#define PROF_FLOAT  8
+#define PROF_NTYPES 9
+
+struct prof_type {
+	uint64_t items;
+	uint64_t head;
+	uint64_t payload;
+};
+
+struct prof_saving {
+	uint64_t count;
+	uint64_t bytes;
+};
+
+struct prof {
+	const uint8_t      *data;
+	size_t              size;
+	uint64_t            items;          /* top level items */
+
+	struct prof_path   *paths;
+	uint32_t            npaths;
+	uint32_t           *path_slots;     /* path id + 1, 0 if free */
+	size_t              path_mask;
+
+	struct prof_string *strings;
+	size_t              nstrings;
+	size_t              string_mask;
+	uint64_t            untracked;      /* strings seen once the table was full */
+	uint64_t            repeats;        /* occurrences after the first */
+	uint64_t            interned;       /* bytes saved by interning them */
+
+	struct prof_type    types[PROF_NTYPES];
+	struct prof_saving  wide_heads;
+	struct prof_saving  to_half;
+	struct prof_saving  to_single;
+};
+
+/* Most keys and repeated strings are short, they get a cheaper hash. */
+static uint64_t
+prof_hash(const void *data, size_t len, uint64_t seed)
+{
+	struct cbor_hash hash;
+
+	if ( len <= 16 ) {
+		uint64_t word[2] = { 0, 0 };
+		uint64_t h;
+
+		if ( len > 0 ) {
+			memcpy(word, data, len);
+		}
+		h = cbor_hash_round(seed ^ len * CBOR_XXH_PRIME5, word[0]);
+		h = cbor_hash_round(h, word[1]);
+		h ^= h >> 33;
+		h *= CBOR_XXH_PRIME2;
+		h ^= h >> 29;
+		h *= CBOR_XXH_PRIME3;
+
+		return h ^ h >> 32;
+	}
+	cbor_hash_init(&hash, seed);
+	cbor_hash_update(&hash, data, len);
+
+	return cbor_hash_digest(&hash);
+}
+
+static uint64_t
+prof_path_hash(uint32_t parent, int kind, const uint8_t *name, uint64_t arg)
+{
+	uint64_t seed = (uint64_t)parent << 8 | (uint64_t)kind;
+
+	return prof_hash(name, kind == PROF_NAME ? (size_t)arg : 0, seed ^ arg * CBOR_XXH_PRIME2);
+}
+
+static bool
+prof_path_equal(const struct prof_path *path, uint32_t parent, int kind, const uint8_t *name, uint64_t arg)
+{
+	if ( path->parent != parent || path->kind != kind || path->arg != arg ) {
+		return false;
+	}
+
+	return kind != PROF_NAME || memcmp(path->name, name, (size_t)arg) == 0;
+}
+
+static bool
+prof_paths_grow(struct prof *prof)
+{
+	size_t            size  = (prof->path_mask + 1) * 2;
+	struct prof_path *paths = realloc(prof->paths, size / 2 * sizeof(*paths));
+	uint32_t         *slots;
+
+	if ( paths == NULL ) {
+		return false;
+	}
+	prof->paths = paths;
+	if ( (slots = calloc(size, sizeof(*slots))) == NULL ) {
+		return false;
+	}
+
+	for ( uint32_t id = 0; id < prof->npaths; id++ ) {
+		struct prof_path *path = &paths[id];
+		size_t            slot = prof_path_hash(path->parent, path->kind, path->name, path->arg) & (size - 1);
+
+		while ( slots[slot] != 0 ) {
+			slot = (slot + 1) & (size - 1);
+		}
+		slots[slot] = id + 1;
+	}
+	free(prof->path_slots);
+	prof->path_slots = slots;
+	prof->path_mask  = size - 1;
+
+	return true;
+}
+
+/* The path below parent for a map key or array element, added on first use. */
+static uint32_t
+prof_path_child(struct prof *prof, uint32_t parent, int kind, const uint8_t *name, uint64_t arg)
+{
+	size_t            slot = prof_path_hash(parent, kind, name, arg) & prof->path_mask;
+	struct prof_path *path;
+	uint32_t          id;
+
+	while ( (id = prof->path_slots[slot]) != 0 ) {
+		if ( prof_path_equal(&prof->paths[id - 1], parent, kind, name, arg) ) {
+			return id - 1;
+		}
+		slot = (slot + 1) & prof->path_mask;
+	}
+
+	if ( kind != PROF_ANY && kind != PROF_ELEM &&
+	     (prof->paths[parent].children >= PROF_MAX_FANOUT || prof->npaths >= PROF_MAX_PATHS - 1) ) {
+		return prof_path_child(prof, parent, PROF_ANY, NULL, 0);
+	}
+	if ( prof->npaths >= PROF_MAX_PATHS ) {
+		return parent;
+	}
+	if ( prof->npaths >= (prof->path_mask + 1) / 2 ) {
+		if ( !prof_paths_grow(prof) ) {
+			return parent;
+		}
+		return prof_path_child(prof, parent, kind, name, arg);
+	}
+
+	id   = prof->npaths++;
+	path = &prof->paths[id];
+	memset(path, 0, sizeof(*path));
+	path->parent = parent;
+	path->kind   = (uint8_t)kind;
+	path->name   = name;
+	path->arg    = arg;
+	prof->path_slots[slot] = id + 1;
+	if ( kind != PROF_ANY && kind != PROF_ELEM ) {
+		prof->paths[parent].children++;
+	}
+
+	return id;
+}
+
+/*
+ * Look up a child, first trying the one that followed prev last time, or
+ * came first below parent if prev is the parent. Records of one shape
+ * always hit, without hashing the key.
+ */
+static uint32_t
+prof_path_hinted(struct prof *prof, uint32_t prev, uint32_t parent, int kind, const uint8_t *name, uint64_t arg)
+{
+	uint32_t id = prev == parent ? prof->paths[prev].first : prof->paths[prev].next;
+
+	if ( id != 0 && prof_path_equal(&prof->paths[id], parent, kind, name, arg) ) {
+		return id;
+	}
+
+	/* The lookup may move the paths. */
+	id = prof_path_child(prof, parent, kind, name, arg);
+	if ( prev == parent ) {
+		prof->paths[prev].first = id;
+	} else {
+		prof->paths[prev].next = id;
+	}
+
+	return id;
+}
+
+static bool
+prof_strings_grow(struct prof *prof)
+{
+	size_t              size    = (prof->string_mask + 1) * 2;
+	struct prof_string *strings = calloc(size, sizeof(*strings));
+
+	if ( strings == NULL ) {
+		return false;
+	}
+	for ( size_t i = 0; i <= prof->string_mask; i++ ) {
+		struct prof_string *string = &prof->strings[i];
+		size_t              slot   = string->hash & (size - 1);
+
+		if ( string->count == 0 ) {
+			continue;
+		}
+		while ( strings[slot].count != 0 ) {
+			slot = (slot + 1) & (size - 1);
+		}
+		strings[slot] = *string;
+	}
+	free(prof->strings);
+	prof->strings     = strings;
+	prof->string_mask = size - 1;
+
+	return true;
+}
+
+static void
+prof_string(struct prof *prof, int major, size_t off, uint64_t len, uint64_t count)
+{
+	const uint8_t      *data = prof->data + off;
+	uint64_t            hash = prof_hash(data, (size_t)len, (uint64_t)major);
+	size_t              slot = hash & prof->string_mask;
+	struct prof_string *string;
+
+	while ( (string = &prof->strings[slot])->count != 0 ) {
+		if ( string->hash == hash && string->len == len && string->major == major &&
+		     memcmp(prof->data + string->off, data, (size_t)len) == 0 ) {
+			string->count += count;
+			if ( off < string->off ) {
+				string->off = off;
+			}
+			return;
+		}
+		slot = (slot + 1) & prof->string_mask;
+	}
+
+	if ( prof->nstrings >= PROF_MAX_STRINGS ) {
+		prof->untracked++;
+		return;
+	}
+	if ( prof->nstrings >= (prof->string_mask + 1) / 2 ) {
+		if ( !prof_strings_grow(prof) ) {
+			prof->untracked++;
+			return;
+		}
+		prof_string(prof, major, off, len, count);
+		return;
+	}
+
+	string->hash  = hash;
+	string->off   = off;
+	string->len   = len;
+	string->count = count;
+	string->major = (uint8_t)major;
+	prof->nstrings++;
+}
+
+/*
+ * Whether the double with bits n is exact in a narrower float format with
+ * a mantissa of width bits and normal exponents min to max: the exponent
+ * is in range and the mantissa bits the format drops are zero.
+ */
+static bool
+prof_fits(uint64_t n, int bits, int min, int max)
+{
+	int      exponent = (int)(n >> 52 & 0x7ff) - 1023;
+	uint64_t mantissa = n & (((uint64_t)1 << 52) - 1);
+	int      drop     = 52 - bits;
+
+	if ( exponent == 1024 ) {
+		return true;            /* infinity and NaN */
+	}
+	if ( exponent == -1023 ) {
+		return mantissa == 0;   /* subnormal doubles fit no narrower format */
+	}
+	if ( exponent > max ) {
+		return false;
+	}
+	if ( exponent < min ) {
+		drop += min - exponent; /* subnormal in the narrower format */
+	}
+
+	return drop <= 52 && (mantissa & (((uint64_t)1 << drop) - 1)) == 0;
+}
+
+/* Bytes a shorter encoding of the head would save. */
+static uint64_t
+prof_waste(struct prof *prof, const struct cbor_head *head)
+{
+	union {
+		uint64_t n;
+		double   x;
+	} f64;
+	union {
+		uint32_t n;
+		float    x;
+	} f32;
+	size_t size;
+
+	if ( head->major != CBOR_MAJOR_SIMPLE ) {
+		if ( head->indefinite || head->size == (size = cbor_head_size(head->arg)) ) {
+			return 0;
+		}
+		prof->wide_heads.count++;
+		prof->wide_heads.bytes += head->size - size;
+		return head->size - size;
+	}
+
+	switch ( head->initial ) {
+		case 0xfb:
+			if ( prof_fits(head->arg, 10, -14, 15) ) {
+				prof->to_half.count++;
+				prof->to_half.bytes += 6;
+				return 6;
+			}
+			if ( prof_fits(head->arg, 23, -126, 127) ) {
+				prof->to_single.count++;
+				prof->to_single.bytes += 4;
+				return 4;
+			}
+			return 0;
+
+		case 0xfa:
+			f32.n = (uint32_t)head->arg;
+			f64.x = f32.x;
+			if ( prof_fits(f64.n, 10, -14, 15) ) {
+				prof->to_half.count++;
+				prof->to_half.bytes += 2;
+				return 2;
+			}
+			return 0;
+
+		default:
+			return 0;
+	}
+}
+
+static void
+prof_account(struct prof *prof, uint32_t id, bool key, bool item, const struct cbor_head *head, uint64_t payload)
+{
+	struct prof_path *path = &prof->paths[id];
+	int               type = head->major;
+
+	if ( type == CBOR_MAJOR_SIMPLE && (head->initial & 0x1f) >= 25 && (head->initial & 0x1f) <= 27 ) {
+		type = PROF_FLOAT;
+	}
+	prof->types[type].items   += item;
+	prof->types[type].head    += head->size;
+	prof->types[type].payload += payload;
+
+	if ( key ) {
+		path->keys    += head->size + payload;
+	} else {
+		path->items   += item;
+		path->head    += head->size;
+		path->payload += payload;
+	}
+	path->waste += prof_waste(prof, head);
+}
+
+struct prof_level {
+	uint64_t remaining;     /* definite: items left */
+	uint32_t path;          /* of the container */
+	uint32_t child;         /* of the next item inside */
+	uint8_t  major;
+	bool     indefinite;
+	bool     key;           /* nested in a map key */
+	bool     value;         /* map: the next item is a value */
+};
+
+/* The path a map key names, the key head is read and its payload checked. */
+static uint32_t
+prof_key_path(struct prof *prof, uint32_t prev, uint32_t parent, struct cbor_buf *buf, const struct cbor_head *head)
+{
+	switch ( head->major ) {
+		case CBOR_MAJOR_UINT:
+			return prof_path_hinted(prof, prev, parent, PROF_UINT, NULL, head->arg);
+
+		case CBOR_MAJOR_NEGINT:
+			return prof_path_hinted(prof, prev, parent, PROF_NEGINT, NULL, head->arg);
+
+		case CBOR_MAJOR_TEXT:
+			if ( !head->indefinite ) {
+				return prof_path_hinted(prof, prev, parent, PROF_NAME, buf->data + buf->idx, head->arg);
+			}
+			/* FALLTHROUGH */
+
+		default:
+			return prof_path_hinted(prof, prev, parent, PROF_ANY, NULL, 0);
+	}
+}
+
+/*
+ * Walk one top level item, like cbor_skip_item() but accounting every
+ * head and payload to the path it sits at.
+ */
+static bool
+prof_item(struct prof *prof, struct cbor_buf *buf)
+{
+	struct prof_level stack[CBOR_MAX_DEPTH];
+	size_t            depth  = 0;
+	uint64_t          tags   = 0;       /* tag heads in front of a map key */
+	bool              tagged = false;
+	struct cbor_head  head;
+
+	for ( ;; ) {
+		size_t             item = buf->idx;
+		struct prof_level *top  = depth > 0 ? &stack[depth - 1] : NULL;
+		uint32_t           path = top != NULL ? top->child : 0;
+		bool               key  = top != NULL && top->key;
+		bool               chunk;
+		bool               intern;
+		uint64_t           payload = 0;
+
+		if ( !cbor_read_head(buf, &head) ) {
+			return false;
+		}
+
+		chunk = top != NULL && top->indefinite &&
+		        (top->major == CBOR_MAJOR_BYTES || top->major == CBOR_MAJOR_TEXT);
+		if ( chunk && head.initial != 0xff && (head.major != top->major || head.indefinite) ) {
+			buf->idx = item;
+			return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_BIT(top->major));
+		}
+
+		/* A tag needs an item, a break cannot complete it. */
+		if ( tagged && head.initial == 0xff ) {
+			buf->idx = item;
+			return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_ANY);
+		}
+		tagged = head.major == CBOR_MAJOR_TAG;
+		if ( (head.major == CBOR_MAJOR_BYTES || head.major == CBOR_MAJOR_TEXT) && !head.indefinite ) {
+			if ( !cbor_check_string(buf, head.arg, item) ) {
+				return false;
+			}
+			payload = head.arg;
+		}
+		intern = payload > 0;
+
+		if ( head.initial == 0xff ) {
+			if ( top == NULL || !top->indefinite ||
+			     (top->major == CBOR_MAJOR_MAP && top->value) ) {
+				buf->idx = item;
+				return cbor_buf_fail(buf, CBOR_ERR_TYPE, CBOR_MAJOR_ANY);
+			}
+			prof_account(prof, top->path, top->key, false, &head, 0);
+			depth--;
+			goto complete;
+		}
+
+		if ( top != NULL && top->major == CBOR_MAJOR_MAP && !top->value && !top->key ) {
+			if ( head.major == CBOR_MAJOR_TAG ) {
+				tags += head.size;
+				prof->types[CBOR_MAJOR_TAG].items++;
+				prof->types[CBOR_MAJOR_TAG].head += head.size;
+				continue;
+			}
+			top->child = path = prof_key_path(prof, top->child, top->path, buf, &head);
+			prof->paths[path].keys += tags;
+			tags = 0;
+			key  = true;
+			if ( prof->paths[path].kind == PROF_NAME && prof->paths[path].parent == top->path ) {
+				prof->paths[path].named++;
+				intern = false;
+			}
+		}
+
+		prof_account(prof, path, key, !chunk, &head, payload);
+		if ( intern ) {
+			prof_string(prof, head.major, buf->idx, payload, 1);
+		}
+		buf->idx += (size_t)payload;
+
+		switch ( head.major ) {
+			case CBOR_MAJOR_BYTES:
+			case CBOR_MAJOR_TEXT:
+			case CBOR_MAJOR_ARRAY:
+			case CBOR_MAJOR_MAP:
+				if ( !head.indefinite ) {
+					if ( head.major == CBOR_MAJOR_BYTES || head.major == CBOR_MAJOR_TEXT ) {
+						break;
+					}
+					if ( !cbor_check_container(buf, head.arg, item) ) {
+						return false;
+					}
+					if ( head.arg == 0 ) {
+						break;
+					}
+				}
+				if ( depth >= CBOR_MAX_DEPTH ) {
+					buf->idx = item;
+					return cbor_buf_fail(buf, CBOR_ERR_DEPTH, CBOR_MAJOR_ANY);
+				}
+				top             = &stack[depth++];
+				top->remaining  = head.major == CBOR_MAJOR_MAP ? head.arg * 2 : head.arg;
+				top->path       = path;
+				top->child      = path;
+				top->major      = head.major;
+				top->indefinite = head.indefinite;
+				top->key        = key;
+				top->value      = false;
+				if ( head.major == CBOR_MAJOR_ARRAY && !key ) {
+					top->child = prof_path_hinted(prof, path, path, PROF_ELEM, NULL, 0);
+				}
+				continue;
+
+			case CBOR_MAJOR_TAG:
+				continue;
+
+			default:
+				break;
+		}
+
+complete:
+		while ( depth > 0 ) {
+			top = &stack[depth - 1];
+			if ( top->major == CBOR_MAJOR_MAP ) {
+				top->value = !top->value;
+			}
+			if ( top->indefinite || --top->remaining > 0 ) {
+				break;
+			}
+			depth--;
+		}
+
+		if ( depth == 0 ) {
+			return true;
+		}
+	}
+}
+
+static bool
+prof_init(struct prof *prof, const uint8_t *data, size_t size)
+{
+	memset(prof, 0, sizeof(*prof));
+	prof->data        = data;
+	prof->size        = size;
+	prof->path_mask   = 1023;
+	prof->string_mask = 4095;
+	prof->paths       = malloc(512 * sizeof(*prof->paths));
+	prof->path_slots  = calloc(1024, sizeof(*prof->path_slots));
+	prof->strings     = calloc(4096, sizeof(*prof->strings));
+	if ( prof->paths == NULL || prof->path_slots == NULL || prof->strings == NULL ) {
+		return false;
+	}
+
+	memset(&prof->paths[0], 0, sizeof(prof->paths[0]));
+	prof->paths[0].kind = PROF_ROOT;
+	prof->npaths        = 1;
+
+	return true;
+}
+
+static void
+prof_free(struct prof *prof)
+{
+	free(prof->paths);
+	free(prof->path_slots);
+	free(prof->strings);
+}
+
+#ifndef CBORPROF_WALK_ONLY
+
+static const char *prof_type_names[PROF_NTYPES] = {
+	"uint", "negint", "bytes", "text", "array", "map", "tag", "simple", "float"
+};
+
+/* Roll the bytes of every path up into its parents. */
+static void
+prof_totals(struct prof *prof)
+{
+	for ( uint32_t id = 0; id < prof->npaths; id++ ) {
+		struct prof_path *path = &prof->paths[id];
+
+		path->total = path->head + path->payload + path->keys;
+	}
+	for ( uint32_t id = prof->npaths - 1; id > 0; id-- ) {
+		prof->paths[prof->paths[id].parent].total += prof->paths[id].total;
+	}
+}
+
+/* Bytes saved by interning with stringref tags: 0xd8 0x19 and an index. */
+static uint64_t
+prof_interned(const struct prof_string *string)
+{
+	uint64_t size = cbor_head_size(string->len) + string->len;
+	uint64_t ref  = 2 + cbor_head_size(string->rank);
+
+	return size > ref ? (string->count - 1) * (size - ref) : 0;
+}
+
+static int
+prof_cmp_paths(const void *a, const void *b)
+{
+	uint64_t x = (*(struct prof_path * const *)a)->total;
+	uint64_t y = (*(struct prof_path * const *)b)->total;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static int
+prof_cmp_offsets(const void *a, const void *b)
+{
+	size_t x = (*(struct prof_string * const *)a)->off;
+	size_t y = (*(struct prof_string * const *)b)->off;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int
+prof_cmp_strings(const void *a, const void *b)
+{
+	uint64_t x = prof_interned(*(struct prof_string * const *)a);
+	uint64_t y = prof_interned(*(struct prof_string * const *)b);
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static bool
+prof_ident(const uint8_t *name, uint64_t len)
+{
+	if ( len == 0 ) {
+		return false;
+	}
+	for ( uint64_t i = 0; i < len; i++ ) {
+		uint8_t c = name[i];
+
+		if ( !(c == '_' || c == '-' || (c >= '0' && c <= '9') ||
+		       (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) ) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Print a string quoted, escaped for JSON, truncated after max bytes. */
+static void
+prof_print_quoted(FILE *out, const uint8_t *data, uint64_t len, uint64_t max)
+{
+	if ( len > max ) {
+		/* Do not split a UTF-8 sequence. */
+		while ( max > 0 && (data[max] & 0xc0) == 0x80 ) {
+			max--;
+		}
+	}
+	putc('"', out);
+	for ( uint64_t i = 0; i < len && i < max; i++ ) {
+		uint8_t c = data[i];
+
+		if ( c == '"' || c == '\\' ) {
+			fprintf(out, "\\%c", c);
+		} else if ( c < 0x20 || c == 0x7f ) {
+			fprintf(out, "\\u%04x", c);
+		} else {
+			putc(c, out);
+		}
+	}
+	if ( len > max ) {
+		fputs("...", out);
+	}
+	putc('"', out);
+}
+
+static void
+prof_print_path(FILE *out, const struct prof *prof, uint32_t id)
+{
+	const struct prof_path *path = &prof->paths[id];
+
+	if ( path->kind == PROF_ROOT ) {
+		putc('$', out);
+		return;
+	}
+	prof_print_path(out, prof, path->parent);
+	switch ( path->kind ) {
+		case PROF_NAME:
+			if ( prof_ident(path->name, path->arg) ) {
+				fprintf(out, ".%.*s", (int)path->arg, (const char *)path->name);
+			} else {
+				putc('[', out);
+				prof_print_quoted(out, path->name, path->arg, path->arg);
+				putc(']', out);
+			}
+			break;
+
+		case PROF_UINT:
+			fprintf(out, "[%" PRIu64 "]", path->arg);
+			break;
+
+		case PROF_NEGINT:
+			if ( path->arg == UINT64_MAX ) {
+				fputs("[-18446744073709551616]", out);
+			} else {
+				fprintf(out, "[-%" PRIu64 "]", path->arg + 1);
+			}
+			break;
+
+		case PROF_ELEM:
+			fputs("[*]", out);
+			break;
+
+		default:
+			fputs(".*", out);
+			break;
+	}
+}
+
+static double
+prof_percent(uint64_t part, uint64_t whole)
+{
+	return whole > 0 ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+static void
+prof_print_text(FILE *out, const struct prof *prof, struct prof_path **paths, size_t npaths,
+                struct prof_string **strings, size_t nstrings)
+{
+	uint64_t total = prof->paths[0].total;
+
+	fprintf(out, "%" PRIu64 " items, %" PRIu64 " bytes\n\n", prof->items, total);
+
+	fprintf(out, "%-8s %12s %14s %14s %14s %7s\n", "type", "items", "head", "payload", "total", "%");
+	for ( int type = 0; type < PROF_NTYPES; type++ ) {
+		const struct prof_type *t = &prof->types[type];
+
+		if ( t->items == 0 && t->head == 0 ) {
+			continue;
+		}
+		fprintf(out, "%-8s %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %6.2f%%\n",
+		        prof_type_names[type], t->items, t->head, t->payload, t->head + t->payload,
+		        prof_percent(t->head + t->payload, total));
+	}
+
+	fprintf(out, "\n%14s %7s %12s %14s %14s %14s %12s  %s\n",
+	        "total", "%", "items", "head", "payload", "keys", "waste", "path");
+	for ( size_t i = 0; i < npaths; i++ ) {
+		const struct prof_path *path = paths[i];
+
+		fprintf(out, "%14" PRIu64 " %6.2f%% %12" PRIu64 " %14" PRIu64 " %14" PRIu64 " %14" PRIu64 " %12" PRIu64 "  ",
+		        path->total, prof_percent(path->total, total), path->items,
+		        path->head, path->payload, path->keys, path->waste);
+		prof_print_path(out, prof, (uint32_t)(path - prof->paths));
+		putc('\n', out);
+	}
+
+	fprintf(out, "\n%-28s %12s %14s\n", "saving", "count", "bytes");
+	fprintf(out, "%-28s %12" PRIu64 " %14" PRIu64 "\n", "shortest heads",
+	        prof->wide_heads.count, prof->wide_heads.bytes);
+	fprintf(out, "%-28s %12" PRIu64 " %14" PRIu64 "\n", "floats to half precision",
+	        prof->to_half.count, prof->to_half.bytes);
+	fprintf(out, "%-28s %12" PRIu64 " %14" PRIu64 "\n", "floats to single precision",
+	        prof->to_single.count, prof->to_single.bytes);
+	fprintf(out, "%-28s %12" PRIu64 " %14" PRIu64 "\n", "interned strings (estimate)",
+	        prof->repeats, prof->interned);
+	if ( prof->untracked > 0 ) {
+		fprintf(out, "%" PRIu64 " strings not tracked, string table full\n", prof->untracked);
+	}
+
+	if ( nstrings == 0 ) {
+		return;
+	}
+	fprintf(out, "\n%12s %10s %14s  %s\n", "count", "size", "saving", "string");
+	for ( size_t i = 0; i < nstrings; i++ ) {
+		const struct prof_string *string = strings[i];
+
+		fprintf(out, "%12" PRIu64 " %10" PRIu64 " %14" PRIu64 "  ", string->count,
+		        cbor_head_size(string->len) + string->len, prof_interned(string));
+		if ( string->major == CBOR_MAJOR_BYTES ) {
+			fputs("h'", out);
+			for ( uint64_t j = 0; j < string->len && j < 32; j++ ) {
+				fprintf(out, "%02x", prof->data[string->off + j]);
+			}
+			fputs(string->len > 32 ? "...'" : "'", out);
+		} else {
+			prof_print_quoted(out, prof->data + string->off, string->len, 48);
+		}
+		putc('\n', out);
+	}
+}
+
+static void
+prof_print_json(FILE *out, const struct prof *prof, struct prof_path **paths, size_t npaths,
+                struct prof_string **strings, size_t nstrings)
+{
+	fprintf(out, "{\"items\":%" PRIu64 ",\"bytes\":%" PRIu64 ",\"types\":{", prof->items, prof->paths[0].total);
+	for ( int type = 0, first = 1; type < PROF_NTYPES; type++ ) {
+		const struct prof_type *t = &prof->types[type];
+
+		if ( t->items == 0 && t->head == 0 ) {
+			continue;
+		}
+		fprintf(out, "%s\"%s\":{\"items\":%" PRIu64 ",\"head\":%" PRIu64 ",\"payload\":%" PRIu64 "}",
+		        first ? "" : ",", prof_type_names[type], t->items, t->head, t->payload);
+		first = 0;
+	}
+
+	fputs("},\"paths\":[", out);
+	for ( size_t i = 0; i < npaths; i++ ) {
+		const struct prof_path *path = paths[i];
+
+		char                   *text = NULL;
+		size_t                  len  = 0;
+		FILE                   *mem  = open_memstream(&text, &len);
+
+		/* Key names in the path are quoted themselves, escape them again. */
+		if ( mem != NULL ) {
+			prof_print_path(mem, prof, (uint32_t)(path - prof->paths));
+			fclose(mem);
+		}
+		fprintf(out, "%s{\"path\":", i == 0 ? "" : ",");
+		prof_print_quoted(out, (const uint8_t *)text, len, len);
+		free(text);
+		fprintf(out, ",\"total\":%" PRIu64 ",\"items\":%" PRIu64 ",\"head\":%" PRIu64
+		        ",\"payload\":%" PRIu64 ",\"keys\":%" PRIu64 ",\"waste\":%" PRIu64 "}",
+		        path->total, path->items, path->head, path->payload, path->keys, path->waste);
+	}
+
+	fprintf(out, "],\"savings\":{"
+	        "\"shortest_heads\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "},"
+	        "\"floats_to_half\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "},"
+	        "\"floats_to_single\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "},"
+	        "\"interned_strings\":{\"count\":%" PRIu64 ",\"bytes\":%" PRIu64 "}},"
+	        "\"untracked_strings\":%" PRIu64 ",\"strings\":[",
+	        prof->wide_heads.count, prof->wide_heads.bytes, prof->to_half.count, prof->to_half.bytes,
+	        prof->to_single.count, prof->to_single.bytes, prof->repeats, prof->interned, prof->untracked);
+	for ( size_t i = 0; i < nstrings; i++ ) {
+		const struct prof_string *string = strings[i];
+
+		fprintf(out, "%s{\"count\":%" PRIu64 ",\"size\":%" PRIu64 ",\"saving\":%" PRIu64 ",\"%s\":",
+		        i == 0 ? "" : ",", string->count, cbor_head_size(string->len) + string->len,
+		        prof_interned(string), string->major == CBOR_MAJOR_BYTES ? "hex" : "text");
+		if ( string->major == CBOR_MAJOR_BYTES ) {
+			putc('"', out);
+			for ( uint64_t j = 0; j < string->len && j < 32; j++ ) {
+				fprintf(out, "%02x", prof->data[string->off + j]);
+			}
+			putc('"', out);
+		} else {
+			prof_print_quoted(out, prof->data + string->off, string->len, 48);
+		}
+		putc('}', out);
+	}
+	fputs("]}\n", out);
+}
+
+static bool
+prof_report(struct prof *prof, bool json, size_t rows)
+{
+	struct prof_path   **paths;
+	struct prof_string **strings;
+	size_t               npaths    = prof->npaths;
+	size_t               nstrings  = 0;
+	size_t               nrepeated = 0;
+
+	/* Text keys were counted per path, the path names the key. */
+	for ( uint32_t id = 0; id < prof->npaths; id++ ) {
+		struct prof_path *path = &prof->paths[id];
+
+		if ( path->kind == PROF_NAME && path->named > 0 ) {
+			prof_string(prof, CBOR_MAJOR_TEXT, (size_t)(path->name - prof->data), path->arg, path->named);
+		}
+	}
+
+	paths   = malloc(npaths * sizeof(*paths));
+	strings = malloc(prof->nstrings * sizeof(*strings) + 1);
+	if ( paths == NULL || strings == NULL ) {
+		free(paths);
+		free(strings);
+		return false;
+	}
+
+	prof_totals(prof);
+	for ( uint32_t id = 0; id < npaths; id++ ) {
+		paths[id] = &prof->paths[id];
+	}
+	qsort(paths, npaths, sizeof(*paths), prof_cmp_paths);
+
+	/* Interned strings are numbered in order of first occurrence. */
+	for ( size_t i = 0; i < prof->string_mask + 1; i++ ) {
+		if ( prof->strings[i].count > 0 ) {
+			strings[nstrings++] = &prof->strings[i];
+		}
+	}
+	qsort(strings, nstrings, sizeof(*strings), prof_cmp_offsets);
+	for ( size_t i = 0; i < nstrings; i++ ) {
+		strings[i]->rank = (uint32_t)i;
+	}
+	for ( size_t i = 0; i < nstrings; i++ ) {
+		struct prof_string *string = strings[i];
+
+		prof->repeats += string->count - 1;
+		if ( prof_interned(string) > 0 ) {
+			prof->interned       += prof_interned(string);
+			strings[nrepeated++]  = string;
+		}
+	}
+	nstrings = nrepeated;
+	qsort(strings, nstrings, sizeof(*strings), prof_cmp_strings);
+
+	if ( json ) {
+		prof_print_json(stdout, prof, paths, npaths < rows ? npaths : rows, strings, nstrings < rows ? nstrings : rows);
+	} else {
+		prof_print_text(stdout, prof, paths, npaths < rows ? npaths : rows, strings, nstrings < rows ? nstrings : rows);
+	}
+	free(paths);
+	free(strings);
+
+	return fflush(stdout) == 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct prof     prof;
+	struct cbor_buf buf;
+	struct stat     st;
+	void           *data   = NULL;
+	size_t          rows   = 30;
+	bool            json   = false;
+	int             status = 0;
+	int             fd;
+	int             opt;
+
+	while ( (opt = getopt(argc, argv, "jn:")) != -1 ) {
+		switch ( opt ) {
+			case 'j':
+				json = true;
+				break;
+
+			case 'n':
+				rows = (size_t)strtoull(optarg, NULL, 10);
+				break;
+
+			default:
+				fprintf(stderr, "usage: cborprof [-j] [-n rows] file\n");
+				return 2;
+		}
+	}
+	if ( optind != argc - 1 ) {
+		fprintf(stderr, "usage: cborprof [-j] [-n rows] file\n");
+		return 2;
+	}
+
+	if ( (fd = open(argv[optind], O_RDONLY)) == -1 || fstat(fd, &st) == -1 ) {
+		fprintf(stderr, "cborprof: %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+	if ( st.st_size > 0 ) {
+		if ( (data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ) {
+			fprintf(stderr, "cborprof: %s: %s\n", argv[optind], strerror(errno));
+			return 1;
+		}
+		posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	if ( !prof_init(&prof, data, (size_t)st.st_size) ) {
+		fprintf(stderr, "cborprof: out of memory\n");
+		return 1;
+	}
+
+	cbor_buf_init(&buf, data, (size_t)st.st_size, (size_t)st.st_size);
+	while ( cbor_buf_index(&buf) < cbor_buf_length(&buf) ) {
+		if ( !prof_item(&prof, &buf) ) {
+			fprintf(stderr, "cborprof: %s at offset %zu, profile covers the %zu bytes before\n",
+			        cbor_error_string(cbor_buf_error(&buf)), cbor_buf_error_offset(&buf), cbor_buf_index(&buf));
+			status = 1;
+			break;
+		}
+		prof.items++;
+	}
+
+	if ( !prof_report(&prof, json, rows) ) {
+		fprintf(stderr, "cborprof: write failed\n");
+		return 1;
+	}
+	prof_free(&prof);
+
+	return status;
+}
+
+#endif /* !CBORPROF_WALK_ONLY */
@@ -0,0 +1,2450 @@
+/**
+ * Copyright (c) 2013, Jan Bramkamp
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met: 
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution. 
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE
+#define CBORPROF_WALK_ONLY
+
+#include "cborprof.c"
+#include "cbor_aio.h"
+#include "cbor_json.h"
+#include "cbor_patch.h"
+#include "cbor_phf.h"
+#include "cbor_path.h"
+#include "cbor_pool.h"
+#include "cbor_ring.h"
+#include "cbor_schema.h"
+
+#include <locale.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * cbortest
+ *
+ * Unit tests of the library and the headers built on it, conformance tests
+ * against the examples of RFC 8949 Appendix A, and round trips of every
+ * writer through the matching readers at the boundaries of each head width.
+ * Exits non-zero if anything fails.
+ */
+
+static size_t failures;
+static size_t checks;
+
+#define CHECK(cond, ...) check((cond), #cond, __FILE__, __LINE__, __VA_ARGS__)
+
+static void
+check(bool ok, const char *cond, const char *file, int line, const char *fmt, ...)
+{
+	va_list ap;
+
+	checks++;
+	if ( ok ) {
+		return;
+	}
+	failures++;
+	fprintf(stderr, "%s:%d: %s failed: ", file, line, cond);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+static size_t
+unhex(const char *hex, uint8_t *data)
+{
+	size_t len = 0;
+
+	for ( ; hex[0] != '\0' && hex[1] != '\0'; hex += 2 ) {
+		unsigned byte;
+
+		sscanf(hex, "%2x", &byte);
+		data[len++] = (uint8_t)byte;
+	}
+
+	return len;
+}
+
+/* The item in hex decodes to exactly its own length, and no prefix does. */
+static void
+check_skip(const char *hex)
+{
+	uint8_t         data[256];
+	size_t          len = unhex(hex, data);
+	struct cbor_buf buf;
+
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	CHECK(cbor_skip_item(&buf) && buf.idx == len, "%s", hex);
+
+	for ( size_t n = 0; n < len; n++ ) {
+		cbor_buf_init(&buf, data, n, sizeof(data));
+		CHECK(!cbor_skip_item(&buf) && buf.idx == 0 && buf.err == CBOR_ERR_TRUNCATED,
+		      "%s prefix %zu", hex, n);
+	}
+}
+
+static bool
+encoded(struct cbor_buf *buf, const char *hex)
+{
+	uint8_t data[256];
+	size_t  len = unhex(hex, data);
+
+	return buf->len == len && memcmp(buf->data, data, len) == 0;
+}
+
+/* RFC 8949 Appendix A, unsigned and negative integers. */
+static const struct {
+	const char *hex;
+	uint64_t    value;
+} uints[] = {
+	{ "00",                 0 },
+	{ "01",                 1 },
+	{ "0a",                 10 },
+	{ "17",                 23 },
+	{ "1818",               24 },
+	{ "1819",               25 },
+	{ "1864",               100 },
+	{ "1903e8",             1000 },
+	{ "1a000f4240",         1000000 },
+	{ "1b000000e8d4a51000", 1000000000000ULL },
+	{ "1bffffffffffffffff", UINT64_MAX },
+};
+
+static const struct {
+	const char *hex;
+	uint64_t    biased;     /* the value is -1 - biased */
+} negints[] = {
+	{ "3bffffffffffffffff", UINT64_MAX },
+	{ "20",                 0 },
+	{ "29",                 9 },
+	{ "3863",               99 },
+	{ "3903e7",             999 },
+};
+
+static void
+test_integers(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+	uint64_t        value   = 0;
+	int128_t        integer = 0;
+
+	for ( size_t i = 0; i < sizeof(uints) / sizeof(uints[0]); i++ ) {
+		size_t len = unhex(uints[i].hex, data);
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_read_positive_integer(&buf, &value) && value == uints[i].value && buf.idx == len,
+		      "%s", uints[i].hex);
+		buf.idx = 0;
+		CHECK(cbor_read_integer(&buf, &integer) && integer == (int128_t)uints[i].value, "%s", uints[i].hex);
+		buf.idx = 0;
+		CHECK(!cbor_read_negative_integer_biased(&buf, &value) && buf.err == CBOR_ERR_TYPE && buf.idx == 0,
+		      "%s", uints[i].hex);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_uint64(&buf, uints[i].value) && encoded(&buf, uints[i].hex), "%s", uints[i].hex);
+		check_skip(uints[i].hex);
+	}
+
+	for ( size_t i = 0; i < sizeof(negints) / sizeof(negints[0]); i++ ) {
+		size_t   len      = unhex(negints[i].hex, data);
+		int128_t expected = -(int128_t)negints[i].biased - 1;
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_read_negative_integer_biased(&buf, &value) && value == negints[i].biased && buf.idx == len,
+		      "%s", negints[i].hex);
+		buf.idx = 0;
+		CHECK(cbor_read_negative_integer_unbiased(&buf, &integer) && integer == expected, "%s", negints[i].hex);
+		buf.idx = 0;
+		CHECK(cbor_read_integer(&buf, &integer) && integer == expected, "%s", negints[i].hex);
+		buf.idx = 0;
+		CHECK(!cbor_read_positive_integer(&buf, &value) && buf.err == CBOR_ERR_TYPE && buf.idx == 0,
+		      "%s", negints[i].hex);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_int128(&buf, expected) && encoded(&buf, negints[i].hex), "%s", negints[i].hex);
+		if ( negints[i].biased <= INT64_MAX ) {
+			cbor_buf_init_empty(&buf, data, sizeof(data));
+			CHECK(cbor_add_int64(&buf, (int64_t)expected) && encoded(&buf, negints[i].hex), "%s", negints[i].hex);
+		}
+		check_skip(negints[i].hex);
+	}
+
+	/* 2^64 and -2^64 - 1 need bignums, tags 2 and 3 over the magnitude. */
+	static const char *const bignums[] = { "c249010000000000000000", "c349010000000000000000" };
+	static const uint8_t     magnitude[] = { 1, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+	for ( size_t i = 0; i < 2; i++ ) {
+		size_t   len = unhex(bignums[i], data);
+		uint64_t tag;
+		uint8_t *bytes;
+		size_t   size;
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_read_tag(&buf, &tag) && tag == 2 + i, "%s", bignums[i]);
+		CHECK(cbor_read_byte_str(&buf, &bytes, &size) && size == sizeof(magnitude) &&
+		      memcmp(bytes, magnitude, size) == 0 && buf.idx == len, "%s", bignums[i]);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_tag(&buf, 2 + i) && cbor_add_byte_str(&buf, (void *)magnitude, sizeof(magnitude)) &&
+		      encoded(&buf, bignums[i]), "%s", bignums[i]);
+		check_skip(bignums[i]);
+	}
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(!cbor_add_int128(&buf, -(int128_t)UINT64_MAX - 2) && buf.len == 0, "-2^64 - 1");
+	CHECK(!cbor_add_int128(&buf, (int128_t)UINT64_MAX + 1) && buf.len == 0, "2^64");
+}
+
+/* RFC 8949 Appendix A, floating point in all three widths. */
+static const struct {
+	const char *hex;
+	double      value;
+} floats[] = {
+	{ "f90000",             0.0 },
+	{ "f98000",             -0.0 },
+	{ "f93c00",             1.0 },
+	{ "fb3ff199999999999a", 1.1 },
+	{ "f93e00",             1.5 },
+	{ "f97bff",             65504.0 },
+	{ "fa47c35000",         100000.0 },
+	{ "fa7f7fffff",         3.4028234663852886e+38 },
+	{ "fb7e37e43c8800759c", 1.0e+300 },
+	{ "f90001",             5.960464477539063e-8 },
+	{ "f90400",             0.00006103515625 },
+	{ "f9c400",             -4.0 },
+	{ "fbc010666666666666", -4.1 },
+	{ "f97c00",             INFINITY },
+	{ "f97e00",             NAN },
+	{ "f9fc00",             -INFINITY },
+	{ "fa7f800000",         INFINITY },
+	{ "fa7fc00000",         NAN },
+	{ "faff800000",         -INFINITY },
+	{ "fb7ff0000000000000", INFINITY },
+	{ "fb7ff8000000000000", NAN },
+	{ "fbfff0000000000000", -INFINITY },
+};
+
+static bool
+same_double(double x, double y)
+{
+	return isnan(x) ? isnan(y) : x == y && signbit(x) == signbit(y);
+}
+
+static void
+test_floats(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+
+	for ( size_t i = 0; i < sizeof(floats) / sizeof(floats[0]); i++ ) {
+		const char *hex = floats[i].hex;
+		size_t      len = unhex(hex, data);
+		double      x   = 0;
+		float       f   = 0;
+		bool        ok  = false;
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		switch ( data[0] ) {
+			case 0xf9:
+				ok = cbor_read_half(&buf, &x);
+				break;
+			case 0xfa:
+				ok = cbor_read_float(&buf, &f);
+				x  = f;
+				break;
+			case 0xfb:
+				ok = cbor_read_double(&buf, &x);
+				break;
+		}
+		CHECK(ok && buf.idx == len && same_double(x, floats[i].value), "%s", hex);
+
+		/* The other widths do not accept it. */
+		buf.idx = 0;
+		CHECK(data[0] == 0xf9 || (!cbor_read_half(&buf, &x) && buf.idx == 0), "%s", hex);
+		CHECK(data[0] == 0xfa || (!cbor_read_float(&buf, &f) && buf.idx == 0), "%s", hex);
+		CHECK(data[0] == 0xfb || (!cbor_read_double(&buf, &x) && buf.idx == 0), "%s", hex);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		if ( len == 5 ) {
+			CHECK(cbor_add_float(&buf, (float)floats[i].value) && encoded(&buf, hex), "%s", hex);
+		} else if ( len == 9 ) {
+			CHECK(cbor_add_double(&buf, floats[i].value) && encoded(&buf, hex), "%s", hex);
+		}
+		check_skip(hex);
+	}
+}
+
+/*
+ * Every half precision value against a decoding that builds the single
+ * precision bits instead of scaling.
+ */
+static double
+half_bits(uint16_t half)
+{
+	uint32_t sign     = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits;
+	float    f;
+
+	if ( exponent == 31 ) {
+		bits = sign | 0x7f800000 | mantissa << 13;
+	} else if ( exponent != 0 ) {
+		bits = sign | (exponent + 112) << 23 | mantissa << 13;
+	} else if ( mantissa == 0 ) {
+		bits = sign;
+	} else {
+		/* Subnormal: normalize the mantissa. */
+		exponent = 113;
+		while ( (mantissa & 0x400) == 0 ) {
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | exponent << 23 | (mantissa & 0x3ff) << 13;
+	}
+	memcpy(&f, &bits, sizeof(f));
+
+	return f;
+}
+
+static void
+test_halves(void)
+{
+	uint8_t         data[3] = { 0xf9 };
+	struct cbor_buf buf;
+	double          x;
+
+	for ( uint32_t half = 0; half <= UINT16_MAX; half++ ) {
+		data[1] = (uint8_t)(half >> 8);
+		data[2] = (uint8_t)half;
+		cbor_buf_init(&buf, data, sizeof(data), sizeof(data));
+		CHECK(cbor_read_half(&buf, &x) && same_double(x, half_bits((uint16_t)half)), "half %04x", half);
+	}
+}
+
+static void
+test_simple(void)
+{
+	uint8_t          data[16];
+	struct cbor_buf  buf;
+	struct cbor_head head;
+	bool             value = false;
+
+	for ( int i = 0; i < 2; i++ ) {
+		const char *hex = i ? "f5" : "f4";
+
+		cbor_buf_init(&buf, data, unhex(hex, data), sizeof(data));
+		CHECK(cbor_read_boolean(&buf, &value) && value == (i == 1) && buf.idx == 1, "%s", hex);
+		buf.idx = 0;
+		CHECK(i ? cbor_expect_true(&buf) : cbor_expect_false(&buf), "%s", hex);
+		buf.idx = 0;
+		CHECK(!(i ? cbor_expect_false(&buf) : cbor_expect_true(&buf)) && buf.idx == 0, "%s", hex);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK((i ? cbor_add_true(&buf) : cbor_add_false(&buf)) && encoded(&buf, hex), "%s", hex);
+		check_skip(hex);
+	}
+
+	cbor_buf_init(&buf, data, unhex("f6", data), sizeof(data));
+	CHECK(cbor_expect_null(&buf) && buf.idx == 1, "f6");
+	buf.idx = 0;
+	CHECK(!cbor_read_boolean(&buf, &value) && buf.err == CBOR_ERR_TYPE, "f6");
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_null(&buf) && encoded(&buf, "f6"), "f6");
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_undef(&buf) && encoded(&buf, "f7"), "f7");
+
+	static const struct {
+		const char *hex;
+		uint64_t    value;
+	} simple[] = {
+		{ "f7",   23 },
+		{ "f0",   16 },
+		{ "f8ff", 255 },
+	};
+
+	for ( size_t i = 0; i < sizeof(simple) / sizeof(simple[0]); i++ ) {
+		size_t len = unhex(simple[i].hex, data);
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_read_head(&buf, &head) && head.major == CBOR_MAJOR_SIMPLE && head.arg == simple[i].value &&
+		      buf.idx == len, "%s", simple[i].hex);
+		check_skip(simple[i].hex);
+	}
+
+	/* Two byte simple values below 32 are not well-formed. */
+	cbor_buf_init(&buf, data, unhex("f818", data), sizeof(data));
+	CHECK(!cbor_read_head(&buf, &head) && buf.err == CBOR_ERR_INFO && buf.idx == 0, "f818");
+	CHECK(!cbor_skip_item(&buf) && buf.idx == 0, "f818");
+}
+
+/* RFC 8949 Appendix A, strings. */
+static const struct {
+	const char *hex;
+	int         major;
+	const char *value;
+	size_t      len;
+} strings[] = {
+	{ "40",         CBOR_MAJOR_BYTES, "",                 0 },
+	{ "4401020304", CBOR_MAJOR_BYTES, "\x01\x02\x03\x04", 4 },
+	{ "60",         CBOR_MAJOR_TEXT,  "",                 0 },
+	{ "6161",       CBOR_MAJOR_TEXT,  "a",                1 },
+	{ "6449455446", CBOR_MAJOR_TEXT,  "IETF",             4 },
+	{ "62225c",     CBOR_MAJOR_TEXT,  "\"\\",             2 },
+	{ "62c3bc",     CBOR_MAJOR_TEXT,  "\xc3\xbc",         2 },
+	{ "63e6b0b4",   CBOR_MAJOR_TEXT,  "\xe6\xb0\xb4",     3 },
+	{ "64f0908591", CBOR_MAJOR_TEXT,  "\xf0\x90\x85\x91", 4 },
+};
+
+static void
+test_strings(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+
+	for ( size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++ ) {
+		const char *hex   = strings[i].hex;
+		int         major = strings[i].major;
+		int         other = major == CBOR_MAJOR_TEXT ? CBOR_MAJOR_BYTES : CBOR_MAJOR_TEXT;
+		size_t      len   = unhex(hex, data);
+		uint8_t    *value;
+		size_t      size;
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_read_string(&buf, major, &value, &size) && size == strings[i].len &&
+		      memcmp(value, strings[i].value, size) == 0 && buf.idx == len, "%s", hex);
+		buf.idx = 0;
+		CHECK(!cbor_read_string(&buf, other, &value, &size) && buf.err == CBOR_ERR_TYPE && buf.idx == 0,
+		      "%s", hex);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK((major == CBOR_MAJOR_TEXT ? cbor_add_utf8_str(&buf, (char *)strings[i].value, strings[i].len) :
+		       cbor_add_byte_str(&buf, (void *)strings[i].value, strings[i].len)) && encoded(&buf, hex), "%s", hex);
+		check_skip(hex);
+	}
+}
+
+/*
+ * RFC 8949 Appendix A, tags and containers, through the JSON transcoder
+ * both ways where JSON can express the item. Items JSON cannot express are
+ * only transcoded one way; tags are dropped and byte strings become
+ * base64url.
+ */
+static const struct {
+	const char *hex;
+	const char *json;
+	bool        both;
+} items[] = {
+	{ "c074323031332d30332d32315432303a30343a30305a", "\"2013-03-21T20:04:00Z\"", false },
+	{ "c11a514b67b0", "1363896240", false },
+	{ "c1fb41d452d9ec200000", "1363896240.5", false },
+	{ "d74401020304", "\"AQIDBA\"", false },
+	{ "d818456449455446", "\"ZElFVEY\"", false },
+	{ "d82076687474703a2f2f7777772e6578616d706c652e636f6d", "\"http://www.example.com\"", false },
+	{ "80", "[]", true },
+	{ "83010203", "[1,2,3]", true },
+	{ "8301820203820405", "[1,[2,3],[4,5]]", true },
+	{ "98190102030405060708090a0b0c0d0e0f101112131415161718181819",
+	  "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25]", true },
+	{ "a0", "{}", true },
+	{ "a201020304", "{\"1\":2,\"3\":4}", false },
+	{ "a26161016162820203", "{\"a\":1,\"b\":[2,3]}", true },
+	{ "826161a161626163", "[\"a\",{\"b\":\"c\"}]", true },
+	{ "a56161614161626142616361436164614461656145",
+	  "{\"a\":\"A\",\"b\":\"B\",\"c\":\"C\",\"d\":\"D\",\"e\":\"E\"}", true },
+	{ "5f42010243030405ff", "\"AQIDBAU\"", false },
+	{ "7f657374726561646d696e67ff", "\"streaming\"", false },
+	{ "9fff", "[]", false },
+	{ "9f018202039f0405ffff", "[1,[2,3],[4,5]]", false },
+	{ "9f01820203820405ff", "[1,[2,3],[4,5]]", false },
+	{ "83018202039f0405ff", "[1,[2,3],[4,5]]", false },
+	{ "83019f0203ff820405", "[1,[2,3],[4,5]]", false },
+	{ "9f0102030405060708090a0b0c0d0e0f101112131415161718181819ff",
+	  "[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,25]", false },
+	{ "bf61610161629f0203ffff", "{\"a\":1,\"b\":[2,3]}", false },
+	{ "826161bf61626163ff", "[\"a\",{\"b\":\"c\"}]", false },
+	{ "bf6346756ef563416d7421ff", "{\"Fun\":true,\"Amt\":-2}", false },
+};
+
+static void
+test_items(void)
+{
+	uint8_t         data[256];
+	uint8_t         text[256];
+	struct cbor_buf buf;
+	struct cbor_buf out;
+
+	for ( size_t i = 0; i < sizeof(items) / sizeof(items[0]); i++ ) {
+		const char *hex  = items[i].hex;
+		const char *json = items[i].json;
+		size_t      len  = unhex(hex, data);
+
+		check_skip(hex);
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_init_empty(&out, text, sizeof(text));
+		CHECK(cbor_to_json(&buf, &out) && buf.idx == len && out.len == strlen(json) &&
+		      memcmp(text, json, out.len) == 0, "%s gave %.*s", hex, (int)out.len, (char *)text);
+
+		if ( items[i].both ) {
+			memcpy(text, json, strlen(json));
+			cbor_buf_init(&buf, text, strlen(json), sizeof(text));
+			cbor_buf_init_empty(&out, data, sizeof(data));
+			CHECK(cbor_from_json(&buf, &out) && encoded(&out, hex), "%s", json);
+		}
+	}
+}
+
+/* Nested containers of more than 23 entries, as JSON and through the writers. */
+static void
+json_nest(struct cbor_buf *json, struct cbor_buf *cbor, size_t level)
+{
+	size_t n = 20 + level * 13;
+
+	if ( level == 6 ) {
+		cbor_add_map(cbor, 30);
+		cbor_json_put(json, "{", 1);
+		for ( size_t j = 0; j < 30; j++ ) {
+			char key[8];
+
+			snprintf(key, sizeof(key), "k%02zu", j);
+			cbor_add_utf8_cstr(cbor, key);
+			cbor_add_uint64(cbor, j * 1000);
+			json->len += (size_t)snprintf((char *)json->data + json->len, json->cap - json->len, "%s\"%s\":%zu",
+			                              j > 0 ? "," : "", key, j * 1000);
+		}
+		cbor_json_put(json, "}", 1);
+		return;
+	}
+
+	cbor_add_array(cbor, n);
+	cbor_json_put(json, "[", 1);
+	for ( size_t j = 0; j + 1 < n; j++ ) {
+		cbor_add_uint64(cbor, j * 37);
+		json->len += (size_t)snprintf((char *)json->data + json->len, json->cap - json->len, "%zu,", j * 37);
+	}
+	json_nest(json, cbor, level + 1);
+	cbor_json_put(json, "]", 1);
+}
+
+static void
+test_json(void)
+{
+	static uint8_t  text[16384];
+	static uint8_t  expect[16384];
+	static uint8_t  data[16384];
+	struct cbor_buf json;
+	struct cbor_buf cbor;
+	struct cbor_buf out;
+	size_t          len;
+
+	cbor_buf_init_empty(&json, text, sizeof(text));
+	cbor_buf_init_empty(&cbor, expect, sizeof(expect));
+	json_nest(&json, &cbor, 0);
+	CHECK(!cbor_buf_error(&json) && !cbor_buf_error(&cbor), "nested containers");
+
+	cbor_buf_init_empty(&out, data, sizeof(data));
+	CHECK(cbor_from_json(&json, &out) && json.idx == json.len && out.len == cbor.len &&
+	      memcmp(data, expect, cbor.len) == 0, "nested containers");
+
+	/* The output needs some room to spare while containers are open. */
+	len = cbor.len;
+	json.idx = 0;
+	cbor_buf_init_empty(&out, data, len + len / 8 + 8 * 8);
+	CHECK(cbor_from_json(&json, &out) && out.len == len, "nested containers with little room");
+	for ( size_t cap = len - 1; cap > 0; cap /= 2 ) {
+		json.idx = 0;
+		cbor_buf_init_empty(&out, data, cap);
+		CHECK(!cbor_from_json(&json, &out) && out.err == CBOR_ERR_CAPACITY && out.len == 0 && json.idx == 0,
+		      "nested containers in %zu bytes", cap);
+	}
+
+	/* Numbers of any length round correctly: the tie at 2^53 + 1 only breaks on the last digit. */
+	for ( int up = 0; up < 2; up++ ) {
+		cbor_buf_init_empty(&json, text, sizeof(text));
+		cbor_json_put(&json, "9007199254740993.", 17);
+		for ( size_t i = 0; i < 900; i++ ) {
+			cbor_json_put(&json, "0", 1);
+		}
+		cbor_json_put(&json, up ? "1" : "0", 1);
+		cbor_buf_init_empty(&out, data, sizeof(data));
+		CHECK(cbor_from_json(&json, &out) && json.idx == json.len &&
+		      encoded(&out, up ? "fb4340000000000001" : "fa5a000000"), "long number rounding %s", up ? "up" : "down");
+	}
+
+	cbor_buf_init_empty(&json, text, sizeof(text));
+	cbor_json_put(&json, "-0.", 3);
+	for ( size_t i = 0; i < 197; i++ ) {
+		cbor_json_put(&json, "0", 1);
+	}
+	cbor_json_put(&json, "15", 2);
+	cbor_buf_init_empty(&cbor, expect, sizeof(expect));
+	cbor_add_double(&cbor, -1.5e-198);
+	cbor_buf_init_empty(&out, data, sizeof(data));
+	CHECK(cbor_from_json(&json, &out) && out.len == cbor.len && memcmp(data, expect, cbor.len) == 0,
+	      "long number");
+
+	/* A decimal comma in the locale does not change how JSON numbers read. */
+	static const char *const locales[] = { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "nl_NL.UTF-8" };
+
+	for ( size_t i = 0; i < sizeof(locales) / sizeof(locales[0]); i++ ) {
+		if ( setlocale(LC_NUMERIC, locales[i]) == NULL ) {
+			continue;
+		}
+		memcpy(text, "[1.5,-2.5e3]", 12);
+		cbor_buf_init(&json, text, 12, sizeof(text));
+		cbor_buf_init_empty(&out, data, sizeof(data));
+		CHECK(cbor_from_json(&json, &out) && encoded(&out, "82fa3fc00000fac51c4000"), "%s", locales[i]);
+		setlocale(LC_NUMERIC, "C");
+		break;
+	}
+}
+
+/* RFC 8949 Appendix F, items that are not well-formed. */
+static const char *const malformed[] = {
+	/* End of input in a head. */
+	"18", "1901", "1a010203", "1b01020304050607", "38", "58", "78", "98", "9a01ff00", "b8", "d8", "f8",
+	"f900", "fa0000", "fb000000",
+	/* Definite length strings with short data. */
+	"41", "61", "5affffffff00", "5bffffffffffffffff010203", "7affffffff00", "7b7fffffffffffffff010203",
+	/* Definite length containers with missing items. */
+	"81", "818181818181818181", "8200", "a1", "a20102", "a100", "a2000000",
+	/* Tag number not followed by a tag content. */
+	"c0",
+	/* Indefinite length strings and containers not closed by a break. */
+	"5f4100", "7f6100", "9f", "9f0102", "bf", "bf01020102", "819f", "9f8000", "9f9f9f9f9fffffffff",
+	"9f819f819f9fffffff",
+	/* Reserved additional information values. */
+	"1c", "1d", "1e", "3c", "3d", "3e", "5c", "5d", "5e", "7c", "7d", "7e", "9c", "9d", "9e",
+	"bc", "bd", "be", "dc", "dd", "de", "fc", "fd", "fe",
+	/* Reserved two byte simple values. */
+	"f800", "f801", "f818", "f81f",
+	/* Indefinite length string chunks that are not definite strings of the same type. */
+	"5f00ff", "5f21ff", "5f6100ff", "5f80ff", "5fa0ff", "5fc000ff", "5fe0ff", "7f4100ff", "5f5f4100ffff",
+	"7f7f6100ffff",
+	/* Break outside an indefinite length item. */
+	"ff", "81ff", "8200ff", "a1ff", "a1ff00", "a100ff", "a20000ff", "9f81ff", "9f829f819f9fffffffff",
+	/* Break after an odd number of map items, or right after a tag. */
+	"bf00ff", "bf000000ff", "9fc0ff", "bf00c0ff",
+	/* Indefinite length for major types 0, 1 and 6. */
+	"1f", "3f", "df",
+};
+
+static void
+test_malformed(void)
+{
+	uint8_t         data[64];
+	uint8_t         text[256];
+	struct cbor_buf buf;
+	struct cbor_buf out;
+
+	for ( size_t i = 0; i < sizeof(malformed) / sizeof(malformed[0]); i++ ) {
+		const char *hex = malformed[i];
+
+		cbor_buf_init(&buf, data, unhex(hex, data), sizeof(data));
+		CHECK(!cbor_skip_item(&buf) && buf.idx == 0 && buf.err != CBOR_OK, "%s", hex);
+
+		cbor_buf_init_empty(&out, text, sizeof(text));
+		CHECK(!cbor_to_json(&buf, &out) && buf.idx == 0 && out.len == 0, "%s", hex);
+	}
+}
+
+static void
+test_tags(void)
+{
+	uint8_t         data[64];
+	uint8_t         bytes[] = { 1, 2, 3, 4 };
+	struct cbor_buf buf;
+	struct cbor_buf inner;
+	uint64_t        value;
+	char           *text = NULL;
+	size_t          len  = 0;
+
+	cbor_buf_init(&buf, data, unhex("c11a514b67b0", data), sizeof(data));
+	CHECK(cbor_read_tag(&buf, &value) && value == 1, "tag 1");
+	CHECK(cbor_read_positive_integer(&buf, &value) && value == 1363896240, "tag 1");
+	buf.idx = 0;
+	CHECK(!cbor_read_embedded(&buf, &inner) && buf.err == CBOR_ERR_TYPE && buf.idx == 0, "tag 1");
+
+	cbor_buf_init(&buf, data, unhex("d818456449455446", data), sizeof(data));
+	CHECK(cbor_read_embedded(&buf, &inner) && buf.idx == buf.len, "tag 24");
+	CHECK(inner.data == data + 3 && inner.len == 5, "tag 24");
+	CHECK(cbor_read_utf8_str(&inner, &text, &len) && len == 4 && text != NULL && memcmp(text, "IETF", 4) == 0, "tag 24");
+
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_tag(&buf, 23) && cbor_add_byte_str(&buf, bytes, sizeof(bytes)) &&
+	      encoded(&buf, "d74401020304"), "tag 23");
+
+	struct cbor_embedded scope;
+
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_embedded_start(&buf, &scope, 0) && cbor_add_utf8_cstr(&buf, "IETF") &&
+	      cbor_add_embedded_end(&buf, &scope) && encoded(&buf, "d818456449455446"), "tag 24");
+
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_tag(&buf, 32) && cbor_add_utf8_cstr(&buf, "http://www.example.com") &&
+	      encoded(&buf, "d82076687474703a2f2f7777772e6578616d706c652e636f6d"), "tag 32");
+}
+
+/*
+ * Values at both ends of every head width, through the writer and back
+ * through the readers; the head must be the shortest for the value.
+ */
+static const uint64_t boundaries[] = {
+	0, 1, 23, 24, 25, UINT8_MAX, UINT8_MAX + 1, UINT16_MAX, UINT16_MAX + 1,
+	UINT32_MAX, (uint64_t)UINT32_MAX + 1, INT64_MAX, (uint64_t)INT64_MAX + 1, UINT64_MAX - 1, UINT64_MAX,
+};
+
+static size_t
+head_width(uint64_t arg)
+{
+	return arg < 24 ? 1 : arg <= UINT8_MAX ? 2 : arg <= UINT16_MAX ? 3 : arg <= UINT32_MAX ? 5 : 9;
+}
+
+static bool
+check_head(struct cbor_buf *buf, int major, uint64_t arg)
+{
+	struct cbor_head head;
+
+	buf->idx = 0;
+
+	return cbor_read_head(buf, &head) && head.major == major && head.arg == arg && !head.indefinite &&
+	       head.size == head_width(arg) && buf->idx == head.size && cbor_head_size(arg) == head.size;
+}
+
+static void
+test_round_trips(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+	uint64_t        value   = 0;
+	int128_t        integer = 0;
+
+	for ( size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++ ) {
+		uint64_t n = boundaries[i];
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_uint64(&buf, n) && check_head(&buf, CBOR_MAJOR_UINT, n), "uint %llu", (unsigned long long)n);
+		buf.idx = 0;
+		CHECK(cbor_read_positive_integer(&buf, &value) && value == n && buf.idx == buf.len,
+		      "uint %llu", (unsigned long long)n);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_int128(&buf, -(int128_t)n - 1) && check_head(&buf, CBOR_MAJOR_NEGINT, n),
+		      "negint %llu", (unsigned long long)n);
+		buf.idx = 0;
+		CHECK(cbor_read_integer(&buf, &integer) && integer == -(int128_t)n - 1 && buf.idx == buf.len,
+		      "negint %llu", (unsigned long long)n);
+
+		if ( n <= INT64_MAX ) {
+			cbor_buf_init_empty(&buf, data, sizeof(data));
+			CHECK(cbor_add_int64(&buf, (int64_t)n) && check_head(&buf, CBOR_MAJOR_UINT, n),
+			      "int64 %llu", (unsigned long long)n);
+			cbor_buf_init_empty(&buf, data, sizeof(data));
+			CHECK(cbor_add_int64(&buf, -(int64_t)n - 1) && check_head(&buf, CBOR_MAJOR_NEGINT, n),
+			      "int64 -%llu - 1", (unsigned long long)n);
+		}
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_tag(&buf, n) && check_head(&buf, CBOR_MAJOR_TAG, n), "tag %llu", (unsigned long long)n);
+		buf.idx = 0;
+		CHECK(cbor_read_tag(&buf, &value) && value == n, "tag %llu", (unsigned long long)n);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_array(&buf, n) && check_head(&buf, CBOR_MAJOR_ARRAY, n),
+		      "array %llu", (unsigned long long)n);
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_add_map(&buf, n) && check_head(&buf, CBOR_MAJOR_MAP, n), "map %llu", (unsigned long long)n);
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(cbor_encode_head(data, CBOR_MAJOR_BYTES, n) == head_width(n), "head %llu", (unsigned long long)n);
+		buf.len = head_width(n);
+		CHECK(check_head(&buf, CBOR_MAJOR_BYTES, n), "head %llu", (unsigned long long)n);
+	}
+
+	/* All of them in one sequence, so that every reader starts mid-buffer. */
+	uint8_t seq[sizeof(boundaries) / sizeof(boundaries[0]) * 4 * 9];
+
+	cbor_buf_init_empty(&buf, seq, sizeof(seq));
+	for ( size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++ ) {
+		cbor_add_uint64(&buf, boundaries[i]);
+		cbor_add_int128(&buf, -(int128_t)boundaries[i] - 1);
+		cbor_add_tag(&buf, boundaries[i]);
+		cbor_add_int128(&buf, -(int128_t)boundaries[i] - 1);
+	}
+	for ( size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++ ) {
+		uint64_t n = boundaries[i];
+
+		CHECK(cbor_is_positive_integer(&buf) && cbor_is_integer(&buf) && !cbor_is_negative_integer(&buf),
+		      "seq %llu", (unsigned long long)n);
+		CHECK(cbor_read_positive_integer(&buf, &value) && value == n, "seq %llu", (unsigned long long)n);
+		CHECK(!cbor_is_positive_integer(&buf) && cbor_is_integer(&buf) && cbor_is_negative_integer(&buf),
+		      "seq %llu", (unsigned long long)n);
+		CHECK(cbor_read_negative_integer_biased(&buf, &value) && value == n, "seq %llu", (unsigned long long)n);
+		CHECK(!cbor_is_integer(&buf), "seq %llu", (unsigned long long)n);
+		CHECK(cbor_read_tag(&buf, &value) && value == n, "seq %llu", (unsigned long long)n);
+		CHECK(cbor_read_integer(&buf, &integer) && integer == -(int128_t)n - 1, "seq %llu", (unsigned long long)n);
+	}
+	CHECK(buf.idx == buf.len && !cbor_is_integer(&buf), "seq end");
+
+	/* A wrong width fails without moving the cursor and fails on every prefix. */
+	for ( size_t i = 0; i < sizeof(boundaries) / sizeof(boundaries[0]); i++ ) {
+		uint64_t n = boundaries[i];
+
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		cbor_add_uint64(&buf, n);
+		for ( size_t len = 0; len < buf.len; len++ ) {
+			struct cbor_buf prefix = { 0 };
+
+			cbor_buf_init(&prefix, data, len, sizeof(data));
+			CHECK(!cbor_read_positive_integer(&prefix, &value) && prefix.err == CBOR_ERR_TRUNCATED &&
+			      prefix.idx == 0, "uint %llu prefix %zu", (unsigned long long)n, len);
+		}
+	}
+}
+
+/* Strings and containers with real payloads at the width boundaries. */
+static void
+test_payloads(void)
+{
+	static const size_t sizes[] = { 0, 1, 23, 24, UINT8_MAX, UINT8_MAX + 1, UINT16_MAX, UINT16_MAX + 1 };
+	size_t              cap     = UINT16_MAX + 1 + 2 * (UINT16_MAX + 2) + 16;
+	uint8_t            *data    = malloc(cap);
+	uint8_t            *payload = malloc(UINT16_MAX + 1);
+	struct cbor_buf     buf;
+
+	if ( data == NULL || payload == NULL ) {
+		CHECK(false, "out of memory");
+		free(data);
+		free(payload);
+		return;
+	}
+	for ( size_t i = 0; i <= UINT16_MAX; i++ ) {
+		payload[i] = (uint8_t)('a' + i % 26);
+	}
+
+	for ( size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+		size_t   size = sizes[i];
+		uint8_t *value = NULL;
+		size_t   len   = 0;
+		uint64_t count = 0;
+
+		for ( int major = CBOR_MAJOR_BYTES; major <= CBOR_MAJOR_TEXT; major++ ) {
+			cbor_buf_init_empty(&buf, data, cap);
+			CHECK(major == CBOR_MAJOR_TEXT ? cbor_add_utf8_str(&buf, (char *)payload, size) :
+			      cbor_add_byte_str(&buf, payload, size), "string %zu", size);
+			CHECK(buf.len == head_width(size) + size, "string %zu", size);
+			CHECK(cbor_read_string(&buf, major, &value, &len) && value == data + head_width(size) && len == size &&
+			      buf.idx == buf.len, "string %zu", size);
+			buf.idx = 0;
+			CHECK(cbor_skip_item(&buf) && buf.idx == buf.len, "string %zu", size);
+
+			/* The reference variant writes the same head and leaves the payload out. */
+			cbor_buf_init_empty(&buf, data, cap);
+			CHECK(cbor_add_string_ref(&buf, major, payload, size) && buf.len == head_width(size) &&
+			      check_head(&buf, major, size), "string ref %zu", size);
+		}
+
+		cbor_buf_init_empty(&buf, data, cap);
+		cbor_add_array(&buf, size);
+		for ( size_t j = 0; j < size; j++ ) {
+			cbor_add_uint64(&buf, j % 24);
+		}
+		CHECK(buf.len == head_width(size) + size, "array %zu", size);
+		CHECK(cbor_read_array(&buf, &count) && count == size, "array %zu", size);
+		buf.idx = 0;
+		CHECK(cbor_skip_item(&buf) && buf.idx == buf.len, "array %zu", size);
+
+		cbor_buf_init_empty(&buf, data, cap);
+		cbor_add_map(&buf, size);
+		for ( size_t j = 0; j < size; j++ ) {
+			cbor_add_uint64(&buf, j % 24);
+			cbor_add_null(&buf);
+		}
+		CHECK(buf.len == head_width(size) + 2 * size, "map %zu", size);
+		CHECK(cbor_read_map(&buf, &count) && count == size, "map %zu", size);
+		buf.idx = 0;
+		CHECK(cbor_skip_item(&buf) && buf.idx == buf.len, "map %zu", size);
+
+		/* One element short is truncated, not accepted. */
+		buf.len--;
+		buf.idx = 0;
+		CHECK(size == 0 || (!cbor_skip_item(&buf) && buf.err == CBOR_ERR_TRUNCATED && buf.idx == 0),
+		      "map %zu", size);
+
+		/* Embedded items whose length crosses the width the hint reserved. */
+		struct cbor_embedded scope;
+		struct cbor_buf      inner = { 0 };
+
+		cbor_buf_init_empty(&buf, data, cap);
+		CHECK(cbor_add_embedded_start(&buf, &scope, UINT8_MAX) && cbor_add_byte_str(&buf, payload, size) &&
+		      cbor_add_embedded_end(&buf, &scope), "embedded %zu", size);
+		CHECK(cbor_read_embedded(&buf, &inner) && buf.idx == buf.len && inner.len == head_width(size) + size &&
+		      cbor_read_byte_str(&inner, &value, &len) && len == size && memcmp(value, payload, size) == 0,
+		      "embedded %zu", size);
+		CHECK(buf.len == 2 + head_width(inner.len) + inner.len, "embedded %zu", size);
+	}
+
+	free(data);
+	free(payload);
+}
+
+/* One element of each kind the typed readers decode, three to an array. */
+static const char *const limit_elements[] = {
+	"1903e8", "3903e7", "fa3fc00000", "fb3ff8000000000000", "f93e00", "f5", "f6", "6161",
+};
+
+static bool
+limit_read(struct cbor_buf *buf, size_t kind)
+{
+	uint64_t u;
+	int128_t i;
+	float    f;
+	double   d;
+	bool     b;
+	char    *str;
+	size_t   len;
+
+	switch ( kind ) {
+		case 0:  return cbor_read_positive_integer(buf, &u);
+		case 1:  return cbor_read_integer(buf, &i);
+		case 2:  return cbor_read_float(buf, &f);
+		case 3:  return cbor_read_double(buf, &d);
+		case 4:  return cbor_read_half(buf, &d);
+		case 5:  return cbor_read_boolean(buf, &b);
+		case 6:  return cbor_expect_null(buf);
+		default: return cbor_read_utf8_str(buf, &str, &len);
+	}
+}
+
+/* Read [_ e, e, e] through the typed API, false at the first failure. */
+static bool
+limit_array(struct cbor_buf *buf, size_t kind, size_t *elements)
+{
+	*elements = 0;
+	if ( !cbor_read_array_start(buf) ) {
+		return false;
+	}
+	for ( ; *elements < 3; (*elements)++ ) {
+		if ( !limit_read(buf, kind) ) {
+			return false;
+		}
+	}
+
+	return cbor_expect_break(buf);
+}
+
+static void
+test_errors(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+	uint64_t        value = 0;
+	double          x     = 0;
+
+	/* A read of the wrong type records where, what was expected and what was found. */
+	cbor_buf_init(&buf, data, unhex("0161", data), sizeof(data));
+	CHECK(cbor_read_positive_integer(&buf, &value) && value == 1 && cbor_buf_error(&buf) == CBOR_OK, "uint");
+	CHECK(!cbor_read_positive_integer(&buf, &value) && buf.idx == 1 && cbor_buf_error(&buf) == CBOR_ERR_TYPE &&
+	      cbor_buf_error_offset(&buf) == 1 && cbor_buf_error_expected(&buf) == CBOR_MAJOR_BIT(CBOR_MAJOR_UINT) &&
+	      cbor_buf_error_actual(&buf) == CBOR_MAJOR_TEXT, "type");
+
+	/* At the end of the buffer nothing was found. */
+	buf.idx = 2;
+	CHECK(!cbor_read_double(&buf, &x) && buf.idx == 2 && cbor_buf_error(&buf) == CBOR_ERR_TRUNCATED &&
+	      cbor_buf_error_offset(&buf) == 2 && cbor_buf_error_expected(&buf) == CBOR_MAJOR_BIT(CBOR_MAJOR_SIMPLE) &&
+	      cbor_buf_error_actual(&buf) == CBOR_MAJOR_NONE, "end");
+
+	/* A head cut short, and a reserved additional info value. */
+	cbor_buf_init(&buf, data, unhex("1901", data), sizeof(data));
+	CHECK(!cbor_read_positive_integer(&buf, &value) && buf.idx == 0 && cbor_buf_error(&buf) == CBOR_ERR_TRUNCATED &&
+	      cbor_buf_error_offset(&buf) == 0 && cbor_buf_error_actual(&buf) == CBOR_MAJOR_UINT, "1901");
+	cbor_buf_init(&buf, data, unhex("1c", data), sizeof(data));
+	CHECK(!cbor_read_positive_integer(&buf, &value) && buf.idx == 0 && cbor_buf_error(&buf) == CBOR_ERR_INFO,
+	      "1c");
+	cbor_buf_clear_error(&buf);
+	CHECK(cbor_buf_error(&buf) == CBOR_OK && cbor_buf_error_offset(&buf) == 0 &&
+	      cbor_buf_error_actual(&buf) == CBOR_MAJOR_NONE, "clear");
+
+	/* Writers report a full buffer at its end. */
+	cbor_buf_init_empty(&buf, data, 2);
+	CHECK(cbor_add_uint64(&buf, 1) && !cbor_add_uint64(&buf, 1000) && buf.len == 1 &&
+	      cbor_buf_error(&buf) == CBOR_ERR_CAPACITY && cbor_buf_error_offset(&buf) == 1, "capacity");
+
+	for ( int err = CBOR_OK; err < CBOR_ERR_COUNT; err++ ) {
+		CHECK(strcmp(cbor_error_string((enum cbor_error)err), "unknown error") != 0, "error %d", err);
+	}
+}
+
+/* Big-endian loads and stores at every alignment, against the bytes. */
+static void
+test_loads(void)
+{
+	static const uint8_t be[] = { 0x81, 0x02, 0x83, 0x04, 0x85, 0x06, 0x87, 0x08 };
+	uint8_t              data[24];
+	struct cbor_buf      buf;
+	uint64_t             value = 0;
+
+	for ( size_t off = 0; off < 8; off++ ) {
+		memset(data, 0xee, sizeof(data));
+		memcpy(data + off, be, sizeof(be));
+		CHECK(cbor_load_be16(data + off) == 0x8102 && cbor_load_be32(data + off) == 0x81028304 &&
+		      cbor_load_be64(data + off) == 0x8102830485068708, "load %zu", off);
+
+		memset(data, 0xee, sizeof(data));
+		cbor_store_be64(data + off, 0x8102830485068708);
+		CHECK(memcmp(data + off, be, 8) == 0 && (off == 0 || data[off - 1] == 0xee) && data[off + 8] == 0xee,
+		      "store64 %zu", off);
+		memset(data, 0xee, sizeof(data));
+		cbor_store_be32(data + off, 0x81028304);
+		CHECK(memcmp(data + off, be, 4) == 0 && data[off + 4] == 0xee, "store32 %zu", off);
+		memset(data, 0xee, sizeof(data));
+		cbor_store_be16(data + off, 0x8102);
+		CHECK(memcmp(data + off, be, 2) == 0 && data[off + 2] == 0xee, "store16 %zu", off);
+
+		/* Heads behind an odd number of bytes go through the same loads. */
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		for ( size_t i = 0; i < off; i++ ) {
+			cbor_add_uint64(&buf, 0);
+		}
+		CHECK(cbor_add_uint64(&buf, 0x8102830485068708) && buf.data[off] == 0x1b, "uint64 at %zu", off);
+		buf.idx = off;
+		CHECK(cbor_read_positive_integer(&buf, &value) && value == 0x8102830485068708 && buf.idx == off + 9,
+		      "uint64 at %zu", off);
+	}
+}
+
+/* The hooks change nothing that is written or read, compiled in or not. */
+static void
+test_hooks(void)
+{
+	uint8_t         data[16];
+	struct cbor_buf buf;
+	uint64_t        value = 0;
+
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	CHECK(cbor_add_array(&buf, 3) && cbor_add_uint64(&buf, 1) && cbor_add_uint64(&buf, 500) &&
+	      cbor_add_utf8_str(&buf, "abc", 3) && encoded(&buf, "83011901f463616263"), "encode");
+	buf.idx = 1;
+	CHECK(cbor_read_positive_integer(&buf, &value) && value == 1 && cbor_read_positive_integer(&buf, &value) &&
+	      value == 500 && buf.idx == 5, "decode");
+	CHECK(!cbor_read_positive_integer(&buf, &value) && buf.idx == 5, "type");
+
+	cbor_buf_init_empty(&buf, data, 2);
+	CHECK(!cbor_add_uint64(&buf, 500) && buf.len == 0, "capacity");
+}
+
+#ifdef CBOR_STATS
+static void
+test_stats(void)
+{
+	uint8_t           data[16];
+	struct cbor_buf   buf;
+	struct cbor_stats stats;
+	struct cbor_stats total;
+	uint64_t          value = 0;
+	char             *text  = NULL;
+	size_t            len   = 0;
+
+	/* [1, 500, "abc"] */
+	cbor_stats_reset(&stats);
+	cbor_buf_init_empty(&buf, data, sizeof(data));
+	cbor_buf_set_stats(&buf, &stats);
+	CHECK(cbor_add_array(&buf, 3) && cbor_add_uint64(&buf, 1) && cbor_add_uint64(&buf, 500) &&
+	      cbor_add_utf8_str(&buf, "abc", 3) && encoded(&buf, "83011901f463616263"), "encode");
+	CHECK(stats.encode.items[CBOR_MAJOR_UINT] == 2 && stats.encode.items[CBOR_MAJOR_TEXT] == 1 &&
+	      stats.encode.items[CBOR_MAJOR_ARRAY] == 1, "encode items");
+	CHECK(stats.encode.bytes[CBOR_MAJOR_UINT] == 4 && stats.encode.bytes[CBOR_MAJOR_TEXT] == 4 &&
+	      stats.encode.bytes[CBOR_MAJOR_ARRAY] == 1, "encode bytes");
+	CHECK(stats.encode.heads[0] == 3 && stats.encode.heads[1] == 0 && stats.encode.heads[2] == 1 &&
+	      stats.encode.heads[3] == 0 && stats.encode.heads[4] == 0, "encode heads");
+	CHECK(stats.decode.items[CBOR_MAJOR_UINT] == 0 && stats.capacity_failures == 0, "encode");
+
+	/* Reading it back counts the same items, bytes and heads. */
+	buf.idx = 0;
+	CHECK(cbor_read_array(&buf, &value) && value == 3 && cbor_read_positive_integer(&buf, &value) && value == 1 &&
+	      cbor_read_positive_integer(&buf, &value) && value == 500 && cbor_read_utf8_str(&buf, &text, &len) &&
+	      len == 3, "decode");
+	CHECK(memcmp(&stats.decode, &stats.encode, sizeof(stats.decode)) == 0, "decode counters");
+
+	/* So does skipping it. */
+	memset(&stats.decode, 0, sizeof(stats.decode));
+	buf.idx = 0;
+	CHECK(cbor_skip_item(&buf) && buf.idx == buf.len, "skip");
+	CHECK(memcmp(&stats.decode, &stats.encode, sizeof(stats.decode)) == 0, "skip counters");
+
+	/* Failures count by reason and remember where the last one happened. */
+	buf.idx = 1;
+	CHECK(!cbor_read_utf8_str(&buf, &text, &len) && buf.err == CBOR_ERR_TYPE, "type");
+	CHECK(stats.decode_failures[CBOR_ERR_TYPE] == 1 && stats.last_failure == CBOR_ERR_TYPE &&
+	      stats.last_failure_offset == 1, "type");
+	buf.idx = buf.len;
+	CHECK(!cbor_read_positive_integer(&buf, &value) && buf.err == CBOR_ERR_TRUNCATED, "truncated");
+	CHECK(stats.decode_failures[CBOR_ERR_TRUNCATED] == 1 && stats.last_failure == CBOR_ERR_TRUNCATED &&
+	      stats.last_failure_offset == buf.len, "truncated");
+	CHECK(stats.decode_failures[CBOR_ERR_TYPE] == 1 && stats.decode.items[CBOR_MAJOR_UINT] == 2, "failures");
+
+	/* A writer that does not fit counts a capacity failure and nothing else. */
+	cbor_buf_init_empty(&buf, data, 2);
+	cbor_buf_set_stats(&buf, &stats);
+	CHECK(!cbor_add_uint64(&buf, 500) && stats.capacity_failures == 1 && stats.encode.items[CBOR_MAJOR_UINT] == 2,
+	      "capacity");
+
+	cbor_stats_reset(&total);
+	cbor_stats_merge(&total, &stats);
+	cbor_stats_merge(&total, &stats);
+	CHECK(total.encode.items[CBOR_MAJOR_UINT] == 4 && total.decode.bytes[CBOR_MAJOR_TEXT] == 8 &&
+	      total.decode_failures[CBOR_ERR_TYPE] == 2 && total.capacity_failures == 2, "merge");
+}
+#endif
+
+static void
+test_limits(void)
+{
+	uint8_t            data[64];
+	struct cbor_limits limits;
+	struct cbor_buf    buf;
+	size_t             elements;
+	size_t             len;
+
+	for ( size_t kind = 0; kind < sizeof(limit_elements) / sizeof(limit_elements[0]); kind++ ) {
+		const char *elem = limit_elements[kind];
+		size_t      size = strlen(elem) / 2;
+
+		len = 0;
+
+		data[len++] = 0x9f;
+		for ( int i = 0; i < 3; i++ ) {
+			len += unhex(elem, data + len);
+		}
+		data[len++] = 0xff;
+
+		/* The array and its elements are four items, the break is none. */
+		cbor_limits_default(&limits);
+		limits.max_items = 4;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(limit_array(&buf, kind, &elements) && buf.idx == len && buf.items == 4, "%s max_items", elem);
+
+		limits.max_items = 3;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(!limit_array(&buf, kind, &elements) && elements == 2 && buf.err == CBOR_ERR_LIMIT &&
+		      buf.idx == 1 + 2 * size && buf.items == 3, "%s max_items - 1", elem);
+
+		cbor_limits_default(&limits);
+		limits.max_bytes = len;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(limit_array(&buf, kind, &elements) && buf.idx == len, "%s max_bytes", elem);
+
+		limits.max_bytes = len - 1;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(!limit_array(&buf, kind, &elements) && elements == 3 && buf.err == CBOR_ERR_LIMIT &&
+		      buf.idx == len - 1, "%s max_bytes - 1", elem);
+
+		limits.max_bytes = len - 2;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(!limit_array(&buf, kind, &elements) && elements == 2 && buf.err == CBOR_ERR_LIMIT &&
+		      buf.idx == 1 + 2 * size, "%s max_bytes - 2", elem);
+
+		/* The skip charges the same items and bytes. */
+		cbor_limits_default(&limits);
+		limits.max_items = 4;
+		limits.max_bytes = len;
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(cbor_skip_item(&buf) && buf.items == 4, "%s skip", elem);
+	}
+
+	/* A skip cut off by the end of input charges nothing, however often it is retried. */
+	cbor_limits_default(&limits);
+	limits.max_items = 3;
+	len = unhex("830102", data);
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	cbor_buf_set_limits(&buf, &limits);
+	for ( int attempt = 0; attempt < 5; attempt++ ) {
+		CHECK(!cbor_skip_item(&buf) && buf.err == CBOR_ERR_TRUNCATED && buf.idx == 0 && buf.items == 0,
+		      "retry %d", attempt);
+		cbor_buf_clear_error(&buf);
+	}
+	data[len] = 0x03;
+	cbor_buf_init(&buf, data, len + 1, sizeof(data));
+	cbor_buf_set_limits(&buf, &limits);
+	CHECK(!cbor_skip_item(&buf) && buf.err == CBOR_ERR_LIMIT && buf.items == 0, "retry over the limit");
+	limits.max_items = 4;
+	CHECK(cbor_skip_item(&buf) && buf.idx == len + 1 && buf.items == 4, "retry complete");
+
+	/* Declared lengths and nesting, at the limit and one past it. */
+	static const struct {
+		const char *hex;
+		int         limit;      /* 0 string, 1 container, 2 depth */
+		size_t      value;
+	} bounds[] = {
+		{ "63616263",   0, 3 },
+		{ "83010203",   1, 3 },
+		{ "a2010203f6", 1, 2 },
+		{ "81818101",   2, 3 },
+		{ "9f9f9f01ffffff", 2, 3 },
+	};
+
+	for ( size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++ ) {
+		len = unhex(bounds[i].hex, data);
+
+		for ( int under = 0; under < 2; under++ ) {
+			size_t value = bounds[i].value - (size_t)under;
+
+			cbor_limits_default(&limits);
+			switch ( bounds[i].limit ) {
+				case 0:  limits.max_string    = value; break;
+				case 1:  limits.max_container = value; break;
+				default: limits.max_depth     = value; break;
+			}
+			cbor_buf_init(&buf, data, len, sizeof(data));
+			cbor_buf_set_limits(&buf, &limits);
+			CHECK(cbor_skip_item(&buf) == !under && (under ? buf.err == (bounds[i].limit == 2 ? CBOR_ERR_DEPTH :
+			      CBOR_ERR_LIMIT) && buf.idx == 0 : buf.idx == len), "%s limit %zu", bounds[i].hex, value);
+		}
+	}
+}
+
+static void
+test_capacity(void)
+{
+	uint8_t         data[9];
+	struct cbor_buf buf;
+
+	/* A writer that does not fit writes nothing. */
+	for ( size_t cap = 0; cap < 9; cap++ ) {
+		cbor_buf_init_empty(&buf, data, cap);
+		CHECK(!cbor_add_uint64(&buf, UINT64_MAX) && buf.len == 0 && buf.err == CBOR_ERR_CAPACITY, "cap %zu", cap);
+		cbor_buf_init_empty(&buf, data, cap);
+		CHECK(!cbor_add_double(&buf, 1.0) && buf.len == 0, "cap %zu", cap);
+		cbor_buf_init_empty(&buf, data, cap);
+		CHECK(!cbor_add_utf8_str(&buf, "12345678", 8) && buf.len == 0, "cap %zu", cap);
+	}
+
+	/* A length that wraps head plus payload around SIZE_MAX still does not fit. */
+	for ( size_t i = 0; i < 9; i++ ) {
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(!cbor_add_byte_str(&buf, data, SIZE_MAX - i) && buf.len == 0 && buf.err == CBOR_ERR_CAPACITY,
+		      "len SIZE_MAX - %zu", i);
+	}
+}
+
+/*
+ * {"a": [1, 2], "b": "xyz", "c": "xyz", "d": 1.5, "e": 1} twice, 1.5 as a
+ * double and 1 with a two byte head.
+ */
+static const char prof_doc[] =
+	"a5" "6161" "820102" "6162" "6378797a" "6163" "6378797a" "6164" "fb3ff8000000000000" "6165" "1801";
+
+static void
+test_prof(void)
+{
+	static const char *const bad[] = { "9fc1ff", "bf61610161c1ff", "bfc1ff", "5f01ff" };
+	uint8_t                  data[160];
+	size_t                   len  = unhex(prof_doc, data);
+	struct cbor_buf          buf;
+	struct prof              prof;
+	uint64_t                 xyz  = 0;
+
+	memcpy(data + len, data, len);
+	cbor_buf_init(&buf, data, 2 * len, sizeof(data));
+	CHECK(prof_init(&prof, data, buf.len), "prof init");
+	CHECK(prof_item(&prof, &buf) && buf.idx == len && prof_item(&prof, &buf) && buf.idx == 2 * len, "prof walk");
+
+	/* Keys are counted as items of their type, their bytes go to the path they name. */
+	CHECK(prof.types[CBOR_MAJOR_MAP].items == 2 && prof.types[CBOR_MAJOR_ARRAY].items == 2 &&
+	      prof.types[CBOR_MAJOR_UINT].items == 6 && prof.types[CBOR_MAJOR_TEXT].items == 14 &&
+	      prof.types[PROF_FLOAT].items == 2, "prof types");
+	CHECK(prof.types[CBOR_MAJOR_TEXT].head == 14 && prof.types[CBOR_MAJOR_TEXT].payload == 2 * (5 + 6) &&
+	      prof.types[PROF_FLOAT].head == 18 && prof.types[CBOR_MAJOR_UINT].head == 8, "prof bytes");
+	CHECK(prof.npaths == 7 && prof.paths[0].items == 2 && prof.paths[0].total == 0, "prof paths");
+	for ( uint32_t id = 1; id < prof.npaths; id++ ) {
+		const struct prof_path *path = &prof.paths[id];
+
+		CHECK(path->kind == PROF_ELEM ? path->items == 4 && path->keys == 0 :
+		      path->kind == PROF_NAME && path->items == 2 && path->keys == 4 && path->named == 2,
+		      "prof path %u", id);
+	}
+
+	/* The double fits a half, the integer a one byte head. */
+	CHECK(prof.to_half.count == 2 && prof.to_half.bytes == 12 && prof.to_single.count == 0 &&
+	      prof.wide_heads.count == 2 && prof.wide_heads.bytes == 2, "prof waste");
+
+	/* Repeated values are interned, the keys naming paths are not. */
+	for ( size_t i = 0; i <= prof.string_mask; i++ ) {
+		if ( prof.strings[i].count != 0 ) {
+			xyz = prof.strings[i].len == 3 ? prof.strings[i].count : 0;
+		}
+	}
+	CHECK(prof.nstrings == 1 && xyz == 4, "prof strings");
+	prof_free(&prof);
+
+	/* A tag or a break where an item has to follow, and a chunk of the wrong type. */
+	for ( size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++ ) {
+		cbor_buf_init(&buf, data, unhex(bad[i], data), sizeof(data));
+		CHECK(prof_init(&prof, data, buf.len) && !prof_item(&prof, &buf) && buf.err == CBOR_ERR_TYPE,
+		      "prof %s", bad[i]);
+		buf.idx = 0;
+		CHECK(!cbor_skip_item(&buf), "prof %s", bad[i]);
+		prof_free(&prof);
+	}
+
+	/* As deep as cbor_skip_item() goes and no deeper. */
+	for ( size_t depth = CBOR_MAX_DEPTH; depth <= CBOR_MAX_DEPTH + 1; depth++ ) {
+		memset(data, 0x81, depth);
+		data[depth] = 0x00;
+		cbor_buf_init(&buf, data, depth + 1, sizeof(data));
+		CHECK(prof_init(&prof, data, buf.len) && prof_item(&prof, &buf) == (depth == CBOR_MAX_DEPTH) &&
+		      (depth == CBOR_MAX_DEPTH ? buf.idx == buf.len : buf.err == CBOR_ERR_DEPTH), "prof depth %zu", depth);
+		buf.idx = 0;
+		CHECK(cbor_skip_item(&buf) == (depth == CBOR_MAX_DEPTH), "prof depth %zu", depth);
+		prof_free(&prof);
+	}
+}
+
+/*
+ * {"a": [1, {"b": 2}, 3], "c": {"d": "x"}, 5: "five", -1: "neg", "t": 1(2),
+ *  "u": 32([7, 8]), "i": [_ 9, 10]}
+ */
+static const char path_doc[] =
+	"a7" "6161" "8301a1616202" "03" "6163" "a161646178" "05" "6466697665" "20" "636e6567"
+	"6174" "c102" "6175" "d820820708" "6169" "9f090aff";
+
+/* Matches of each path in path_doc, in the order they are reported. */
+static const struct {
+	const char *expr;
+	const char *matches;
+} paths[] = {
+	{ ".a",         "8301a161620203" },
+	{ ".a[0]",      "01" },
+	{ ".a[1].b",    "02" },
+	{ "$.a[1].b",   "02" },
+	{ ".a[*]",      "01 a1616202 03" },
+	{ ".a[3]",      "" },
+	{ ".a.b",       "" },
+	{ ".c.d",       "6178" },
+	{ ".c[\"d\"]",  "6178" },
+	{ ".\"c\".d",   "6178" },
+	{ "[5]",        "6466697665" },
+	{ "[-1]",       "636e6567" },
+	{ ".t",         "c102" },
+	{ ".u[1]",      "08" },
+	{ ".i[1]",      "0a" },
+	{ ".i[*]",      "09 0a" },
+	{ ".*.d",       "6178" },
+	{ ".*[0]",      "01 07 09" },
+	{ ".x",         "" },
+};
+
+/* Paths that do not compile, and the error they fail with. */
+static const struct {
+	const char     *expr;
+	enum cbor_error err;
+} path_errors[] = {
+	{ "a",                          CBOR_ERR_SYNTAX },
+	{ ".a[",                        CBOR_ERR_TRUNCATED },
+	{ ".a[1",                       CBOR_ERR_TRUNCATED },
+	{ ".a[x]",                      CBOR_ERR_SYNTAX },
+	{ "[-0]",                       CBOR_ERR_SYNTAX },
+	{ "[99999999999999999999]",     CBOR_ERR_OVERFLOW },
+	{ ".\"abc",                     CBOR_ERR_TRUNCATED },
+	{ ".a..b",                      CBOR_ERR_SYNTAX },
+	{ ".a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q", CBOR_ERR_LIMIT },
+};
+
+struct path_matches {
+	char   hex[256];
+	size_t len;
+};
+
+static bool
+path_match(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len)
+{
+	struct path_matches *matches = arg;
+
+	(void)path;
+	if ( matches->len > 0 ) {
+		matches->hex[matches->len++] = ' ';
+	}
+	for ( size_t i = 0; i < len; i++ ) {
+		matches->len += (size_t)snprintf(matches->hex + matches->len, sizeof(matches->hex) - matches->len, "%02x",
+		                                 buf->data[offset + i]);
+	}
+
+	return true;
+}
+
+static bool
+path_batch(void *arg, size_t path, struct cbor_buf *buf, size_t offset, size_t len)
+{
+	uint64_t *seen = arg;
+
+	(void)len;
+	*seen |= (uint64_t)buf->data[offset] << (8 * path);
+
+	return true;
+}
+
+#define RING_RECORDS   20000
+#define RING_PRODUCERS 4
+
+struct ring_producer {
+	pthread_t         thread;
+	struct cbor_ring *ring;
+	uint64_t          id;
+};
+
+/* What the consumer expects next from each producer. */
+struct ring_seen {
+	uint64_t next[RING_PRODUCERS];
+	size_t   records;
+	size_t   bad;
+};
+
+/* Record i of a producer is [id, i, h'ii ii ...'] with i % 80 payload bytes. */
+static void *
+ring_produce(void *arg)
+{
+	struct ring_producer *producer = arg;
+	uint8_t               payload[80];
+	struct cbor_buf       buf;
+
+	for ( uint64_t i = 0; i < RING_RECORDS; i++ ) {
+		memset(payload, (uint8_t)i, sizeof(payload));
+		while ( !cbor_ring_reserve(producer->ring, &buf, 16 + i % 80) ) {
+			sched_yield();
+		}
+		cbor_add_array(&buf, 3);
+		cbor_add_uint64(&buf, producer->id);
+		cbor_add_uint64(&buf, i);
+		cbor_add_byte_str(&buf, payload, i % 80);
+		cbor_ring_commit(producer->ring, &buf);
+	}
+
+	return NULL;
+}
+
+static bool
+ring_consume(void *arg, struct cbor_buf *record)
+{
+	struct ring_seen *seen  = arg;
+	uint64_t           size  = 0;
+	uint64_t           id    = 0;
+	uint64_t           i     = 0;
+	uint8_t           *data  = NULL;
+	size_t             len   = 0;
+	bool               ok;
+
+	ok = cbor_read_array(record, &size) && size == 3 && cbor_read_positive_integer(record, &id) &&
+	     id < RING_PRODUCERS && cbor_read_positive_integer(record, &i) && i == seen->next[id] &&
+	     cbor_read_byte_str(record, &data, &len) && len == i % 80 && record->idx == record->len;
+	for ( size_t j = 0; ok && j < len; j++ ) {
+		ok = data[j] == (uint8_t)i;
+	}
+	if ( ok ) {
+		seen->next[id]++;
+	} else {
+		seen->bad++;
+	}
+	seen->records++;
+
+	return true;
+}
+
+static bool
+ring_stop(void *arg, struct cbor_buf *record)
+{
+	size_t *count = arg;
+
+	(*count)++;
+	(void)record;
+
+	return false;
+}
+
+static void
+test_ring_threads(struct cbor_ring *ring, void *data, size_t size, size_t producers)
+{
+	struct ring_producer threads[RING_PRODUCERS];
+	struct ring_seen     seen  = { { 0 }, 0, 0 };
+	bool                 multi = producers > 1;
+
+	CHECK(cbor_ring_init(ring, data, size, multi), "ring %zu", producers);
+	for ( size_t i = 0; i < producers; i++ ) {
+		threads[i].ring = ring;
+		threads[i].id   = i;
+		pthread_create(&threads[i].thread, NULL, ring_produce, &threads[i]);
+	}
+	while ( seen.records < producers * RING_RECORDS ) {
+		if ( cbor_ring_drain(ring, ring_consume, &seen, 64) == 0 ) {
+			sched_yield();
+		}
+	}
+	for ( size_t i = 0; i < producers; i++ ) {
+		pthread_join(threads[i].thread, NULL);
+	}
+
+	CHECK(seen.bad == 0 && seen.records == producers * RING_RECORDS, "ring %zu: %zu bad", producers, seen.bad);
+	for ( size_t i = 0; i < producers; i++ ) {
+		CHECK(seen.next[i] == RING_RECORDS, "ring %zu: producer %zu", producers, i);
+	}
+	CHECK(cbor_ring_drain(ring, ring_consume, &seen, 64) == 0 && ring->head == ring->tail, "ring %zu", producers);
+}
+
+static void
+test_ring(void)
+{
+	static uint8_t    data[4096] __attribute__((aligned(CBOR_RING_CHUNK)));
+	struct cbor_ring  ring;
+	struct cbor_buf   buf;
+	struct cbor_buf   bufs[4];
+	struct ring_seen  seen  = { { 0 }, 0, 0 };
+	uint8_t           payload[80];
+	size_t            count = 0;
+
+	CHECK(!cbor_ring_init(&ring, data, CBOR_RING_CHUNK, false), "ring one chunk");
+	CHECK(!cbor_ring_init(&ring, data, 3 * CBOR_RING_CHUNK, false), "ring not a power of two");
+	CHECK(!cbor_ring_init(&ring, data + 8, 4 * CBOR_RING_CHUNK, false), "ring misaligned");
+
+	/* Four chunks take four one chunk records, the fifth does not fit and reserves nothing. */
+	CHECK(cbor_ring_init(&ring, data, 4 * CBOR_RING_CHUNK, false), "ring");
+	for ( uint64_t i = 0; i < 4; i++ ) {
+		CHECK(cbor_ring_reserve(&ring, &bufs[i], CBOR_RING_CHUNK - CBOR_RING_HEADER) &&
+		      bufs[i].data == data + i * CBOR_RING_CHUNK + CBOR_RING_HEADER, "ring reserve %llu",
+		      (unsigned long long)i);
+	}
+	CHECK(!cbor_ring_reserve(&ring, &buf, 1) && ring.tail == 4 * CBOR_RING_CHUNK, "ring full");
+	CHECK(!cbor_ring_reserve(&ring, &buf, 2 * CBOR_RING_CHUNK) && ring.tail == 4 * CBOR_RING_CHUNK, "ring too large");
+
+	/* Nothing is drained past a reservation that is not committed yet. */
+	for ( uint64_t i = 0; i < 4; i++ ) {
+		memset(payload, (uint8_t)i, sizeof(payload));
+		cbor_add_array(&bufs[i], 3);
+		cbor_add_uint64(&bufs[i], 0);
+		cbor_add_uint64(&bufs[i], i);
+		cbor_add_byte_str(&bufs[i], payload, i % 80);
+	}
+	cbor_ring_commit(&ring, &bufs[1]);
+	CHECK(cbor_ring_drain(&ring, ring_consume, &seen, 64) == 0 && ring.head == 0, "ring uncommitted");
+	cbor_ring_commit(&ring, &bufs[0]);
+	CHECK(cbor_ring_drain(&ring, ring_stop, &count, 64) == 1 && count == 1 && ring.head == CBOR_RING_CHUNK,
+	      "ring stop");
+	seen.next[0] = 1;
+	CHECK(cbor_ring_drain(&ring, ring_consume, &seen, 64) == 1 && ring.head == 2 * CBOR_RING_CHUNK,
+	      "ring partial");
+
+	/* An empty commit abandons the reservation, the consumer skips it. */
+	bufs[2].len = 0;
+	cbor_ring_commit(&ring, &bufs[2]);
+	cbor_ring_commit(&ring, &bufs[3]);
+	seen.next[0] = 3;
+	CHECK(cbor_ring_drain(&ring, ring_consume, &seen, 64) == 2 && seen.records == 2 && seen.next[0] == 4 &&
+	      seen.bad == 0, "ring abandoned");
+
+	/*
+	 * At offset 192 a two chunk record would straddle the end: a padding
+	 * record fills the last chunk and the record starts at the beginning.
+	 */
+	for ( size_t i = 0; i < 3; i++ ) {
+		CHECK(cbor_ring_reserve(&ring, &buf, 1), "ring reserve");
+		cbor_ring_commit(&ring, &buf);
+	}
+	CHECK(cbor_ring_drain(&ring, ring_consume, &seen, 64) == 3 && ring.head == 7 * CBOR_RING_CHUNK, "ring skip");
+	CHECK(cbor_ring_reserve(&ring, &buf, CBOR_RING_CHUNK + 1) && buf.data == data + CBOR_RING_HEADER &&
+	      ring.tail == 10 * CBOR_RING_CHUNK, "ring wrap");
+	memset(payload, 5, sizeof(payload));
+	cbor_add_array(&buf, 3);
+	cbor_add_uint64(&buf, 0);
+	cbor_add_uint64(&buf, 5);
+	cbor_add_byte_str(&buf, payload, 5);
+	cbor_ring_commit(&ring, &buf);
+	seen = (struct ring_seen){ { 5 }, 0, 0 };
+	CHECK(cbor_ring_drain(&ring, ring_consume, &seen, 64) == 2 && seen.records == 1 && seen.bad == 0 &&
+	      ring.head == ring.tail, "ring wrap");
+	for ( size_t i = 0; i < 4; i++ ) {
+		CHECK(((uint64_t *)data)[i * CBOR_RING_CHUNK / sizeof(uint64_t)] == 0, "ring cleared %zu", i);
+	}
+
+	test_ring_threads(&ring, data, sizeof(data), 1);
+	test_ring_threads(&ring, data, sizeof(data), RING_PRODUCERS);
+}
+
+#define POOL_REMOTE 500
+
+struct pool_putter {
+	pthread_t              thread;
+	struct cbor_pool_cache cache;
+	struct cbor_buf        bufs[POOL_REMOTE];
+};
+
+/* Put buffers another thread got back through that thread's stash. */
+static void *
+pool_put_remote(void *arg)
+{
+	struct pool_putter *putter = arg;
+
+	for ( size_t i = 0; i < POOL_REMOTE; i++ ) {
+		cbor_pool_put(&putter->cache, &putter->bufs[i]);
+	}
+
+	return NULL;
+}
+
+static void
+test_pool(void)
+{
+	static struct pool_putter putters[2];
+	struct cbor_pool_cache    cache;
+	struct cbor_buf           buf;
+	struct cbor_buf           bufs[4];
+	uint8_t                  *data;
+	size_t                    allocs;
+
+	/* Classes are the powers of two from 256 bytes, larger requests are huge. */
+	CHECK(cbor_pool_class_of(0) == 0 && cbor_pool_class_of(1) == 0 && cbor_pool_class_of(256) == 0, "class 0");
+	CHECK(cbor_pool_class_of(257) == 1 && cbor_pool_class_of(512) == 1 && cbor_pool_class_of(513) == 2, "class 1");
+	CHECK(cbor_pool_class_of(cbor_pool_class_size(CBOR_POOL_CLASSES - 1)) == CBOR_POOL_CLASSES - 1 &&
+	      cbor_pool_class_of(cbor_pool_class_size(CBOR_POOL_CLASSES - 1) + 1) == CBOR_POOL_HUGE, "class huge");
+
+	cbor_pool_init(&cache);
+	CHECK(cbor_pool_get(&cache, &buf, 100) && buf.cap == 256 && buf.len == 0 &&
+	      (uintptr_t)buf.data % CBOR_POOL_LINE == 0 && cache.stats.allocs == 1, "pool get");
+	data = buf.data;
+	cbor_add_uint64(&buf, 1000);
+	cbor_pool_put(&cache, &buf);
+	CHECK(buf.data == NULL && cache.classes[0].cached == 1 && cache.stats.cached_bytes == 256, "pool put");
+
+	/* The cache refills the next get of the class without calling malloc(). */
+	CHECK(cbor_pool_get(&cache, &buf, 200) && buf.data == data && buf.len == 0 && cache.stats.hits == 1 &&
+	      cache.stats.allocs == 1 && cache.classes[0].cached == 0 && cache.stats.cached_bytes == 0, "pool hit");
+	CHECK(cbor_add_utf8_str(&buf, "abc", 3) && cbor_pool_grow(&cache, &buf) && buf.cap == 512 && buf.len == 4 &&
+	      encoded(&buf, "63616263") && cache.classes[0].cached == 1, "pool grow");
+	cbor_pool_put(&cache, &buf);
+
+	/* An oversized request gets exactly its size and is freed on put. */
+	size_t huge = cbor_pool_class_size(CBOR_POOL_CLASSES - 1) + 1;
+
+	CHECK(cbor_pool_get(&cache, &buf, huge) && buf.cap == huge && cache.stats.allocs == 3, "pool huge");
+	buf.data[huge - 1] = 0;
+	cbor_pool_put(&cache, &buf);
+	CHECK(cache.stats.cached_bytes == 256 + 512 && cache.stats.puts == 4, "pool huge put");
+
+	/* A trim keeps what the period needed at its peak, the next one flushes the rest. */
+	for ( size_t i = 0; i < 4; i++ ) {
+		CHECK(cbor_pool_get(&cache, &bufs[i], 300), "pool class 1 %zu", i);
+	}
+	for ( size_t i = 0; i < 4; i++ ) {
+		cbor_pool_put(&cache, &bufs[i]);
+	}
+	CHECK(cache.classes[1].cached == 4 && cbor_pool_trim(&cache) == 0 && cache.classes[0].cached == 1 &&
+	      cache.classes[1].cached == 4, "pool trim");
+	CHECK(cbor_pool_trim(&cache) == 5 && cache.classes[0].cached == 0 && cache.classes[1].cached == 0 &&
+	      cache.stats.cached_bytes == 0 && cache.stats.trimmed == 5, "pool trim");
+
+	/* Buffers put by other threads come back through the stash when the class runs dry. */
+	for ( size_t t = 0; t < 2; t++ ) {
+		cbor_pool_init(&putters[t].cache);
+		for ( size_t i = 0; i < POOL_REMOTE; i++ ) {
+			CHECK(cbor_pool_get(&cache, &putters[t].bufs[i], 1000), "pool remote get");
+		}
+	}
+	allocs = cache.stats.allocs;
+	for ( size_t t = 0; t < 2; t++ ) {
+		pthread_create(&putters[t].thread, NULL, pool_put_remote, &putters[t]);
+	}
+	for ( size_t t = 0; t < 2; t++ ) {
+		pthread_join(putters[t].thread, NULL);
+		CHECK(putters[t].cache.stats.remote_puts == POOL_REMOTE && putters[t].cache.stats.cached_bytes == 0,
+		      "pool remote put %zu", t);
+	}
+	CHECK(cache.classes[2].cached == 0 && cache.classes[2].in_use == 2 * POOL_REMOTE, "pool stash");
+	for ( size_t t = 0; t < 2; t++ ) {
+		for ( size_t i = 0; i < POOL_REMOTE; i++ ) {
+			CHECK(cbor_pool_get(&cache, &putters[t].bufs[i], 1000), "pool remote take");
+		}
+	}
+	CHECK(cache.stats.allocs == allocs && cache.stats.remote_takes == 2 * POOL_REMOTE &&
+	      cache.classes[2].in_use == 2 * POOL_REMOTE && cache.classes[2].cached == 0, "pool remote take");
+	for ( size_t t = 0; t < 2; t++ ) {
+		for ( size_t i = 0; i < POOL_REMOTE; i++ ) {
+			cbor_pool_put(&cache, &putters[t].bufs[i]);
+		}
+		cbor_pool_destroy(&putters[t].cache);
+	}
+	cbor_pool_destroy(&cache);
+	CHECK(cache.stats.cached_bytes == 0 && cache.classes[2].free == NULL, "pool destroy");
+}
+
+/* NaN doubles patched into a float item. */
+static const struct {
+	uint64_t    bits;
+	const char *hex;
+} nans[] = {
+	{ 0x7ff8000000000000, "82fa7fc0000001" },
+	{ 0xfff8000000000000, "82faffc0000001" },
+	{ 0x7ff4000020000000, "82fa7fa0000101" },
+	{ 0x7ff0000000000001, "82fb7ff000000000000101" },
+	{ 0x7ff8000010000000, "82fb7ff800001000000001" },
+};
+
+static void
+test_patch(void)
+{
+	uint8_t            data[64];
+	struct cbor_limits limits;
+	struct cbor_buf    buf;
+	size_t             outer[2];
+	size_t             len;
+
+	/* Same width: overwritten in place, a narrower value keeps the head. */
+	cbor_buf_init(&buf, data, unhex("831903e8f601", data), sizeof(data));
+	CHECK(cbor_patch_uint64(&buf, 1, 2000, NULL, 0) && encoded(&buf, "831907d0f601"), "patch uint");
+	CHECK(cbor_patch_int64(&buf, 1, -5, NULL, 0) && encoded(&buf, "83390004f601"), "patch int");
+	cbor_buf_init(&buf, data, unhex("82fb3ff800000000000001", data), sizeof(data));
+	CHECK(cbor_patch_double(&buf, 1, 0.1, NULL, 0) && encoded(&buf, "82fb3fb999999999999a01"), "patch double");
+	CHECK(cbor_patch_double(&buf, 1, 2.5, NULL, 0) && encoded(&buf, "82fb400400000000000001"), "patch double");
+	cbor_buf_init(&buf, data, unhex("82fa3fc0000001", data), sizeof(data));
+	CHECK(cbor_patch_double(&buf, 1, 2.5, NULL, 0) && encoded(&buf, "82fa4020000001"), "patch float");
+
+	/* A NaN stays a float only if the float keeps its sign and payload. */
+	for ( size_t i = 0; i < sizeof(nans) / sizeof(nans[0]); i++ ) {
+		double x;
+
+		memcpy(&x, &nans[i].bits, sizeof(x));
+		cbor_buf_init(&buf, data, unhex("82fa3fc0000001", data), sizeof(data));
+		CHECK(cbor_patch_double(&buf, 1, x, NULL, 0) && encoded(&buf, nans[i].hex), "patch %s", nans[i].hex);
+	}
+	cbor_buf_init(&buf, data, unhex("826361626301", data), sizeof(data));
+	CHECK(cbor_patch_utf8_str(&buf, 1, "xyz", 3, NULL, 0) && encoded(&buf, "826378797a01"), "patch string");
+
+	/* Growth and shrink move the rest of the buffer. */
+	cbor_buf_init(&buf, data, unhex("820102", data), sizeof(data));
+	CHECK(cbor_patch_uint64(&buf, 1, 1000, NULL, 0) && encoded(&buf, "821903e802"), "patch grow");
+	CHECK(cbor_patch_bool(&buf, 1, true, NULL, 0) && encoded(&buf, "82f502"), "patch shrink");
+	CHECK(cbor_patch_double(&buf, 1, 0.1, NULL, 0) && encoded(&buf, "82fb3fb999999999999a02"), "patch grow");
+	CHECK(cbor_patch_double(&buf, 1, 0.5, NULL, 0) && encoded(&buf, "82fb3fe000000000000002"), "patch keep");
+	CHECK(cbor_patch_utf8_str(&buf, 1, "abc", 3, NULL, 0) && encoded(&buf, "826361626302"), "patch shrink");
+	CHECK(cbor_patch_null(&buf, 1, NULL, 0) && encoded(&buf, "82f602"), "patch shrink");
+
+	/*
+	 * Tag 24 inside tag 24: growing the item by two bytes grows the inner
+	 * string head in place and the outer one from 0x57 to 0x5819.
+	 */
+	len = unhex("d81857d818548261617070707070707070707070707070707070", data);
+	outer[0] = 2;
+	outer[1] = 5;
+	cbor_buf_init(&buf, data, len, len + 1);
+	CHECK(!cbor_patch_utf8_str(&buf, 7, "abc", 3, outer, 2) && buf.err == CBOR_ERR_CAPACITY &&
+	      encoded(&buf, "d81857d818548261617070707070707070707070707070707070") && outer[0] == 2 && outer[1] == 5, "patch capacity");
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	CHECK(cbor_patch_utf8_str(&buf, 7, "abc", 3, outer, 2) && outer[0] == 2 && outer[1] == 6 &&
+	      encoded(&buf, "d8185819d8185682636162637070707070707070707070707070707070"), "patch outer grow");
+	CHECK(cbor_patch_utf8_str(&buf, 8, "a", 1, outer, 2) && outer[0] == 2 && outer[1] == 5 &&
+	      encoded(&buf, "d81857d818548261617070707070707070707070707070707070"), "patch outer shrink");
+
+	/* Reading up to the limits does not stop later edits; the cursor moves with the bytes. */
+	cbor_limits_default(&limits);
+	limits.max_items = 4;
+	limits.max_bytes = 4;
+	cbor_buf_init(&buf, data, unhex("83010203", data), sizeof(data));
+	cbor_buf_set_limits(&buf, &limits);
+	CHECK(cbor_skip_item(&buf) && buf.items == 4, "patch limits");
+	CHECK(cbor_patch_uint64(&buf, 1, 1000, NULL, 0) && cbor_patch_double(&buf, 4, 0.1, NULL, 0) &&
+	      cbor_patch_uint64(&buf, 1, 7, NULL, 0) && encoded(&buf, "83190007fb3fb999999999999a03") &&
+	      buf.idx == 14 && buf.items == 4 && buf.err == CBOR_OK && buf.limits == &limits, "patch limits");
+
+	/* A failed probe reports at the edited item and restores the cursor. */
+	cbor_buf_init(&buf, data, unhex("826261", data), sizeof(data));
+	buf.idx   = 2;
+	buf.items = 7;
+	CHECK(!cbor_patch_utf8_str(&buf, 1, "ab", 2, NULL, 0) && buf.err == CBOR_ERR_TRUNCATED &&
+	      buf.err_idx == 1 && buf.idx == 2 && buf.items == 7 && encoded(&buf, "826261"), "patch truncated");
+}
+
+static bool
+phf_sum(void *arg, size_t field, struct cbor_buf *buf)
+{
+	uint64_t value;
+
+	(void)field;
+	if ( !cbor_read_positive_integer(buf, &value) ) {
+		return false;
+	}
+	*(uint64_t *)arg += value;
+
+	return true;
+}
+
+static void
+test_phf(void)
+{
+	static const char *const keys[] = { "a", "b" };
+	static const struct {
+		const char     *hex;
+		enum cbor_error err;
+		uint64_t        sum;
+	} maps[] = {
+		{ "a2616101616202",         CBOR_OK,            3 },
+		{ "bf6161016163f6616202ff", CBOR_OK,            3 },
+		{ "a261610161620f",         CBOR_OK,           16 },
+		{ "a2616101616260",         CBOR_ERR_TYPE,      0 },
+		{ "a26161016162",           CBOR_ERR_TRUNCATED, 0 },
+		{ "bf61610161620a",         CBOR_ERR_TRUNCATED, 0 },
+		{ "826161",                 CBOR_ERR_TYPE,      0 },
+	};
+	cbor_phf_handler handlers[2] = { phf_sum, phf_sum };
+	struct cbor_phf  phf;
+	uint8_t          data[64];
+	struct cbor_buf  buf;
+
+	CHECK(cbor_phf_init(&phf, keys, 2), "phf init");
+	for ( size_t i = 0; i < sizeof(maps) / sizeof(maps[0]); i++ ) {
+		size_t   len = unhex(maps[i].hex, data);
+		uint64_t sum = 0;
+		bool     ok;
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		buf.items = 5;
+		ok        = cbor_phf_read_map(&phf, &buf, handlers, &sum);
+		if ( maps[i].err == CBOR_OK ) {
+			CHECK(ok && buf.idx == len && sum == maps[i].sum, "%s", maps[i].hex);
+		} else {
+			CHECK(!ok && buf.err == maps[i].err && buf.idx == 0 && buf.items == 5, "%s", maps[i].hex);
+		}
+	}
+}
+
+static void
+test_path(void)
+{
+	uint8_t             data[64];
+	size_t              len = unhex(path_doc, data);
+	struct cbor_path    path[2];
+	struct cbor_buf     expr;
+	struct cbor_buf     buf;
+	struct cbor_buf     match;
+	struct cbor_limits  limits;
+	struct path_matches matches;
+	uint64_t            seen = 0;
+
+	check_skip(path_doc);
+
+	for ( size_t i = 0; i < sizeof(path_errors) / sizeof(path_errors[0]); i++ ) {
+		size_t size = strlen(path_errors[i].expr);
+
+		cbor_buf_init(&expr, (void *)path_errors[i].expr, size, size);
+		CHECK(!cbor_path_compile(&path[0], &expr) && cbor_buf_error(&expr) == path_errors[i].err,
+		      "path %s error %d", path_errors[i].expr, cbor_buf_error(&expr));
+	}
+
+	/* Every head is read once, even in the parts that are skipped. */
+	cbor_limits_default(&limits);
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	cbor_buf_set_limits(&buf, &limits);
+	for ( limits.max_items = 0; !cbor_skip_item(&buf); limits.max_items++ ) {
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+	}
+
+	for ( size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++ ) {
+		if ( !cbor_path_compile_cstr(&path[0], paths[i].expr) ) {
+			CHECK(false, "path %s does not compile", paths[i].expr);
+			continue;
+		}
+		matches.len    = 0;
+		matches.hex[0] = '\0';
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(cbor_path_eval(&buf, path, 1, path_match, &matches) && buf.idx == len &&
+		      strcmp(matches.hex, paths[i].matches) == 0, "path %s matched %s", paths[i].expr, matches.hex);
+
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_path_find(&buf, path, &match) == (paths[i].matches[0] != '\0') && buf.idx == 0,
+		      "path %s find", paths[i].expr);
+	}
+
+	/* One item too few fails, and leaves the cursor at the item. */
+	limits.max_items--;
+	cbor_path_compile_cstr(&path[0], ".i[1]");
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	cbor_buf_set_limits(&buf, &limits);
+	CHECK(!cbor_path_eval(&buf, path, 1, path_match, &matches) && buf.err == CBOR_ERR_LIMIT && buf.idx == 0 &&
+	      buf.items == 0, "path under limits");
+
+	/* A batch reports each path by its index. */
+	cbor_path_compile_cstr(&path[0], ".a[2]");
+	cbor_path_compile_cstr(&path[1], ".u[0]");
+	cbor_buf_init(&buf, data, len, sizeof(data));
+	CHECK(cbor_path_eval(&buf, path, 2, path_batch, &seen) && seen == 0x0703, "path batch");
+
+	/* Levels the walk opens count against max_depth as they do in the skip. */
+	static const char *const deep[] = { "81818101", "8181818100", "81a1018101", "818180", "81c18181f6" };
+	static const char *const walks[] = { "[*]", "[0][*]", "[*][*][*]", "[0].*", "[5]" };
+
+	for ( size_t i = 0; i < sizeof(deep) / sizeof(deep[0]); i++ ) {
+		len = unhex(deep[i], data);
+		for ( size_t j = 0; j < sizeof(walks) / sizeof(walks[0]); j++ ) {
+			cbor_path_compile_cstr(&path[0], walks[j]);
+			for ( size_t max = 1; max <= 4; max++ ) {
+				bool skipped;
+
+				cbor_limits_default(&limits);
+				limits.max_depth = max;
+				cbor_buf_init(&buf, data, len, sizeof(data));
+				cbor_buf_set_limits(&buf, &limits);
+				skipped = cbor_skip_item(&buf);
+
+				cbor_buf_init(&buf, data, len, sizeof(data));
+				cbor_buf_set_limits(&buf, &limits);
+				CHECK(cbor_path_eval(&buf, path, 1, path_batch, &seen) == skipped &&
+				      (skipped || buf.err == CBOR_ERR_DEPTH), "path %s over %s depth %zu", walks[j], deep[i], max);
+			}
+		}
+	}
+}
+
+/* xxHash64 of the first len bytes of (i * 31 + 1), from the reference implementation. */
+static const struct {
+	size_t   len;
+	uint64_t seed;
+	uint64_t digest;
+} hashes[] = {
+	{    0, 0,                     0xef46db3751d8e999ull },
+	{    1, 0,                     0x8a4127811b21e730ull },
+	{    3, 0,                     0x3ace196e68db6596ull },
+	{    4, 0,                     0xff0fe609a6c96014ull },
+	{    8, 0,                     0x7a082df5fa1a977cull },
+	{   31, 0,                     0x97203e9c0a367930ull },
+	{   32, 0,                     0x6c7d61763e6d6eedull },
+	{   33, 0,                     0x1e0e0df8045a41dfull },
+	{   64, 0,                     0x00fa74d04232942eull },
+	{  100, 0,                     0x0cc1e92aa8ea6f85ull },
+	{ 1000, 0,                     0x1ac712c0704c6508ull },
+	{    0, 0x27d4eb2f165667c5ull, 0x9aadff3ee38d8e67ull },
+	{   33, 0x27d4eb2f165667c5ull, 0xfec2f32cf7c627f6ull },
+	{ 1000, 0x27d4eb2f165667c5ull, 0x3210d0592a71f92bull },
+};
+
+static uint64_t
+hash_once(const void *data, size_t len)
+{
+	struct cbor_hash hash;
+
+	cbor_hash_init(&hash, 0);
+	cbor_hash_update(&hash, data, len);
+
+	return cbor_hash_digest(&hash);
+}
+
+static void
+test_hash(void)
+{
+	uint8_t          data[1000];
+	uint8_t          out[2048];
+	struct cbor_hash hash;
+	struct cbor_buf  buf;
+
+	for ( size_t i = 0; i < sizeof(data); i++ ) {
+		data[i] = (uint8_t)(i * 31 + 1);
+	}
+
+	for ( size_t i = 0; i < sizeof(hashes) / sizeof(hashes[0]); i++ ) {
+		size_t len = hashes[i].len;
+
+		cbor_hash_init(&hash, hashes[i].seed);
+		cbor_hash_update(&hash, data, len);
+		CHECK(cbor_hash_digest(&hash) == hashes[i].digest && cbor_hash_digest(&hash) == hashes[i].digest,
+		      "xxh64 length %zu", len);
+
+		/* Any split of the input gives the same digest. */
+		for ( size_t step = 1; step <= 40; step++ ) {
+			cbor_hash_init(&hash, hashes[i].seed);
+			for ( size_t off = 0; off < len; off += step ) {
+				cbor_hash_update(&hash, data + off, len - off < step ? len - off : step);
+			}
+			CHECK(cbor_hash_digest(&hash) == hashes[i].digest, "xxh64 length %zu in runs of %zu", len, step);
+		}
+	}
+
+	/* Appends hashed in batches, across several runs of CBOR_HASH_BATCH. */
+	cbor_hash_init(&hash, 0);
+	cbor_buf_init_empty(&buf, out, sizeof(out));
+	cbor_buf_set_hash(&buf, &hash);
+	cbor_add_array(&buf, 300);
+	for ( uint64_t i = 0; i < 300; i++ ) {
+		cbor_add_uint64(&buf, i * 1000);
+	}
+	CHECK(buf.len > 2 * CBOR_HASH_BATCH && hash.pending > 0 && cbor_buf_digest(&buf) == hash_once(out, buf.len),
+	      "batched appends");
+
+	/* A payload hashed in place sits between the bytes around it. */
+	size_t   head;
+	uint64_t digest;
+
+	cbor_buf_init_empty(&buf, out, sizeof(out));
+	cbor_hash_init(&hash, 0);
+	cbor_buf_set_hash(&buf, &hash);
+	cbor_add_array(&buf, 2);
+	cbor_add_byte_str_ref(&buf, data, sizeof(data));
+	head = buf.len;
+	cbor_add_utf8_cstr(&buf, "after");
+	digest = cbor_buf_digest(&buf);
+	memmove(out + head + sizeof(data), out + head, buf.len - head);
+	memcpy(out + head, data, sizeof(data));
+	CHECK(digest == hash_once(out, buf.len + sizeof(data)), "hash segment");
+}
+
+static void
+test_embedded(void)
+{
+	uint8_t              out[128];
+	uint8_t              text[40];
+	struct cbor_hash     hash;
+	struct cbor_buf      buf;
+	struct cbor_buf      inner;
+	struct cbor_buf      nested;
+	struct cbor_embedded outer_scope;
+	struct cbor_embedded scope;
+	struct cbor_limits   limits;
+	char                *str;
+	size_t               len;
+
+	memset(text, 'x', sizeof(text));
+
+	/* A hint too small and one too large both end with the shortest head. */
+	for ( size_t hint = 0; hint <= UINT16_MAX; hint += UINT16_MAX ) {
+		cbor_buf_init_empty(&buf, out, sizeof(out));
+		cbor_hash_init(&hash, 0);
+		cbor_buf_set_hash(&buf, &hash);
+		CHECK(cbor_add_array(&buf, 2) && cbor_add_embedded_start(&buf, &scope, hint) &&
+		      cbor_add_utf8_str(&buf, (char *)text, 30) && cbor_add_embedded_end(&buf, &scope) &&
+		      cbor_add_null(&buf) && buf.len == 1 + 2 + 2 + 32 + 1 && out[3] == 0x58 && out[4] == 32 &&
+		      buf.hash == &hash && cbor_buf_digest(&buf) == hash_once(out, buf.len), "embedded hint %zu", hint);
+	}
+
+	/* Nested scopes, both moved by their ends. */
+	cbor_buf_init_empty(&buf, out, sizeof(out));
+	cbor_hash_init(&hash, 0);
+	cbor_buf_set_hash(&buf, &hash);
+	CHECK(cbor_add_embedded_start(&buf, &outer_scope, 0) && cbor_add_embedded_start(&buf, &scope, 0) &&
+	      cbor_add_utf8_str(&buf, (char *)text, 30) && cbor_add_embedded_end(&buf, &scope) &&
+	      cbor_add_embedded_end(&buf, &outer_scope) && buf.len == 2 + 2 + 2 + 2 + 32 &&
+	      out[2] == 0x58 && out[3] == 36 && out[6] == 0x58 && out[7] == 32 &&
+	      cbor_buf_digest(&buf) == hash_once(out, buf.len), "embedded nested");
+
+	cbor_buf_init(&buf, out, buf.len, sizeof(out));
+	CHECK(cbor_read_embedded(&buf, &inner) && buf.idx == buf.len && inner.len == 36 &&
+	      cbor_read_embedded(&inner, &nested) && inner.idx == inner.len && nested.len == 32 &&
+	      cbor_read_utf8_str(&nested, &str, &len) && len == 30 && nested.idx == nested.len, "embedded read nested");
+
+	/* The readers leave the cursor on the tag when they fail. */
+	cbor_buf_init(&buf, out, unhex("c1456449455446", out), sizeof(out));
+	CHECK(!cbor_read_embedded(&buf, &inner) && buf.err == CBOR_ERR_TYPE && buf.idx == 0, "embedded tag 1");
+	cbor_buf_init(&buf, out, unhex("d81845644945", out), sizeof(out));
+	CHECK(!cbor_read_embedded(&buf, &inner) && buf.err == CBOR_ERR_TRUNCATED && buf.idx == 0, "embedded truncated");
+	cbor_buf_init(&buf, out, unhex("d8186449455446", out), sizeof(out));
+	CHECK(!cbor_read_embedded(&buf, &inner) && buf.err == CBOR_ERR_TYPE && buf.idx == 0, "embedded text");
+
+	/* The embedded item counts against the items of buf, a failed read charges nothing. */
+	cbor_limits_default(&limits);
+	for ( limits.max_items = 5; limits.max_items <= 6; limits.max_items++ ) {
+		bool fits = limits.max_items == 6;
+
+		cbor_buf_init(&buf, out, unhex("d8184483010203", out), sizeof(out));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(cbor_read_embedded(&buf, &inner) && buf.items == 2 && inner.items == 2 && inner.limits == &limits,
+		      "embedded items %llu", (unsigned long long)limits.max_items);
+		CHECK(cbor_skip_item(&inner) == fits && (fits ? inner.idx == inner.len && inner.items == 6 :
+		      inner.err == CBOR_ERR_LIMIT && inner.idx == 0 && inner.items == 2),
+		      "embedded items %llu", (unsigned long long)limits.max_items);
+	}
+	for ( int i = 0; i < 3; i++ ) {
+		static const char *failing[] = { "c1456449455446", "d81845644945", "d8186449455446" };
+
+		cbor_buf_init(&buf, out, unhex(failing[i], out), sizeof(out));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(!cbor_read_embedded(&buf, &inner) && buf.idx == 0 && buf.items == 0, "embedded %s", failing[i]);
+	}
+
+	/* An end without room to move keeps the hash, and the scope cancels. */
+	cbor_buf_init_empty(&buf, out, 1 + 2 + 1 + 30);
+	cbor_hash_init(&hash, 0);
+	cbor_buf_set_hash(&buf, &hash);
+	CHECK(cbor_add_array(&buf, 2) && cbor_add_embedded_start(&buf, &scope, 0) &&
+	      cbor_add_byte_str(&buf, text, 28) && !cbor_add_embedded_end(&buf, &scope) &&
+	      buf.err == CBOR_ERR_CAPACITY && buf.hash == &hash && buf.len == 1 + 2 + 1 + 30, "embedded full");
+	cbor_add_embedded_cancel(&buf, &scope);
+	CHECK(buf.len == 1 && buf.hash == &hash && cbor_add_null(&buf) && cbor_add_null(&buf) &&
+	      cbor_buf_digest(&buf) == hash_once("\x82\xf6\xf6", 3), "embedded cancel");
+}
+
+/* Schemas that do not compile, and the error they fail with. */
+static const struct {
+	const char     *text;
+	enum cbor_error err;
+} schema_errors[] = {
+	{ "",                    CBOR_ERR_TRUNCATED },
+	{ "a",                   CBOR_ERR_TRUNCATED },
+	{ "a = [ uint",          CBOR_ERR_TRUNCATED },
+	{ "a = b",               CBOR_ERR_SYNTAX },
+	{ "a = a / int",         CBOR_ERR_SYNTAX },
+	{ "a = int a = uint",    CBOR_ERR_SYNTAX },
+	{ "a = { uint }",        CBOR_ERR_SYNTAX },
+	{ "a = [ 3*1 uint ]",    CBOR_ERR_SYNTAX },
+	{ "a = #6.1 uint",       CBOR_ERR_SYNTAX },
+	{ "a = 99999999999999999999", CBOR_ERR_OVERFLOW },
+};
+
+/* Items in hex validated against a schema. */
+static const struct {
+	const char *text;
+	const char *hex;
+	bool        valid;
+} schema_items[] = {
+	/* Literal keys are looked up before key types, in any order. */
+	{ "m = { * tstr => any, \"id\": uint }", "a261780162696405", true },
+	{ "m = { \"id\": uint, * tstr => any }", "a261780162696405", true },
+	{ "m = { * tstr => any, \"id\": uint }", "a2626964056178f6", true },
+	{ "m = { * tstr => any, \"id\": uint }", "a1617801",         false },
+	{ "m = { * tstr => any, \"id\": uint }", "a162696461",       false },
+	{ "m = { * tstr => any, \"id\": uint }", "a26269640162696402", false },
+	{ "m = { 1: tstr, ? 2: uint }",          "a1016161",         true },
+	{ "m = { 1: tstr, ? 2: uint }",          "a20201016161",     true },
+	{ "m = { 1: tstr, ? 2: uint }",          "bf0161610201ff",   true },
+	{ "m = { 1: tstr, ? 2: uint }",          "a10201",           false },
+	{ "m = { + uint => bool }",              "a0",               false },
+	{ "m = { + uint => bool }",              "a201f502f4",       true },
+	{ "m = { 0*1 uint => bool }",            "a201f502f4",       false },
+
+	/* Occurrences. */
+	{ "a = [ 2*3 uint ]",                    "820102",           true },
+	{ "a = [ 2*3 uint ]",                    "83010203",         true },
+	{ "a = [ 2*3 uint ]",                    "8101",             false },
+	{ "a = [ 2*3 uint ]",                    "8401020304",       false },
+	{ "a = [ 1*1 uint ]",                    "8101",             true },
+	{ "a = [ ? uint, + tstr ]",              "816161",           true },
+	{ "a = [ ? uint, + tstr ]",              "830161616162",     true },
+	{ "a = [ ? uint, + tstr ]",              "8101",             false },
+	{ "a = [ * uint ]",                      "80",               true },
+	{ "a = [ * uint ]",                      "9f010203ff",       true },
+	{ "a = [ * uint ]",                      "9f0161ff",         false },
+	{ "a = [ x: uint, y: uint ]",            "820102",           true },
+
+	/* Choices start over from the item after an alternative fails. */
+	{ "a = [ uint, tstr ] / [ uint, uint ]", "820102",           true },
+	{ "a = [ uint, tstr ] / [ uint, uint ]", "82016161",         true },
+	{ "a = [ uint, tstr ] / [ uint, uint ]", "8201f6",           false },
+	{ "a = #6.1(tstr) / #6.1(uint)",         "c101",             true },
+	{ "a = b / c  b = { 1: uint }  c = { 1: tstr }", "a1016161", true },
+	{ "a = nil / true",                      "f5",               true },
+	{ "a = nil / true",                      "f4",               false },
+
+	/* Tags. */
+	{ "a = #6.32(tstr)",                     "d8206161",         true },
+	{ "a = #6.32(tstr)",                     "d8216161",         false },
+	{ "a = #6.32(tstr)",                     "d82001",           false },
+	{ "a = #6.32(tstr)",                     "6161",             false },
+	{ "a = #6.1(#6.2(any))",                 "c1c2f6",           true },
+
+	/* Ranges. */
+	{ "a = 1..10",                           "01",               true },
+	{ "a = 1..10",                           "0a",               true },
+	{ "a = 1..10",                           "0b",               false },
+	{ "a = 1..10",                           "00",               false },
+	{ "a = 1...10",                          "09",               true },
+	{ "a = 1...10",                          "0a",               false },
+	{ "a = -5..-1",                          "24",               true },
+	{ "a = -5..-1",                          "20",               true },
+	{ "a = -5..-1",                          "25",               false },
+	{ "a = -5..-1",                          "00",               false },
+	{ "a = 0..255",                          "18ff",             true },
+	{ "a = 0..255",                          "190100",           false },
+
+	/* Types and literals. */
+	{ "a = \"abc\"",                       "63616263",         true },
+	{ "a = \"abc\"",                       "63616264",         false },
+	{ "a = float32 / float64",               "fa3fc00000",       true },
+	{ "a = float32 / float64",               "f93e00",           false },
+	{ "a = bstr",                            "5f4101ff",         true },
+};
+
+static void
+test_schema(void)
+{
+	struct cbor_schema *schema = malloc(sizeof(*schema));
+	uint8_t             data[64];
+	struct cbor_buf     text;
+	struct cbor_buf     buf;
+
+	if ( schema == NULL ) {
+		CHECK(false, "out of memory");
+		return;
+	}
+
+	for ( size_t i = 0; i < sizeof(schema_errors) / sizeof(schema_errors[0]); i++ ) {
+		size_t len = strlen(schema_errors[i].text);
+
+		cbor_buf_init(&text, (void *)schema_errors[i].text, len, len);
+		CHECK(!cbor_schema_compile(schema, &text) && cbor_buf_error(&text) == schema_errors[i].err,
+		      "schema \"%s\" error %d", schema_errors[i].text, cbor_buf_error(&text));
+	}
+
+	for ( size_t i = 0; i < sizeof(schema_items) / sizeof(schema_items[0]); i++ ) {
+		const char *hex = schema_items[i].hex;
+		size_t      len = unhex(hex, data);
+
+		if ( !cbor_schema_compile_cstr(schema, schema_items[i].text) ) {
+			CHECK(false, "schema \"%s\" does not compile", schema_items[i].text);
+			continue;
+		}
+		cbor_buf_init(&buf, data, len, sizeof(data));
+		CHECK(cbor_schema_validate(schema, &buf) == schema_items[i].valid &&
+		      buf.idx == (schema_items[i].valid ? len : 0), "schema \"%s\" item %s", schema_items[i].text, hex);
+	}
+
+	/* A failed choice reports the alternative that got furthest, in either order. */
+	static const char *const choices[] = {
+		"r = [ uint, uint, tstr ] / [ uint ]",
+		"r = [ uint ] / [ uint, uint, tstr ]",
+	};
+
+	for ( size_t i = 0; i < sizeof(choices) / sizeof(choices[0]); i++ ) {
+		cbor_schema_compile_cstr(schema, choices[i]);
+		cbor_buf_init(&buf, data, unhex("83010203", data), sizeof(data));
+		CHECK(!cbor_schema_validate(schema, &buf) && buf.err == CBOR_ERR_SCHEMA && buf.err_idx == 3 && buf.idx == 0,
+		      "schema \"%s\" error at %zu", choices[i], buf.err_idx);
+	}
+
+	/* Nesting is limited as in cbor_skip_item(), with the limit reached exactly. */
+	static const char *const nested[] = {
+		"a = any",
+		"a = [ * a ] / uint / nil",
+		"a = [ * any ]",
+		"a = [ * b ]  b = #6.1(a) / [ * any ] / uint",
+		"a = { * uint => a } / [ * a ] / uint",
+	};
+	static const char *const deep[] = {
+		"81818101", "9f9f9f01ffffff", "818180", "8181c18101", "a101a10181a0", "81818181f6",
+	};
+	struct cbor_limits limits;
+
+	for ( size_t i = 0; i < sizeof(nested) / sizeof(nested[0]); i++ ) {
+		if ( !cbor_schema_compile_cstr(schema, nested[i]) ) {
+			CHECK(false, "schema \"%s\" does not compile", nested[i]);
+			continue;
+		}
+		for ( size_t j = 0; j < sizeof(deep) / sizeof(deep[0]); j++ ) {
+			size_t len = unhex(deep[j], data);
+
+			for ( size_t max = 1; max <= 5; max++ ) {
+				bool skipped;
+
+				cbor_limits_default(&limits);
+				limits.max_depth = max;
+				cbor_buf_init(&buf, data, len, sizeof(data));
+				cbor_buf_set_limits(&buf, &limits);
+				skipped = cbor_skip_item(&buf);
+
+				cbor_buf_init(&buf, data, len, sizeof(data));
+				cbor_buf_set_limits(&buf, &limits);
+				if ( cbor_schema_validate(schema, &buf) ) {
+					CHECK(skipped, "schema \"%s\" item %s depth %zu", nested[i], deep[j], max);
+				} else if ( buf.err == CBOR_ERR_DEPTH ) {
+					CHECK(!skipped, "schema \"%s\" item %s depth %zu", nested[i], deep[j], max);
+				}
+			}
+		}
+	}
+
+	/* [[[1]]] opens three levels. */
+	cbor_schema_compile_cstr(schema, "a = [ * a ] / uint");
+	for ( size_t max = 2; max <= 3; max++ ) {
+		cbor_limits_default(&limits);
+		limits.max_depth = max;
+		cbor_buf_init(&buf, data, unhex("81818101", data), sizeof(data));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(cbor_schema_validate(schema, &buf) == (max == 3) && (max == 3 || (buf.err == CBOR_ERR_DEPTH &&
+		      buf.err_idx == 2)), "schema depth %zu", max);
+	}
+
+	/* Tags open no level, a chain longer than CBOR_MAX_DEPTH is refused. */
+	cbor_schema_compile_cstr(schema, "a = #6.1(a) / uint");
+	for ( size_t tags = CBOR_MAX_DEPTH - 1; tags <= CBOR_MAX_DEPTH + 1; tags++ ) {
+		uint8_t chain[CBOR_MAX_DEPTH + 2];
+
+		memset(chain, 0xc1, tags);
+		chain[tags] = 0x01;
+		cbor_limits_default(&limits);
+		limits.max_depth = 1;
+		cbor_buf_init(&buf, chain, tags + 1, sizeof(chain));
+		cbor_buf_set_limits(&buf, &limits);
+		CHECK(cbor_schema_validate(schema, &buf) == (tags <= CBOR_MAX_DEPTH) &&
+		      (tags <= CBOR_MAX_DEPTH || buf.err == CBOR_ERR_DEPTH), "schema %zu tags", tags);
+	}
+
+	free(schema);
+}
+
+/*
+ * A sequence written through the block writer reads back item by item,
+ * with items that span blocks and one larger than a block.
+ */
+#define AIO_BLOCK 512
+#define AIO_ITEMS 1000
+#define AIO_BIG   (3 * AIO_BLOCK + 100)
+
+static bool
+aio_item(struct cbor_buf *buf, size_t i)
+{
+	static char text[61];
+
+	memset(text, 'a' + (int)(i % 26), sizeof(text));
+
+	return cbor_add_array(buf, 2) && cbor_add_uint64(buf, i * 977) && cbor_add_utf8_str(buf, text, i % sizeof(text));
+}
+
+static void
+test_aio_engine(struct cbor_aio *aio, const char *engine)
+{
+	char                   path[] = "/tmp/cbortest-XXXXXX";
+	uint8_t                data[128];
+	uint8_t               *big = malloc(AIO_BIG);
+	struct cbor_aio_writer writer;
+	struct cbor_aio_reader reader;
+	struct cbor_buf        buf;
+	struct cbor_buf        item;
+	size_t                 n = 0;
+	int                    fd;
+
+	if ( big == NULL || (fd = mkstemp(path)) == -1 ) {
+		CHECK(false, "%s: no temporary file", engine);
+		free(big);
+		return;
+	}
+	unlink(path);
+	for ( size_t i = 0; i < AIO_BIG; i++ ) {
+		big[i] = (uint8_t)(i * 31);
+	}
+
+	CHECK(cbor_aio_writer_init(&writer, aio, fd, 0, AIO_BLOCK), "%s", engine);
+	for ( size_t i = 0; i < AIO_ITEMS; i++ ) {
+		if ( i == AIO_ITEMS / 2 ) {
+			CHECK(cbor_aio_writer_reserve(&writer, 3) &&
+			      cbor_add_byte_str_ref(cbor_aio_writer_buf(&writer), big, AIO_BIG) &&
+			      cbor_aio_writer_write(&writer, big, AIO_BIG), "%s", engine);
+			continue;
+		}
+		cbor_buf_init_empty(&buf, data, sizeof(data));
+		CHECK(aio_item(&buf, i) && cbor_aio_writer_write(&writer, buf.data, buf.len), "%s item %zu", engine, i);
+	}
+	CHECK(cbor_aio_writer_finish(&writer) && writer.off > 4 * AIO_BLOCK, "%s", engine);
+	cbor_aio_writer_destroy(&writer);
+
+	CHECK(cbor_aio_reader_init(&reader, aio, fd, 0, AIO_BLOCK, 3), "%s", engine);
+	while ( cbor_aio_reader_item(&reader, &item) ) {
+		uint8_t *value = NULL;
+		size_t   len   = 0;
+
+		if ( n == AIO_ITEMS / 2 ) {
+			CHECK(cbor_read_byte_str(&item, &value, &len) && len == AIO_BIG && memcmp(value, big, len) == 0,
+			      "%s big item", engine);
+		} else {
+			cbor_buf_init_empty(&buf, data, sizeof(data));
+			aio_item(&buf, n);
+			CHECK(item.len == buf.len && memcmp(item.data, buf.data, buf.len) == 0, "%s item %zu", engine, n);
+		}
+		n++;
+	}
+	CHECK(n == AIO_ITEMS && reader.err == 0 && cbor_buf_error(&reader.view) == CBOR_OK,
+	      "%s: %zu items, errno %d", engine, n, reader.err);
+	cbor_aio_reader_destroy(&reader);
+
+	close(fd);
+	free(big);
+}
+
+static void
+test_aio(void)
+{
+	struct cbor_aio aio;
+
+	CHECK(cbor_aio_init_threads(&aio, 4, 2), "threads");
+	test_aio_engine(&aio, "threads");
+	cbor_aio_destroy(&aio);
+
+#ifdef CBOR_AIO_URING
+	/* Kernels and sandboxes without io_uring only run the threads. */
+	if ( cbor_aio_init_uring(&aio, 4) ) {
+		test_aio_engine(&aio, "io_uring");
+		cbor_aio_destroy(&aio);
+	}
+#endif
+}
+
+int
+main(void)
+{
+	test_integers();
+	test_floats();
+	test_halves();
+	test_simple();
+	test_strings();
+	test_items();
+	test_malformed();
+	test_tags();
+	test_round_trips();
+	test_payloads();
+	test_capacity();
+	test_hooks();
+#ifdef CBOR_STATS
+	test_stats();
+#endif
+	test_errors();
+	test_limits();
+	test_loads();
+	test_json();
+	test_path();
+	test_schema();
+	test_ring();
+	test_pool();
+	test_patch();
+	test_hash();
+	test_prof();
+	test_aio();
+	test_embedded();
+	test_phf();
+
+	printf("%zu checks, %zu failed\n", checks, failures);
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+#include "cbor_json.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+/*
+ * json2cbor [file]
+ *
+ * Transcode a sequence of white space separated JSON texts to a CBOR
+ * sequence.
+ */
+
+static uint8_t *
+read_all(FILE *file, size_t *len)
+{
+	size_t   cap  = 64 * 1024;
+	size_t   size = 0;
+	uint8_t *data = malloc(cap);
+
+	while ( data != NULL ) {
+		size += fread(data + size, 1, cap - size, file);
+		if ( size < cap ) {
+			break;
+		}
+		cap *= 2;
+
+		uint8_t *grown = realloc(data, cap);
+
+		if ( grown == NULL ) {
+			free(data);
+		}
+		data = grown;
+	}
+	if ( data == NULL || ferror(file) ) {
+		free(data);
+		return NULL;
+	}
+	*len = size;
+
+	return data;
+}
+
+static bool
+flush(struct cbor_buf *out)
+{
+	size_t len = cbor_buf_length(out);
+
+	if ( fwrite(cbor_buf_data(out), 1, len, stdout) != len ) {
+		return false;
+	}
+	cbor_buf_init_empty(out, cbor_buf_data(out), cbor_buf_capacity(out));
+
+	return true;
+}
+
+/* Make room after a capacity failure: flush, or grow if already empty. */
+static bool
+make_room(struct cbor_buf *out)
+{
+	size_t   cap = cbor_buf_capacity(out);
+	uint8_t *data;
+
+	if ( cbor_buf_length(out) > 0 ) {
+		return flush(out);
+	}
+	if ( (data = realloc(cbor_buf_data(out), cap * 2)) == NULL ) {
+		return false;
+	}
+	cbor_buf_init_empty(out, data, cap * 2);
+
+	return true;
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE           *file = stdin;
+	struct cbor_buf in;
+	struct cbor_buf out;
+	uint8_t        *data;
+	size_t          len;
+
+	if ( argc > 2 ) {
+		fprintf(stderr, "usage: json2cbor [file]\n");
+		return 2;
+	}
+	if ( argc == 2 && (file = fopen(argv[1], "rb")) == NULL ) {
+		fprintf(stderr, "json2cbor: %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	if ( (data = read_all(file, &len)) == NULL ) {
+		fprintf(stderr, "json2cbor: read failed\n");
+		return 1;
+	}
+
+	cbor_buf_init(&in, data, len, len);
+	cbor_buf_init_empty(&out, malloc(64 * 1024), 64 * 1024);
+	if ( cbor_buf_data(&out) == NULL ) {
+		return 1;
+	}
+
+	for ( ;; ) {
+		cbor_json_skip_space(&in);
+		if ( cbor_buf_index(&in) >= cbor_buf_length(&in) ) {
+			break;
+		}
+		if ( cbor_from_json(&in, &out) ) {
+			continue;
+		}
+		if ( cbor_buf_error(&out) != CBOR_ERR_CAPACITY ) {
+			fprintf(stderr, "json2cbor: %s at offset %zu\n",
+			        cbor_error_string(cbor_buf_error(&in)), cbor_buf_error_offset(&in));
+			flush(&out);
+			return 1;
+		}
+		if ( !make_room(&out) ) {
+			fprintf(stderr, "json2cbor: write failed\n");
+			return 1;
+		}
+	}
+
+	return flush(&out) ? 0 : 1;
+}